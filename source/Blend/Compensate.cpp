@@ -1,5 +1,6 @@
 ﻿#include "ZBlend.h"
 #include "ZBlendAlgo.h"
+#include "LookUpTable.h"
 #include "opencv2/core.hpp"
 #include "opencv2/imgproc.hpp"
 #include "opencv2/highgui.hpp"
@@ -361,57 +362,24 @@ void getLUTBezierSmooth(std::vector<unsigned char>& lut, double k)
 static void adjust(cv::Mat& image, const unsigned char lut[256])
 {
     CV_Assert(image.data && image.depth() == CV_8U);
-    int rows = image.rows, cols = image.cols * image.channels();
-    for (int i = 0; i < rows; i++)
-    {
-        unsigned char* ptr = image.ptr<unsigned char>(i);
-        for (int j = 0; j < cols; j++)
-        {
-            *ptr = lut[*ptr];
-            ptr++;
-        }
-    }
+    cv::Mat image1 = image.reshape(1);
+    applyLUTs(image1, image1, &lut, 1);
 }
 
 void adjust(const cv::Mat& src, cv::Mat& dst, const std::vector<unsigned char>& lut)
 {
     CV_Assert(src.data && src.depth() == CV_8U && lut.size() == 256);
     dst.create(src.size(), src.type());
-    int rows = src.rows, cols = src.cols * src.channels();
+    cv::Mat dst1 = dst.reshape(1);
     const unsigned char* ptrLut = lut.data();
-    for (int i = 0; i < rows; i++)
-    {
-        const unsigned char* ptrSrc = src.ptr<unsigned char>(i);
-        unsigned char* ptrDst = dst.ptr<unsigned char>(i);
-        for (int j = 0; j < cols; j++)
-        {
-            *ptrDst = ptrLut[*ptrSrc];
-            ptrDst++;
-            ptrSrc++;
-        }
-    }
+    applyLUTs(src.reshape(1), dst1, &ptrLut, 1);
 }
 
 void adjust(const cv::Mat& src, cv::Mat& dst, const std::vector<std::vector<unsigned char> >& luts)
 {
-    CV_Assert(src.data && src.depth() == CV_8U &&
+    CV_Assert(src.data && src.type() == CV_8UC3 &&
         luts.size() == 3 && luts[0].size() == 256 && luts[1].size() == 256 && luts[2].size() == 256);
-    dst.create(src.size(), src.type());
-    int rows = src.rows, cols = src.cols;
-    const unsigned char* blut = luts[0].data();
-    const unsigned char* glut = luts[1].data();
-    const unsigned char* rlut = luts[2].data();
-    for (int i = 0; i < rows; i++)
-    {
-        const unsigned char* ptrSrc = src.ptr<unsigned char>(i);
-        unsigned char* ptrDst = dst.ptr<unsigned char>(i);
-        for (int j = 0; j < cols; j++)
-        {
-            *(ptrDst++) = blut[*(ptrSrc++)];
-            *(ptrDst++) = glut[*(ptrSrc++)];
-            *(ptrDst++) = rlut[*(ptrSrc++)];
-        }
-    }
+    applyLUTs(src, dst, luts);
 }
 
 void isDiffSmall(const cv::Mat& a, const cv::Mat& b, const cv::Mat& mask, cv::Mat& out)
@@ -6,6 +6,10 @@
 #include "opencv2/core.hpp"
 #include "opencv2/imgproc.hpp"
 #include "opencv2/highgui.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cfloat>
 
 #define PRINT_AND_SHOW 0
 
@@ -767,6 +771,52 @@ static void getPointPairsAllReproject(const std::vector<cv::Mat>& src, const std
 #endif
 }
 
+// Appends the value pairs given by the histogram specifications between the cumulative histograms
+// of the overlapping region of image i and image j, three channels each.
+static void getPointPairsFromAccumHists(int i, int j, std::vector<double> accumHistI[3], std::vector<double> accumHistJ[3],
+    std::vector<ValuePair>& pairs)
+{
+    std::vector<unsigned char> transIToJ[3], transJToI[3];
+    for (int k = 0; k < 3; k++)
+    {
+        histSpecification(accumHistI[k], accumHistJ[k], transIToJ[k]);
+        histSpecification(accumHistJ[k], accumHistI[k], transJToI[k]);
+    }
+
+    int minVal = 5, maxVal = 250;
+    double normScale = 1.0 / 255.0;
+    for (int k = minVal; k < maxVal; k++)
+    {
+        if (transIToJ[0][k] > minVal && transIToJ[0][k] < maxVal &&
+            transIToJ[1][k] > minVal && transIToJ[1][k] < maxVal &&
+            transIToJ[2][k] > minVal && transIToJ[2][k] < maxVal)
+        {
+            ValuePair pair;
+            pair.i = i;
+            pair.j = j;
+            pair.iVal = cv::Vec3b(k, k, k);
+            pair.iValD = toVec3d(pair.iVal) * normScale;
+            pair.jVal = cv::Vec3b(transIToJ[0][k], transIToJ[1][k], transIToJ[2][k]);
+            pair.jValD = toVec3d(pair.jVal) * normScale;
+            pairs.push_back(pair);
+        }
+
+        if (transJToI[0][k] > minVal && transJToI[0][k] < maxVal &&
+            transJToI[1][k] > minVal && transJToI[1][k] < maxVal &&
+            transJToI[2][k] > minVal && transJToI[2][k] < maxVal)
+        {
+            ValuePair pair;
+            pair.i = j;
+            pair.j = i;
+            pair.iVal = cv::Vec3b(k, k, k);
+            pair.iValD = toVec3d(pair.iVal) * normScale;
+            pair.jVal = cv::Vec3b(transJToI[0][k], transJToI[1][k], transJToI[2][k]);
+            pair.jValD = toVec3d(pair.jVal) * normScale;
+            pairs.push_back(pair);
+        }
+    }
+}
+
 // use this downSizeRatio had better keep small
 static void getPointPairsHistogram(const std::vector<cv::Mat>& src, const std::vector<PhotoParam>& photoParams,
     int downSizeRatio, std::vector<ValuePair>& pairs)
@@ -788,15 +838,10 @@ static void getPointPairsHistogram(const std::vector<cv::Mat>& src, const std::v
         gradSmalls[i] = grads[i] <= gradThresh;
     }
 
-    std::vector<unsigned char> lutI[3], lutJ[3];
     std::vector<double> accumHistI[3], accumHistJ[3];
-    std::vector<unsigned char> transIToJ[3], transJToI[3];
     cv::Mat intersect;
     cv::Mat bgrI[3], bgrJ[3];
 
-    int minVal = 5, maxVal = 250;
-    double normScale = 1.0 / 255.0;
-
     pairs.reserve(numImages * (numImages - 1) * 2 * 256);
     for (int i = 0; i < numImages - 1; i++)
     {
@@ -815,40 +860,8 @@ static void getPointPairsHistogram(const std::vector<cv::Mat>& src, const std::v
             {
                 calcAccumHist(bgrI[k], intersect, accumHistI[k]);
                 calcAccumHist(bgrJ[k], intersect, accumHistJ[k]);
-                histSpecification(accumHistI[k], accumHistJ[k], transIToJ[k]);
-                histSpecification(accumHistJ[k], accumHistI[k], transJToI[k]);
-            }
-
-            for (int k = minVal; k < maxVal; k++)
-            {
-                if (transIToJ[0][k] > minVal && transIToJ[0][k] < maxVal &&
-                    transIToJ[1][k] > minVal && transIToJ[1][k] < maxVal &&
-                    transIToJ[2][k] > minVal && transIToJ[2][k] < maxVal)
-                {
-                    ValuePair pair;
-                    pair.i = i;
-                    pair.j = j;
-                    pair.iVal = cv::Vec3b(k, k, k);
-                    pair.iValD = toVec3d(pair.iVal) * normScale;
-                    pair.jVal = cv::Vec3b(transIToJ[0][k], transIToJ[1][k], transIToJ[2][k]);
-                    pair.jValD = toVec3d(pair.jVal) * normScale;
-                    pairs.push_back(pair);
-                }
-
-                if (transJToI[0][k] > minVal && transJToI[0][k] < maxVal &&
-                    transJToI[1][k] > minVal && transJToI[1][k] < maxVal &&
-                    transJToI[2][k] > minVal && transJToI[2][k] < maxVal)
-                {
-                    ValuePair pair;
-                    pair.i = j;
-                    pair.j = i;
-                    pair.iVal = cv::Vec3b(k, k, k);
-                    pair.iValD = toVec3d(pair.iVal) * normScale;
-                    pair.jVal = cv::Vec3b(transJToI[0][k], transJToI[1][k], transJToI[2][k]);
-                    pair.jValD = toVec3d(pair.jVal) * normScale;
-                    pairs.push_back(pair);
-                }
             }
+            getPointPairsFromAccumHists(i, j, accumHistI, accumHistJ, pairs);
         }
     }
 }
@@ -1090,9 +1103,9 @@ static void errorFunc(double* p, double* hx, int m, int n, void* data)
         if (contains(anchorIndexes, i))
             continue;
 
-        hx[index++] = abs(transforms[i].exposure - 1) * 2;
-        hx[index++] = abs(transforms[i].whiteBalanceBlue - 1) * 2;
-        hx[index++] = abs(transforms[i].whiteBalanceRed - 1) * 2;
+        hx[index++] = fabs(transforms[i].exposure - 1) * 2;
+        hx[index++] = fabs(transforms[i].whiteBalanceBlue - 1) * 2;
+        hx[index++] = fabs(transforms[i].whiteBalanceRed - 1) * 2;
     }
 
     double huberSigma = edata->huberSigma;
@@ -1113,8 +1126,8 @@ static void errorFunc(double* p, double* hx, int m, int n, void* data)
 
         for (int j = 0; j < 3; j++)
         {
-            hx[index++] = weightHuber(abs(errI[j]), huberSigma);
-            hx[index++] = weightHuber(abs(errJ[j]), huberSigma);
+            hx[index++] = weightHuber(fabs(errI[j]), huberSigma);
+            hx[index++] = weightHuber(fabs(errJ[j]), huberSigma);
             //hx[index++] = errI[j] * errI[j];
             //hx[index++] = errJ[j] * errJ[j];
             //hx[index++] = errI[j];
@@ -1130,7 +1143,7 @@ static void errorFunc(double* p, double* hx, int m, int n, void* data)
     {
         diff += transforms[i].applyInverse(edata->meanVals[i]) - edata->meanVals[i];
     }
-    hx[index++] = weightHuber(abs(diff[0] + diff[1] + diff[2]) / 3.0, huberSigma);
+    hx[index++] = weightHuber(fabs(diff[0] + diff[1] + diff[2]) / 3.0, huberSigma);
 
     edata->errorFuncCallCount++;
 
@@ -1141,9 +1154,352 @@ static void errorFunc(double* p, double* hx, int m, int n, void* data)
 
 #include "levmar.h"
 
+static int exposureColorOptimizeUseNormalEquations = 1;
+
+void setExposureColorOptimizeUseNormalEquations(bool useNormalEquations)
+{
+    exposureColorOptimizeUseNormalEquations = useNormalEquations;
+}
+
+// Indexes of the parameters of one image in p, -1 if the value is not optimized.
+// scaleIndexes[c] is the index of the white balance ratio applied to channel c.
+struct ParamIndexes
+{
+    int exposure;
+    int scaleIndexes[3];
+};
+
+static void getParamIndexes(int numImages, const std::vector<int>& anchorIndexes, int optimizeWhat,
+    std::vector<ParamIndexes>& indexes)
+{
+    indexes.resize(numImages);
+    int offset = 0;
+    for (int i = 0; i < numImages; i++)
+    {
+        ParamIndexes& idx = indexes[i];
+        idx.exposure = idx.scaleIndexes[0] = idx.scaleIndexes[1] = idx.scaleIndexes[2] = -1;
+        if (contains(anchorIndexes, i))
+            continue;
+        if (optimizeWhat & EXPOSURE)
+            idx.exposure = offset++;
+        if (optimizeWhat & WHITE_BALANCE)
+        {
+            idx.scaleIndexes[2] = offset++;
+            idx.scaleIndexes[0] = offset++;
+        }
+    }
+}
+
+// Residual r = weightHuber(|err|) and its derivative dr / derr.
+inline double huberResidual(double err, double sigma, double& deriv)
+{
+    double absErr = fabs(err);
+    double sign = err >= 0 ? 1 : -1;
+    if (absErr > sigma)
+    {
+        double r = sqrt(sigma * (2 * absErr - sigma));
+        deriv = sign * sigma / r;
+        return r;
+    }
+    deriv = sign;
+    return absErr;
+}
+
+// Adds one residual with count Jacobian entries to J^T J (upper triangle) and J^T r,
+// entries with a negative index are ignored.
+inline void accumResidual(double r, double scale, const int* idx, const double* jac, int count, int m, double* JtJ, double* Jtr)
+{
+    for (int a = 0; a < count; a++)
+    {
+        if (idx[a] < 0)
+            continue;
+        Jtr[idx[a]] += jac[a] * r;
+        double* row = JtJ + idx[a] * m;
+        for (int b = 0; b < count; b++)
+        {
+            if (idx[b] >= idx[a])
+                row[idx[b]] += scale * jac[a] * jac[b];
+        }
+    }
+}
+
+// With s = exposure * white balance ratio of a channel, the pair residuals of errorFunc are
+// weightHuber(|errI|) and weightHuber(|errJ|), errI = jVal - iVal * sJ / sI, errJ = iVal - jVal * sI / sJ.
+// Their Jacobian rows are derivI * qI * v and -derivJ * qJ * v, qI = iVal * sJ / sI, qJ = jVal * sI / sJ,
+// where v = (1 / exposure i, 1 / ratio i, -1 / exposure j, -1 / ratio j) only depends on the images
+// and the channel. So the pairs only add to two sums per image pair and channel,
+// sum of (derivI * qI)^2 + (derivJ * qJ)^2 for J^T J and sum of rI * derivI * qI - rJ * derivJ * qJ
+// for J^T r, each stripe of pairs accumulates them in its own buffer.
+class ExposureColorNormalEquationsLoop : public cv::ParallelLoopBody
+{
+public:
+    ExposureColorNormalEquationsLoop(const std::vector<ValuePair>& pairs_, const std::vector<double>& ratios_,
+        int numImages_, double huberSigma_, bool calcSums_, int numStripes_, std::vector<double>* sums_, double* errs_)
+        : pairs(pairs_), ratios(ratios_), numImages(numImages_), huberSigma(huberSigma_), calcSums(calcSums_),
+          numStripes(numStripes_), sums(sums_), errs(errs_)
+    {}
+
+    void operator()(const cv::Range& r) const
+    {
+        int numPairs = pairs.size();
+        for (int k = r.start; k < r.end; k++)
+        {
+            int beg = (long long)numPairs * k / numStripes, end = (long long)numPairs * (k + 1) / numStripes;
+            double* ptrSums = calcSums ? sums[k].data() : 0;
+            double err = 0;
+            for (int t = beg; t < end; t++)
+            {
+                const ValuePair& pair = pairs[t];
+                int block = (pair.i * numImages + pair.j) * 3;
+                const double* ptrRatios = ratios.data() + block;
+                for (int c = 0; c < 3; c++)
+                {
+                    double qI = pair.iValD[c] * ptrRatios[c], qJ = pair.jValD[c] / ptrRatios[c];
+                    double derivI, derivJ;
+                    double rI = huberResidual(pair.jValD[c] - qI, huberSigma, derivI);
+                    double rJ = huberResidual(pair.iValD[c] - qJ, huberSigma, derivJ);
+                    err += rI * rI + rJ * rJ;
+                    if (ptrSums)
+                    {
+                        double gI = derivI * qI, gJ = derivJ * qJ;
+                        ptrSums[(block + c) * 2] += gI * gI + gJ * gJ;
+                        ptrSums[(block + c) * 2 + 1] += rI * gI - rJ * gJ;
+                    }
+                }
+            }
+            errs[k] = err;
+        }
+    }
+
+private:
+    const std::vector<ValuePair>& pairs;
+    const std::vector<double>& ratios;
+    int numImages;
+    double huberSigma;
+    bool calcSums;
+    int numStripes;
+    std::vector<double>* sums;
+    double* errs;
+};
+
+inline double getWhiteBalance(const ImageInfo& info, int channel)
+{
+    return channel == 0 ? info.whiteBalanceBlue : (channel == 2 ? info.whiteBalanceRed : 1);
+}
+
+// Returns the squared norm of the residuals of errorFunc at p. If JtJ is not null,
+// also computes J^T J (m x m) and J^T r (m) with the analytic Jacobian.
+// Stripes are reduced in a fixed order, so the result does not depend on the number of threads.
+static double calcNormalEquations(const double* p, int m, ExternData& edata,
+    const std::vector<ParamIndexes>& indexes, double* JtJ, double* Jtr)
+{
+    std::vector<ImageInfo>& infos = edata.imageInfos;
+    readFrom(infos, p, edata.anchoIndexes, edata.optimizeWhat);
+    int numImages = infos.size();
+    double huberSigma = edata.huberSigma;
+    double sqrErr = 0;
+
+    if (JtJ)
+    {
+        memset(JtJ, 0, m * m * sizeof(double));
+        memset(Jtr, 0, m * sizeof(double));
+    }
+
+    // Regularization residuals, 2 * |x - 1| for exposure, blue and red ratio of non anchor images
+    for (int i = 0; i < numImages; i++)
+    {
+        if (contains(edata.anchoIndexes, i))
+            continue;
+
+        const ParamIndexes& idx = indexes[i];
+        int regIndexes[3] = { idx.exposure, idx.scaleIndexes[0], idx.scaleIndexes[2] };
+        double vals[3] = { infos[i].exposure, infos[i].whiteBalanceBlue, infos[i].whiteBalanceRed };
+        for (int k = 0; k < 3; k++)
+        {
+            double r = fabs(vals[k] - 1) * 2;
+            sqrErr += r * r;
+            if (JtJ)
+            {
+                double jac = vals[k] >= 1 ? 2 : -2;
+                accumResidual(r, 1, regIndexes + k, &jac, 1, m, JtJ, Jtr);
+            }
+        }
+    }
+
+    // sJ / sI of every image pair and channel
+    std::vector<double> ratios(numImages * numImages * 3);
+    for (int i = 0; i < numImages; i++)
+    {
+        for (int j = 0; j < numImages; j++)
+        {
+            for (int c = 0; c < 3; c++)
+                ratios[(i * numImages + j) * 3 + c] = (infos[j].exposure * getWhiteBalance(infos[j], c)) /
+                                                      (infos[i].exposure * getWhiteBalance(infos[i], c));
+        }
+    }
+
+    int numPairs = edata.pairs.size();
+    int numStripes = std::max(1, std::min(64, numPairs / 4096));
+    std::vector<std::vector<double> > sums(JtJ ? numStripes : 0);
+    for (int k = 0; k < sums.size(); k++)
+        sums[k].assign(numImages * numImages * 3 * 2, 0);
+    std::vector<double> errs(numStripes, 0);
+    ExposureColorNormalEquationsLoop loop(edata.pairs, ratios, numImages, huberSigma, JtJ != 0,
+        numStripes, sums.data(), errs.data());
+    if (numStripes > 1)
+        cv::parallel_for_(cv::Range(0, numStripes), loop);
+    else
+        loop(cv::Range(0, 1));
+    for (int k = 0; k < numStripes; k++)
+        sqrErr += errs[k];
+
+    if (JtJ)
+    {
+        for (int k = 1; k < numStripes; k++)
+        {
+            for (int t = 0; t < sums[0].size(); t++)
+                sums[0][t] += sums[k][t];
+        }
+        for (int i = 0; i < numImages; i++)
+        {
+            for (int j = 0; j < numImages; j++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    const double* ptrSums = sums[0].data() + ((i * numImages + j) * 3 + c) * 2;
+                    if (ptrSums[0] == 0 && ptrSums[1] == 0)
+                        continue;
+                    int idx[4] = { indexes[i].exposure, indexes[i].scaleIndexes[c], indexes[j].exposure, indexes[j].scaleIndexes[c] };
+                    double v[4] = { 1 / infos[i].exposure, 1 / getWhiteBalance(infos[i], c),
+                                    -1 / infos[j].exposure, -1 / getWhiteBalance(infos[j], c) };
+                    accumResidual(ptrSums[1], ptrSums[0], idx, v, 4, m, JtJ, Jtr);
+                }
+            }
+        }
+    }
+
+    // Mean value residual, its Jacobian row is dense
+    double diff = 0;
+    std::vector<double> meanJac(m, 0);
+    for (int i = 0; i < numImages; i++)
+    {
+        const ParamIndexes& idx = indexes[i];
+        for (int c = 0; c < 3; c++)
+        {
+            double wb = getWhiteBalance(infos[i], c);
+            double light = edata.meanVals[i][c] / (infos[i].exposure * wb);
+            diff += light - edata.meanVals[i][c];
+            if (idx.exposure >= 0)
+                meanJac[idx.exposure] -= light / infos[i].exposure;
+            if (idx.scaleIndexes[c] >= 0)
+                meanJac[idx.scaleIndexes[c]] -= light / wb;
+        }
+    }
+    double deriv;
+    double r = huberResidual(diff / 3.0, huberSigma, deriv);
+    sqrErr += r * r;
+    if (JtJ)
+    {
+        for (int a = 0; a < m; a++)
+        {
+            if (meanJac[a] == 0)
+                continue;
+            Jtr[a] += deriv / 3.0 * meanJac[a] * r;
+            for (int b = a; b < m; b++)
+                JtJ[a * m + b] += (deriv / 3.0) * (deriv / 3.0) * meanJac[a] * meanJac[b];
+        }
+
+        for (int a = 0; a < m; a++)
+        {
+            for (int b = 0; b < a; b++)
+                JtJ[a * m + b] = JtJ[b * m + a];
+        }
+    }
+
+    edata.errorFuncCallCount++;
+    return sqrErr;
+}
+
+// Levenberg-Marquardt with the damping update and the stopping criteria of dlevmar_der,
+// opts are the first four options of levmar. It works on the m x m normal equations
+// accumulated by calcNormalEquations, while dlevmar_dif evaluates errorFunc m + 1 times
+// per iteration for a finite difference Jacobian, and dlevmar_der would store the dense
+// n x m Jacobian. Returns the number of iterations.
+static int levmarNormalEquations(double* p, int m, int maxIter, const double* opts, ExternData& edata)
+{
+    std::vector<ParamIndexes> indexes;
+    getParamIndexes(edata.imageInfos.size(), edata.anchoIndexes, edata.optimizeWhat, indexes);
+
+    const double eps1 = opts[1], eps2 = opts[2], eps2Sqr = opts[2] * opts[2], eps3 = opts[3];
+    cv::Mat JtJ(m, m, CV_64FC1), Jtr(m, 1, CV_64FC1), A, dp, pNew(m, 1, CV_64FC1);
+    double mu = 0, nu = 2;
+    double err = calcNormalEquations(p, m, edata, indexes, (double*)JtJ.data, (double*)Jtr.data);
+    int iter;
+    for (iter = 0; iter < maxIter; iter++)
+    {
+        double JtrInf = 0, pSqr = 0, maxDiag = 0;
+        for (int i = 0; i < m; i++)
+        {
+            JtrInf = std::max(JtrInf, fabs(Jtr.at<double>(i)));
+            pSqr += p[i] * p[i];
+            maxDiag = std::max(maxDiag, JtJ.at<double>(i, i));
+        }
+        if (JtrInf <= eps1 || err <= eps3)
+            break;
+        if (iter == 0)
+            mu = opts[0] * maxDiag;
+
+        bool stop = false;
+        while (true)
+        {
+            A = JtJ.clone();
+            for (int i = 0; i < m; i++)
+                A.at<double>(i, i) += mu;
+            if (cv::solve(A, -Jtr, dp, cv::DECOMP_CHOLESKY))
+            {
+                double dpSqr = dp.dot(dp);
+                if (dpSqr <= eps2Sqr * pSqr || dpSqr >= (pSqr + eps2) / (DBL_EPSILON * DBL_EPSILON))
+                {
+                    stop = true;
+                    break;
+                }
+                for (int i = 0; i < m; i++)
+                    pNew.at<double>(i) = p[i] + dp.at<double>(i);
+                double errNew = calcNormalEquations((double*)pNew.data, m, edata, indexes, 0, 0);
+                // Predicted decrease dp^T (mu dp - J^T r)
+                double dL = dp.dot(mu * dp - Jtr);
+                double dF = err - errNew;
+                if (dL > 0 && dF > 0)
+                {
+                    double t = 2 * dF / dL - 1;
+                    t = 1 - t * t * t;
+                    mu *= std::max(t, 1.0 / 3);
+                    nu = 2;
+                    memcpy(p, pNew.data, m * sizeof(double));
+                    err = calcNormalEquations(p, m, edata, indexes, (double*)JtJ.data, (double*)Jtr.data);
+                    break;
+                }
+            }
+            mu *= nu;
+            nu *= 2;
+            if (nu > 1e300)
+            {
+                stop = true;
+                break;
+            }
+        }
+        if (stop)
+            break;
+    }
+    readFrom(edata.imageInfos, p, edata.anchoIndexes, edata.optimizeWhat);
+    return iter;
+}
+
+// If warmStart is true, the optimization starts from the exposures and white balance ratios
+// in outImageInfos instead of 1.
 static void optimize(const std::vector<ValuePair>& valuePairs, int numImages, std::vector<int> anchorIndexes,
     const cv::Size& imageSize, const std::vector<int>& optimizeOptions,
-    std::vector<ImageInfo>& outImageInfos)
+    std::vector<ImageInfo>& outImageInfos, bool warmStart = false)
 {
     std::vector<ImageInfo> imageInfos(numImages);
     for (int i = 0; i < numImages; i++)
@@ -1151,6 +1507,12 @@ static void optimize(const std::vector<ValuePair>& valuePairs, int numImages, st
         ImageInfo info(imageSize);
         imageInfos[i] = info;
         imageInfos[i].meanVals = outImageInfos[i].meanVals;
+        if (warmStart)
+        {
+            imageInfos[i].exposure = outImageInfos[i].exposure;
+            imageInfos[i].whiteBalanceRed = outImageInfos[i].whiteBalanceRed;
+            imageInfos[i].whiteBalanceBlue = outImageInfos[i].whiteBalanceBlue;
+        }
     }
     int numAnchors = anchorIndexes.size();
 
@@ -1180,15 +1542,8 @@ static void optimize(const std::vector<ValuePair>& valuePairs, int numImages, st
         int m = (numImages - numAnchors) * numParams;
         std::vector<double> p(m, 0.0);
 
-        // vector for errors
-        int n = 2 * 3 * valuePairs.size() + 3 * (numImages - numAnchors) + 1;
-        std::vector<double> x(n, 0.0);
-
         writeTo(imageInfos, p.data(), anchorIndexes, option);
 
-        // covariance matrix at solution
-        cv::Mat cov(m, m, CV_64FC1);
-
         ExternData edata(imageInfos, valuePairs);
         edata.huberSigma = 5.0 / 255;
         edata.errorFuncCallCount = 0;
@@ -1198,7 +1553,19 @@ static void optimize(const std::vector<ValuePair>& valuePairs, int numImages, st
         for (int i = 0; i < numImages; i++)
             edata.meanVals[i] = imageInfos[i].meanVals;
 
-        ret = dlevmar_dif(&errorFunc, &(p[0]), &(x[0]), m, n, maxIter, optimOpts, info, NULL, (double*)cov.data, &edata);  // no jacobian
+        if (exposureColorOptimizeUseNormalEquations)
+            ret = levmarNormalEquations(p.data(), m, maxIter, optimOpts, edata);
+        else
+        {
+            // vector for errors
+            int n = 2 * 3 * valuePairs.size() + 3 * (numImages - numAnchors) + 1;
+            std::vector<double> x(n, 0.0);
+
+            // covariance matrix at solution
+            cv::Mat cov(m, m, CV_64FC1);
+
+            ret = dlevmar_dif(&errorFunc, &(p[0]), &(x[0]), m, n, maxIter, optimOpts, info, NULL, (double*)cov.data, &edata);  // no jacobian
+        }
         // copy to source images (data.m_imgs)
         readFrom(imageInfos, p.data(), anchorIndexes, option);
     }
@@ -1214,6 +1581,49 @@ static void optimize(const std::vector<ValuePair>& valuePairs, int numImages, st
     outImageInfos = imageInfos;
 }
 
+// Runs optimize on value pairs given without the internal structs, declared by the solver test.
+// Pair k is seen by images pairIndexes[k][0] and pairIndexes[k][1] with BGR values in [0, 1]
+// valsI[k] and valsJ[k], meanVals are the mean BGR values of the images in [0, 1].
+void optimizeExposureColorPairs(int numImages, const cv::Size& imageSize, const std::vector<cv::Vec2i>& pairIndexes,
+    const std::vector<cv::Vec3d>& valsI, const std::vector<cv::Vec3d>& valsJ, const std::vector<cv::Vec3d>& meanVals,
+    const std::vector<int>& anchorIndexes, int optimizeWhat,
+    std::vector<double>& exposures, std::vector<double>& redRatios, std::vector<double>& blueRatios)
+{
+    CV_Assert(pairIndexes.size() == valsI.size() && pairIndexes.size() == valsJ.size() &&
+        (int)meanVals.size() == numImages);
+
+    int numPairs = pairIndexes.size();
+    std::vector<ValuePair> pairs(numPairs);
+    for (int k = 0; k < numPairs; k++)
+    {
+        ValuePair& pair = pairs[k];
+        pair.i = pairIndexes[k][0];
+        pair.j = pairIndexes[k][1];
+        pair.iValD = valsI[k];
+        pair.jValD = valsJ[k];
+        for (int c = 0; c < 3; c++)
+        {
+            pair.iVal[c] = cv::saturate_cast<unsigned char>(valsI[k][c] * 255);
+            pair.jVal[c] = cv::saturate_cast<unsigned char>(valsJ[k][c] * 255);
+        }
+    }
+
+    std::vector<ImageInfo> infos(numImages);
+    for (int i = 0; i < numImages; i++)
+        infos[i].meanVals = meanVals[i];
+    optimize(pairs, numImages, anchorIndexes, imageSize, std::vector<int>(1, optimizeWhat), infos);
+
+    exposures.resize(numImages);
+    redRatios.resize(numImages);
+    blueRatios.resize(numImages);
+    for (int i = 0; i < numImages; i++)
+    {
+        exposures[i] = infos[i].exposure;
+        redRatios[i] = infos[i].whiteBalanceRed;
+        blueRatios[i] = infos[i].whiteBalanceBlue;
+    }
+}
+
 void getLUT(std::vector<unsigned char>& lut, double k)
 {
     CV_Assert(k > 0);
@@ -1461,3 +1871,381 @@ void getExposureColorOptimizeBezierClampedLUTs(const std::vector<double>& exposu
         //getLUTMaxScaleRaiseIfKLessThanOne(luts[i][2], exposures[i] * redRatios[i], maxScale);
     }
 }
+
+struct ExposureColorEstimator::Impl
+{
+    Impl() : numImages(0), sampleStep(0), optimizeWhat(0), frameInterval(0), frameCount(0), historyWeight(0),
+        numAccumFrames(0), hasPendingFrames(false), endFlag(false), numSolves(0), success(false) {}
+    void run();
+    void estimate(std::vector<cv::Mat>& frames);
+
+    struct Overlap
+    {
+        int i, j;
+        cv::Mat intersect;
+        std::vector<double> accumHistI[3], accumHistJ[3];
+    };
+
+    int numImages;
+    cv::Size srcSize, smallSize;
+    int sampleStep;
+    std::vector<cv::Mat> maps, masks;
+    std::vector<Overlap> overlaps;
+    std::vector<ImageInfo> imageInfos;
+    int optimizeWhat;
+    int frameInterval;
+    int frameCount;
+    double historyWeight;
+    int numAccumFrames;
+
+    std::thread thread;
+    std::mutex mtxFrames;
+    std::condition_variable condFrames;
+    // Sampled by addFrames before mtxFrames is taken, then swapped with pendingFrames
+    std::vector<cv::Mat> sampledFrames;
+    std::vector<cv::Mat> pendingFrames;
+    bool hasPendingFrames;
+    bool endFlag;
+
+    mutable std::mutex mtxResult;
+    std::shared_ptr<const std::vector<std::vector<std::vector<unsigned char> > > > luts;
+    std::vector<double> exposures, redRatios, blueRatios;
+    int numSolves;
+    bool success;
+};
+
+void ExposureColorEstimator::Impl::run()
+{
+    // Swapped with pendingFrames, so it should hold numImages mats as well
+    std::vector<cv::Mat> frames(numImages);
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mtxFrames);
+            condFrames.wait(lock, [this] { return hasPendingFrames || endFlag; });
+            if (endFlag)
+                break;
+            std::swap(frames, pendingFrames);
+            hasPendingFrames = false;
+        }
+
+        try
+        {
+            estimate(frames);
+        }
+        catch (const std::exception& e)
+        {
+            printf("Error in %s, exception caught, %s\n", __FUNCTION__, e.what());
+        }
+    }
+}
+
+// frames are of type CV_8UC3 and size smallSize
+void ExposureColorEstimator::Impl::estimate(std::vector<cv::Mat>& frames)
+{
+    std::vector<cv::Mat> reprojImages;
+    reprojectParallel(frames, reprojImages, maps);
+
+    // Statistics of earlier frames decay by historyWeight per estimate
+    double newWeight = numAccumFrames ? 1 - historyWeight : 1;
+    for (int i = 0; i < numImages; i++)
+    {
+        cv::Scalar meanVals = cv::mean(frames[i]) / 255.0;
+        imageInfos[i].meanVals = imageInfos[i].meanVals * (1 - newWeight) +
+            cv::Vec3d(meanVals[0], meanVals[1], meanVals[2]) * newWeight;
+    }
+
+    std::vector<double> accumHist;
+    cv::Mat bgrI[3], bgrJ[3];
+    int numOverlaps = overlaps.size();
+    for (int k = 0; k < numOverlaps; k++)
+    {
+        Overlap& overlap = overlaps[k];
+        cv::split(reprojImages[overlap.i], bgrI);
+        cv::split(reprojImages[overlap.j], bgrJ);
+        for (int c = 0; c < 3; c++)
+        {
+            for (int t = 0; t < 2; t++)
+            {
+                std::vector<double>& dst = t ? overlap.accumHistJ[c] : overlap.accumHistI[c];
+                calcAccumHist(t ? bgrJ[c] : bgrI[c], overlap.intersect, accumHist);
+                dst.resize(256, 0);
+                for (int v = 0; v < 256; v++)
+                    dst[v] = dst[v] * (1 - newWeight) + accumHist[v] * newWeight;
+            }
+        }
+    }
+    numAccumFrames++;
+
+    std::vector<ValuePair> pairs;
+    pairs.reserve(numOverlaps * 2 * 256);
+    for (int k = 0; k < numOverlaps; k++)
+        getPointPairsFromAccumHists(overlaps[k].i, overlaps[k].j, overlaps[k].accumHistI, overlaps[k].accumHistJ, pairs);
+    if (pairs.empty())
+        return;
+
+    std::vector<int> optimizeOptions(1, optimizeWhat);
+    optimize(pairs, numImages, std::vector<int>(), smallSize, optimizeOptions, imageInfos, numSolves > 0);
+
+    std::vector<double> es(numImages), rs(numImages), bs(numImages);
+    for (int i = 0; i < numImages; i++)
+    {
+        es[i] = 1.0 / imageInfos[i].exposure;
+        rs[i] = 1.0 / imageInfos[i].whiteBalanceRed;
+        bs[i] = 1.0 / imageInfos[i].whiteBalanceBlue;
+    }
+    std::shared_ptr<std::vector<std::vector<std::vector<unsigned char> > > >
+        newLuts(new std::vector<std::vector<std::vector<unsigned char> > >);
+    getExposureColorOptimizeLUTs(es, rs, bs, *newLuts);
+
+    std::lock_guard<std::mutex> lock(mtxResult);
+    luts = newLuts;
+    exposures.swap(es);
+    redRatios.swap(rs);
+    blueRatios.swap(bs);
+    numSolves++;
+}
+
+ExposureColorEstimator::ExposureColorEstimator()
+    : ptrImpl(new Impl)
+{
+}
+
+ExposureColorEstimator::~ExposureColorEstimator()
+{
+    clear();
+}
+
+bool ExposureColorEstimator::prepare(const std::vector<PhotoParam>& params, const cv::Size& srcSize,
+    int optimizeWhat, int frameInterval, double historyWeight)
+{
+    clear();
+
+    if (params.empty() || srcSize.width <= 0 || srcSize.height <= 0 ||
+        !((optimizeWhat & EXPOSURE) || (optimizeWhat & WHITE_BALANCE)) ||
+        frameInterval < 1 || historyWeight < 0 || historyWeight >= 1)
+        return false;
+
+    Impl& impl = *ptrImpl;
+    impl.numImages = params.size();
+    impl.srcSize = srcSize;
+    impl.optimizeWhat = optimizeWhat;
+    impl.frameInterval = frameInterval;
+    impl.historyWeight = historyWeight;
+
+    // Same source size as exposureColorOptimize, which halves the images resizeTimes times
+    int resizeTimes = getResizeTimes(srcSize.width, srcSize.height, 100, 100);
+    impl.smallSize = srcSize;
+    impl.sampleStep = 1 << resizeTimes;
+    for (int i = 0; i < resizeTimes; i++)
+    {
+        impl.smallSize.width = cv::saturate_cast<int>(impl.smallSize.width * 0.5);
+        impl.smallSize.height = cv::saturate_cast<int>(impl.smallSize.height * 0.5);
+    }
+    std::vector<PhotoParam> smallParams = params;
+    rescalePhotoParams(smallParams, 1.0 / pow(2, resizeTimes));
+
+    // Cumulative histograms are normalized, so a coarser equirect than that of
+    // getPointPairsHistogram gives nearly the same statistics at a quarter of the cost
+    getReprojectMapsCompactAndMasks(smallParams, impl.smallSize, cv::Size(800, 400), impl.maps, impl.masks);
+
+    for (int i = 0; i < impl.numImages - 1; i++)
+    {
+        for (int j = i + 1; j < impl.numImages; j++)
+        {
+            Impl::Overlap overlap;
+            overlap.i = i;
+            overlap.j = j;
+            cv::bitwise_and(impl.masks[i], impl.masks[j], overlap.intersect);
+            if (cv::countNonZero(overlap.intersect) > 0)
+                impl.overlaps.push_back(overlap);
+        }
+    }
+
+    impl.imageInfos.resize(impl.numImages);
+    for (int i = 0; i < impl.numImages; i++)
+    {
+        impl.imageInfos[i] = ImageInfo(impl.smallSize);
+        impl.imageInfos[i].meanVals = cv::Vec3d();
+    }
+    impl.sampledFrames.resize(impl.numImages);
+    impl.pendingFrames.resize(impl.numImages);
+
+    impl.endFlag = false;
+    impl.thread = std::thread(&ExposureColorEstimator::Impl::run, ptrImpl.get());
+    impl.success = true;
+    return true;
+}
+
+// Takes the center pixel of every step x step block of src into dst of type CV_8UC3,
+// much cheaper than cv::resize with INTER_AREA on the full frame, while the histograms
+// and means the estimate is based on stay nearly the same.
+static void sampleFrame(const cv::Mat& src, cv::Mat& dst, const cv::Size& dstSize, int step)
+{
+    dst.create(dstSize, CV_8UC3);
+    int srcChannels = src.channels();
+    for (int i = 0; i < dstSize.height; i++)
+    {
+        const unsigned char* ptrSrc = src.ptr<unsigned char>(std::min(i * step + step / 2, src.rows - 1));
+        unsigned char* ptrDst = dst.ptr<unsigned char>(i);
+        for (int j = 0; j < dstSize.width; j++, ptrDst += 3)
+        {
+            const unsigned char* ptr = ptrSrc + std::min(j * step + step / 2, src.cols - 1) * srcChannels;
+            ptrDst[0] = ptr[0];
+            ptrDst[1] = ptr[1];
+            ptrDst[2] = ptr[2];
+        }
+    }
+}
+
+void ExposureColorEstimator::addFrames(const std::vector<cv::Mat>& images)
+{
+    Impl& impl = *ptrImpl;
+    if (!impl.success || (int)images.size() != impl.numImages)
+        return;
+
+    if (impl.frameCount++ % impl.frameInterval)
+        return;
+
+    for (int i = 0; i < impl.numImages; i++)
+    {
+        CV_Assert(images[i].data && (images[i].type() == CV_8UC3 || images[i].type() == CV_8UC4) &&
+            images[i].size() == impl.srcSize);
+    }
+
+    // Never wait for the estimating thread, the frames are dropped if it is busy taking the last ones.
+    // Only this function sets hasPendingFrames, so it stays false until the frames are handed over.
+    {
+        std::unique_lock<std::mutex> lock(impl.mtxFrames, std::try_to_lock);
+        if (!lock.owns_lock() || impl.hasPendingFrames)
+            return;
+    }
+
+    // Only the small frames the estimate works on are taken, sampled outside the lock
+    for (int i = 0; i < impl.numImages; i++)
+        sampleFrame(images[i], impl.sampledFrames[i], impl.smallSize, impl.sampleStep);
+
+    std::lock_guard<std::mutex> lock(impl.mtxFrames);
+    std::swap(impl.sampledFrames, impl.pendingFrames);
+    impl.hasPendingFrames = true;
+    impl.condFrames.notify_one();
+}
+
+std::shared_ptr<const std::vector<std::vector<std::vector<unsigned char> > > > ExposureColorEstimator::getLUTs() const
+{
+    std::lock_guard<std::mutex> lock(ptrImpl->mtxResult);
+    return ptrImpl->luts;
+}
+
+bool ExposureColorEstimator::getResult(std::vector<double>& exposures,
+    std::vector<double>& redRatios, std::vector<double>& blueRatios) const
+{
+    std::lock_guard<std::mutex> lock(ptrImpl->mtxResult);
+    exposures = ptrImpl->exposures;
+    redRatios = ptrImpl->redRatios;
+    blueRatios = ptrImpl->blueRatios;
+    return !exposures.empty();
+}
+
+int ExposureColorEstimator::getNumSolves() const
+{
+    std::lock_guard<std::mutex> lock(ptrImpl->mtxResult);
+    return ptrImpl->numSolves;
+}
+
+void ExposureColorEstimator::clear()
+{
+    Impl& impl = *ptrImpl;
+    if (impl.thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(impl.mtxFrames);
+            impl.endFlag = true;
+        }
+        impl.condFrames.notify_one();
+        impl.thread.join();
+    }
+
+    impl.success = false;
+    impl.numImages = 0;
+    impl.frameCount = 0;
+    impl.numAccumFrames = 0;
+    impl.hasPendingFrames = false;
+    impl.maps.clear();
+    impl.masks.clear();
+    impl.overlaps.clear();
+    impl.imageInfos.clear();
+    impl.sampledFrames.clear();
+    impl.pendingFrames.clear();
+
+    std::lock_guard<std::mutex> lock(impl.mtxResult);
+    impl.luts.reset();
+    impl.exposures.clear();
+    impl.redRatios.clear();
+    impl.blueRatios.clear();
+    impl.numSolves = 0;
+}
+
+bool SwitchableExposureColorEstimator::begin(const std::vector<PhotoParam>& params, const cv::Size& srcSize,
+    int optimizeWhat, int frameInterval, double historyWeight)
+{
+    std::shared_ptr<ExposureColorEstimator> newEstimator(new ExposureColorEstimator);
+    if (!newEstimator->prepare(params, srcSize, optimizeWhat, frameInterval, historyWeight))
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(mtxEstimator);
+        estimator.swap(newEstimator);
+    }
+    // The replaced estimator, if any, is joined outside the lock
+    release(newEstimator);
+    return true;
+}
+
+void SwitchableExposureColorEstimator::stop()
+{
+    std::shared_ptr<ExposureColorEstimator> oldEstimator;
+    {
+        std::lock_guard<std::mutex> lock(mtxEstimator);
+        estimator.swap(oldEstimator);
+    }
+    release(oldEstimator);
+}
+
+void SwitchableExposureColorEstimator::release(std::shared_ptr<ExposureColorEstimator>& oldEstimator)
+{
+    // The processing thread may still be inside addFrames of the old estimator, 
+    // wait for it to drop its reference, so that the join happens here instead of there
+    while (oldEstimator && oldEstimator.use_count() > 1)
+        std::this_thread::yield();
+    oldEstimator.reset();
+}
+
+std::shared_ptr<const std::vector<std::vector<std::vector<unsigned char> > > > 
+SwitchableExposureColorEstimator::addFrames(const std::vector<cv::Mat>& images)
+{
+    // The lock only guards the pointer, the estimator is called outside it
+    std::shared_ptr<ExposureColorEstimator> currEstimator;
+    {
+        std::lock_guard<std::mutex> lock(mtxEstimator);
+        currEstimator = estimator;
+    }
+    if (!currEstimator)
+        return std::shared_ptr<const std::vector<std::vector<std::vector<unsigned char> > > >();
+    currEstimator->addFrames(images);
+    return currEstimator->getLUTs();
+}
+
+std::shared_ptr<const std::vector<std::vector<std::vector<unsigned char> > > > SwitchableExposureColorEstimator::getLUTs() const
+{
+    std::lock_guard<std::mutex> lock(mtxEstimator);
+    if (!estimator)
+        return std::shared_ptr<const std::vector<std::vector<std::vector<unsigned char> > > >();
+    return estimator->getLUTs();
+}
+
+int SwitchableExposureColorEstimator::getNumSolves() const
+{
+    std::lock_guard<std::mutex> lock(mtxEstimator);
+    return estimator ? estimator->getNumSolves() : 0;
+}
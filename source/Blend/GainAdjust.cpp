@@ -1,5 +1,7 @@
 #include "VisualManip.h"
 #include "ZBlendAlgo.h"
+#include "LookUpTable.h"
+#include "Tool/Ransac.h"
 #include "opencv2/imgproc.hpp"
 #include "opencv2/highgui.hpp"
 #include <algorithm>
@@ -50,51 +52,12 @@ static void getLineParam(const cv::Point& a, const cv::Point& b, cv::Point2d& p,
     p.y = (a.y + b.y) * 0.5;
 }
 
-inline double distToLine(const cv::Point& a, const cv::Point2d& p, const cv::Point2d& dir)
-{
-    if (dir.x == 0)
-    {
-        return abs(a.x - p.x);
-    }
-
-    double k = dir.y / dir.x;
-    return abs(k * a.x - a.y + p.y - k * p.x) / sqrt(1.0 + k * k);
-}
-
 inline void cvtPDirToKH(const cv::Point2d& p, const cv::Point2d& dir, double& k, double& h)
 {
     k = dir.y / dir.x;
     h = p.y - k * p.x;
 }
 
-static void randomPermute(int size, int count, std::vector<int>& arr, std::vector<int>& buf)
-{
-    arr.clear();
-    CV_Assert(size > 0 && count > 0 && count <= size);
-    cv::RNG rng(cv::getTickCount());
-    std::vector<int>& total = buf;
-    total.resize(size);
-    for (int i = 0; i < size; i++)
-        total[i] = i;
-    for (int i = 0; i < count; i++)
-    {
-        int index = rng.uniform(i, size);
-        std::swap(total[i], total[index]);
-    }
-    arr.resize(count);
-    for (int i = 0; i < count; i++)
-        arr[i] = total[i];
-}
-
-static void select(const std::vector<cv::Point>& total, const std::vector<int>& index, std::vector<cv::Point>& subset)
-{
-    subset.clear();
-    int size = index.size();
-    subset.resize(size);
-    for (int i = 0; i < size; i++)
-        subset[i] = total[index[i]];
-}
-
 static void select(const std::vector<cv::Point>& total, const std::vector<unsigned char>& mask, std::vector<cv::Point>& subset)
 {
     subset.clear();
@@ -108,92 +71,98 @@ static void select(const std::vector<cv::Point>& total, const std::vector<unsign
     }
 }
 
-static int getInliers(const std::vector<cv::Point>& points, const cv::Point2d& p, const cv::Point2d& dir, 
-    double error, std::vector<unsigned char>& mask)
+// Points of getLineRANSAC for ztool::runRansac, one array for each coordinate
+class LineRansacProblem
 {
-    mask.clear();
-    if (points.empty())
-        return 0;
+public:
+    // The line through p along dir, and the same line as a * x + b * y + c = 0 with a * a + b * b = 1
+    struct Model
+    {
+        cv::Point2d p, dir;
+        double a, b, c;
+    };
+    enum { NUM_MODEL_POINTS = 2 };
 
-    int size = points.size();
-    mask.resize(size, 0);
-    int count = 0;
-    double minError = DBL_MAX, maxError = 0;
-    for (int i = 0; i < size; i++)
+    LineRansacProblem(const std::vector<cv::Point>& points)
     {
-        double currError = distToLine(points[i], p, dir);
-        minError = MIN(currError, minError);
-        maxError = MAX(currError, maxError);
-        if (currError < error)
-        {
-            mask[i] = 255;
-            count++;
-        }
+        numPoints = points.size();
+        x.resize(numPoints);
+        y.resize(numPoints);
+        for (int i = 0; i < numPoints; i++)
+            x[i] = points[i].x, y[i] = points[i].y;
     }
-    //printf("in getInliers, minError = %f, maxError = %f\n", minError, maxError);
-    return count;
-}
 
-static int updateNumIters(double p, double ep, int modelPoints, int maxIters)
-{
-    CV_Assert(modelPoints > 0);
+    int size() const
+    {
+        return numPoints;
+    }
 
-    p = MAX(p, 0.);
-    p = MIN(p, 1.);
-    ep = MAX(ep, 0.);
-    ep = MIN(ep, 1.);
+    bool fit(const int* indexes, Model& model) const
+    {
+        cv::Point a(x[indexes[0]], y[indexes[0]]), b(x[indexes[1]], y[indexes[1]]);
+        // Pixel value pairs repeat a lot, two equal points do not define a line
+        if (a == b)
+            return false;
+        getLineParam(a, b, model.p, model.dir);
+        if (model.dir.x == 0)
+        {
+            model.a = 1, model.b = 0, model.c = -model.p.x;
+            return true;
+        }
+        double k = model.dir.y / model.dir.x;
+        double scale = 1.0 / sqrt(1.0 + k * k);
+        model.a = k * scale, model.b = -scale, model.c = (model.p.y - k * model.p.x) * scale;
+        return true;
+    }
 
-    // avoid inf's & nan's
-    double num = MAX(1. - p, DBL_MIN);
-    double denom = 1. - pow(1. - ep, modelPoints);
-    if (denom < DBL_MIN)
-        return 0;
+    int countInliers(const Model& model, int beg, int end, double thresh) const
+    {
+        double a = model.a, b = model.b, c = model.c;
+        const double* ptrX = &x[0], *ptrY = &y[0];
+        int count = 0;
+        for (int i = beg; i < end; i++)
+            count += (fabs(a * ptrX[i] + b * ptrY[i] + c) < thresh);
+        return count;
+    }
 
-    num = log(num);
-    denom = log(denom);
+    int getInliers(const Model& model, double thresh, unsigned char* mask) const
+    {
+        int count = 0;
+        for (int i = 0; i < numPoints; i++)
+        {
+            mask[i] = countInliers(model, i, i + 1, thresh) ? 255 : 0;
+            count += mask[i] != 0;
+        }
+        return count;
+    }
 
-    return denom >= 0 || -num >= maxIters*(-denom) ?
-    maxIters : cvRound(num / denom);
-}
+private:
+    int numPoints;
+    std::vector<double> x, y;
+};
 
+// If no line is found, such as when all the points are equal, the identity line
+// through the origin is returned, which makes cvtPDirToKH give k = 1 and h = 0,
+// so the LUT of the image stays unchanged.
 int getLineRANSAC(const std::vector<cv::Point>& points, cv::Point2d& p, cv::Point2d& dir)
 {
     CV_Assert(points.size() > 3);
-    int size = points.size();
-    //printf("RANSAC:\n");
-    //printf("size = %d\n", size);
-
-    int numModelPoints = 2;
-    int numMaxIters = 1000;
-    int numIters = numMaxIters;
-    double confidence = 0.99;
-    double projError = 2;
-    std::vector<unsigned char> currMask, bestMask;
-    std::vector<int> currIndex, indexBuf;
-    std::vector<cv::Point> currPoints;
-    int numMaxInliers = 0;
-    for (int i = 0; i < numIters; i++)
+
+    LineRansacProblem problem(points);
+    LineRansacProblem::Model model;
+    std::vector<unsigned char> mask;
+    int numMaxInliers = ztool::runRansac(problem, ztool::RansacParam(2, 0.99, 1000), model, mask);
+    if (numMaxInliers < 2)
     {
-        //printf("iter = %d\n", i);
-        randomPermute(size, numModelPoints, currIndex, indexBuf);
-        select(points, currIndex, currPoints);
-        cv::Point2d currP, currDir;
-        getLineParam(currPoints[0], currPoints[1], currP, currDir);
-        int currNumInliers = getInliers(points, currP, currDir, projError, currMask);
-        //printf("currNumInliers = %d\n", currNumInliers);
-        if (currNumInliers > MAX(numMaxInliers, numModelPoints - 1))
-        {
-            numIters = updateNumIters(confidence, double(size - currNumInliers) / size, numModelPoints, numMaxIters);
-            //int currNumIters = updateNumIters(confidence, double(size - currNumInliers) / size, numModelPoints, numMaxIters);
-            //numIters = MIN(numMaxIters, i > 2 * currNumIters ? currNumIters : currNumIters + i); 
-            //printf("numIters changed to %d\n", numIters);
-            numMaxInliers = currNumInliers;
-            bestMask = currMask;
-        }
+        p = cv::Point2d(0, 0);
+        dir = cv::Point2d(sqrt(0.5), sqrt(0.5));
+        return numMaxInliers;
     }
-    select(points, bestMask, currPoints);
+
+    std::vector<cv::Point> inlierPoints;
+    select(points, mask, inlierPoints);
     cv::Mat line;
-    cv::fitLine(currPoints, line, CV_DIST_L2, 0, 0, 0);
+    cv::fitLine(inlierPoints, line, CV_DIST_L2, 0, 0, 0);
     dir.x = line.at<float>(0);
     dir.y = line.at<float>(1);
     p.x = line.at<float>(2);
@@ -246,50 +215,8 @@ void transform(const cv::Mat& src, cv::Mat& dst, const std::vector<unsigned char
     CV_Assert(src.type() == CV_8UC3 && lut.size() == 256 &&
         (!mask.data || (mask.data && src.size() == mask.size())));
 
-    dst.create(src.size(), src.type());
-
     const unsigned char* ptrLUT = &lut[0];
-
-    int rows = src.rows, cols = src.cols;
-
-    if (mask.data)
-    {
-        for (int i = 0; i < rows; i++)
-        {
-            const unsigned char* ptrMask = mask.ptr<unsigned char>(i);
-            const unsigned char* ptrSrc = src.ptr<unsigned char>(i);
-            unsigned char* ptrDst = dst.ptr<unsigned char>(i);
-            for (int j = 0; j < cols; j++)
-            {
-                if (*(ptrMask++))
-                {
-                    *(ptrDst++) = ptrLUT[ptrSrc[j * 3]];
-                    *(ptrDst++) = ptrLUT[ptrSrc[j * 3 + 1]];
-                    *(ptrDst++) = ptrLUT[ptrSrc[j * 3 + 2]];
-                }
-                else
-                {
-                    *(ptrDst++) = 0;
-                    *(ptrDst++) = 0;
-                    *(ptrDst++) = 0;
-                }
-            }
-        }
-    }
-    else
-    {
-        for (int i = 0; i < rows; i++)
-        {
-            const unsigned char* ptrSrc = src.ptr<unsigned char>(i);
-            unsigned char* ptrDst = dst.ptr<unsigned char>(i);
-            for (int j = 0; j < cols; j++)
-            {
-                *(ptrDst++) = ptrLUT[*(ptrSrc++)];
-                *(ptrDst++) = ptrLUT[*(ptrSrc++)];
-                *(ptrDst++) = ptrLUT[*(ptrSrc++)];
-            }
-        }
-    }
+    applyLUTs(src, dst, &ptrLUT, 1, mask);
 }
 
 void transform(const cv::Mat& src, cv::Mat& dst, const std::vector<std::vector<unsigned char> >& luts, const cv::Mat& mask)
@@ -298,52 +225,7 @@ void transform(const cv::Mat& src, cv::Mat& dst, const std::vector<std::vector<u
         luts[0].size() == 256 && luts[1].size() == 256 && luts[2].size() == 256 &&
         (!mask.data || (mask.data && src.size() == mask.size())));
 
-    dst.create(src.size(), src.type());
-
-    const unsigned char* ptrLUT0 = &luts[0][0];
-    const unsigned char* ptrLUT1 = &luts[1][0];
-    const unsigned char* ptrLUT2 = &luts[2][0];
-
-    int rows = src.rows, cols = src.cols;
-
-    if (mask.data)
-    {
-        for (int i = 0; i < rows; i++)
-        {
-            const unsigned char* ptrMask = mask.ptr<unsigned char>(i);
-            const unsigned char* ptrSrc = src.ptr<unsigned char>(i);
-            unsigned char* ptrDst = dst.ptr<unsigned char>(i);
-            for (int j = 0; j < cols; j++)
-            {
-                if (*(ptrMask++))
-                {
-                    *(ptrDst++) = ptrLUT0[ptrSrc[j * 3]];
-                    *(ptrDst++) = ptrLUT1[ptrSrc[j * 3 + 1]];
-                    *(ptrDst++) = ptrLUT2[ptrSrc[j * 3 + 2]];
-                }
-                else
-                {
-                    *(ptrDst++) = 0;
-                    *(ptrDst++) = 0;
-                    *(ptrDst++) = 0;
-                }
-            }
-        }
-    }
-    else
-    {
-        for (int i = 0; i < rows; i++)
-        {
-            const unsigned char* ptrSrc = src.ptr<unsigned char>(i);
-            unsigned char* ptrDst = dst.ptr<unsigned char>(i);
-            for (int j = 0; j < cols; j++)
-            {
-                *(ptrDst++) = ptrLUT0[*(ptrSrc++)];
-                *(ptrDst++) = ptrLUT1[*(ptrSrc++)];
-                *(ptrDst++) = ptrLUT2[*(ptrSrc++)];
-            }
-        }
-    }
+    applyLUTs(src, dst, luts, mask);
 }
 
 bool MultibandBlendGainAdjust::prepare(const std::vector<cv::Mat>& masks, int radius)
@@ -466,11 +348,12 @@ bool MultibandBlendGainAdjust::calcGain(const std::vector<cv::Mat>& images, std:
         // IMPORTANT!!!
         // Only if the valPairs have a large intensity expanding range 
         // can we use RANSAC, otherwise the estimated line would be rather inaccurate!
+        int numInliers = 0;
         if (blendExpandCount > 128 && imageExpandCount > 128)
-            getLineRANSAC(valPairs, p, dir);
+            numInliers = getLineRANSAC(valPairs, p, dir);
         // If the slope does not close to 1, the result also may be inaccurate!
         double slope = abs(dir.x) < 0.00001 ? (dir.x * dir.y > 0 ? 100000 : -1000000) : dir.y / dir.x;
-        if (!(blendExpandCount > 128 && imageExpandCount > 128) || slope < 0.5 || slope > 2)
+        if (numInliers < 2 || slope < 0.5 || slope > 2)
         {
             cv::Mat line;
             cv::fitLine(valPairs, line, CV_DIST_L2, 0, 0, 0);
@@ -0,0 +1,527 @@
+#include "GridMaxFlow.h"
+#include "gcgraph.hpp"
+#include <algorithm>
+#include <climits>
+
+GCGraphMaxFlow::GCGraphMaxFlow() : rows(0), cols(0), horiWrap(false)
+{
+}
+
+GCGraphMaxFlow::~GCGraphMaxFlow()
+{
+}
+
+void GCGraphMaxFlow::create(int rows_, int cols_, bool horiWrap_, const cv::Mat& active)
+{
+    CV_Assert(rows_ > 0 && cols_ > 0);
+    CV_Assert(!active.data || (active.type() == CV_8UC1 && active.rows == rows_ && active.cols == cols_));
+
+    rows = rows_;
+    cols = cols_;
+    horiWrap = horiWrap_;
+    index.create(rows, cols, CV_32SC1);
+    int count = 0;
+    for (int i = 0; i < rows; i++)
+    {
+        const unsigned char* ptrActive = active.data ? active.ptr<unsigned char>(i) : 0;
+        int* ptrIndex = index.ptr<int>(i);
+        for (int j = 0; j < cols; j++)
+            ptrIndex[j] = (!ptrActive || ptrActive[j]) ? (count++) : -1;
+    }
+    graph.reset(new GCGraph<float>(count, 2 * count));
+    for (int i = 0; i < count; i++)
+        graph->addVtx();
+}
+
+void GCGraphMaxFlow::addTermWeights(int y, int x, float sourceWeight, float sinkWeight)
+{
+    int v = index.at<int>(y, x);
+    if (v >= 0)
+        graph->addTermWeights(v, sourceWeight, sinkWeight);
+}
+
+void GCGraphMaxFlow::addRightEdge(int y, int x, float weight)
+{
+    int x1 = x + 1;
+    if (x1 == cols)
+    {
+        if (!horiWrap)
+            return;
+        x1 = 0;
+    }
+    int v = index.at<int>(y, x), u = index.at<int>(y, x1);
+    if (v >= 0 && u >= 0 && v != u)
+        graph->addEdges(v, u, weight, weight);
+}
+
+void GCGraphMaxFlow::addDownEdge(int y, int x, float weight)
+{
+    if (y + 1 == rows)
+        return;
+    int v = index.at<int>(y, x), u = index.at<int>(y + 1, x);
+    if (v >= 0 && u >= 0)
+        graph->addEdges(v, u, weight, weight);
+}
+
+float GCGraphMaxFlow::maxFlow()
+{
+    return graph->maxFlow();
+}
+
+bool GCGraphMaxFlow::inSourceSegment(int y, int x) const
+{
+    int v = index.at<int>(y, x);
+    return v >= 0 && graph->inSourceSegment(v);
+}
+
+// Values of parent, a direction d is stored as d + 1 and points from the vertex to its parent.
+enum { NO_PARENT = 0, TERMINAL = 5, ORPHAN = 6 };
+
+void GridBKMaxFlow::create(int rows_, int cols_, bool horiWrap_, const cv::Mat& active_)
+{
+    CV_Assert(rows_ > 0 && cols_ > 0);
+    CV_Assert(!active_.data || (active_.type() == CV_8UC1 && active_.rows == rows_ && active_.cols == cols_));
+
+    rows = rows_;
+    cols = cols_;
+    flow = 0;
+
+    // Bounding rect of the active vertices
+    left = 0, top = 0, width = cols, height = rows;
+    if (active_.data)
+    {
+        int xBeg = cols, xEnd = 0, yBeg = rows, yEnd = 0;
+        for (int i = 0; i < rows; i++)
+        {
+            const unsigned char* ptrActive = active_.ptr<unsigned char>(i);
+            int j = 0;
+            while (j < cols && !ptrActive[j])
+                j++;
+            if (j == cols)
+                continue;
+            int k = cols - 1;
+            while (!ptrActive[k])
+                k--;
+            xBeg = std::min(xBeg, j);
+            xEnd = std::max(xEnd, k + 1);
+            yBeg = std::min(yBeg, i);
+            yEnd = i + 1;
+        }
+        if (xBeg < xEnd)
+            left = xBeg, top = yBeg, width = xEnd - xBeg, height = yEnd - yBeg;
+        else
+            width = height = 0;
+    }
+    // The wrap around edge links the first and the last column, one of them
+    // is out of the bounding rect unless it spans the full width.
+    horiWrap = horiWrap_ && width == cols;
+
+    int size = width * height;
+    active.resize(size);
+    if (active_.data)
+    {
+        for (int i = 0; i < height; i++)
+        {
+            const unsigned char* ptrActive = active_.ptr<unsigned char>(top + i) + left;
+            unsigned char* ptrDst = &active[i * width];
+            for (int j = 0; j < width; j++)
+                ptrDst[j] = ptrActive[j] ? 1 : 0;
+        }
+    }
+    else
+        std::fill(active.begin(), active.end(), 1);
+    termWeight.assign(size, 0.F);
+    for (int i = 0; i < 4; i++)
+        capacity[i].assign(size, 0.F);
+    parent.assign(size, NO_PARENT);
+    tree.assign(size, 0);
+    timeStamp.assign(size, 0);
+    dist.assign(size, 0);
+    next.assign(size, -1);
+    orphans.clear();
+}
+
+void GridBKMaxFlow::release()
+{
+    rows = cols = 0;
+    left = top = width = height = 0;
+    flow = 0;
+    std::vector<unsigned char>().swap(active);
+    std::vector<float>().swap(termWeight);
+    for (int i = 0; i < 4; i++)
+        std::vector<float>().swap(capacity[i]);
+    std::vector<unsigned char>().swap(parent);
+    std::vector<unsigned char>().swap(tree);
+    std::vector<int>().swap(timeStamp);
+    std::vector<int>().swap(dist);
+    std::vector<int>().swap(next);
+    std::vector<int>().swap(orphans);
+}
+
+size_t GridBKMaxFlow::getMemorySize() const
+{
+    size_t size = active.capacity() + parent.capacity() + tree.capacity() +
+        termWeight.capacity() * sizeof(float) +
+        (timeStamp.capacity() + dist.capacity() + next.capacity() + orphans.capacity()) * sizeof(int);
+    for (int i = 0; i < 4; i++)
+        size += capacity[i].capacity() * sizeof(float);
+    return size;
+}
+
+// Index of the vertex at (y, x) of the grid, -1 if the vertex is not active.
+inline int GridBKMaxFlow::vertex(int y, int x) const
+{
+    x -= left;
+    y -= top;
+    if (x < 0 || y < 0 || x >= width || y >= height)
+        return -1;
+    int v = y * width + x;
+    return active[v] ? v : -1;
+}
+
+void GridBKMaxFlow::addTermWeights(int y, int x, float sourceWeight, float sinkWeight)
+{
+    int v = vertex(y, x);
+    if (v < 0)
+        return;
+
+    float dw = termWeight[v];
+    if (dw > 0)
+        sourceWeight += dw;
+    else
+        sinkWeight -= dw;
+    flow += std::min(sourceWeight, sinkWeight);
+    termWeight[v] = sourceWeight - sinkWeight;
+}
+
+void GridBKMaxFlow::addRightEdge(int y, int x, float weight)
+{
+    CV_DbgAssert(weight >= 0);
+    int x1 = x + 1;
+    if (x1 == cols)
+    {
+        if (!horiWrap)
+            return;
+        x1 = 0;
+    }
+    int v = vertex(y, x), u = vertex(y, x1);
+    if (v >= 0 && u >= 0 && u != v)
+    {
+        capacity[RIGHT][v] += weight;
+        capacity[LEFT][u] += weight;
+    }
+}
+
+void GridBKMaxFlow::addDownEdge(int y, int x, float weight)
+{
+    CV_DbgAssert(weight >= 0);
+    if (y + 1 == rows)
+        return;
+    int v = vertex(y, x), u = vertex(y + 1, x);
+    if (v >= 0 && u >= 0)
+    {
+        capacity[DOWN][v] += weight;
+        capacity[UP][u] += weight;
+    }
+}
+
+bool GridBKMaxFlow::inSourceSegment(int y, int x) const
+{
+    int v = vertex(y, x);
+    return v >= 0 && tree[v] == 0;
+}
+
+inline int GridBKMaxFlow::neighbour(int v, int dir) const
+{
+    int y = v / width, x = v - y * width;
+    switch (dir)
+    {
+    case RIGHT:
+        return x < width - 1 ? v + 1 : (horiWrap ? v - width + 1 : -1);
+    case LEFT:
+        return x > 0 ? v - 1 : (horiWrap ? v + width - 1 : -1);
+    case DOWN:
+        return y < height - 1 ? v + width : -1;
+    default:
+        return y > 0 ? v - width : -1;
+    }
+}
+
+inline void GridBKMaxFlow::neighbours(int v, int* nbrs) const
+{
+    int y = v / width, x = v - y * width;
+    nbrs[RIGHT] = x < width - 1 ? v + 1 : (horiWrap ? v - width + 1 : -1);
+    nbrs[LEFT] = x > 0 ? v - 1 : (horiWrap ? v + width - 1 : -1);
+    nbrs[DOWN] = y < height - 1 ? v + width : -1;
+    nbrs[UP] = y > 0 ? v - width : -1;
+}
+
+inline void GridBKMaxFlow::pushActive(int v)
+{
+    if (next[v] != -1)
+        return;
+    next[v] = INT_MAX;
+    if (first < 0)
+        first = v;
+    else
+        next[last] = v;
+    last = v;
+}
+
+// The same algorithm as GCGraph::maxFlow, edge ei of GCGraph corresponds to
+// the pair of a vertex and a direction, and edge ei ^ 1 to the neighbour and the opposite direction.
+float GridBKMaxFlow::maxFlow()
+{
+    int size = width * height;
+    int currTimeStamp = 0;
+    first = last = -1;
+
+    // initialize the active queue and the graph vertices
+    for (int v = 0; v < size; v++)
+    {
+        timeStamp[v] = 0;
+        if (termWeight[v] != 0)
+        {
+            pushActive(v);
+            dist[v] = 1;
+            parent[v] = TERMINAL;
+            tree[v] = termWeight[v] < 0;
+        }
+        else
+            parent[v] = NO_PARENT;
+    }
+
+    // run the search-path -> augment-graph -> restore-trees loop
+    for (;;)
+    {
+        // the path edge goes from vertex sourceSide in direction pathDir to vertex sinkSide
+        int sourceSide = -1, sinkSide = -1, pathDir = -1;
+
+        // grow S & T search trees, find an edge connecting them
+        while (first >= 0)
+        {
+            int v = first;
+            if (parent[v] != NO_PARENT)
+            {
+                int vt = tree[v];
+                int nbrs[4];
+                neighbours(v, nbrs);
+                for (int d = 0; d < 4; d++)
+                {
+                    int u = nbrs[d];
+                    if (u < 0)
+                        continue;
+                    float cap = vt ? capacity[d ^ 1][u] : capacity[d][v];
+                    if (cap == 0)
+                        continue;
+                    if (parent[u] == NO_PARENT)
+                    {
+                        tree[u] = vt;
+                        parent[u] = (d ^ 1) + 1;
+                        timeStamp[u] = timeStamp[v];
+                        dist[u] = dist[v] + 1;
+                        pushActive(u);
+                        continue;
+                    }
+
+                    if (tree[u] != vt)
+                    {
+                        if (vt)
+                        {
+                            sourceSide = u;
+                            sinkSide = v;
+                            pathDir = d ^ 1;
+                        }
+                        else
+                        {
+                            sourceSide = v;
+                            sinkSide = u;
+                            pathDir = d;
+                        }
+                        break;
+                    }
+
+                    if (dist[u] > dist[v] + 1 && timeStamp[u] <= timeStamp[v])
+                    {
+                        // reassign the parent
+                        parent[u] = (d ^ 1) + 1;
+                        timeStamp[u] = timeStamp[v];
+                        dist[u] = dist[v] + 1;
+                    }
+                }
+                if (pathDir >= 0)
+                    break;
+            }
+            // exclude the vertex from the active list
+            first = next[v];
+            if (first == INT_MAX)
+                first = last = -1;
+            next[v] = -1;
+        }
+
+        if (pathDir < 0)
+            break;
+
+        // find the minimum edge weight along the path
+        float minWeight = capacity[pathDir][sourceSide];
+        // k = 1: source tree, k = 0: destination tree
+        for (int k = 1; k >= 0; k--)
+        {
+            int v = k ? sourceSide : sinkSide;
+            for (;;)
+            {
+                int pd = parent[v];
+                if (pd == TERMINAL || pd == ORPHAN)
+                    break;
+                pd--;
+                int p = neighbour(v, pd);
+                minWeight = std::min(minWeight, k ? capacity[pd ^ 1][p] : capacity[pd][v]);
+                v = p;
+            }
+            minWeight = std::min(minWeight, std::abs(termWeight[v]));
+        }
+
+        // modify weights of the edges along the path and collect orphans
+        capacity[pathDir][sourceSide] -= minWeight;
+        capacity[pathDir ^ 1][sinkSide] += minWeight;
+        flow += minWeight;
+
+        // k = 1: source tree, k = 0: destination tree
+        for (int k = 1; k >= 0; k--)
+        {
+            int v = k ? sourceSide : sinkSide;
+            for (;;)
+            {
+                int pd = parent[v];
+                if (pd == TERMINAL || pd == ORPHAN)
+                    break;
+                pd--;
+                int p = neighbour(v, pd);
+                float& capToChild = capacity[pd ^ 1][p];
+                float& capToParent = capacity[pd][v];
+                if (k)
+                {
+                    capToParent += minWeight;
+                    capToChild -= minWeight;
+                    if (capToChild == 0)
+                    {
+                        orphans.push_back(v);
+                        parent[v] = ORPHAN;
+                    }
+                }
+                else
+                {
+                    capToChild += minWeight;
+                    capToParent -= minWeight;
+                    if (capToParent == 0)
+                    {
+                        orphans.push_back(v);
+                        parent[v] = ORPHAN;
+                    }
+                }
+                v = p;
+            }
+
+            termWeight[v] += minWeight * (1 - k * 2);
+            if (termWeight[v] == 0)
+            {
+                orphans.push_back(v);
+                parent[v] = ORPHAN;
+            }
+        }
+
+        // restore the search trees by finding new parents for the orphans
+        currTimeStamp++;
+        while (!orphans.empty())
+        {
+            int v = orphans.back();
+            orphans.pop_back();
+
+            int minDist = INT_MAX, bestDir = -1;
+            int vt = tree[v];
+            int nbrs[4];
+            neighbours(v, nbrs);
+
+            for (int d = 0; d < 4; d++)
+            {
+                int u = nbrs[d];
+                if (u < 0)
+                    continue;
+                float cap = vt ? capacity[d][v] : capacity[d ^ 1][u];
+                if (cap == 0)
+                    continue;
+                if (tree[u] != vt || parent[u] == NO_PARENT)
+                    continue;
+                // compute the distance to the tree root
+                int dd = 0;
+                for (int w = u;;)
+                {
+                    if (timeStamp[w] == currTimeStamp)
+                    {
+                        dd += dist[w];
+                        break;
+                    }
+                    int pw = parent[w];
+                    dd++;
+                    if (pw == TERMINAL)
+                    {
+                        timeStamp[w] = currTimeStamp;
+                        dist[w] = 1;
+                        break;
+                    }
+                    if (pw == ORPHAN)
+                    {
+                        dd = INT_MAX - 1;
+                        break;
+                    }
+                    w = neighbour(w, pw - 1);
+                }
+
+                // update the distance
+                if (++dd < INT_MAX)
+                {
+                    if (dd < minDist)
+                    {
+                        minDist = dd;
+                        bestDir = d;
+                    }
+                    for (int w = u; timeStamp[w] != currTimeStamp; w = neighbour(w, parent[w] - 1))
+                    {
+                        timeStamp[w] = currTimeStamp;
+                        dist[w] = --dd;
+                    }
+                }
+            }
+
+            if (bestDir >= 0)
+            {
+                parent[v] = bestDir + 1;
+                timeStamp[v] = currTimeStamp;
+                dist[v] = minDist;
+                continue;
+            }
+
+            // no parent is found
+            parent[v] = NO_PARENT;
+            timeStamp[v] = 0;
+            for (int d = 0; d < 4; d++)
+            {
+                int u = nbrs[d];
+                if (u < 0)
+                    continue;
+                int pu = parent[u];
+                if (tree[u] != vt || pu == NO_PARENT)
+                    continue;
+                float cap = vt ? capacity[d][v] : capacity[d ^ 1][u];
+                if (cap != 0)
+                    pushActive(u);
+                if (pu != TERMINAL && pu != ORPHAN && neighbour(u, pu - 1) == v)
+                {
+                    orphans.push_back(u);
+                    parent[u] = ORPHAN;
+                }
+            }
+        }
+    }
+    return flow;
+}
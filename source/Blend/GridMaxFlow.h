@@ -0,0 +1,88 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include <vector>
+#include <memory>
+
+template <class TWeight> class GCGraph;
+
+// Max-flow solver interface of the graphcut seam functions.
+// Vertices form a rows x cols grid, each vertex is linked to its right and its bottom neighbour.
+// If horiWrap is true, the right neighbour of a vertex in the last column is the vertex
+// in the first column of the same row. Only vertices marked non zero in active take part
+// in the graph, edges linked to inactive vertices are ignored. If active is empty,
+// all the vertices are active. Edge weights are symmetric.
+class GridMaxFlow
+{
+public:
+    virtual ~GridMaxFlow() {}
+    // active should be empty or of type CV_8UC1 and size rows x cols.
+    virtual void create(int rows, int cols, bool horiWrap, const cv::Mat& active) = 0;
+    virtual void addTermWeights(int y, int x, float sourceWeight, float sinkWeight) = 0;
+    virtual void addRightEdge(int y, int x, float weight) = 0;
+    virtual void addDownEdge(int y, int x, float weight) = 0;
+    virtual float maxFlow() = 0;
+    virtual bool inSourceSegment(int y, int x) const = 0;
+};
+
+// GridMaxFlow on top of GCGraph, a new GCGraph is allocated in every call of create.
+class GCGraphMaxFlow : public GridMaxFlow
+{
+public:
+    GCGraphMaxFlow();
+    ~GCGraphMaxFlow();
+    void create(int rows, int cols, bool horiWrap, const cv::Mat& active);
+    void addTermWeights(int y, int x, float sourceWeight, float sinkWeight);
+    void addRightEdge(int y, int x, float weight);
+    void addDownEdge(int y, int x, float weight);
+    float maxFlow();
+    bool inSourceSegment(int y, int x) const;
+private:
+    std::unique_ptr<GCGraph<float> > graph;
+    cv::Mat index;
+    int rows, cols;
+    bool horiWrap;
+};
+
+// Boykov-Kolmogorov max-flow specialized for the grid. Edges are implicit, the neighbours
+// of a vertex are computed from its position. Residual capacities and search tree states
+// are kept in separate arrays indexed by vertex, one capacity array per direction.
+// Only the bounding rect of the active vertices is stored and searched, so a thin band
+// of active vertices costs memory and time in proportion to its bounding rect, not the grid.
+// The arrays are reused by later calls of create, they only grow until release is called.
+class GridBKMaxFlow : public GridMaxFlow
+{
+public:
+    GridBKMaxFlow() : rows(0), cols(0), left(0), top(0), width(0), height(0), horiWrap(false), flow(0) {}
+    void create(int rows, int cols, bool horiWrap, const cv::Mat& active);
+    void addTermWeights(int y, int x, float sourceWeight, float sinkWeight);
+    void addRightEdge(int y, int x, float weight);
+    void addDownEdge(int y, int x, float weight);
+    float maxFlow();
+    bool inSourceSegment(int y, int x) const;
+    // Frees the arrays, create allocates them again.
+    void release();
+    // Bytes allocated for the arrays.
+    size_t getMemorySize() const;
+private:
+    enum { RIGHT = 0, LEFT = 1, DOWN = 2, UP = 3 };
+    int vertex(int y, int x) const;
+    int neighbour(int v, int dir) const;
+    void neighbours(int v, int* nbrs) const;
+    void pushActive(int v);
+
+    // rows and cols are the size of the grid, the vertices are stored for the width x height
+    // bounding rect of the active vertices whose top left corner is (left, top) in the grid.
+    // horiWrap is only kept if the bounding rect spans the full width.
+    int rows, cols;
+    int left, top, width, height;
+    bool horiWrap;
+    float flow;
+    std::vector<unsigned char> active;
+    std::vector<float> termWeight;
+    std::vector<float> capacity[4];
+    std::vector<unsigned char> parent, tree;
+    std::vector<int> timeStamp, dist, next;
+    std::vector<int> orphans;
+    int first, last;
+};
@@ -0,0 +1,221 @@
+#include "LookUpTable.h"
+#include <immintrin.h>
+
+// The tables of all the channels are expanded to one int table, the entry of value v
+// in channel c is at c * 256 + v. The AVX2 kernels widen 8 bytes to 32 bit lanes,
+// add the channel offset of every lane and gather 8 entries at once. 8 pixels of 3 channels
+// take 3 gathers, 8 pixels of 4 channels or 32 pixels of 1 channel take 4 gathers,
+// so the channel offsets of the lanes are the same for every iteration.
+// Row ends shorter than one iteration are left to the scalar code.
+
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+static int lutUseSIMD = 1;
+
+void setLUTUseSIMD(bool useSIMD)
+{
+    lutUseSIMD = useSIMD;
+}
+
+static inline bool lutUseAVX2()
+{
+    return lutUseSIMD && cv::checkHardwareSupport(CV_CPU_AVX2);
+}
+
+TARGET_AVX2 static inline __m256i gatherLUT8(const int* table, const unsigned char* src, __m256i offsets)
+{
+    __m256i index = _mm256_add_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)src)), offsets);
+    return _mm256_i32gather_epi32(table, index, 4);
+}
+
+// Packs the 8 bit values in 32 bit lanes of a, b, c and d to bytes in the order a, b, c, d.
+TARGET_AVX2 static inline __m256i packLUT8x4(__m256i a, __m256i b, __m256i c, __m256i d)
+{
+    __m256i val = _mm256_packus_epi16(_mm256_packus_epi32(a, b), _mm256_packus_epi32(c, d));
+    return _mm256_permutevar8x32_epi32(val, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+// Returns the number of pixels processed.
+TARGET_AVX2 static int applyLUTsRowAVX2_3(const unsigned char* src, unsigned char* dst, int width, const int* table)
+{
+    const __m256i offsets0 = _mm256_setr_epi32(0, 256, 512, 0, 256, 512, 0, 256);
+    const __m256i offsets1 = _mm256_setr_epi32(512, 0, 256, 512, 0, 256, 512, 0);
+    const __m256i offsets2 = _mm256_setr_epi32(256, 512, 0, 256, 512, 0, 256, 512);
+    int x = 0;
+    for (; x <= width - 8; x += 8)
+    {
+        __m256i a = gatherLUT8(table, src + x * 3, offsets0);
+        __m256i b = gatherLUT8(table, src + x * 3 + 8, offsets1);
+        __m256i c = gatherLUT8(table, src + x * 3 + 16, offsets2);
+        __m256i val = packLUT8x4(a, b, c, c);
+        _mm_storeu_si128((__m128i*)(dst + x * 3), _mm256_castsi256_si128(val));
+        _mm_storel_epi64((__m128i*)(dst + x * 3 + 16), _mm256_extracti128_si256(val, 1));
+    }
+    return x;
+}
+
+// Processes 32 bytes per iteration, offsets holds the channel offsets of 8 consecutive bytes.
+// Returns the number of bytes processed.
+TARGET_AVX2 static int applyLUTsRowAVX2_32(const unsigned char* src, unsigned char* dst, int length,
+    const int* table, const __m256i& offsets)
+{
+    int x = 0;
+    for (; x <= length - 32; x += 32)
+    {
+        __m256i a = gatherLUT8(table, src + x, offsets);
+        __m256i b = gatherLUT8(table, src + x + 8, offsets);
+        __m256i c = gatherLUT8(table, src + x + 16, offsets);
+        __m256i d = gatherLUT8(table, src + x + 24, offsets);
+        _mm256_storeu_si256((__m256i*)(dst + x), packLUT8x4(a, b, c, d));
+    }
+    return x;
+}
+
+TARGET_AVX2 static int applyLUTsRowAVX2_1(const unsigned char* src, unsigned char* dst, int width, const int* table)
+{
+    return applyLUTsRowAVX2_32(src, dst, width, table, _mm256_setzero_si256());
+}
+
+TARGET_AVX2 static int applyLUTsRowAVX2_4(const unsigned char* src, unsigned char* dst, int width, const int* table)
+{
+    return applyLUTsRowAVX2_32(src, dst, width * 4, table, _mm256_setr_epi32(0, 256, 512, 768, 0, 256, 512, 768)) / 4;
+}
+
+class ApplyLUTsLoop : public cv::ParallelLoopBody
+{
+public:
+    ApplyLUTsLoop(const cv::Mat& src_, cv::Mat& dst_, const cv::Mat& mask_,
+        const unsigned char* const* luts_, const int* table_, bool useAVX2_)
+        : src(src_), dst(dst_), mask(mask_), luts(luts_), table(table_), useAVX2(useAVX2_)
+    {}
+
+    virtual ~ApplyLUTsLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        int cols = src.cols, cn = src.channels();
+        for (int i = r.start; i < r.end; i++)
+        {
+            const unsigned char* ptrSrc = src.ptr<unsigned char>(i);
+            unsigned char* ptrDst = dst.ptr<unsigned char>(i);
+            int j = 0;
+            if (cn == 1)
+            {
+                if (useAVX2)
+                    j = applyLUTsRowAVX2_1(ptrSrc, ptrDst, cols, table);
+                const unsigned char* lut = luts[0];
+                for (; j < cols; j++)
+                    ptrDst[j] = lut[ptrSrc[j]];
+            }
+            else if (cn == 3)
+            {
+                if (useAVX2)
+                    j = applyLUTsRowAVX2_3(ptrSrc, ptrDst, cols, table);
+                const unsigned char* lut0 = luts[0], *lut1 = luts[1], *lut2 = luts[2];
+                for (; j < cols; j++)
+                {
+                    ptrDst[j * 3] = lut0[ptrSrc[j * 3]];
+                    ptrDst[j * 3 + 1] = lut1[ptrSrc[j * 3 + 1]];
+                    ptrDst[j * 3 + 2] = lut2[ptrSrc[j * 3 + 2]];
+                }
+            }
+            else
+            {
+                if (useAVX2)
+                    j = applyLUTsRowAVX2_4(ptrSrc, ptrDst, cols, table);
+                const unsigned char* lut0 = luts[0], *lut1 = luts[1], *lut2 = luts[2], *lut3 = luts[3];
+                for (; j < cols; j++)
+                {
+                    ptrDst[j * 4] = lut0[ptrSrc[j * 4]];
+                    ptrDst[j * 4 + 1] = lut1[ptrSrc[j * 4 + 1]];
+                    ptrDst[j * 4 + 2] = lut2[ptrSrc[j * 4 + 2]];
+                    ptrDst[j * 4 + 3] = lut3[ptrSrc[j * 4 + 3]];
+                }
+            }
+
+            if (mask.data)
+            {
+                const unsigned char* ptrMask = mask.ptr<unsigned char>(i);
+                for (j = 0; j < cols; j++)
+                {
+                    if (!ptrMask[j])
+                    {
+                        for (int k = 0; k < cn; k++)
+                            ptrDst[j * cn + k] = 0;
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    const cv::Mat& src;
+    cv::Mat& dst;
+    const cv::Mat& mask;
+    const unsigned char* const* luts;
+    const int* table;
+    bool useAVX2;
+};
+
+void applyLUTs(const cv::Mat& src, cv::Mat& dst, const unsigned char* const* luts, int numLUTs, const cv::Mat& mask)
+{
+    int cn = src.channels();
+    CV_Assert(src.data && src.depth() == CV_8U && (cn == 1 || cn == 3 || cn == 4));
+    CV_Assert(luts && (numLUTs == 1 || numLUTs == cn || (cn == 4 && numLUTs == 3)));
+    CV_Assert(!mask.data || (mask.type() == CV_8UC1 && mask.size() == src.size()));
+
+    unsigned char identity[256];
+    const unsigned char* channelLUTs[4];
+    for (int k = 0; k < cn; k++)
+    {
+        if (k < numLUTs)
+            channelLUTs[k] = luts[k];
+        else if (numLUTs == 1)
+            channelLUTs[k] = luts[0];
+        else
+        {
+            for (int v = 0; v < 256; v++)
+                identity[v] = v;
+            channelLUTs[k] = identity;
+        }
+    }
+
+    bool useAVX2 = lutUseAVX2();
+    int table[4 * 256];
+    if (useAVX2)
+    {
+        for (int k = 0; k < cn; k++)
+        {
+            for (int v = 0; v < 256; v++)
+                table[k * 256 + v] = channelLUTs[k][v];
+        }
+    }
+
+    // Keep src valid if dst is src and gets reallocated
+    cv::Mat source = src;
+    cv::Mat maskSource = mask;
+    dst.create(source.size(), source.type());
+
+    ApplyLUTsLoop loop(source, dst, maskSource, channelLUTs, table, useAVX2);
+    if (source.total() * cn >= 256 * 256)
+        cv::parallel_for_(cv::Range(0, source.rows), loop, source.total() * cn / (128 * 128));
+    else
+        loop(cv::Range(0, source.rows));
+}
+
+void applyLUTs(const cv::Mat& src, cv::Mat& dst, const std::vector<std::vector<unsigned char> >& luts, const cv::Mat& mask)
+{
+    int numLUTs = luts.size();
+    CV_Assert(numLUTs >= 1 && numLUTs <= 4);
+    const unsigned char* ptrLUTs[4];
+    for (int i = 0; i < numLUTs; i++)
+    {
+        CV_Assert(luts[i].size() == 256);
+        ptrLUTs[i] = luts[i].data();
+    }
+    applyLUTs(src, dst, ptrLUTs, numLUTs, mask);
+}
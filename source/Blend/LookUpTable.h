@@ -0,0 +1,22 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include <vector>
+
+// Look up table application shared by the color correction functions.
+// src should be of type CV_8UC1, CV_8UC3 or CV_8UC4, dst is created with the same size and type,
+// src and dst may be the same Mat. luts holds numLUTs tables of 256 entries.
+// If numLUTs is 1, the table is applied to all the channels, otherwise numLUTs should equal
+// the number of channels, or be 3 for CV_8UC4, in which case the alpha channel is copied.
+// If mask is not empty, it should be of type CV_8UC1 and the same size as src,
+// pixels where mask is zero are set to zero in dst.
+// Large images are processed by row bands in parallel.
+void applyLUTs(const cv::Mat& src, cv::Mat& dst, const unsigned char* const* luts, int numLUTs,
+    const cv::Mat& mask = cv::Mat());
+
+void applyLUTs(const cv::Mat& src, cv::Mat& dst, const std::vector<std::vector<unsigned char> >& luts,
+    const cv::Mat& mask = cv::Mat());
+
+// Enables or disables the AVX2 gather kernels of applyLUTs. They are enabled by default
+// and only used if the cpu supports AVX2.
+void setLUTUseSIMD(bool useSIMD);
@@ -729,23 +729,21 @@ static void setAlpha16SAccordingToAlpha32S(const cv::Mat& alpha32S, cv::Mat& alp
     }
 }
 
-static void calcDstImage(const cv::Mat& srcImage32S, const cv::Mat& srcAlpha32S, cv::Mat& dstImage)
+template<typename AlphaElemType, int alphaShift>
+static void calcDstImage_(const cv::Mat& srcImage32S, const cv::Mat& srcAlpha, cv::Mat& dstImage)
 {
-    CV_Assert(srcImage32S.data && srcImage32S.type() == CV_32SC3 &&
-        srcAlpha32S.data && srcAlpha32S.type() == CV_32SC1 &&
-        srcImage32S.size() == srcAlpha32S.size());
     int rows = srcImage32S.rows, cols = srcImage32S.cols;
     dstImage.create(rows, cols, CV_16SC3);
     for (int i = 0; i < rows; i++)
     {
         const int* ptrSrcImage = srcImage32S.ptr<int>(i);
-        const int* ptrSrcAlpha = srcAlpha32S.ptr<int>(i);
+        const AlphaElemType* ptrSrcAlpha = srcAlpha.ptr<AlphaElemType>(i);
         short* ptrDstImage = dstImage.ptr<short>(i);
         for (int j = 0; j < cols; j++)
         {
             if (*ptrSrcAlpha)
             {
-                int alpha = *ptrSrcAlpha, halfAlpha = alpha >> 1;
+                int alpha = int(*ptrSrcAlpha) << alphaShift, halfAlpha = alpha >> 1;
                 int val0, val1, val2;
                 val0 = ((ptrSrcImage[0] << 8) - ptrSrcImage[0]/* + halfAlpha*/) / alpha;
                 val1 = ((ptrSrcImage[1] << 8) - ptrSrcImage[1]/* + halfAlpha*/) / alpha;
@@ -767,6 +765,19 @@ static void calcDstImage(const cv::Mat& srcImage32S, const cv::Mat& srcAlpha32S,
     }
 }
 
+// srcAlpha32S is either the 32SC1 alpha computed by pyramidDownTo32S, or a 16SC1 alpha holding 
+// the 32SC1 alpha divided by 256, which is exact since the alpha is downsampled from 0 or 256.
+static void calcDstImage(const cv::Mat& srcImage32S, const cv::Mat& srcAlpha32S, cv::Mat& dstImage)
+{
+    CV_Assert(srcImage32S.data && srcImage32S.type() == CV_32SC3 &&
+        srcAlpha32S.data && (srcAlpha32S.type() == CV_32SC1 || srcAlpha32S.type() == CV_16SC1) &&
+        srcImage32S.size() == srcAlpha32S.size());
+    if (srcAlpha32S.type() == CV_32SC1)
+        calcDstImage_<int, 0>(srcImage32S, srcAlpha32S, dstImage);
+    else
+        calcDstImage_<short, 8>(srcImage32S, srcAlpha32S, dstImage);
+}
+
 void restoreImageFromLaplacePyramid(std::vector<cv::Mat>& pyr, bool horiWrap, std::vector<cv::Mat>& upPyr)
 {
     if (pyr.empty())
@@ -984,6 +995,166 @@ bool TilingMultibandBlendFast::prepare(const std::vector<cv::Mat>& masks, int ma
     return true;
 }
 
+// Number of rows of level 0 processed together, should be even.
+// The working set of one strip of an 8K panorama is a few megabytes.
+static const int BLEND_STRIP_ROWS = 16;
+
+// Element type dependent constants of the accumulated result pyramid.
+// With int elements the weights of all the images sum to 256. With short elements the weights
+// sum to 128, so that the weighted Laplacian of 8 bit images, which lies in [-255, 255], 
+// still fits in short, and the accumulation saturates.
+template<typename AccumElemType>
+struct MultibandBlendAccum;
+
+template<>
+struct MultibandBlendAccum<int>
+{
+    enum { ACCUM_TYPE = CV_32SC3, WEIGHT_SUM_TYPE = CV_32SC1, WEIGHT_SHIFT = 8 };
+};
+
+template<>
+struct MultibandBlendAccum<short>
+{
+    enum { ACCUM_TYPE = CV_16SC3, WEIGHT_SUM_TYPE = CV_16SC1, WEIGHT_SHIFT = 7 };
+};
+
+// Adds the Laplacian of a row, src minus up, or src itself if up is null, weighted by weight to accum.
+// The Laplacian is saturated to short as cv::subtract does.
+template<typename SrcElemType, typename AccumElemType>
+static void accumulateLaplaceRow(const SrcElemType* ptrSrc, const short* ptrUp, const short* ptrWeight, AccumElemType* ptrAccum, int cols)
+{
+    for (int x = 0; x < cols; x++)
+    {
+        int w = ptrWeight[x];
+        if (ptrUp)
+        {
+            ptrAccum[0] = cv::saturate_cast<AccumElemType>(ptrAccum[0] + cv::saturate_cast<short>(ptrSrc[0] - ptrUp[0]) * w);
+            ptrAccum[1] = cv::saturate_cast<AccumElemType>(ptrAccum[1] + cv::saturate_cast<short>(ptrSrc[1] - ptrUp[1]) * w);
+            ptrAccum[2] = cv::saturate_cast<AccumElemType>(ptrAccum[2] + cv::saturate_cast<short>(ptrSrc[2] - ptrUp[2]) * w);
+            ptrUp += 3;
+        }
+        else
+        {
+            ptrAccum[0] = cv::saturate_cast<AccumElemType>(ptrAccum[0] + ptrSrc[0] * w);
+            ptrAccum[1] = cv::saturate_cast<AccumElemType>(ptrAccum[1] + ptrSrc[1] * w);
+            ptrAccum[2] = cv::saturate_cast<AccumElemType>(ptrAccum[2] + ptrSrc[2] * w);
+        }
+        ptrSrc += 3;
+        ptrAccum += 3;
+    }
+}
+
+// Produces rows of the blended image strip by strip. For each strip, the Laplacian of level 0
+// of every image is computed from the image and the rows of level 1 around the strip, 
+// taken from imageLevel1s, the level 1 images of the Gauss pyramids computed before,
+// and accumulated into a strip sized buffer.
+// The accumulated result is normalized, added to the upsampled level 1 of the restored
+// result and converted to 8 bit. Full size level 0 pyramid images are never produced.
+// AccumElemType is the element type of the result pyramid and of the weight sums, see MultibandBlendAccum.
+template<typename AccumElemType>
+class MultibandBlendStripLoop : public cv::ParallelLoopBody
+{
+public:
+    MultibandBlendStripLoop(const std::vector<cv::Mat>& images_, const std::vector<cv::Mat>& imageLevel1s_,
+        const std::vector<std::vector<cv::Mat> >& weightPyrs_, const cv::Mat& resultWeight_, const cv::Mat& resultLevel1_,
+        const cv::Mat& maskNot_, bool fullMask_, int numLevels_, cv::Mat& blendImage_)
+        : images(images_), imageLevel1s(imageLevel1s_), weightPyrs(weightPyrs_), resultWeight(resultWeight_), 
+          resultLevel1(resultLevel1_), maskNot(maskNot_), fullMask(fullMask_), numLevels(numLevels_), blendImage(blendImage_)
+    {
+    }
+
+    virtual ~MultibandBlendStripLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        int rows = blendImage.rows, cols = blendImage.cols, numImages = images.size();
+        cv::Size size0(cols, rows), size1((cols + 1) / 2, (rows + 1) / 2);
+        cv::Mat up16S, upResult;
+        cv::Mat accum(BLEND_STRIP_ROWS, cols, MultibandBlendAccum<AccumElemType>::ACCUM_TYPE);
+        for (int s = r.start; s < r.end; s++)
+        {
+            int beg = s * BLEND_STRIP_ROWS, end = std::min(beg + BLEND_STRIP_ROWS, rows);
+            accum.setTo(0);
+            for (int i = 0; i < numImages; i++)
+            {
+                if (numLevels > 0)
+                    pyramidUpRows(imageLevel1s[i], size1, 0, up16S, size0, beg, end, cv::BORDER_WRAP);
+                bool is8U = images[i].depth() == CV_8U;
+                for (int y = beg; y < end; y++)
+                {
+                    const short* ptrWeight = weightPyrs[i][0].ptr<short>(y);
+                    const short* ptrUp = numLevels > 0 ? up16S.ptr<short>(y - beg) : 0;
+                    AccumElemType* ptrAccum = accum.ptr<AccumElemType>(y - beg);
+                    if (is8U)
+                        accumulateLaplaceRow(images[i].ptr<unsigned char>(y), ptrUp, ptrWeight, ptrAccum, cols);
+                    else
+                        accumulateLaplaceRow(images[i].ptr<short>(y), ptrUp, ptrWeight, ptrAccum, cols);
+                }
+            }
+
+            if (numLevels > 0)
+                pyramidUpRows(resultLevel1, size1, 0, upResult, size0, beg, end, cv::BORDER_WRAP);
+            for (int y = beg; y < end; y++)
+            {
+                const AccumElemType* ptrAccum = accum.ptr<AccumElemType>(y - beg);
+                const AccumElemType* ptrUp = numLevels > 0 ? upResult.ptr<AccumElemType>(y - beg) : 0;
+                const AccumElemType* ptrWeight = fullMask ? 0 : resultWeight.ptr<AccumElemType>(y);
+                const unsigned char* ptrMaskNot = fullMask ? 0 : maskNot.ptr<unsigned char>(y);
+                unsigned char* ptrDst = blendImage.ptr<unsigned char>(y);
+                for (int x = 0; x < cols; x++)
+                {
+                    int val[3];
+                    if (fullMask)
+                    {
+                        val[0] = ptrAccum[0] >> MultibandBlendAccum<AccumElemType>::WEIGHT_SHIFT;
+                        val[1] = ptrAccum[1] >> MultibandBlendAccum<AccumElemType>::WEIGHT_SHIFT;
+                        val[2] = ptrAccum[2] >> MultibandBlendAccum<AccumElemType>::WEIGHT_SHIFT;
+                    }
+                    else
+                    {
+                        int w = ptrWeight[x];
+                        if (!w) w++;
+                        val[0] = ptrAccum[0] / w;
+                        val[1] = ptrAccum[1] / w;
+                        val[2] = ptrAccum[2] / w;
+                    }
+                    if (ptrUp)
+                    {
+                        val[0] += ptrUp[0];
+                        val[1] += ptrUp[1];
+                        val[2] += ptrUp[2];
+                        ptrUp += 3;
+                    }
+                    if (ptrMaskNot && ptrMaskNot[x])
+                    {
+                        ptrDst[0] = 0;
+                        ptrDst[1] = 0;
+                        ptrDst[2] = 0;
+                    }
+                    else
+                    {
+                        ptrDst[0] = cv::saturate_cast<unsigned char>(val[0]);
+                        ptrDst[1] = cv::saturate_cast<unsigned char>(val[1]);
+                        ptrDst[2] = cv::saturate_cast<unsigned char>(val[2]);
+                    }
+                    ptrAccum += 3;
+                    ptrDst += 3;
+                }
+            }
+        }
+    }
+
+    const std::vector<cv::Mat>& images;
+    const std::vector<cv::Mat>& imageLevel1s;
+    const std::vector<std::vector<cv::Mat> >& weightPyrs;
+    cv::Mat resultWeight;
+    cv::Mat resultLevel1;
+    cv::Mat maskNot;
+    bool fullMask;
+    int numLevels;
+    cv::Mat& blendImage;
+};
+
 void TilingMultibandBlendFast::blend(const std::vector<cv::Mat>& images, cv::Mat& blendImage)
 {
     if (!success)
@@ -997,37 +1168,52 @@ void TilingMultibandBlendFast::blend(const std::vector<cv::Mat>& images, cv::Mat
             images[i].rows == rows && images[i].cols == cols);
     }
 
-    for (int i = 0; i <= numLevels; i++)
+    // Levels above 0 are small enough to be processed as whole images.
+    for (int i = 1; i <= numLevels; i++)
         resultPyr[i].setTo(0);
 
+    // Level 1 of each image is kept before the Laplacian is taken, the strips upsample it
+    // for the Laplacian of level 0.
     imagePyr.resize(numLevels + 1);
-    for (int i = 0; i < numImages; i++)
+    imageLevel1s.resize(numImages);
+    for (int i = 0; i < numImages && numLevels > 0; i++)
     {
-        if (images[i].type() == CV_8UC3)
-            images[i].convertTo(imagePyr[0], CV_16S);
-        else if (images[i].type() == CV_16SC3)
-            imagePyr[0] = images[i];
-        for (int j = 0; j < numLevels; j++)
+        pyramidDownTo32S(images[i], image32SPyr[1], cv::Size(), cv::BORDER_WRAP);
+        calcDstImage(image32SPyr[1], alphaPyrs[i][1], imageLevel1s[i]);
+        for (int j = 1; j < numLevels; j++)
         {
-            pyramidDownTo32S(imagePyr[j], image32SPyr[j + 1], cv::Size(), cv::BORDER_WRAP);
+            pyramidDownTo32S(j > 1 ? imagePyr[j] : imageLevel1s[i], image32SPyr[j + 1], cv::Size(), cv::BORDER_WRAP);
             calcDstImage(image32SPyr[j + 1], alphaPyrs[i][j + 1], imagePyr[j + 1]);
         }
-        for (int j = 0; j < numLevels; j++)
+        for (int j = 1; j < numLevels; j++)
         {
-            pyramidUp(imagePyr[j + 1], imageUpPyr[j], imagePyr[j].size(), cv::BORDER_WRAP);
-            cv::subtract(imagePyr[j], imageUpPyr[j], imagePyr[j]);
+            const cv::Mat& gauss = j > 1 ? imagePyr[j] : imageLevel1s[i];
+            pyramidUp(imagePyr[j + 1], imageUpPyr[j], gauss.size(), cv::BORDER_WRAP);
+            cv::subtract(gauss, imageUpPyr[j], imagePyr[j]);
         }
-        accumulate(imagePyr, weightPyrs[i], resultPyr);
+        // With one level, level 1 is the top and is accumulated as it is
+        for (int j = 1; j <= numLevels; j++)
+            ::accumulate(j == 1 && numLevels == 1 ? imageLevel1s[i] : imagePyr[j], weightPyrs[i][j], resultPyr[j]);
     }
 
-    if (fullMask)
-        normalize(resultPyr);
-    else
-        normalize(resultPyr, resultWeightPyr);
-    restoreImageFromLaplacePyramid(resultPyr, true, resultUpPyr);
-    resultPyr[0].convertTo(blendImage, CV_8U);
-    if (!fullMask)
-        blendImage.setTo(0, maskNot);
+    for (int i = 1; i <= numLevels; i++)
+    {
+        if (fullMask)
+            normalize(resultPyr[i]);
+        else
+            normalize(resultPyr[i], resultWeightPyr[i]);
+    }
+    for (int i = numLevels; i > 1; i--)
+    {
+        pyramidUp(resultPyr[i], resultUpPyr[i - 1], resultPyr[i - 1].size(), cv::BORDER_WRAP);
+        cv::add(resultUpPyr[i - 1], resultPyr[i - 1], resultPyr[i - 1]);
+    }
+
+    blendImage.create(rows, cols, CV_8UC3);
+    int numStrips = (rows + BLEND_STRIP_ROWS - 1) / BLEND_STRIP_ROWS;
+    MultibandBlendStripLoop<int> loop(images, imageLevel1s, weightPyrs, fullMask ? cv::Mat() : resultWeightPyr[0],
+        numLevels > 0 ? resultPyr[1] : cv::Mat(), maskNot, fullMask, numLevels, blendImage);
+    cv::parallel_for_(cv::Range(0, numStrips), loop);
 }
 
 void TilingMultibandBlendFast::blend(const std::vector<cv::Mat>& images, const std::vector<cv::Mat>& masks, cv::Mat& blendImage)
@@ -1203,16 +1389,305 @@ void TilingMultibandBlendFast::getUniqueMasks(std::vector<cv::Mat>& masks) const
         masks.clear();
 }
 
-TilingMultibandBlendFastParallel::~TilingMultibandBlendFastParallel()
+// Builds the weight pyramids, and the alpha pyramids if alphaMasks is not null, of the images in range.
+// The weight masks are set to weightValue. The alpha pyramids are of type alphaType,
+// either CV_32SC1, or CV_16SC1 holding the 32 bit alpha divided by 256.
+class MultibandBlendMaskPyramidLoop : public cv::ParallelLoopBody
 {
-    endThreads();
+public:
+    MultibandBlendMaskPyramidLoop(const std::vector<cv::Mat>& weightMasks_, int numLevels_, int weightValue_,
+        std::vector<std::vector<cv::Mat> >& weightPyrs_, const std::vector<cv::Mat>* alphaMasks_ = 0, 
+        std::vector<std::vector<cv::Mat> >* alphaPyrs_ = 0, int alphaType_ = CV_32SC1)
+        : weightMasks(weightMasks_), numLevels(numLevels_), weightValue(weightValue_), weightPyrs(weightPyrs_), 
+          alphaMasks(alphaMasks_), alphaPyrs(alphaPyrs_), alphaType(alphaType_)
+    {
+    }
+
+    virtual ~MultibandBlendMaskPyramidLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        std::vector<cv::Mat> tempAlphaPyr(numLevels + 1);
+        cv::Mat alpha32S;
+        for (int i = r.start; i < r.end; i++)
+        {
+            cv::Mat aux = cv::Mat::zeros(weightMasks[i].size(), CV_16SC1);
+            aux.setTo(weightValue, weightMasks[i]);
+            createGaussPyramid(aux, numLevels, true, weightPyrs[i]);
+
+            if (!alphaMasks)
+                continue;
+
+            std::vector<cv::Mat>& alphaPyr = (*alphaPyrs)[i];
+            alphaPyr.resize(numLevels + 1);
+            tempAlphaPyr[0] = cv::Mat::zeros(weightMasks[i].size(), CV_16SC1);
+            tempAlphaPyr[0].setTo(256, (*alphaMasks)[i]);
+            for (int j = 0; j < numLevels; j++)
+            {
+                pyramidDownTo32S(tempAlphaPyr[j], alpha32S, cv::Size(), cv::BORDER_WRAP);
+                tempAlphaPyr[j + 1].create(alpha32S.size(), CV_16SC1);
+                setAlpha16SAccordingToAlpha32S(alpha32S, tempAlphaPyr[j + 1]);
+                // alpha32S is downsampled from 0 or 256 with kernel weights summing to 256,
+                // so it is a multiple of 256 no larger than 65536 and the division is exact.
+                if (alphaType == CV_32SC1)
+                    alpha32S.copyTo(alphaPyr[j + 1]);
+                else
+                    alpha32S.convertTo(alphaPyr[j + 1], CV_16S, 1.0 / 256);
+            }
+        }
+    }
+
+    const std::vector<cv::Mat>& weightMasks;
+    int numLevels;
+    int weightValue;
+    std::vector<std::vector<cv::Mat> >& weightPyrs;
+    const std::vector<cv::Mat>* alphaMasks;
+    std::vector<std::vector<cv::Mat> >* alphaPyrs;
+    int alphaType;
+};
+
+static int getNumBands(int rows)
+{
+    return (rows + BLEND_STRIP_ROWS - 1) / BLEND_STRIP_ROWS;
 }
 
-bool TilingMultibandBlendFastParallel::prepare(const std::vector<cv::Mat>& masks, int maxLevels, int minLength)
+// Computes a level of the Gauss pyramids of all the images from the level below.
+// The range is over the bands of all the images, band s is band s % numBands of image s / numBands,
+// so the images are processed concurrently.
+class MultibandBlendDownLoop : public cv::ParallelLoopBody
+{
+public:
+    MultibandBlendDownLoop(const std::vector<cv::Mat>& images_, const std::vector<std::vector<cv::Mat> >& alphaPyrs_,
+        int level_, std::vector<std::vector<cv::Mat> >& imagePyrs_)
+        : images(images_), alphaPyrs(alphaPyrs_), level(level_), imagePyrs(imagePyrs_)
+    {
+        numBands = getNumBands(imagePyrs[0][level].rows);
+    }
+
+    virtual ~MultibandBlendDownLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        cv::Mat down32S, dstRows;
+        for (int s = r.start; s < r.end; s++)
+        {
+            int i = s / numBands;
+            const cv::Mat& src = level == 1 ? images[i] : imagePyrs[i][level - 1];
+            cv::Mat& dst = imagePyrs[i][level];
+            int beg = (s % numBands) * BLEND_STRIP_ROWS, end = std::min(beg + BLEND_STRIP_ROWS, dst.rows);
+            pyramidDownTo32SRows(src, src.size(), 0, down32S, dst.size(), beg, end, cv::BORDER_WRAP);
+            dstRows = dst.rowRange(beg, end);
+            calcDstImage(down32S, alphaPyrs[i][level].rowRange(beg, end), dstRows);
+        }
+    }
+
+    const std::vector<cv::Mat>& images;
+    const std::vector<std::vector<cv::Mat> >& alphaPyrs;
+    int level;
+    std::vector<std::vector<cv::Mat> >& imagePyrs;
+    int numBands;
+};
+
+// Accumulates the weighted Laplacians of a level of the pyramids of all the images band by band.
+// The Laplacian is computed from the level and the level above of the Gauss pyramid,
+// the top level is accumulated as it is. Each band accumulates the images in the same order,
+// so the saturating 16 bit accumulation gives the same result however the bands are scheduled.
+template<typename AccumElemType>
+class MultibandBlendAccumulateLoop : public cv::ParallelLoopBody
+{
+public:
+    MultibandBlendAccumulateLoop(const std::vector<std::vector<cv::Mat> >& imagePyrs_, 
+        const std::vector<std::vector<cv::Mat> >& weightPyrs_, int level_, cv::Mat& result_)
+        : imagePyrs(imagePyrs_), weightPyrs(weightPyrs_), level(level_), result(result_)
+    {
+    }
+
+    virtual ~MultibandBlendAccumulateLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        cv::Mat up16S, dst = result;
+        int numImages = imagePyrs.size();
+        bool top = level == int(imagePyrs[0].size()) - 1;
+        for (int s = r.start; s < r.end; s++)
+        {
+            int beg = s * BLEND_STRIP_ROWS, end = std::min(beg + BLEND_STRIP_ROWS, dst.rows);
+            for (int i = 0; i < numImages; i++)
+            {
+                const cv::Mat& gauss = imagePyrs[i][level];
+                if (!top)
+                {
+                    const cv::Mat& gaussAbove = imagePyrs[i][level + 1];
+                    pyramidUpRows(gaussAbove, gaussAbove.size(), 0, up16S, gauss.size(), beg, end, cv::BORDER_WRAP);
+                }
+                for (int y = beg; y < end; y++)
+                {
+                    accumulateLaplaceRow(gauss.ptr<short>(y), top ? 0 : up16S.ptr<short>(y - beg),
+                        weightPyrs[i][level].ptr<short>(y), dst.ptr<AccumElemType>(y), gauss.cols);
+                }
+            }
+        }
+    }
+
+    const std::vector<std::vector<cv::Mat> >& imagePyrs;
+    const std::vector<std::vector<cv::Mat> >& weightPyrs;
+    int level;
+    cv::Mat result;
+};
+
+// Normalizes a level of the result band by band and adds the upsampled level above, 
+// which should have been restored, if there is one. 
+// If weight is empty, the weights sum to 1 << MultibandBlendAccum<AccumElemType>::WEIGHT_SHIFT everywhere.
+template<typename AccumElemType>
+class MultibandBlendRestoreLoop : public cv::ParallelLoopBody
 {
-    endThreads();
-    init();
+public:
+    MultibandBlendRestoreLoop(cv::Mat& result_, const cv::Mat& weight_, const cv::Mat& resultAbove_)
+        : result(result_), weight(weight_), resultAbove(resultAbove_)
+    {
+    }
 
+    virtual ~MultibandBlendRestoreLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        cv::Mat up, dst = result;
+        int cols = result.cols;
+        for (int s = r.start; s < r.end; s++)
+        {
+            int beg = s * BLEND_STRIP_ROWS, end = std::min(beg + BLEND_STRIP_ROWS, result.rows);
+            if (resultAbove.data)
+                pyramidUpRows(resultAbove, resultAbove.size(), 0, up, result.size(), beg, end, cv::BORDER_WRAP);
+            for (int y = beg; y < end; y++)
+            {
+                AccumElemType* ptrResult = dst.ptr<AccumElemType>(y);
+                const AccumElemType* ptrWeight = weight.data ? weight.ptr<AccumElemType>(y) : 0;
+                const AccumElemType* ptrUp = resultAbove.data ? up.ptr<AccumElemType>(y - beg) : 0;
+                for (int x = 0; x < cols; x++)
+                {
+                    int val[3];
+                    if (ptrWeight)
+                    {
+                        int w = ptrWeight[x];
+                        if (!w) w++;
+                        val[0] = ptrResult[0] / w;
+                        val[1] = ptrResult[1] / w;
+                        val[2] = ptrResult[2] / w;
+                    }
+                    else
+                    {
+                        val[0] = ptrResult[0] >> MultibandBlendAccum<AccumElemType>::WEIGHT_SHIFT;
+                        val[1] = ptrResult[1] >> MultibandBlendAccum<AccumElemType>::WEIGHT_SHIFT;
+                        val[2] = ptrResult[2] >> MultibandBlendAccum<AccumElemType>::WEIGHT_SHIFT;
+                    }
+                    if (ptrUp)
+                    {
+                        val[0] += ptrUp[0];
+                        val[1] += ptrUp[1];
+                        val[2] += ptrUp[2];
+                        ptrUp += 3;
+                    }
+                    ptrResult[0] = cv::saturate_cast<AccumElemType>(val[0]);
+                    ptrResult[1] = cv::saturate_cast<AccumElemType>(val[1]);
+                    ptrResult[2] = cv::saturate_cast<AccumElemType>(val[2]);
+                    ptrResult += 3;
+                }
+            }
+        }
+    }
+
+    cv::Mat result, weight, resultAbove;
+};
+
+// Sums the weight pyramids of all the images level by level, the sums are of type weightSumType.
+static void sumWeightPyramids(const std::vector<std::vector<cv::Mat> >& weightPyrs, int weightSumType, 
+    std::vector<cv::Mat>& resultWeightPyr)
+{
+    int numImages = weightPyrs.size(), numLevels = weightPyrs[0].size() - 1;
+    resultWeightPyr.resize(numLevels + 1);
+    for (int j = 0; j <= numLevels; j++)
+    {
+        cv::Mat sum32S = cv::Mat::zeros(weightPyrs[0][j].size(), CV_32SC1);
+        for (int i = 0; i < numImages; i++)
+            accumulateWeight(weightPyrs[i][j], sum32S);
+        if (weightSumType == CV_32SC1)
+            resultWeightPyr[j] = sum32S;
+        else
+            sum32S.convertTo(resultWeightPyr[j], CV_MAT_DEPTH(weightSumType));
+    }
+}
+
+// Scales down the weights of all the images where they sum to more than maxWeightSum,
+// so that the weighted sums of the images do not saturate a 16 bit accumulator.
+static void limitWeightPyramids(std::vector<std::vector<cv::Mat> >& weightPyrs, int maxWeightSum)
+{
+    int numImages = weightPyrs.size(), numLevels = weightPyrs[0].size() - 1;
+    for (int j = 0; j <= numLevels; j++)
+    {
+        cv::Mat sum32S = cv::Mat::zeros(weightPyrs[0][j].size(), CV_32SC1);
+        for (int i = 0; i < numImages; i++)
+            accumulateWeight(weightPyrs[i][j], sum32S);
+        int rows = sum32S.rows, cols = sum32S.cols;
+        for (int i = 0; i < numImages; i++)
+        {
+            for (int y = 0; y < rows; y++)
+            {
+                const int* ptrSum = sum32S.ptr<int>(y);
+                short* ptrWeight = weightPyrs[i][j].ptr<short>(y);
+                for (int x = 0; x < cols; x++)
+                {
+                    if (ptrSum[x] > maxWeightSum)
+                        ptrWeight[x] = ptrWeight[x] * maxWeightSum / ptrSum[x];
+                }
+            }
+        }
+    }
+}
+
+template<typename AccumElemType>
+static void multibandBlendParallel(const std::vector<cv::Mat>& images, 
+    const std::vector<std::vector<cv::Mat> >& alphaPyrs, const std::vector<std::vector<cv::Mat> >& weightPyrs, 
+    const std::vector<cv::Mat>& resultWeightPyr, const cv::Mat& maskNot, bool fullMask, int numLevels,
+    std::vector<std::vector<cv::Mat> >& imagePyrs, std::vector<cv::Mat>& resultPyr, cv::Mat& blendImage)
+{
+    int numImages = images.size(), rows = images[0].rows, cols = images[0].cols;
+
+    for (int i = 1; i <= numLevels; i++)
+        resultPyr[i].setTo(0);
+
+    // imagePyrs hold the Gauss pyramids of all the images, each level is computed for all
+    // the images by one parallel loop. The Laplacian of each level is computed on the fly 
+    // by the accumulation, every band of the result sums all the images.
+    for (int j = 1; j <= numLevels; j++)
+    {
+        cv::parallel_for_(cv::Range(0, numImages * getNumBands(resultPyr[j].rows)),
+            MultibandBlendDownLoop(images, alphaPyrs, j, imagePyrs));
+    }
+    for (int j = 1; j <= numLevels; j++)
+    {
+        cv::parallel_for_(cv::Range(0, getNumBands(resultPyr[j].rows)),
+            MultibandBlendAccumulateLoop<AccumElemType>(imagePyrs, weightPyrs, j, resultPyr[j]));
+    }
+
+    for (int j = numLevels; j > 0; j--)
+    {
+        cv::parallel_for_(cv::Range(0, getNumBands(resultPyr[j].rows)),
+            MultibandBlendRestoreLoop<AccumElemType>(resultPyr[j], fullMask ? cv::Mat() : resultWeightPyr[j],
+            j < numLevels ? resultPyr[j + 1] : cv::Mat()));
+    }
+
+    // Level 1 of the Gauss pyramids is upsampled by the strips for the Laplacian of level 0
+    std::vector<cv::Mat> imageLevel1s(numImages);
+    for (int i = 0; i < numImages && numLevels > 0; i++)
+        imageLevel1s[i] = imagePyrs[i][1];
+    blendImage.create(rows, cols, CV_8UC3);
+    cv::parallel_for_(cv::Range(0, getNumBands(rows)),
+        MultibandBlendStripLoop<AccumElemType>(images, imageLevel1s, weightPyrs, fullMask ? cv::Mat() : resultWeightPyr[0],
+        numLevels > 0 ? resultPyr[1] : cv::Mat(), maskNot, fullMask, numLevels, blendImage));
+}
+
+bool TilingMultibandBlendFastParallel::prepare(const std::vector<cv::Mat>& masks, int maxLevels, int minLength)
+{
     success = false;
     if (masks.empty())
         return false;
@@ -1234,40 +1709,25 @@ bool TilingMultibandBlendFastParallel::prepare(const std::vector<cv::Mat>& masks
 
     numLevels = getTrueNumLevels(cols, rows, maxLevels, minLength);
 
+    // Only levels above 0 are stored, level 0 is blended strip by strip.
     std::vector<cv::Size> sizes;
     getPyramidLevelSizes(sizes, rows, cols, numLevels);
-    image32SPyrs.resize(numImages);
-    imageUpPyrs.resize(numImages);
-    for (int i = 0; i < numImages; i++)
-        allocMemoryForImage32SPyrAndImageUpPyr(sizes, image32SPyrs[i], imageUpPyrs[i]);
-    allocMemoryForResultPyrAndResultUpPyr(sizes, resultPyr, resultUpPyr);
-
-    cv::Mat aux(rows, cols, CV_16SC1);
-
-    weightPyrs.resize(numImages);
-    for (int i = 0; i < numImages; i++)
+    resultPyr.resize(numLevels + 1);
+    for (int i = 1; i <= numLevels; i++)
+        resultPyr[i].create(sizes[i], use16S ? MultibandBlendAccum<short>::ACCUM_TYPE : MultibandBlendAccum<int>::ACCUM_TYPE);
+    imagePyrs.resize(numImages);
+    for (int k = 0; k < numImages; k++)
     {
-        aux.setTo(0);
-        aux.setTo(256, uniqueMasks[i]);
-        cv::Mat base = aux.clone();
-        createGaussPyramid(base, numLevels, true, weightPyrs[i]);
+        imagePyrs[k].resize(numLevels + 1);
+        for (int i = 1; i <= numLevels; i++)
+            imagePyrs[k][i].create(sizes[i], CV_16SC3);
     }
 
+    weightPyrs.resize(numImages);
     alphaPyrs.resize(numImages);
-    std::vector<cv::Mat> tempAlphaPyr(numLevels + 1);
-    for (int i = 0; i < numImages; i++)
-    {
-        alphaPyrs[i].resize(numLevels + 1);
-        aux.setTo(0);
-        aux.setTo(256, masks[i]);
-        tempAlphaPyr[0] = aux.clone();
-        for (int j = 0; j < numLevels; j++)
-        {
-            pyramidDownTo32S(tempAlphaPyr[j], alphaPyrs[i][j + 1], cv::Size(), cv::BORDER_WRAP);
-            tempAlphaPyr[j + 1].create(alphaPyrs[i][j + 1].size(), CV_16SC1);
-            setAlpha16SAccordingToAlpha32S(alphaPyrs[i][j + 1], tempAlphaPyr[j + 1]);
-        }
-    }
+    cv::parallel_for_(cv::Range(0, numImages), 
+        MultibandBlendMaskPyramidLoop(uniqueMasks, numLevels, getWeightValue(), weightPyrs, &masks, &alphaPyrs, 
+        use16S ? CV_16SC1 : CV_32SC1));
 
     cv::Mat mask = cv::Mat::zeros(rows, cols, CV_8UC1);
     for (int i = 0; i < numImages; i++)
@@ -1280,33 +1740,10 @@ bool TilingMultibandBlendFastParallel::prepare(const std::vector<cv::Mat>& masks
     }
     else
     {
-        resultWeightPyr.resize(numLevels + 1);
-        for (int i = 0; i < numLevels + 1; i++)
-        {
-            resultWeightPyr[i].create(sizes[i], CV_32SC1);
-            resultWeightPyr[i].setTo(0);
-        }
-        for (int i = 0; i < numImages; i++)
-            accumulateWeight(weightPyrs[i], resultWeightPyr);
+        sumWeightPyramids(weightPyrs, getWeightSumType(), resultWeightPyr);
         maskNot = ~mask;
     }
 
-    imageHeaders.resize(numImages);
-    imagePyrs.resize(numImages);
-
-    rowBuffers.resize(numImages);
-    tabBuffers.resize(numImages);
-
-    customMasks.resize(numImages);
-    customAuxes.resize(numImages);
-    customWeightPyrs.resize(numImages);
-
-    threadEnd = false;
-    threads.clear();
-    threads.resize(numImages);
-    for (int i = 0; i < numImages; i++)
-        threads[i].reset(new std::thread(&TilingMultibandBlendFastParallel::buildPyramid, this, i));
-
     success = true;
     return true;
 }
@@ -1324,42 +1761,7 @@ void TilingMultibandBlendFastParallel::blend(const std::vector<cv::Mat>& images,
             images[i].rows == rows && images[i].cols == cols);
     }
 
-    for (int i = 0; i < numImages; i++)
-    {
-        imageHeaders[i] = images[i];
-        customMasks[i].release();
-    }
-
-    buildCount.store(0);
-    cvBuildPyr.notify_all();
-
-    // It seems that unconditional waiting causes deadlock if this library
-    // runs on a less powerful CPU.
-    // After I used conditional wait, deadlock no longer happened.
-    // The cause of deadlock has not been really discovered.
-    // I do not recommend using TilingMultibandBlendFastParallel,
-    // it runs just a little faster than TilingMultibandBlendFast but 
-    // consumes more memory.
-    // I want to mark this class as DEPRECATED.
-    {
-        std::unique_lock<std::mutex> lk(mtxAccum);
-        cvAccum.wait(lk, [this] { return buildCount.load() == numImages; });
-    }
-
-    for (int i = 0; i <= numLevels; i++)
-        resultPyr[i].setTo(0);
-    // Acording to run time test, weighting imagrPyr to a weightedPyr in respective thread 
-    // and then add all weightedPyrs in the main thread will slow down the speed.
-    for (int i = 0; i < numImages; i++)
-        accumulate(imagePyrs[i], weightPyrs[i], resultPyr);
-    if (fullMask)
-        normalize(resultPyr);
-    else
-        normalize(resultPyr, resultWeightPyr);
-    restoreImageFromLaplacePyramid(resultPyr, true, resultUpPyr, restoreRowBuffer, restoreTabBuffer);
-    resultPyr[0].convertTo(blendImage, CV_8U);
-    if (!fullMask)
-        blendImage.setTo(0, maskNot);
+    blendPyramids(images, weightPyrs, resultWeightPyr, maskNot, fullMask, blendImage);
 }
 
 void TilingMultibandBlendFastParallel::blend(const std::vector<cv::Mat>& images, const std::vector<cv::Mat>& masks, cv::Mat& blendImage)
@@ -1381,129 +1783,46 @@ void TilingMultibandBlendFastParallel::blend(const std::vector<cv::Mat>& images,
     customMaskNot.setTo(0);
     for (int i = 0; i < numImages; i++)
         customMaskNot |= masks[i];
-    bool customFullMask = cv::countNonZero(customMaskNot) == rows * cols;
 
-    for (int i = 0; i < numImages; i++)
-    {
-        imageHeaders[i] = images[i];
-        customMasks[i] = masks[i];
-    }
-
-    buildCount.store(0);
-    cvBuildPyr.notify_all();
-
-    {
-        std::unique_lock<std::mutex> lk(mtxAccum);
-        cvAccum.wait(lk, [this] { return buildCount.load() == numImages; });
-    }
+    customWeightPyrs.resize(numImages);
+    cv::parallel_for_(cv::Range(0, numImages),
+        MultibandBlendMaskPyramidLoop(masks, numLevels, getWeightValue(), customWeightPyrs));
 
-    customResultWeightPyr.resize(numLevels + 1);
-    for (int i = 0; i < numLevels + 1; i++)
-    {
-        customResultWeightPyr[i].create(customWeightPyrs[0][i].size(), CV_32SC1);
-        customResultWeightPyr[i].setTo(0);
-    }
-    for (int i = 0; i < numImages; i++)
-        accumulateWeight(customWeightPyrs[i], customResultWeightPyr);
+    if (use16S)
+        limitWeightPyramids(customWeightPyrs, getWeightValue());
+    sumWeightPyramids(customWeightPyrs, getWeightSumType(), customResultWeightPyr);
     cv::bitwise_not(customMaskNot, customMaskNot);
 
-    for (int i = 0; i <= numLevels; i++)
-        resultPyr[i].setTo(0);
-    for (int i = 0; i < numImages; i++)
-        accumulate(imagePyrs[i], customWeightPyrs[i], resultPyr);
-
-    normalize(resultPyr, customResultWeightPyr);
-    restoreImageFromLaplacePyramid(resultPyr, true, resultUpPyr, restoreRowBuffer, restoreTabBuffer);
-    resultPyr[0].convertTo(blendImage, CV_8U);
-    if (!customFullMask)
-        blendImage.setTo(0, customMaskNot);
+    // Custom masks may overlap, so the result is always normalized by the weight sums.
+    blendPyramids(images, customWeightPyrs, customResultWeightPyr, customMaskNot, false, blendImage);
 }
 
-void TilingMultibandBlendFastParallel::getUniqueMasks(std::vector<cv::Mat>& masks) const
+void TilingMultibandBlendFastParallel::blendPyramids(const std::vector<cv::Mat>& images, 
+    const std::vector<std::vector<cv::Mat> >& currWeightPyrs, const std::vector<cv::Mat>& currResultWeightPyr, 
+    const cv::Mat& currMaskNot, bool currFullMask, cv::Mat& blendImage)
 {
-    if (success)
-        masks = uniqueMasks;
+    if (use16S)
+        multibandBlendParallel<short>(images, alphaPyrs, currWeightPyrs, currResultWeightPyr, currMaskNot, 
+            currFullMask, numLevels, imagePyrs, resultPyr, blendImage);
     else
-        masks.clear();
+        multibandBlendParallel<int>(images, alphaPyrs, currWeightPyrs, currResultWeightPyr, currMaskNot, 
+            currFullMask, numLevels, imagePyrs, resultPyr, blendImage);
 }
 
-void TilingMultibandBlendFastParallel::buildPyramid(int index)
+int TilingMultibandBlendFastParallel::getWeightValue() const
 {
-    const cv::Mat& image = imageHeaders[index];
-    std::vector<cv::Mat>& imagePyr = imagePyrs[index];
-    std::vector<cv::Mat>& image32SPyr = image32SPyrs[index];
-    std::vector<cv::Mat>& imageUpPyr = imageUpPyrs[index];
-    std::vector<cv::Mat>& alphaPyr = alphaPyrs[index];
-    std::vector<cv::Mat>& weightPyr = weightPyrs[index];
-    std::vector<unsigned char>& rowBuffer = rowBuffers[index];
-    std::vector<unsigned char>& tabBuffer = tabBuffers[index];
-
-    const cv::Mat& customMask = customMasks[index];
-    cv::Mat& customAux = customAuxes[index];
-    std::vector<cv::Mat>& customWeightPyr = customWeightPyrs[index];
-
-    while (true)
-    {
-        {
-            std::unique_lock<std::mutex> lk(mtxBuildPyr);
-            cvBuildPyr.wait(lk);
-        }
-        if (threadEnd)
-            break;
-
-        if (customMask.data)
-        {
-            customAux.create(rows, cols, CV_16SC1);
-            customAux.setTo(0);
-            customAux.setTo(256, customMask);
-            createGaussPyramid(customAux, numLevels, true, customWeightPyr);
-        }
-
-        imagePyr.resize(numLevels + 1);
-        if (image.type() == CV_8UC3)
-            image.convertTo(imagePyr[0], CV_16S);
-        else if (image.type() == CV_16SC3)
-            imagePyr[0] = image;
-        for (int j = 0; j < numLevels; j++)
-        {
-            pyramidDownTo32S(imagePyr[j], image32SPyr[j + 1], rowBuffer, tabBuffer, cv::Size(), cv::BORDER_WRAP);
-            calcDstImage(image32SPyr[j + 1], alphaPyr[j + 1], imagePyr[j + 1]);
-        }
-        for (int j = 0; j < numLevels; j++)
-        {
-            pyramidUp(imagePyr[j + 1], imageUpPyr[j], rowBuffer, tabBuffer, imagePyr[j].size(), cv::BORDER_WRAP);
-            cv::subtract(imagePyr[j], imageUpPyr[j], imagePyr[j]);
-        }
-
-        buildCount.fetch_add(1);
-        if (buildCount.load() == numImages)
-            cvAccum.notify_one();
-    }
+    return 1 << (use16S ? int(MultibandBlendAccum<short>::WEIGHT_SHIFT) : int(MultibandBlendAccum<int>::WEIGHT_SHIFT));
 }
 
-void TilingMultibandBlendFastParallel::endThreads()
+int TilingMultibandBlendFastParallel::getWeightSumType() const
 {
-    if (!threadEnd)
-    {
-        threadEnd = true;
-        cvBuildPyr.notify_all();
-        for (int i = 0; i < numImages; i++)
-        {
-            if (threads[i]->joinable())
-                threads[i]->join();
-        }
-    }
+    return use16S ? MultibandBlendAccum<short>::WEIGHT_SUM_TYPE : MultibandBlendAccum<int>::WEIGHT_SUM_TYPE;
 }
 
-void TilingMultibandBlendFastParallel::init()
+void TilingMultibandBlendFastParallel::getUniqueMasks(std::vector<cv::Mat>& masks) const
 {
-    numImages = 0;
-    rows = 0;
-    cols = 0;
-    numLevels = 0;
-    success = false;
-
-    threads.clear();
-    threadEnd = true;
-    buildCount.store(0);
-}
\ No newline at end of file
+    if (success)
+        masks = uniqueMasks;
+    else
+        masks.clear();
+}
@@ -1,15 +1,354 @@
 ﻿#include "Pyramid.h"
 #include <xmmintrin.h>
 #include <emmintrin.h>
+#include <immintrin.h>
+
+// AVX2 kernels for the interior of 1, 3 and 4 channel rows, the elements near the left and right
+// ends of a row, whose taps need border interpolation, are left to the scalar code,
+// so the horizontal wrap border needs no padding. Rows are processed in 32 bit lanes
+// with the same integer arithmetic as the scalar code, so the results are bit-exact.
+
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+static int pyramidUseSIMD = 1;
+
+void setPyramidUseSIMD(bool useSIMD)
+{
+    pyramidUseSIMD = useSIMD;
+}
+
+static inline bool pyramidUseAVX2()
+{
+    return pyramidUseSIMD && cv::checkHardwareSupport(CV_CPU_AVX2);
+}
+
+TARGET_AVX2 inline __m256i loadAsInt32x8(const uchar* ptr)
+{
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)ptr));
+}
+
+TARGET_AVX2 inline __m256i loadAsInt32x8(const short* ptr)
+{
+    return _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)ptr));
+}
+
+TARGET_AVX2 inline __m256i loadAsInt32x8(const ushort* ptr)
+{
+    return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)ptr));
+}
+
+TARGET_AVX2 inline __m256i loadAsInt32x8(const int* ptr)
+{
+    return _mm256_loadu_si256((const __m256i*)ptr);
+}
+
+// The stores truncate like the C style casts of FixPtCast.
+TARGET_AVX2 inline void storeFromInt32x8(uchar* ptr, __m256i val)
+{
+    val = _mm256_srai_epi32(_mm256_slli_epi32(val, 24), 24);
+    __m128i val16 = _mm_packs_epi32(_mm256_castsi256_si128(val), _mm256_extracti128_si256(val, 1));
+    _mm_storel_epi64((__m128i*)ptr, _mm_packs_epi16(val16, val16));
+}
+
+TARGET_AVX2 inline void storeFromInt32x8(short* ptr, __m256i val)
+{
+    val = _mm256_srai_epi32(_mm256_slli_epi32(val, 16), 16);
+    _mm_storeu_si128((__m128i*)ptr, _mm_packs_epi32(_mm256_castsi256_si128(val), _mm256_extracti128_si256(val, 1)));
+}
+
+TARGET_AVX2 inline void storeFromInt32x8(ushort* ptr, __m256i val)
+{
+    storeFromInt32x8((short*)ptr, val);
+}
+
+TARGET_AVX2 inline void storeFromInt32x8(int* ptr, __m256i val)
+{
+    _mm256_storeu_si256((__m256i*)ptr, val);
+}
+
+// s[-cn*2] + (s[-cn] + s[cn])*4 + s[0]*6 + s[cn*2] for 8 consecutive elements of a cn channel row.
+template<int cn, typename T>
+TARGET_AVX2 inline __m256i pyrDownHorz8(const T* s)
+{
+    __m256i c = loadAsInt32x8(s);
+    __m256i n = _mm256_add_epi32(loadAsInt32x8(s - cn), loadAsInt32x8(s + cn));
+    __m256i f = _mm256_add_epi32(loadAsInt32x8(s - cn*2), loadAsInt32x8(s + cn*2));
+    return _mm256_add_epi32(_mm256_add_epi32(f, _mm256_slli_epi32(_mm256_add_epi32(n, c), 2)), 
+        _mm256_slli_epi32(c, 1));
+}
+
+// Horizontal convolution and decimation of a 1 channel row, 8 pixels per iteration.
+// The filter is computed at full resolution for src elements x*2 to x*2 + 15,
+// and the even results are picked by permutes and a blend.
+// Starts from dst element x, which should be at least 1, and returns the first element not processed.
+template<typename T>
+TARGET_AVX2 int pyrDownRowAVX2_1(const T* src, int* row, int x, int width0, int srcWidth)
+{
+    const __m256i permLo = _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0), permHi = _mm256_setr_epi32(0, 0, 0, 0, 0, 2, 4, 6);
+    for( ; x + 8 <= width0 && x*2 + 18 <= srcWidth; x += 8 )
+    {
+        const T* s = src + x*2;
+        __m256i r = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(pyrDownHorz8<1>(s), permLo),
+            _mm256_permutevar8x32_epi32(pyrDownHorz8<1>(s + 8), permHi), 0xF0);
+        _mm256_storeu_si256((__m256i*)(row + x), r);
+    }
+    return x;
+}
+
+// Horizontal convolution and decimation of a 4 channel row, 2 pixels per iteration.
+// dst pixels x/4 and x/4 + 1 take the first src pixel of the two groups of 8 src elements
+// from x*2 and x*2 + 8, which are joined by a lane permute.
+// Starts from dst element x, which should be at least 4, and returns the first element not processed.
+template<typename T>
+TARGET_AVX2 int pyrDownRowAVX2_4(const T* src, int* row, int x, int width0, int srcWidth)
+{
+    for( ; x + 8 <= width0 && x*2 + 24 <= srcWidth; x += 8 )
+    {
+        const T* s = src + x*2;
+        __m256i r = _mm256_permute2x128_si256(pyrDownHorz8<4>(s), pyrDownHorz8<4>(s + 8), 0x20);
+        _mm256_storeu_si256((__m256i*)(row + x), r);
+    }
+    return x;
+}
+
+// Horizontal convolution and decimation of a 3 channel row, 8 pixels per iteration.
+// The filter is computed at full resolution for six groups of 8 src elements,
+// dst element x + i takes src element x*2 + i*2 - i%3, picked by permutes and blends.
+// Starts from dst element x, which should be at least 3, and returns the first element not processed.
+template<typename T>
+TARGET_AVX2 int pyrDownRowAVX2_3(const T* src, int* row, int x, int width0, int srcWidth)
+{
+    const __m256i permA0 = _mm256_setr_epi32(0, 1, 2, 6, 7, 0, 0, 0), permB0 = _mm256_setr_epi32(0, 0, 0, 0, 0, 0, 4, 5);
+    const __m256i permA1 = _mm256_setr_epi32(0, 4, 5, 6, 0, 0, 0, 0), permB1 = _mm256_setr_epi32(0, 0, 0, 0, 0, 1, 2, 6);
+    const __m256i permA2 = _mm256_setr_epi32(0, 1, 5, 6, 7, 0, 0, 0);
+    for( ; x + 24 <= width0 && x*2 + 51 <= srcWidth; x += 24 )
+    {
+        const T* s = src + x*2;
+        __m256i r0 = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(pyrDownHorz8<3>(s), permA0),
+            _mm256_permutevar8x32_epi32(pyrDownHorz8<3>(s + 8), permB0), 0xE0);
+        __m256i r1 = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(pyrDownHorz8<3>(s + 14), permA1),
+            _mm256_permutevar8x32_epi32(pyrDownHorz8<3>(s + 24), permB1), 0xF0);
+        __m256i r2 = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(pyrDownHorz8<3>(s + 31), permA2),
+            pyrDownHorz8<3>(s + 37), 0xE0);
+        _mm256_storeu_si256((__m256i*)(row + x), r0);
+        _mm256_storeu_si256((__m256i*)(row + x + 8), r1);
+        _mm256_storeu_si256((__m256i*)(row + x + 16), r2);
+    }
+    return x;
+}
+
+template<typename T, typename WT>
+inline int pyrDownRowVec(const T*, WT*, int x, int, int, int)
+{
+    return x;
+}
+
+template<typename T>
+inline int pyrDownRowVec(const T* src, int* row, int x, int width0, int srcWidth, int cn)
+{
+    if( !pyramidUseAVX2() )
+        return x;
+    if( cn == 1 )
+        return pyrDownRowAVX2_1(src, row, x, width0, srcWidth);
+    if( cn == 3 )
+        return pyrDownRowAVX2_3(src, row, x, width0, srcWidth);
+    if( cn == 4 )
+        return pyrDownRowAVX2_4(src, row, x, width0, srcWidth);
+    return x;
+}
+
+TARGET_AVX2 static int pyrDownVertAVX2(int** src, int* dst, int width)
+{
+    int x = 0;
+    const int *row0 = src[0], *row1 = src[1], *row2 = src[2], *row3 = src[3], *row4 = src[4];
+    for( ; x <= width - 8; x += 8 )
+    {
+        __m256i r0, r1, r2, r3, r4;
+        r0 = _mm256_loadu_si256((const __m256i*)(row0 + x));
+        r1 = _mm256_loadu_si256((const __m256i*)(row1 + x));
+        r2 = _mm256_loadu_si256((const __m256i*)(row2 + x));
+        r3 = _mm256_loadu_si256((const __m256i*)(row3 + x));
+        r4 = _mm256_loadu_si256((const __m256i*)(row4 + x));
+        r0 = _mm256_add_epi32(r0, r4);
+        r1 = _mm256_add_epi32(_mm256_add_epi32(r1, r3), r2);
+        r0 = _mm256_add_epi32(r0, _mm256_add_epi32(r2, r2));
+        r0 = _mm256_add_epi32(r0, _mm256_slli_epi32(r1, 2));
+        _mm256_storeu_si256((__m256i*)(dst + x), r0);
+    }
+    return x;
+}
+
+// Vertical pass of pyramidDown for 32 bit rows, rounds and shifts like FixPtCast<T, 8>.
+template<typename T>
+TARGET_AVX2 int pyrDownVertCastAVX2(int** src, T* dst, int width)
+{
+    int x = 0;
+    const int *row0 = src[0], *row1 = src[1], *row2 = src[2], *row3 = src[3], *row4 = src[4];
+    const __m256i delta = _mm256_set1_epi32(128);
+    for( ; x <= width - 8; x += 8 )
+    {
+        __m256i r0, r1, r2, r3, r4;
+        r0 = _mm256_loadu_si256((const __m256i*)(row0 + x));
+        r1 = _mm256_loadu_si256((const __m256i*)(row1 + x));
+        r2 = _mm256_loadu_si256((const __m256i*)(row2 + x));
+        r3 = _mm256_loadu_si256((const __m256i*)(row3 + x));
+        r4 = _mm256_loadu_si256((const __m256i*)(row4 + x));
+        r0 = _mm256_add_epi32(r0, r4);
+        r1 = _mm256_add_epi32(_mm256_add_epi32(r1, r3), r2);
+        r0 = _mm256_add_epi32(r0, _mm256_add_epi32(r2, r2));
+        r0 = _mm256_add_epi32(r0, _mm256_slli_epi32(r1, 2));
+        storeFromInt32x8(dst + x, _mm256_srai_epi32(_mm256_add_epi32(r0, delta), 8));
+    }
+    return x;
+}
+
+// s[-cn] + s[0]*6 + s[cn], the even dst pixels, and (s[0] + s[cn])*4, the odd dst pixels,
+// for 8 consecutive elements of a cn channel row.
+template<int cn, typename T>
+TARGET_AVX2 inline __m256i pyrUpHorzEven8(const T* s)
+{
+    __m256i c = loadAsInt32x8(s);
+    return _mm256_add_epi32(_mm256_add_epi32(loadAsInt32x8(s - cn), loadAsInt32x8(s + cn)),
+        _mm256_add_epi32(_mm256_slli_epi32(c, 2), _mm256_slli_epi32(c, 1)));
+}
+
+template<int cn, typename T>
+TARGET_AVX2 inline __m256i pyrUpHorzOdd8(const T* s)
+{
+    return _mm256_slli_epi32(_mm256_add_epi32(loadAsInt32x8(s), loadAsInt32x8(s + cn)), 2);
+}
+
+// Horizontal convolution and upsampling of a 1 channel row, 8 src elements per iteration.
+// Even and odd results are interleaved by unpacks within the 128 bit lanes and a lane permute.
+// Starts from src element x, which should be at least 1, and returns the first element not processed.
+template<typename T>
+TARGET_AVX2 int pyrUpRowAVX2_1(const T* src, int* row, int x, int srcWidth)
+{
+    for( ; x + 9 <= srcWidth; x += 8 )
+    {
+        const T* s = src + x;
+        __m256i e = pyrUpHorzEven8<1>(s), o = pyrUpHorzOdd8<1>(s);
+        __m256i lo = _mm256_unpacklo_epi32(e, o), hi = _mm256_unpackhi_epi32(e, o);
+        _mm256_storeu_si256((__m256i*)(row + x*2), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(row + x*2 + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    return x;
+}
+
+// Horizontal convolution and upsampling of a 4 channel row, 2 src pixels per iteration.
+// The even and odd results of each src pixel are neighbouring dst pixels, 
+// so the 128 bit lanes holding them are joined by lane permutes.
+// Starts from src element x, which should be at least 4, and returns the first element not processed.
+template<typename T>
+TARGET_AVX2 int pyrUpRowAVX2_4(const T* src, int* row, int x, int srcWidth)
+{
+    for( ; x + 12 <= srcWidth; x += 8 )
+    {
+        const T* s = src + x;
+        __m256i e = pyrUpHorzEven8<4>(s), o = pyrUpHorzOdd8<4>(s);
+        _mm256_storeu_si256((__m256i*)(row + x*2), _mm256_permute2x128_si256(e, o, 0x20));
+        _mm256_storeu_si256((__m256i*)(row + x*2 + 8), _mm256_permute2x128_si256(e, o, 0x31));
+    }
+    return x;
+}
+
+// Horizontal convolution and upsampling of a 3 channel row, 4 src pixels per iteration.
+// Even and odd results E and O of src elements x to x + 11 are interleaved pixel by pixel 
+// to E0 E1 E2 O0 O1 O2 E3 ... O11 by permutes and blends.
+// Starts from src element x, which should be at least 3, and returns the first element not processed.
+template<typename T>
+TARGET_AVX2 int pyrUpRowAVX2_3(const T* src, int* row, int x, int srcWidth)
+{
+    const __m256i permE0 = _mm256_setr_epi32(0, 1, 2, 0, 0, 0, 3, 4), permO0 = _mm256_setr_epi32(0, 0, 0, 0, 1, 2, 0, 0);
+    const __m256i permE1 = _mm256_setr_epi32(0, 0, 0, 0, 1, 2, 3, 0), permO1 = _mm256_setr_epi32(0, 0, 1, 2, 0, 0, 0, 3);
+    const __m256i permE2 = _mm256_setr_epi32(0, 0, 0, 1, 2, 0, 0, 0), permO2 = _mm256_setr_epi32(0, 1, 0, 0, 0, 2, 3, 4);
+    for( ; x + 20 <= srcWidth; x += 12 )
+    {
+        const T* s = src + x;
+        __m256i r0 = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(pyrUpHorzEven8<3>(s), permE0),
+            _mm256_permutevar8x32_epi32(pyrUpHorzOdd8<3>(s), permO0), 0x38);
+        __m256i r1 = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(pyrUpHorzEven8<3>(s + 5), permE1),
+            _mm256_permutevar8x32_epi32(pyrUpHorzOdd8<3>(s + 3), permO1), 0x8E);
+        __m256i r2 = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(pyrUpHorzEven8<3>(s + 9), permE2),
+            _mm256_permutevar8x32_epi32(pyrUpHorzOdd8<3>(s + 7), permO2), 0xE3);
+        _mm256_storeu_si256((__m256i*)(row + x*2), r0);
+        _mm256_storeu_si256((__m256i*)(row + x*2 + 8), r1);
+        _mm256_storeu_si256((__m256i*)(row + x*2 + 16), r2);
+    }
+    return x;
+}
+
+template<typename T, typename WT>
+inline int pyrUpRowVec(const T*, WT*, int x, int, int)
+{
+    return x;
+}
+
+template<typename T>
+inline int pyrUpRowVec(const T* src, int* row, int x, int srcWidth, int cn)
+{
+    if( !pyramidUseAVX2() )
+        return x;
+    if( cn == 1 )
+        return pyrUpRowAVX2_1(src, row, x, srcWidth);
+    if( cn == 3 )
+        return pyrUpRowAVX2_3(src, row, x, srcWidth);
+    if( cn == 4 )
+        return pyrUpRowAVX2_4(src, row, x, srcWidth);
+    return x;
+}
+
+template<typename T>
+TARGET_AVX2 int pyrUpVertAVX2(int** src, T* dst0, T* dst1, int width)
+{
+    int x = 0;
+    const int *row0 = src[0], *row1 = src[1], *row2 = src[2];
+    const __m256i delta = _mm256_set1_epi32(32);
+    for( ; x <= width - 8; x += 8 )
+    {
+        __m256i r0, r1, r2, t0, t1;
+        r0 = _mm256_loadu_si256((const __m256i*)(row0 + x));
+        r1 = _mm256_loadu_si256((const __m256i*)(row1 + x));
+        r2 = _mm256_loadu_si256((const __m256i*)(row2 + x));
+        t1 = _mm256_slli_epi32(_mm256_add_epi32(r1, r2), 2);
+        t0 = _mm256_add_epi32(_mm256_add_epi32(r0, r2), _mm256_add_epi32(_mm256_slli_epi32(r1, 2), _mm256_slli_epi32(r1, 1)));
+        t1 = _mm256_srai_epi32(_mm256_add_epi32(t1, delta), 6);
+        t0 = _mm256_srai_epi32(_mm256_add_epi32(t0, delta), 6);
+        // dst1 is the same as dst0 for the last row of an odd height dst, in which case t0 should be kept.
+        storeFromInt32x8(dst1 + x, t1);
+        storeFromInt32x8(dst0 + x, t0);
+    }
+    return x;
+}
+
+template<typename T> struct PyrUpVec_32s
+{
+    int operator()(int** src, T* dst0, T* dst1, int width) const
+    {
+        return pyramidUseAVX2() ? pyrUpVertAVX2(src, dst0, dst1, width) : 0;
+    }
+};
+
+template<typename T> struct PyrDownVec_32sFixPt
+{
+    int operator()(int** src, T* dst, int, int width) const
+    {
+        return pyramidUseAVX2() ? pyrDownVertCastAVX2(src, dst, width) : 0;
+    }
+};
 
 struct PyrDownVec_32s
 {
     int operator()(int** src, int* dst, int, int width) const
     {
+        int x = pyramidUseAVX2() ? pyrDownVertAVX2(src, dst, width) : 0;
         if( !cv::checkHardwareSupport(CV_CPU_SSE2) )
-            return 0;
+            return x;
 
-        int x = 0;
         const int *row0 = src[0], *row1 = src[1], *row2 = src[2], *row3 = src[3], *row4 = src[4];
         __m128i delta = _mm_set1_epi16(128);
 
@@ -32,12 +371,14 @@ struct PyrDownVec_32s
     }
 };
 
+// Computes rows [dstRowBeg, dstRowEnd) of the result of size dsize, and writes them
+// to _dst starting from its first row. Row i of _src holds row srcRowOfs + i of the source of size ssize.
 template<typename SrcElemType> void
-pyrDown_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorderType )
+pyrDownRows_( const cv::Mat& _src, cv::Size ssize, int srcRowOfs, cv::Mat& _dst, cv::Size dsize, 
+    int dstRowBeg, int dstRowEnd, int horiBorderType, int vertBorderType )
 {
     const int PD_SZ = 5;
 
-    cv::Size ssize = _src.size(), dsize = _dst.size();
     int cn = _src.channels();
     int bufstep = (int)cv::alignSize(dsize.width*cn, 16);
     cv::AutoBuffer<int> _buf(bufstep*PD_SZ + 16);
@@ -49,7 +390,7 @@ pyrDown_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorder
 
     CV_Assert( std::abs(dsize.width*2 - ssize.width) <= 2 &&
                std::abs(dsize.height*2 - ssize.height) <= 2 );
-    int k, x, sy0 = -PD_SZ/2, sy = sy0, width0 = std::min((ssize.width-PD_SZ/2-1)/2 + 1, dsize.width);
+    int k, x, sy0 = dstRowBeg*2 - PD_SZ/2, sy = sy0, width0 = std::min((ssize.width-PD_SZ/2-1)/2 + 1, dsize.width);
 
     for( x = 0; x <= PD_SZ+1; x++ )
     {
@@ -71,9 +412,9 @@ pyrDown_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorder
 
     PyrDownVec_32s vecOp;
 
-    for( int y = 0; y < dsize.height; y++ )
+    for( int y = dstRowBeg; y < dstRowEnd; y++ )
     {
-        int* dst = (int*)(_dst.data + _dst.step*y);
+        int* dst = (int*)(_dst.data + _dst.step*(y - dstRowBeg));
         int *row0, *row1, *row2, *row3, *row4;
 
         // fill the ring buffer (horizontal convolution and decimation)
@@ -81,7 +422,7 @@ pyrDown_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorder
         {
             int* row = buf + ((sy - sy0) % PD_SZ)*bufstep;
             int _sy = cv::borderInterpolate(sy, ssize.height, vertBorderType);
-            const SrcElemType* src = (const SrcElemType*)(_src.data + _src.step*_sy);
+            const SrcElemType* src = (const SrcElemType*)(_src.data + _src.step*(_sy - srcRowOfs));
             int limit = cn;
             const int* tab = tabL;
 
@@ -98,12 +439,14 @@ pyrDown_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorder
 
                 if( cn == 1 )
                 {
+                    x = pyrDownRowVec(src, row, x, width0, ssize.width, cn);
                     for( ; x < width0; x++ )
                         row[x] = src[x*2]*6 + (src[x*2 - 1] + src[x*2 + 1])*4 +
                             src[x*2 - 2] + src[x*2 + 2];
                 }
                 else if( cn == 3 )
                 {
+                    x = pyrDownRowVec(src, row, x, width0, ssize.width, cn);
                     for( ; x < width0; x += 3 )
                     {
                         const SrcElemType* s = src + x*2;
@@ -115,6 +458,7 @@ pyrDown_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorder
                 }
                 else if( cn == 4 )
                 {
+                    x = pyrDownRowVec(src, row, x, width0, ssize.width, cn);
                     for( ; x < width0; x += 4 )
                     {
                         const SrcElemType* s = src + x*2;
@@ -152,6 +496,12 @@ pyrDown_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorder
     }
 }
 
+template<typename SrcElemType> void
+pyrDown_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorderType )
+{
+    pyrDownRows_<SrcElemType>(_src, _src.size(), 0, _dst, _dst.size(), 0, _dst.rows, horiBorderType, vertBorderType);
+}
+
 typedef void (*PyrFuncTo32S)(const cv::Mat&, cv::Mat&, int, int);
 
 void pyramidDownTo32S( const cv::Mat& src, cv::Mat& dst, const cv::Size& _dsz, int horiBorderType, int vertBorderType )
@@ -175,6 +525,31 @@ void pyramidDownTo32S( const cv::Mat& src, cv::Mat& dst, const cv::Size& _dsz, i
     func( src, dst, horiBorderType, vertBorderType );
 }
 
+typedef void (*PyrRowsFuncTo32S)(const cv::Mat&, cv::Size, int, cv::Mat&, cv::Size, int, int, int, int);
+
+void pyramidDownTo32SRows(const cv::Mat& src, const cv::Size& srcSize, int srcRowOfs,
+    cv::Mat& dst, const cv::Size& dstSize, int dstRowBeg, int dstRowEnd, int horiBorderType, int vertBorderType)
+{
+    CV_Assert(horiBorderType == cv::BORDER_DEFAULT || horiBorderType == cv::BORDER_WRAP);
+    CV_Assert(vertBorderType == cv::BORDER_DEFAULT || vertBorderType == cv::BORDER_WRAP);
+    CV_Assert(src.cols == srcSize.width && srcRowOfs >= 0 && srcRowOfs + src.rows <= srcSize.height);
+    CV_Assert(dstRowBeg >= 0 && dstRowBeg < dstRowEnd && dstRowEnd <= dstSize.height);
+    dst.create(dstRowEnd - dstRowBeg, dstSize.width, CV_MAKETYPE(CV_32S, src.channels()));
+
+    int depth = src.depth();
+    PyrRowsFuncTo32S func = 0;
+    if( depth == CV_8U )
+        func = pyrDownRows_<uchar>;
+    else if( depth == CV_16S )
+        func = pyrDownRows_<short>;
+    else if( depth == CV_16U )
+        func = pyrDownRows_<unsigned short>;
+    else
+        CV_Error( CV_StsUnsupportedFormat, "" );
+
+    func( src, srcSize, srcRowOfs, dst, dstSize, dstRowBeg, dstRowEnd, horiBorderType, vertBorderType );
+}
+
 template<typename T, int shift> struct FixPtCast
 {
     typedef int type1;
@@ -192,6 +567,7 @@ template<typename T, int shift> struct FltCast
 template<typename T1, typename T2> struct NoVec
 {
     int operator()(T1**, T2*, int, int) const { return 0; }
+    int operator()(T1**, T2*, T2*, int) const { return 0; }
 };
 
 #define CV_SSE2 1
@@ -384,12 +760,14 @@ pyrDown_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorder
 
                 if( cn == 1 )
                 {
+                    x = pyrDownRowVec(src, row, x, width0, ssize.width, cn);
                     for( ; x < width0; x++ )
                         row[x] = src[x*2]*6 + (src[x*2 - 1] + src[x*2 + 1])*4 +
                             src[x*2 - 2] + src[x*2 + 2];
                 }
                 else if( cn == 3 )
                 {
+                    x = pyrDownRowVec(src, row, x, width0, ssize.width, cn);
                     for( ; x < width0; x += 3 )
                     {
                         const T* s = src + x*2;
@@ -401,6 +779,7 @@ pyrDown_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorder
                 }
                 else if( cn == 4 )
                 {
+                    x = pyrDownRowVec(src, row, x, width0, ssize.width, cn);
                     for( ; x < width0; x += 4 )
                     {
                         const T* s = src + x*2;
@@ -438,14 +817,17 @@ pyrDown_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorder
     }
 }
 
+// Computes rows [dstRowBeg, dstRowEnd) of the result of size dsize, and writes them
+// to _dst starting from its first row, dstRowBeg should be even. 
+// Row i of _src holds row srcRowOfs + i of the source of size ssize.
 template<class CastOp, class VecOp> void
-pyrUp_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorderType )
+pyrUpRows_( const cv::Mat& _src, cv::Size ssize, int srcRowOfs, cv::Mat& _dst, cv::Size dsize, 
+    int dstRowBeg, int dstRowEnd, int horiBorderType, int vertBorderType )
 {
     const int PU_SZ = 3;
     typedef typename CastOp::type1 WT;
     typedef typename CastOp::rtype T;
 
-    cv::Size ssize = _src.size(), dsize = _dst.size();
     int cn = _src.channels();
     int bufstep = (int)cv::alignSize((dsize.width+1)*cn, 16);
     cv::AutoBuffer<WT> _buf(bufstep*PU_SZ + 16);
@@ -458,7 +840,8 @@ pyrUp_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorderTy
 
     CV_Assert( std::abs(dsize.width - ssize.width*2) == dsize.width % 2 &&
                std::abs(dsize.height - ssize.height*2) == dsize.height % 2);
-    int k, x, sy0 = -PU_SZ/2, sy = sy0;
+    int srcRowBeg = dstRowBeg / 2, srcRowEnd = (dstRowEnd + 1) / 2;
+    int k, x, sy0 = srcRowBeg - PU_SZ/2, sy = sy0;
 
     int lx = cv::borderInterpolate(-1, ssize.width, horiBorderType) * cn;
     int rx = cv::borderInterpolate(ssize.width, ssize.width, horiBorderType) * cn;
@@ -471,13 +854,13 @@ pyrUp_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorderTy
     for( x = 0; x < ssize.width; x++ )
         dtab[x] = (x/cn)*2*cn + x % cn;
 
-    for( int y = 0; y < ssize.height; y++ )
+    for( int y = srcRowBeg; y < srcRowEnd; y++ )
     {
-        T* dst0 = (T*)(_dst.data + _dst.step*y*2);
-        T* dst1 = (T*)(_dst.data + _dst.step*(y*2+1));
+        T* dst0 = (T*)(_dst.data + _dst.step*(y*2 - dstRowBeg));
+        T* dst1 = (T*)(_dst.data + _dst.step*(y*2+1 - dstRowBeg));
         WT *row0, *row1, *row2;
 
-        if( y*2+1 >= dsize.height )
+        if( y*2+1 >= dstRowEnd )
             dst1 = dst0;
 
         // fill the ring buffer (horizontal convolution and decimation)
@@ -486,7 +869,7 @@ pyrUp_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorderTy
             WT* row = buf + ((sy - sy0) % PU_SZ)*bufstep;
             //int _sy = cv::borderInterpolate(sy*2, dsize.height, cv::BORDER_REFLECT_101)/2;
             int _sy = cv::borderInterpolate(sy, ssize.height, vertBorderType/*cv::BORDER_REFLECT_101*/);
-            const T* src = (const T*)(_src.data + _src.step*_sy);
+            const T* src = (const T*)(_src.data + _src.step*(_sy - srcRowOfs));
 
             if( ssize.width == cn )
             {
@@ -510,7 +893,8 @@ pyrUp_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorderTy
                 //printf("[%d, %d, %d], [%d, %d]\n", sx - cn, sx, rx + x, sx, rx + x);
             }
 
-            for( x = cn; x < ssize.width - cn; x++ )
+            x = pyrUpRowVec(src, row, cn, ssize.width, cn);
+            for( ; x < ssize.width - cn; x++ )
             {
                 int dx = dtab[x];
                 WT t0 = src[x-cn] + src[x]*6 + src[x+cn];
@@ -525,7 +909,7 @@ pyrUp_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorderTy
             rows[k] = buf + ((y - PU_SZ/2 + k - sy0) % PU_SZ)*bufstep;
         row0 = rows[0]; row1 = rows[1]; row2 = rows[2];
 
-        x = vecOp(rows, dst0, (int)_dst.step, dsize.width);
+        x = vecOp(rows, dst0, dst1, dsize.width);
         for( ; x < dsize.width; x++ )
         {
             T t1 = castOp((row1[x] + row2[x])*4);
@@ -535,6 +919,12 @@ pyrUp_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorderTy
     }
 }
 
+template<class CastOp, class VecOp> void
+pyrUp_( const cv::Mat& _src, cv::Mat& _dst, int horiBorderType, int vertBorderType )
+{
+    pyrUpRows_<CastOp, VecOp>(_src, _src.size(), 0, _dst, _dst.size(), 0, _dst.rows, horiBorderType, vertBorderType);
+}
+
 typedef void (*PyrFunc)(const cv::Mat&, cv::Mat&, int, int);
 
 void pyramidDown( const cv::Mat& src, cv::Mat& dst, const cv::Size& _dsz, 
@@ -550,11 +940,11 @@ void pyramidDown( const cv::Mat& src, cv::Mat& dst, const cv::Size& _dsz,
     if( depth == CV_8U )
         func = pyrDown_<FixPtCast<uchar, 8>, PyrDownVec_32s8u>;
     else if( depth == CV_16S )
-        func = pyrDown_<FixPtCast<short, 8>, NoVec<int, short> >;
+        func = pyrDown_<FixPtCast<short, 8>, PyrDownVec_32sFixPt<short> >;
     else if( depth == CV_16U )
-        func = pyrDown_<FixPtCast<ushort, 8>, NoVec<int, ushort> >;
+        func = pyrDown_<FixPtCast<ushort, 8>, PyrDownVec_32sFixPt<ushort> >;
     else if( depth == CV_32S )
-        func = pyrDown_<FixPtCast<int, 8>, NoVec<int, int> >;
+        func = pyrDown_<FixPtCast<int, 8>, PyrDownVec_32sFixPt<int> >;
     else if( depth == CV_32F )
         func = pyrDown_<FltCast<float, 8>, PyrDownVec_32f>;
     else if( depth == CV_64F )
@@ -576,13 +966,13 @@ void pyramidUp( const cv::Mat& src, cv::Mat& dst, const cv::Size& _dsz,
     int depth = src.depth();
     PyrFunc func = 0;
     if( depth == CV_8U )
-        func = pyrUp_<FixPtCast<uchar, 6>, NoVec<int, uchar> >;
+        func = pyrUp_<FixPtCast<uchar, 6>, PyrUpVec_32s<uchar> >;
     else if( depth == CV_16S )
-        func = pyrUp_<FixPtCast<short, 6>, NoVec<int, short> >;
+        func = pyrUp_<FixPtCast<short, 6>, PyrUpVec_32s<short> >;
     else if( depth == CV_16U )
-        func = pyrUp_<FixPtCast<ushort, 6>, NoVec<int, ushort> >;
+        func = pyrUp_<FixPtCast<ushort, 6>, PyrUpVec_32s<ushort> >;
     else if( depth == CV_32S )
-        func = pyrUp_<FixPtCast<int, 6>, NoVec<int, int> >;
+        func = pyrUp_<FixPtCast<int, 6>, PyrUpVec_32s<int> >;
     else if( depth == CV_32F )
         func = pyrUp_<FltCast<float, 6>, NoVec<float, float> >;
     else if( depth == CV_64F )
@@ -591,4 +981,35 @@ void pyramidUp( const cv::Mat& src, cv::Mat& dst, const cv::Size& _dsz,
         CV_Error( CV_StsUnsupportedFormat, "" );
 
     func( src, dst, horiBorderType, vertBorderType );
-}
\ No newline at end of file
+}
+
+typedef void (*PyrRowsFunc)(const cv::Mat&, cv::Size, int, cv::Mat&, cv::Size, int, int, int, int);
+
+void pyramidUpRows(const cv::Mat& src, const cv::Size& srcSize, int srcRowOfs,
+    cv::Mat& dst, const cv::Size& dstSize, int dstRowBeg, int dstRowEnd, int horiBorderType, int vertBorderType)
+{
+    CV_Assert(horiBorderType == cv::BORDER_DEFAULT || horiBorderType == cv::BORDER_WRAP);
+    CV_Assert(vertBorderType == cv::BORDER_DEFAULT || vertBorderType == cv::BORDER_WRAP);
+    CV_Assert(src.cols == srcSize.width && srcRowOfs >= 0 && srcRowOfs + src.rows <= srcSize.height);
+    CV_Assert(dstRowBeg >= 0 && (dstRowBeg & 1) == 0 && dstRowBeg < dstRowEnd && dstRowEnd <= dstSize.height);
+    dst.create(dstRowEnd - dstRowBeg, dstSize.width, src.type());
+
+    int depth = src.depth();
+    PyrRowsFunc func = 0;
+    if( depth == CV_8U )
+        func = pyrUpRows_<FixPtCast<uchar, 6>, PyrUpVec_32s<uchar> >;
+    else if( depth == CV_16S )
+        func = pyrUpRows_<FixPtCast<short, 6>, PyrUpVec_32s<short> >;
+    else if( depth == CV_16U )
+        func = pyrUpRows_<FixPtCast<ushort, 6>, PyrUpVec_32s<ushort> >;
+    else if( depth == CV_32S )
+        func = pyrUpRows_<FixPtCast<int, 6>, PyrUpVec_32s<int> >;
+    else if( depth == CV_32F )
+        func = pyrUpRows_<FltCast<float, 6>, NoVec<float, float> >;
+    else if( depth == CV_64F )
+        func = pyrUpRows_<FltCast<double, 6>, NoVec<double, double> >;
+    else
+        CV_Error( CV_StsUnsupportedFormat, "" );
+
+    func( src, srcSize, srcRowOfs, dst, dstSize, dstRowBeg, dstRowEnd, horiBorderType, vertBorderType );
+}
@@ -13,6 +13,26 @@ void pyramidDown(const cv::Mat& src, cv::Mat& dst, const cv::Size& dstsize = cv:
 void pyramidUp(const cv::Mat& src, cv::Mat& dst, const cv::Size& dstsize = cv::Size(), 
     int horiBorderType = cv::BORDER_DEFAULT, int vertBorderType = cv::BORDER_DEFAULT);
 
+//! switches the AVX2 kernels of pyramidDownTo32S, pyramidDown and pyramidUp on or off, they are on by default
+//! and only used if the cpu supports AVX2
+void setPyramidUseSIMD(bool useSIMD);
+
+//! smooths and downsamples the image, only rows [dstRowBeg, dstRowEnd) of the result of size dstSize
+//! are computed and written to dst. src holds rows [srcRowOfs, srcRowOfs + src.rows) of the source
+//! of size srcSize, which should cover the source rows the computed rows depend on.
+//! The result is the same as the corresponding rows of pyramidDownTo32S.
+void pyramidDownTo32SRows(const cv::Mat& src, const cv::Size& srcSize, int srcRowOfs,
+    cv::Mat& dst, const cv::Size& dstSize, int dstRowBeg, int dstRowEnd,
+    int horiBorderType = cv::BORDER_DEFAULT, int vertBorderType = cv::BORDER_DEFAULT);
+
+//! upsamples and smoothes the image, only rows [dstRowBeg, dstRowEnd) of the result of size dstSize
+//! are computed and written to dst, dstRowBeg should be even. src holds rows [srcRowOfs, srcRowOfs + src.rows)
+//! of the source of size srcSize, which should cover the source rows the computed rows depend on.
+//! The result is the same as the corresponding rows of pyramidUp.
+void pyramidUpRows(const cv::Mat& src, const cv::Size& srcSize, int srcRowOfs,
+    cv::Mat& dst, const cv::Size& dstSize, int dstRowBeg, int dstRowEnd,
+    int horiBorderType = cv::BORDER_DEFAULT, int vertBorderType = cv::BORDER_DEFAULT);
+
 //! smooths and downsamples the image
 void pyramidDownTo32S(const cv::Mat& src, cv::Mat& dst, void* aux1, void* aux2, const cv::Size& dstsize = cv::Size(),
     int horiBorderType = cv::BORDER_DEFAULT, int vertBorderType = cv::BORDER_DEFAULT);
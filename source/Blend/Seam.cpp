@@ -1,17 +1,124 @@
-﻿#include "gcgraph.hpp"
+﻿#include "GridMaxFlow.h"
 #include "ZBlendAlgo.h"
 #include "SeamVisualizer.h"
 #include "opencv2/imgproc.hpp"
 #include "opencv2/highgui.hpp"
+#include <mutex>
+#include <tmmintrin.h>
+#include <immintrin.h>
 
 #define SHOW_SEAM 0
 
-static void calcRGBColorDiff(const cv::Mat& img1, const cv::Mat& img2, cv::Mat& diff)
+// SSSE3 and AVX2 kernels of calcRGBColorDiff. 16 pixels are split into channels by byte shuffles,
+// the squared channel differences are summed as 32 bit integers and converted to float before
+// the square root, so the results are bit-exact with the scalar code.
+
+#if defined(__GNUC__)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#endif
+
+static int seamCostUseSIMD = 1;
+
+void setSeamCostUseSIMD(bool useSIMD)
+{
+    seamCostUseSIMD = useSIMD;
+}
+
+// Absolute differences of channel 0, 1 and 2 of 16 pixels of ptr1 and ptr2.
+TARGET_SSSE3 static inline void absDiff16x3(const unsigned char* ptr1, const unsigned char* ptr2, 
+    __m128i& diff0, __m128i& diff1, __m128i& diff2)
+{
+    const __m128i shuf00 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i shuf01 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i shuf02 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i shuf10 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i shuf11 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i shuf12 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i shuf20 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i shuf21 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i shuf22 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+
+    __m128i a0 = _mm_loadu_si128((const __m128i*)ptr1);
+    __m128i a1 = _mm_loadu_si128((const __m128i*)(ptr1 + 16));
+    __m128i a2 = _mm_loadu_si128((const __m128i*)(ptr1 + 32));
+    __m128i b0 = _mm_loadu_si128((const __m128i*)ptr2);
+    __m128i b1 = _mm_loadu_si128((const __m128i*)(ptr2 + 16));
+    __m128i b2 = _mm_loadu_si128((const __m128i*)(ptr2 + 32));
+    // Per byte absolute difference first, the channels are split afterwards
+    __m128i d0 = _mm_or_si128(_mm_subs_epu8(a0, b0), _mm_subs_epu8(b0, a0));
+    __m128i d1 = _mm_or_si128(_mm_subs_epu8(a1, b1), _mm_subs_epu8(b1, a1));
+    __m128i d2 = _mm_or_si128(_mm_subs_epu8(a2, b2), _mm_subs_epu8(b2, a2));
+    diff0 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(d0, shuf00), _mm_shuffle_epi8(d1, shuf01)), _mm_shuffle_epi8(d2, shuf02));
+    diff1 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(d0, shuf10), _mm_shuffle_epi8(d1, shuf11)), _mm_shuffle_epi8(d2, shuf12));
+    diff2 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(d0, shuf20), _mm_shuffle_epi8(d1, shuf21)), _mm_shuffle_epi8(d2, shuf22));
+}
+
+// Returns the number of pixels processed, the rest of the row is left to the scalar code.
+// The row kernels, calcRGBColorDiff and downDiff are not static so that TestSeamCostSIMD can check them.
+TARGET_SSSE3 int calcRGBColorDiffRowSSSE3(const unsigned char* ptr1, const unsigned char* ptr2, float* ptr, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x <= width - 16; x += 16)
+    {
+        __m128i diff0, diff1, diff2;
+        absDiff16x3(ptr1 + x * 3, ptr2 + x * 3, diff0, diff1, diff2);
+        for (int k = 0; k < 2; k++)
+        {
+            __m128i d0 = k ? _mm_unpackhi_epi8(diff0, zero) : _mm_unpacklo_epi8(diff0, zero);
+            __m128i d1 = k ? _mm_unpackhi_epi8(diff1, zero) : _mm_unpacklo_epi8(diff1, zero);
+            __m128i d2 = k ? _mm_unpackhi_epi8(diff2, zero) : _mm_unpacklo_epi8(diff2, zero);
+            __m128i d01 = _mm_unpacklo_epi16(d0, d1), d2z = _mm_unpacklo_epi16(d2, zero);
+            __m128i sum = _mm_add_epi32(_mm_madd_epi16(d01, d01), _mm_madd_epi16(d2z, d2z));
+            _mm_storeu_ps(ptr + x + k * 8, _mm_sqrt_ps(_mm_cvtepi32_ps(sum)));
+            d01 = _mm_unpackhi_epi16(d0, d1);
+            d2z = _mm_unpackhi_epi16(d2, zero);
+            sum = _mm_add_epi32(_mm_madd_epi16(d01, d01), _mm_madd_epi16(d2z, d2z));
+            _mm_storeu_ps(ptr + x + k * 8 + 4, _mm_sqrt_ps(_mm_cvtepi32_ps(sum)));
+        }
+    }
+    return x;
+}
+
+TARGET_AVX2 int calcRGBColorDiffRowAVX2(const unsigned char* ptr1, const unsigned char* ptr2, float* ptr, int width)
+{
+    int x = 0;
+    for (; x <= width - 16; x += 16)
+    {
+        __m128i diff0, diff1, diff2;
+        absDiff16x3(ptr1 + x * 3, ptr2 + x * 3, diff0, diff1, diff2);
+        __m256i d0 = _mm256_cvtepu8_epi16(diff0);
+        __m256i d1 = _mm256_cvtepu8_epi16(diff1);
+        __m256i d2 = _mm256_cvtepu8_epi16(diff2);
+        __m256i zero = _mm256_setzero_si256();
+        // Unpacking works within 128 bit lanes, lo holds pixels 0-3 and 8-11, hi holds pixels 4-7 and 12-15
+        __m256i d01 = _mm256_unpacklo_epi16(d0, d1), d2z = _mm256_unpacklo_epi16(d2, zero);
+        __m256i lo = _mm256_add_epi32(_mm256_madd_epi16(d01, d01), _mm256_madd_epi16(d2z, d2z));
+        d01 = _mm256_unpackhi_epi16(d0, d1);
+        d2z = _mm256_unpackhi_epi16(d2, zero);
+        __m256i hi = _mm256_add_epi32(_mm256_madd_epi16(d01, d01), _mm256_madd_epi16(d2z, d2z));
+        _mm256_storeu_ps(ptr + x, _mm256_sqrt_ps(_mm256_cvtepi32_ps(_mm256_permute2x128_si256(lo, hi, 0x20))));
+        _mm256_storeu_ps(ptr + x + 8, _mm256_sqrt_ps(_mm256_cvtepi32_ps(_mm256_permute2x128_si256(lo, hi, 0x31))));
+    }
+    return x;
+}
+
+void calcRGBColorDiff(const cv::Mat& img1, const cv::Mat& img2, cv::Mat& diff)
 {
     CV_Assert(img1.data && img1.type() == CV_8UC3 &&
         img2.data && img2.type() == CV_8UC3 &&
         img1.size() == img2.size());
 
+    int (*calcRow)(const unsigned char*, const unsigned char*, float*, int) = 0;
+    if (seamCostUseSIMD && cv::checkHardwareSupport(CV_CPU_AVX2))
+        calcRow = calcRGBColorDiffRowAVX2;
+    else if (seamCostUseSIMD && cv::checkHardwareSupport(CV_CPU_SSSE3))
+        calcRow = calcRGBColorDiffRowSSSE3;
+
     int width = img1.cols, height = img1.rows;
     diff.create(height, width, CV_32FC1);
     for (int i = 0; i < height; i++)
@@ -19,7 +126,11 @@ static void calcRGBColorDiff(const cv::Mat& img1, const cv::Mat& img2, cv::Mat&
         const unsigned char* ptr1 = img1.ptr<unsigned char>(i);
         const unsigned char* ptr2 = img2.ptr<unsigned char>(i);
         float* ptr = diff.ptr<float>(i);
-        for (int j = 0; j < width; j++)
+        int j = calcRow ? calcRow(ptr1, ptr2, ptr, width) : 0;
+        ptr1 += j * 3;
+        ptr2 += j * 3;
+        ptr += j;
+        for (; j < width; j++)
         {
             int diff0 = int(ptr1[0]) - int(ptr2[0]);
             int diff1 = int(ptr1[1]) - int(ptr2[1]);
@@ -162,19 +273,66 @@ static void showFloatMat(const std::string& winName, const cv::Mat& image)
     cv::imshow(winName, image / maxVal);
 }
 
-static void findSeam(const cv::Mat& diff, cv::Mat& mask1, cv::Mat& mask2, 
+static int seamUseGridMaxFlow = 1;
+
+void setSeamUseGridMaxFlow(bool useGridMaxFlow)
+{
+    seamUseGridMaxFlow = useGridMaxFlow;
+}
+
+// Solvers are kept after use so that the storage of GridBKMaxFlow is reused by later seams.
+// Seams may be searched concurrently, each search takes a solver of its own.
+// At most one solver per thread is kept, and a solver whose storage grew beyond
+// maxPooledMaxFlowBytes on a large seam is freed rather than kept.
+static const size_t maxPooledMaxFlowBytes = 64 << 20;
+static std::mutex mtxMaxFlowPool;
+static std::vector<std::unique_ptr<GridMaxFlow> > maxFlowPool;
+
+static std::unique_ptr<GridMaxFlow> acquireMaxFlow()
+{
+    if (!seamUseGridMaxFlow)
+        return std::unique_ptr<GridMaxFlow>(new GCGraphMaxFlow);
+
+    std::lock_guard<std::mutex> lg(mtxMaxFlowPool);
+    if (maxFlowPool.empty())
+        return std::unique_ptr<GridMaxFlow>(new GridBKMaxFlow);
+    std::unique_ptr<GridMaxFlow> solver = std::move(maxFlowPool.back());
+    maxFlowPool.pop_back();
+    return solver;
+}
+
+static void releaseMaxFlow(std::unique_ptr<GridMaxFlow>& solver)
+{
+    GridBKMaxFlow* gridSolver = dynamic_cast<GridBKMaxFlow*>(solver.get());
+    if (!gridSolver || gridSolver->getMemorySize() > maxPooledMaxFlowBytes)
+        return;
+
+    std::lock_guard<std::mutex> lg(mtxMaxFlowPool);
+    if ((int)maxFlowPool.size() < std::max(cv::getNumThreads(), 1))
+        maxFlowPool.push_back(std::move(solver));
+}
+
+void releaseSeamMaxFlowPool()
+{
+    std::lock_guard<std::mutex> lg(mtxMaxFlowPool);
+    maxFlowPool.clear();
+}
+
+// Builds the graph of diff over the pixels marked non zero in active, all the pixels if active is empty,
+// and splits the active pixels between mask1 and mask2 along the min cut.
+static void findSeamInMaskedROI(const cv::Mat& diff, cv::Mat& mask1, cv::Mat& mask2, const cv::Mat& active,
     float terminalCost, float badRegionPenalty, bool horiWrap)
 {
     CV_Assert(diff.data && diff.type() == CV_32FC1 &&
         mask1.data && mask1.type() == CV_8UC1 &&
         mask2.data && mask2.type() == CV_8UC1 &&
         diff.size() == mask1.size() && diff.size() == mask2.size());
+    CV_Assert(!active.data || (active.type() == CV_8UC1 && active.size() == diff.size()));
 
     int width = diff.cols, height = diff.rows;
 
-    const int vertexCount = height * width;
-    const int edgeCount = (height - 1) * width + (horiWrap ? width : width - 1) * height;
-    GCGraph<float> graph(vertexCount, edgeCount); 
+    std::unique_ptr<GridMaxFlow> graph = acquireMaxFlow();
+    graph->create(height, width, horiWrap, active);
 
     // Set terminal weights
     for (int y = 0; y < height; ++y)
@@ -183,13 +341,12 @@ static void findSeam(const cv::Mat& diff, cv::Mat& mask1, cv::Mat& mask2,
         const unsigned char* ptr2 = mask2.ptr<unsigned char>(y);
         for (int x = 0; x < width; ++x)
         {
-            int v = graph.addVtx();
-            graph.addTermWeights(v, ptr1[x] ? terminalCost : 0.f,
-                                    ptr2[x] ? terminalCost : 0.f);
+            graph->addTermWeights(y, x, ptr1[x] ? terminalCost : 0.f,
+                                        ptr2[x] ? terminalCost : 0.f);
         }
     }
 
-    // Set regular edge weights
+    // Set regular edge weights, edges linked to inactive pixels are ignored by the solver
     const float weightEps = 1.f;
     for (int y = 0; y < height; ++y)
     {
@@ -207,22 +364,14 @@ static void findSeam(const cv::Mat& diff, cv::Mat& mask1, cv::Mat& mask2,
         }
         for (int x = 0; x < width; ++x)
         {
-            int v = y * width + x;
-            if (x < width - 1)
-            {
-                float weight = ptrDiff[x] + ptrDiff[x + 1] + weightEps;
-                if (!ptrMask1[x] || !ptrMask1[x + 1] ||
-                    !ptrMask2[x] || !ptrMask2[x + 1])
-                    weight += badRegionPenalty;
-                graph.addEdges(v, v + 1, weight, weight);
-            }
-            else if (horiWrap)
+            if (x < width - 1 || horiWrap)
             {
-                float weight = ptrDiff[x] + ptrDiff[x - width + 1] + weightEps;
-                if (!ptrMask1[x] || !ptrMask1[x - width + 1] ||
-                    !ptrMask2[x] || !ptrMask2[x - width + 1])
+                int x1 = x < width - 1 ? x + 1 : 0;
+                float weight = ptrDiff[x] + ptrDiff[x1] + weightEps;
+                if (!ptrMask1[x] || !ptrMask1[x1] ||
+                    !ptrMask2[x] || !ptrMask2[x1])
                     weight += badRegionPenalty;
-                graph.addEdges(v, v - width + 1, weight, weight);
+                graph->addRightEdge(y, x, weight);
             }
             if (y < height - 1)
             {
@@ -230,20 +379,23 @@ static void findSeam(const cv::Mat& diff, cv::Mat& mask1, cv::Mat& mask2,
                 if (!ptrMask1[x] || !ptrMask1Next[x] ||
                     !ptrMask2[x] || !ptrMask2Next[x])
                     weight += badRegionPenalty;
-                graph.addEdges(v, v + width, weight, weight);
+                graph->addDownEdge(y, x, weight);
             }
         }
     }
 
-    graph.maxFlow();
+    graph->maxFlow();
 
     for (int y = 0; y < height; ++y)
     {
+        const unsigned char* ptrActive = active.data ? active.ptr<unsigned char>(y) : 0;
         unsigned char* ptrMask1 = mask1.ptr<unsigned char>(y);
         unsigned char* ptrMask2 = mask2.ptr<unsigned char>(y);
         for (int x = 0; x < width; ++x)
         {
-            if (graph.inSourceSegment(y * width + x))
+            if (ptrActive && !ptrActive[x])
+                continue;
+            if (graph->inSourceSegment(y, x))
             {
                 if (ptrMask1[x])
                     ptrMask2[x] = 0;
@@ -255,6 +407,14 @@ static void findSeam(const cv::Mat& diff, cv::Mat& mask1, cv::Mat& mask2,
             }
         }
     }
+
+    releaseMaxFlow(graph);
+}
+
+static void findSeam(const cv::Mat& diff, cv::Mat& mask1, cv::Mat& mask2, 
+    float terminalCost, float badRegionPenalty, bool horiWrap)
+{
+    findSeamInMaskedROI(diff, mask1, mask2, cv::Mat(), terminalCost, badRegionPenalty, horiWrap);
 }
 
 const static float eps32F = std::numeric_limits<float>::epsilon();
@@ -446,178 +606,48 @@ static void upMask(const cv::Mat& src, cv::Mat& dst, int scale, const cv::Size&
     }
 }
 
-static void downDiff(const cv::Mat& src, cv::Mat& dst, int scale)
+// The result is the length x length box blur of src, as cv::blur with the default border,
+// sampled at every scale-th row and column. Only the sampled values are computed,
+// the vertical box sums of the rows around each sampled row are accumulated in one row buffer.
+void downDiff(const cv::Mat& src, cv::Mat& dst, int scale)
 {
     CV_Assert(src.data && src.type() == CV_32FC1);
 
     int length = (scale & 1) ? scale : scale + 1;
-    cv::Mat srcBlur;
-    cv::blur(src, srcBlur, cv::Size(length, length));
-    //cv::imshow("diff blur", srcBlur * (1.0 / 255));
-    //cv::GaussianBlur(src, srcBlur, cv::Size(length, length), length / 6.0, length / 6.0);
+    int radius = length / 2;
     int srcRows = src.rows, srcCols = src.cols;
     int dstRows = (srcRows + scale - 1) / scale, dstCols = (srcCols + scale - 1) / scale;
     dst.create(dstRows, dstCols, CV_32FC1);
-    dst.setTo(0);
-    for (int i = 0; i < dstRows; i++)
-    {
-        const float* ptrSrc = srcBlur.ptr<float>(i * scale);
-        float* ptrDst = dst.ptr<float>(i);
-        for (int j = 0; j < dstCols; j++)
-        {
-            *(ptrDst++) = *ptrSrc;
-            ptrSrc += scale;
-        }
-    }
-}
-
-static int labelIndex(const cv::Mat& mask, cv::Mat& index)
-{
-    CV_Assert(mask.data && mask.type() == CV_8UC1);
-    int rows = mask.rows, cols = mask.cols;
-    index.create(rows, cols, CV_32SC1);
-    int count = 0;
-    for (int i = 0; i < rows; i++)
-    {
-        const unsigned char* ptrMask = mask.ptr<unsigned char>(i);
-        int* ptrIndex = index.ptr<int>(i);
-        for (int j = 0; j < cols; j++)
-        //{
-        //    if (*ptrMask)
-        //    {
-        //        *ptrIndex = count;
-        //        count++;
-        //    }
-        //    else
-        //        *ptrIndex = -1;
-        //    ptrIndex++;
-        //    ptrMask++;
-        //}
-            *(ptrIndex++) = (*(ptrMask++)) ? (count++) : -1;
-    }
-    return count;
-}
-
-static void findSeamInIndexedROI(const cv::Mat& diff, cv::Mat& mask1, cv::Mat& mask2, cv::Mat& index,
-    int num, float terminalCost, float badRegionPenalty, bool horiWrap)
-{
-    CV_Assert(diff.data && diff.type() == CV_32FC1 &&
-        mask1.data && mask1.type() == CV_8UC1 &&
-        mask2.data && mask2.type() == CV_8UC1 &&
-        index.data && index.type() == CV_32SC1 &&
-        diff.size() == mask1.size() && 
-        diff.size() == mask2.size() &&
-        diff.size() == index.size());
-    
-    int width = diff.cols, height = diff.rows;
-
-    const int vertexCount = num;
-    const int edgeCount = 2 * num;
-    GCGraph<float> graph(vertexCount, edgeCount); 
 
-    for (int i = 0; i < num; i++)
-        graph.addVtx();
-
-    // Set terminal weights
-    for (int y = 0; y < height; ++y)
+    std::vector<int> colIndex(dstCols * length);
+    for (int j = 0; j < dstCols; j++)
     {
-        const unsigned char* ptr1 = mask1.ptr<unsigned char>(y);
-        const unsigned char* ptr2 = mask2.ptr<unsigned char>(y);
-        const int* ptrIndex = index.ptr<int>(y);
-        for (int x = 0; x < width; ++x)
-        {
-            int v = ptrIndex[x];
-            if (v >= 0)
-            {
-                graph.addTermWeights(v, ptr1[x] ? terminalCost : 0.f,
-                                        ptr2[x] ? terminalCost : 0.f);
-            }
-        }
+        for (int k = 0; k < length; k++)
+            colIndex[j * length + k] = cv::borderInterpolate(j * scale + k - radius, srcCols, cv::BORDER_DEFAULT);
     }
 
-    // Set regular edge weights
-    const float weightEps = 1.f;
-    for (int y = 0; y < height; ++y)
+    std::vector<float> colSum(srcCols);
+    float normScale = 1.0F / (length * length);
+    for (int i = 0; i < dstRows; i++)
     {
-        const float* ptrDiff = diff.ptr<float>(y);
-        const unsigned char* ptrMask1 = mask1.ptr<unsigned char>(y);
-        const unsigned char* ptrMask2 = mask2.ptr<unsigned char>(y);
-        const int* ptrIndex = index.ptr<int>(y);
-        const float* ptrDiffNext = 0;
-        const unsigned char* ptrMask1Next = 0;
-        const unsigned char* ptrMask2Next = 0;
-        const int* ptrIndexNext = 0;
-        if (y < height - 1)
-        {
-            ptrDiffNext = diff.ptr<float>(y + 1);
-            ptrMask1Next = mask1.ptr<unsigned char>(y + 1);
-            ptrMask2Next = mask2.ptr<unsigned char>(y + 1);
-            ptrIndexNext = index.ptr<int>(y + 1);
-        }
-        for (int x = 0; x < width; ++x)
+        const float* ptrSrc = src.ptr<float>(cv::borderInterpolate(i * scale - radius, srcRows, cv::BORDER_DEFAULT));
+        for (int j = 0; j < srcCols; j++)
+            colSum[j] = ptrSrc[j];
+        for (int k = 1; k < length; k++)
         {
-            if (x < width - 1)
-            {
-                int index = ptrIndex[x], index1 = ptrIndex[x + 1];
-                if (index >= 0 && index1 >= 0)
-                {
-                    float weight = ptrDiff[x] + ptrDiff[x + 1] + weightEps;
-                    if (!ptrMask1[x] || !ptrMask1[x + 1] ||
-                        !ptrMask2[x] || !ptrMask2[x + 1])
-                        weight += badRegionPenalty;
-                    graph.addEdges(index, index1, weight, weight);
-                }
-            }
-            else if (horiWrap)
-            {
-                int index = ptrIndex[x], index1 = ptrIndex[x - width + 1];
-                if (index >= 0 && index1 >= 0)
-                {
-                    float weight = ptrDiff[x] + ptrDiff[x - width + 1] + weightEps;
-                    if (!ptrMask1[x] || !ptrMask1[x - width + 1] ||
-                        !ptrMask2[x] || !ptrMask2[x - width + 1])
-                        weight += badRegionPenalty;
-                    graph.addEdges(index, index1, weight, weight);
-                }
-            }
-            if (y < height - 1)
-            {
-                int index = ptrIndex[x], index1 = ptrIndexNext[x];
-                if (index >= 0 && index1 >= 0)
-                {
-                    float weight = ptrDiff[x] + ptrDiffNext[x] + weightEps;
-                    if (!ptrMask1[x] || !ptrMask1Next[x] ||
-                        !ptrMask2[x] || !ptrMask2Next[x])
-                        weight += badRegionPenalty;
-                    graph.addEdges(index, index1, weight, weight);
-                }
-            }
+            ptrSrc = src.ptr<float>(cv::borderInterpolate(i * scale + k - radius, srcRows, cv::BORDER_DEFAULT));
+            for (int j = 0; j < srcCols; j++)
+                colSum[j] += ptrSrc[j];
         }
-    }
-
-    graph.maxFlow();
 
-    for (int y = 0; y < height; ++y)
-    {
-        unsigned char* ptrMask1 = mask1.ptr<unsigned char>(y);
-        unsigned char* ptrMask2 = mask2.ptr<unsigned char>(y);
-        const int* ptrIndex = index.ptr<int>(y);
-        for (int x = 0; x < width; ++x)
+        float* ptrDst = dst.ptr<float>(i);
+        const int* ptrIndex = &colIndex[0];
+        for (int j = 0; j < dstCols; j++)
         {
-            int index = ptrIndex[x];
-            if (index >= 0)
-            {
-                if (graph.inSourceSegment(index))
-                {
-                    if (ptrMask1[x])
-                        ptrMask2[x] = 0;
-                }
-                else
-                {
-                    if (ptrMask2[x])
-                        ptrMask1[x] = 0;
-                }
-            }
+            float sum = 0;
+            for (int k = 0; k < length; k++)
+                sum += colSum[*(ptrIndex++)];
+            *(ptrDst++) = sum * normScale;
         }
     }
 }
@@ -635,10 +665,8 @@ void findSeamInROI(const cv::Mat& image1, const cv::Mat& image2, const cv::Mat&
         mask1.size() == size && mask2.size() == size);
 
     cv::Mat kern = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(8, 8));
-    cv::Mat dilateMask, index;
+    cv::Mat dilateMask;
     cv::dilate(roi, dilateMask, kern);
-    int num = labelIndex(dilateMask, index);
-    dilateMask.release();
     cv::Mat diff;
     calcColorDiff(image1, image2, diff);
     cv::blur(diff, diff, cv::Size(3, 3));
@@ -646,7 +674,7 @@ void findSeamInROI(const cv::Mat& image1, const cv::Mat& image2, const cv::Mat&
     SeamVisualizer vis(mask1, mask2, diff);
     vis.show("diff without seam");
 #endif
-    findSeamInIndexedROI(diff, mask1, mask2, index, num, 10000, 1000, horiWrap);
+    findSeamInMaskedROI(diff, mask1, mask2, dilateMask, 10000, 1000, horiWrap);
 #if SHOW_SEAM
     vis.drawSeam(mask1, mask2);
     vis.show("diff with seam");
@@ -762,13 +790,11 @@ void findSeamScaleDown(const cv::Mat& image1, const cv::Mat& image2,
     cv::Mat diffROI(diff, roi);
     cv::Mat mask1ROI(mask1, roi);
     cv::Mat mask2ROI(mask2, roi);
-    cv::Mat indexROI;
-    int numIndex = labelIndex(intersectROI, indexROI);
 #if SHOW_SEAM
     SeamVisualizer vis2(mask1ROI, mask2ROI, diffROI);
     vis2.show("large scale diff without seam");
 #endif
-    findSeamInIndexedROI(diffROI, mask1ROI, mask2ROI, indexROI, numIndex, terminalCost, badRegionPenalty, horiWrap);
+    findSeamInMaskedROI(diffROI, mask1ROI, mask2ROI, intersectROI, terminalCost, badRegionPenalty, horiWrap);
 #if SHOW_SEAM
     vis2.drawSeam(mask1ROI, mask2ROI);
     vis2.show("large scale diff with seam");
@@ -782,137 +808,13 @@ static void findSeamLeftRightWrap(const cv::Mat& diff, cv::Mat& mask1, cv::Mat&
     int zeroBegInc, int zeroEndExc, float terminalCost, float badRegionPenalty)
 {
     CV_Assert(diff.data && diff.type() == CV_32FC1 &&
-        mask1.data && mask1.type() == CV_8UC1 &&
-        mask2.data && mask2.type() == CV_8UC1 &&
-        diff.size() == mask1.size() && diff.size() == mask2.size() &&
         zeroBegInc >=0 && zeroEndExc <= diff.cols && zeroBegInc < zeroEndExc);
 
-    int width = diff.cols, height = diff.rows;
-    int rightWidth = width - zeroEndExc;
-    int effectWidth = width - (zeroEndExc - zeroBegInc);
-
-    const int vertexCount = height * effectWidth;
-    const int edgeCount = (height - 1) * effectWidth + (effectWidth - 1) * height;
-    GCGraph<float> graph(vertexCount, edgeCount); 
-
-    // Set terminal weights
-    for (int y = 0; y < height; ++y)
-    {
-        const unsigned char* ptr1 = mask1.ptr<unsigned char>(y);
-        const unsigned char* ptr2 = mask2.ptr<unsigned char>(y);
-        for (int x = zeroEndExc; x < width; ++x)
-        {
-            int v = graph.addVtx();
-            graph.addTermWeights(v, ptr1[x] ? terminalCost : 0.f,
-                                    ptr2[x] ? terminalCost : 0.f);
-        }
-        for (int x = 0; x < zeroBegInc; ++x)
-        {
-            int v = graph.addVtx();
-            graph.addTermWeights(v, ptr1[x] ? terminalCost : 0.f,
-                                    ptr2[x] ? terminalCost : 0.f);
-        }
-    }
-
-    // Set regular edge weights
-    const float weightEps = 1.f;
-    for (int y = 0; y < height; ++y)
-    {
-        const float* ptrDiff = diff.ptr<float>(y);
-        const unsigned char* ptrMask1 = mask1.ptr<unsigned char>(y);
-        const unsigned char* ptrMask2 = mask2.ptr<unsigned char>(y);
-        const float* ptrDiffNext = 0;
-        const unsigned char* ptrMask1Next = 0;
-        const unsigned char* ptrMask2Next = 0;
-        if (y < height - 1)
-        {
-            ptrDiffNext = diff.ptr<float>(y + 1);
-            ptrMask1Next = mask1.ptr<unsigned char>(y + 1);
-            ptrMask2Next = mask2.ptr<unsigned char>(y + 1);
-        }
-        for (int x = zeroEndExc; x < width; ++x)
-        {
-            int v = y * effectWidth + x - zeroEndExc;
-            if (x < width - 1)
-            {
-                float weight = ptrDiff[x] + ptrDiff[x + 1] + weightEps;
-                if (!ptrMask1[x] || !ptrMask1[x + 1] ||
-                    !ptrMask2[x] || !ptrMask2[x + 1])
-                    weight += badRegionPenalty;
-                graph.addEdges(v, v + 1, weight, weight);
-            }
-            else
-            {
-                float weight = ptrDiff[x] + ptrDiff[x - width + 1] + weightEps;
-                if (!ptrMask1[x] || !ptrMask1[x - width + 1] ||
-                    !ptrMask2[x] || !ptrMask2[x - width + 1])
-                    weight += badRegionPenalty;
-                graph.addEdges(v, v + 1, weight, weight);
-            }
-            if (y < height - 1)
-            {
-                float weight = ptrDiff[x] + ptrDiffNext[x] + weightEps;
-                if (!ptrMask1[x] || !ptrMask1Next[x] ||
-                    !ptrMask2[x] || !ptrMask2Next[x])
-                    weight += badRegionPenalty;
-                graph.addEdges(v, v + effectWidth, weight, weight);
-            }
-        }
-        for (int x = 0; x < zeroBegInc; ++x)
-        {
-            int v = y * effectWidth + x + rightWidth;
-            if (x < zeroBegInc - 1)
-            {
-                float weight = ptrDiff[x] + ptrDiff[x + 1] + weightEps;
-                if (!ptrMask1[x] || !ptrMask1[x + 1] ||
-                    !ptrMask2[x] || !ptrMask2[x + 1])
-                    weight += badRegionPenalty;
-                graph.addEdges(v, v + 1, weight, weight);
-            }
-            if (y < height - 1)
-            {
-                float weight = ptrDiff[x] + ptrDiffNext[x] + weightEps;
-                if (!ptrMask1[x] || !ptrMask1Next[x] ||
-                    !ptrMask2[x] || !ptrMask2Next[x])
-                    weight += badRegionPenalty;
-                graph.addEdges(v, v + effectWidth, weight, weight);
-            }
-        }
-    }
-
-    graph.maxFlow();
-
-    for (int y = 0; y < height; ++y)
-    {
-        unsigned char* ptrMask1 = mask1.ptr<unsigned char>(y);
-        unsigned char* ptrMask2 = mask2.ptr<unsigned char>(y);
-        for (int x = zeroEndExc; x < width; ++x)
-        {
-            if (graph.inSourceSegment(y * effectWidth + x - zeroEndExc))
-            {
-                if (ptrMask1[x])
-                    ptrMask2[x] = 0;
-            }
-            else
-            {
-                if (ptrMask2[x])
-                    ptrMask1[x] = 0;
-            }
-        }
-        for (int x = 0; x < zeroBegInc; ++x)
-        {
-            if (graph.inSourceSegment(y * effectWidth + x + rightWidth))
-            {
-                if (ptrMask1[x])
-                    ptrMask2[x] = 0;
-            }
-            else
-            {
-                if (ptrMask2[x])
-                    ptrMask1[x] = 0;
-            }
-        }
-    }
+    // Columns [zeroBegInc, zeroEndExc) are left out, the right part is linked to the left part across
+    // the horizontal border.
+    cv::Mat active(diff.size(), CV_8UC1, cv::Scalar::all(255));
+    active.colRange(zeroBegInc, zeroEndExc).setTo(0);
+    findSeamInMaskedROI(diff, mask1, mask2, active, terminalCost, badRegionPenalty, true);
 }
 
 void findSeamLeftRightWrap(const cv::Mat& image1, const cv::Mat& image2,
@@ -934,6 +836,36 @@ void findSeamLeftRightWrap(const cv::Mat& image1, const cv::Mat& image2,
     //vis.show("diff with seam");
 }
 
+// Finds the seam between image1 and image2 inside the bounding rect of mask1 & mask2 padded by pad,
+// with the findSeam variant chosen by scale and ratio as in findSeams.
+static void findSeamInIntersectRect(const cv::Mat& image1, const cv::Mat& image2, 
+    cv::Mat& mask1, cv::Mat& mask2, int pad, int scale, double ratio, bool refine)
+{
+    cv::Mat intersect = mask1 & mask2;
+    int numNonZero = cv::countNonZero(intersect);
+    if (!numNonZero)
+        return;
+
+    cv::Rect imageRect(0, 0, image1.cols, image1.rows);
+    cv::Rect boundingRect = getNonZeroBoundingRect(intersect);
+    boundingRect = padRect(boundingRect, pad) & imageRect;
+
+    cv::Mat mask1ROI = mask1(boundingRect);
+    cv::Mat mask2ROI = mask2(boundingRect);
+    cv::Mat image1ROI = image1(boundingRect);
+    cv::Mat image2ROI = image2(boundingRect);
+    bool horiWrap = boundingRect.width == imageRect.width;
+    if (scale == 1)
+    {
+        if (numNonZero < ratio * boundingRect.area())
+            findSeamInROI(image1ROI, image2ROI, intersect(boundingRect), mask1ROI, mask2ROI, horiWrap);
+        else
+            findSeam(image1ROI, image2ROI, mask1ROI, mask2ROI, horiWrap);
+    }
+    else
+        findSeamScaleDown(image1ROI, image2ROI, mask1ROI, mask2ROI, horiWrap, scale, refine);
+}
+
 void findSeams(const std::vector<cv::Mat>& images, const std::vector<cv::Mat>& masks, 
     std::vector<cv::Mat>& resultMasks, int pad, int scale, double ratio, bool refine)
 {
@@ -948,37 +880,9 @@ void findSeams(const std::vector<cv::Mat>& images, const std::vector<cv::Mat>& m
         masks[i].copyTo(resultMasks[i]);
     cv::Mat image = images[0].clone();
     cv::Mat mask = resultMasks[0].clone();
-    cv::Mat intersect;
-    cv::Rect imageRect(0, 0, images[0].cols, images[0].rows);
     for (int i = 1; i < numImages; i++)
     {
-        intersect = mask & resultMasks[i];
-        int numNonZero = cv::countNonZero(intersect);
-        if (numNonZero)
-        {
-            cv::Rect boundingRect = getNonZeroBoundingRect(intersect);
-            boundingRect = padRect(boundingRect, 8) & imageRect;
-
-            cv::Mat baseMaskROI = mask(boundingRect);
-            cv::Mat currMaskROI = resultMasks[i](boundingRect);
-            cv::Mat baseImageROI = image(boundingRect);
-            cv::Mat currImageROI = images[i](boundingRect);
-            //cv::imshow("base mask roi before", baseMaskROI);
-            //cv::imshow("curr mask roi before", currMaskROI);
-            bool horiWrap = boundingRect.width == imageRect.width;
-            if (scale == 1)
-            {
-                if (numNonZero < ratio * boundingRect.area())
-                    findSeamInROI(baseImageROI, currImageROI, intersect(boundingRect), baseMaskROI, currMaskROI, horiWrap);
-                else
-                    findSeam(baseImageROI, currImageROI, baseMaskROI, currMaskROI, horiWrap);
-            }
-            else
-                findSeamScaleDown(baseImageROI, currImageROI, baseMaskROI, currMaskROI, horiWrap, scale, refine);
-            
-            //cv::imshow("base mask roi after", baseMaskROI);
-            //cv::imshow("curr mask roi after", currMaskROI);
-        }
+        findSeamInIntersectRect(image, images[i], mask, resultMasks[i], 8, scale, ratio, refine);
 
         mask |= resultMasks[i];
         images[i].copyTo(image, resultMasks[i]);
@@ -987,4 +891,188 @@ void findSeams(const std::vector<cv::Mat>& images, const std::vector<cv::Mat>& m
         //cv::imshow("image", image);
         //cv::waitKey(0);
     }
-}
\ No newline at end of file
+}
+
+// Finds the seams of the pairs of images in range, no two pairs share an image.
+class FindSeamPairsLoop : public cv::ParallelLoopBody
+{
+public:
+    FindSeamPairsLoop(const std::vector<cv::Mat>& images_, std::vector<cv::Mat>& masks_, 
+        const std::vector<std::pair<int, int> >& pairs_, int pad_, int scale_, double ratio_, bool refine_)
+        : images(images_), masks(masks_), pairs(pairs_), pad(pad_), scale(scale_), ratio(ratio_), refine(refine_)
+    {
+    }
+
+    virtual ~FindSeamPairsLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        for (int k = r.start; k < r.end; k++)
+        {
+            int i = pairs[k].first, j = pairs[k].second;
+            findSeamInIntersectRect(images[i], images[j], masks[i], masks[j], pad, scale, ratio, refine);
+        }
+    }
+
+    const std::vector<cv::Mat>& images;
+    std::vector<cv::Mat>& masks;
+    const std::vector<std::pair<int, int> >& pairs;
+    int pad, scale;
+    double ratio;
+    bool refine;
+};
+
+void findSeamsParallel(const std::vector<cv::Mat>& images, const std::vector<cv::Mat>& masks, 
+    std::vector<cv::Mat>& resultMasks, int pad, int scale, double ratio, bool refine)
+{
+    CV_Assert(checkSize(images, masks) && checkType(images, CV_8UC3) && checkType(masks, CV_8UC1));
+
+    if (pad < 0 || pad > 32) pad = 8;
+    if (scale < 0 || scale > 32) scale = 8;
+
+    int numImages = images.size();
+    resultMasks.resize(numImages);
+    for (int i = 0; i < numImages; i++)
+        masks[i].copyTo(resultMasks[i]);
+
+    // Color the edges of the overlap graph greedily, pairs of the same color share no image
+    // and are put in the same round.
+    std::vector<std::vector<std::pair<int, int> > > rounds;
+    std::vector<std::vector<unsigned char> > imageUsed;
+    for (int i = 0; i < numImages; i++)
+    {
+        for (int j = i + 1; j < numImages; j++)
+        {
+            if (!cv::countNonZero(masks[i] & masks[j]))
+                continue;
+            int r = 0;
+            while (r < (int)rounds.size() && (imageUsed[r][i] || imageUsed[r][j]))
+                r++;
+            if (r == (int)rounds.size())
+            {
+                rounds.push_back(std::vector<std::pair<int, int> >());
+                imageUsed.push_back(std::vector<unsigned char>(numImages, 0));
+            }
+            rounds[r].push_back(std::make_pair(i, j));
+            imageUsed[r][i] = imageUsed[r][j] = 1;
+        }
+    }
+
+    // Pairs of one round write disjoint masks, so they run concurrently.
+    int numRounds = rounds.size();
+    for (int r = 0; r < numRounds; r++)
+    {
+        cv::parallel_for_(cv::Range(0, rounds[r].size()), 
+            FindSeamPairsLoop(images, resultMasks, rounds[r], pad, scale, ratio, refine));
+    }
+
+    // As in findSeams, make the result masks disjoint in case a findSeam variant left some overlap.
+    for (int i = 1; i < numImages; i++)
+    {
+        for (int j = 0; j < i; j++)
+            resultMasks[j].setTo(0, resultMasks[i]);
+    }
+}
+
+bool TemporalSeamTracker::prepare(const cv::Mat& mask1_, const cv::Mat& mask2_, int bandRadius_, double diffThresh_)
+{
+    success = false;
+    hasSeam = false;
+    numVertices = 0;
+    if (!mask1_.data || mask1_.type() != CV_8UC1 ||
+        !mask2_.data || mask2_.type() != CV_8UC1 ||
+        mask1_.size() != mask2_.size() || bandRadius_ <= 0 || diffThresh_ < 0)
+        return false;
+
+    mask1 = mask1_.clone();
+    mask2 = mask2_.clone();
+    bandRadius = bandRadius_;
+    diffThresh = diffThresh_;
+
+    // Without intersection there is no seam, roi stays empty and track returns the masks.
+    roi = cv::Rect();
+    horiWrap = false;
+    success = true;
+    cv::Mat intersect = mask1 & mask2;
+    if (!cv::countNonZero(intersect))
+        return true;
+
+    cv::Rect imageRect(0, 0, mask1.cols, mask1.rows);
+    roi = padRect(getNonZeroBoundingRect(intersect), 8) & imageRect;
+    horiWrap = roi.width == imageRect.width;
+    mask1ROI = mask1(roi);
+    mask2ROI = mask2(roi);
+    intersectROI = intersect(roi);
+    // The vertices of the first graphcut, the same as those of findSeamInROI.
+    cv::Mat kern = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(8, 8));
+    cv::dilate(intersectROI, activeROI, kern);
+    return true;
+}
+
+bool TemporalSeamTracker::track(const cv::Mat& image1, const cv::Mat& image2, cv::Mat& resultMask1, cv::Mat& resultMask2)
+{
+    if (!success)
+        return false;
+
+    CV_Assert(image1.data && image1.type() == CV_8UC3 && image1.size() == mask1.size() &&
+        image2.data && image2.type() == CV_8UC3 && image2.size() == mask1.size());
+
+    mask1.copyTo(resultMask1);
+    mask2.copyTo(resultMask2);
+    if (!roi.area())
+        return false;
+
+    cv::Mat diff;
+    calcColorDiff(image1(roi), image2(roi), diff);
+    cv::blur(diff, diff, cv::Size(3, 3));
+
+    bool updated = false;
+    if (!hasSeam)
+    {
+        seamMask1 = mask1ROI.clone();
+        seamMask2 = mask2ROI.clone();
+        numVertices = cv::countNonZero(activeROI);
+        findSeamInMaskedROI(diff, seamMask1, seamMask2, activeROI, 10000, 1000, horiWrap);
+        refDiff = diff;
+        hasSeam = true;
+        updated = true;
+    }
+    else
+    {
+        cv::Mat changed;
+        cv::absdiff(diff, refDiff, changed);
+        changed = (changed > diffThresh) & intersectROI;
+        if (cv::countNonZero(changed))
+        {
+            // Pixels of the graph are near both the previous seam and the changed pixels.
+            cv::Mat kern = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(bandRadius * 2 + 1, bandRadius * 2 + 1));
+            cv::Mat band1, band2, region;
+            cv::dilate(seamMask1, band1, kern);
+            cv::dilate(seamMask2, band2, kern);
+            cv::dilate(changed, region, kern);
+            region &= band1 & band2 & intersectROI;
+            if (cv::countNonZero(region))
+            {
+                // Inside region both labels are possible, the ring of pixels around region
+                // keeps the labels of the previous seam.
+                cv::Mat currMask1 = seamMask1.clone(), currMask2 = seamMask2.clone();
+                currMask1.setTo(255, region);
+                currMask2.setTo(255, region);
+                cv::Mat ring;
+                cv::dilate(region, ring, cv::Mat());
+                numVertices = cv::countNonZero(ring);
+                findSeamInMaskedROI(diff, currMask1, currMask2, ring, 10000, 1000, horiWrap);
+                seamMask1 = currMask1;
+                seamMask2 = currMask2;
+                updated = true;
+            }
+            // Only the reference differences of the changed pixels are renewed,
+            // so a slow drift is detected once it accumulates beyond diffThresh.
+            diff.copyTo(refDiff, changed);
+        }
+    }
+
+    seamMask1.copyTo(resultMask1(roi));
+    seamMask2.copyTo(resultMask2(roi));
+    return updated;
+}
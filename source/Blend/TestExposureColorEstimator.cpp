@@ -0,0 +1,185 @@
+#include "VisualManip.h"
+#include "opencv2/core.hpp"
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+typedef std::vector<std::vector<std::vector<unsigned char> > > LUTs;
+
+static const cv::Size frameSize(640, 480);
+
+// Two cameras with the same parameters, so that the whole frame overlaps.
+static void makeParams(std::vector<PhotoParam>& params)
+{
+    PhotoParam param;
+    param.imageType = PhotoParam::ImageTypeRectlinear;
+    param.cropWidth = frameSize.width;
+    param.cropHeight = frameSize.height;
+    param.hfov = 90;
+    params.assign(2, param);
+}
+
+// Frames of the same scene, the second camera with gain applied to all channels
+// and redGain applied on top to the red channel. The scene spans the whole value range,
+// values a camera never produces would be paired with the maximum of the other camera
+// by histogram specification.
+static void makeFrames(double gain, double redGain, std::vector<cv::Mat>& frames)
+{
+    frames.resize(2);
+    for (int k = 0; k < 2; k++)
+    {
+        double scales[3] = { 1, 1, 1 };
+        if (k == 1)
+        {
+            scales[0] = scales[1] = gain;
+            scales[2] = gain * redGain;
+        }
+        frames[k].create(frameSize, CV_8UC3);
+        for (int i = 0; i < frameSize.height; i++)
+        {
+            unsigned char* ptr = frames[k].ptr<unsigned char>(i);
+            for (int j = 0; j < frameSize.width; j++, ptr += 3)
+            {
+                double base = 127.5 + 127.5 * sin(j * 0.03) * cos(i * 0.02);
+                for (int c = 0; c < 3; c++)
+                    ptr[c] = cv::saturate_cast<unsigned char>(base * scales[c]);
+            }
+        }
+    }
+}
+
+// The LUTs of the second camera should map a value scaled by scale back to
+// where the LUTs of the first camera map the unscaled value.
+static int lutMismatch(const LUTs& luts, int channel, double scale)
+{
+    int maxDiff = 0;
+    for (int v = 40; v <= 160; v += 10)
+    {
+        int scaled = cv::saturate_cast<int>(v * scale);
+        maxDiff = std::max(maxDiff, std::abs(luts[1][channel][scaled] - luts[0][channel][v]));
+    }
+    return maxDiff;
+}
+
+// The proc thread of PanoramaLiveStreamTask2, which passes every frame set to the estimator
+// and renders with the LUTs it gets back, while beginAutoExposures and stopAutoExposures
+// start and stop the estimator. The frames are written into one buffer per camera,
+// which is overwritten right after addFrames returns, as pooled frames are reused.
+struct Proc
+{
+    explicit Proc(SwitchableExposureColorEstimator& estimator_)
+        : estimator(estimator_), frameSetIndex(0), endFlag(false), numRendered(0), heldMismatch(false) {}
+
+    // Every set of LUTs taken is read again after the estimator has moved on,
+    // a published set that changed while held is recorded in heldMismatch.
+    void run()
+    {
+        std::vector<cv::Mat> src(2);
+        std::shared_ptr<const LUTs> held;
+        LUTs heldCopy;
+        while (!endFlag)
+        {
+            for (int i = 0; i < 2; i++)
+                frameSets[frameSetIndex][i].copyTo(src[i]);
+            std::shared_ptr<const LUTs> localLookUpTables = estimator.addFrames(src);
+            for (int i = 0; i < 2; i++)
+                src[i].setTo(cv::Scalar::all(i ? 255 : 0));
+            if (held && *held != heldCopy)
+                heldMismatch = true;
+            if (localLookUpTables && localLookUpTables != held)
+            {
+                held = localLookUpTables;
+                heldCopy = *held;
+            }
+            numRendered++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        if (held && *held != heldCopy)
+            heldMismatch = true;
+    }
+
+    SwitchableExposureColorEstimator& estimator;
+    std::vector<cv::Mat> frameSets[2];
+    std::atomic<int> frameSetIndex;
+    std::atomic<bool> endFlag;
+    std::atomic<int> numRendered;
+    std::atomic<bool> heldMismatch;
+};
+
+static bool waitForSolves(const SwitchableExposureColorEstimator& estimator, int numSolves)
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        if (estimator.getNumSolves() >= numSolves)
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    return false;
+}
+
+int main()
+{
+    const double gains[2] = { 1.25, 0.8 }, redGain = 1.1;
+    const int maxLUTDiff = 4;
+    std::vector<PhotoParam> params;
+    makeParams(params);
+
+    SwitchableExposureColorEstimator estimator;
+    Proc proc(estimator);
+    makeFrames(gains[0], redGain, proc.frameSets[0]);
+    makeFrames(gains[1], redGain, proc.frameSets[1]);
+    std::thread procThread(&Proc::run, &proc);
+
+    bool ok = estimator.begin(params, frameSize, EXPOSURE | WHITE_BALANCE, 1, 0.5);
+    ok &= waitForSolves(estimator, 3);
+    std::shared_ptr<const LUTs> first = estimator.getLUTs();
+    ok &= first && first->size() == 2;
+    int firstGreenDiff = ok ? lutMismatch(*first, 1, gains[0]) : 256;
+    int firstRedDiff = ok ? lutMismatch(*first, 2, gains[0] * redGain) : 256;
+    ok &= firstGreenDiff <= maxLUTDiff && firstRedDiff <= maxLUTDiff;
+    printf("gain %.2f: green diff %d, red diff %d\n", gains[0], firstGreenDiff, firstRedDiff);
+
+    // The gain changes, the estimate follows while the set held here stays as it was
+    LUTs firstCopy = first ? *first : LUTs();
+    proc.frameSetIndex = 1;
+    int numSolves = estimator.getNumSolves();
+    ok &= waitForSolves(estimator, numSolves + 8);
+    std::shared_ptr<const LUTs> second = estimator.getLUTs();
+    ok &= second && second != first && first && *first == firstCopy;
+    int secondGreenDiff = second ? lutMismatch(*second, 1, gains[1]) : 256;
+    int secondRedDiff = second ? lutMismatch(*second, 2, gains[1] * redGain) : 256;
+    ok &= secondGreenDiff <= maxLUTDiff && secondRedDiff <= maxLUTDiff;
+    printf("gain %.2f: green diff %d, red diff %d, earlier LUTs kept %d\n",
+        gains[1], secondGreenDiff, secondRedDiff, first && *first == firstCopy);
+
+    // Stopping joins the estimating thread, LUTs taken before stay valid
+    LUTs secondCopy = second ? *second : LUTs();
+    estimator.stop();
+    int numRenderedAfterStop = proc.numRendered;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    bool stopped = !estimator.getLUTs() && proc.numRendered > numRenderedAfterStop &&
+        second && *second == secondCopy;
+    ok &= stopped;
+
+    // Starting again begins from scratch with a new estimator
+    ok &= estimator.begin(params, frameSize, EXPOSURE, 1, 0.5);
+    ok &= waitForSolves(estimator, 1);
+    std::shared_ptr<const LUTs> restarted = estimator.getLUTs();
+    int restartedDiff = restarted ? lutMismatch(*restarted, 1, gains[1]) : 256;
+    ok &= restarted && restarted != second && restartedDiff <= maxLUTDiff;
+
+    // A failed begin keeps the running estimator
+    ok &= !estimator.begin(params, frameSize, EXPOSURE, 0, 0.5) && estimator.getLUTs();
+    estimator.stop();
+
+    proc.endFlag = true;
+    procThread.join();
+    ok &= !proc.heldMismatch;
+    printf("stopped %d, restarted green diff %d, held LUTs changed %d\n", stopped, restartedDiff, (bool)proc.heldMismatch);
+
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+#include "VisualManip.h"
+#include "Timer.h"
+#include "opencv2/core.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// The solver of exposureColorOptimize fed with synthetic value pairs, defined in ExposureColorOptimize.cpp.
+void optimizeExposureColorPairs(int numImages, const cv::Size& imageSize, const std::vector<cv::Vec2i>& pairIndexes,
+    const std::vector<cv::Vec3d>& valsI, const std::vector<cv::Vec3d>& valsJ, const std::vector<cv::Vec3d>& meanVals,
+    const std::vector<int>& anchorIndexes, int optimizeWhat,
+    std::vector<double>& exposures, std::vector<double>& redRatios, std::vector<double>& blueRatios);
+
+static double random01()
+{
+    return rand() / double(RAND_MAX);
+}
+
+// Value pairs of numImages images with the given exposures and white balance ratios,
+// with noise and a few outliers.
+static void makePairs(int numImages, int numPairs, const std::vector<double>& es,
+    const std::vector<double>& rs, const std::vector<double>& bs, std::vector<cv::Vec2i>& pairIndexes,
+    std::vector<cv::Vec3d>& valsI, std::vector<cv::Vec3d>& valsJ)
+{
+    pairIndexes.resize(numPairs);
+    valsI.resize(numPairs);
+    valsJ.resize(numPairs);
+    for (int k = 0; k < numPairs; k++)
+    {
+        int i = rand() % numImages, j;
+        do j = rand() % numImages; while (j == i);
+        pairIndexes[k] = cv::Vec2i(i, j);
+        for (int c = 0; c < 3; c++)
+        {
+            double light = 0.05 + 0.8 * random01();
+            double scaleI = es[i] * (c == 0 ? bs[i] : (c == 2 ? rs[i] : 1));
+            double scaleJ = es[j] * (c == 0 ? bs[j] : (c == 2 ? rs[j] : 1));
+            double outlier = random01() < 0.02 ? 0.2 : 0;
+            valsI[k][c] = std::min(1.0, light * scaleI + 0.01 * (random01() - 0.5) + outlier);
+            valsJ[k][c] = std::min(1.0, light * scaleJ + 0.01 * (random01() - 0.5));
+        }
+    }
+}
+
+// Largest difference of the results of the two solvers, and largest relative error
+// of the normal equations result to the values the pairs are made from.
+static const double maxSolverDiff = 1e-3, maxRelErr = 0.02;
+
+// Solves with the normal equations and, if pairs are not too many, with dlevmar_dif, reports
+// the times and the largest difference of the results, and returns whether both are within tolerance.
+static bool compare(int numImages, int numPairs, int optimizeWhat)
+{
+    // Only the quantities being optimized differ from 1
+    std::vector<double> es(numImages, 1), rs(numImages, 1), bs(numImages, 1);
+    for (int i = 1; i < numImages; i++)
+    {
+        if (optimizeWhat & EXPOSURE)
+            es[i] = 0.8 + 0.4 * random01();
+        if (optimizeWhat & WHITE_BALANCE)
+        {
+            rs[i] = 0.9 + 0.2 * random01();
+            bs[i] = 0.9 + 0.2 * random01();
+        }
+    }
+    std::vector<cv::Vec2i> pairIndexes;
+    std::vector<cv::Vec3d> valsI, valsJ;
+    makePairs(numImages, numPairs, es, rs, bs, pairIndexes, valsI, valsJ);
+
+    std::vector<int> anchors(1, 0);
+    std::vector<cv::Vec3d> meanVals(numImages, cv::Vec3d(0.4, 0.45, 0.5));
+    std::vector<double> exposures[2], redRatios[2], blueRatios[2];
+    double times[2] = { 0, 0 };
+    int numRuns = numPairs <= 100000 ? 2 : 1;
+    for (int k = 0; k < numRuns; k++)
+    {
+        setExposureColorOptimizeUseNormalEquations(k == 0);
+        ztool::Timer timer;
+        optimizeExposureColorPairs(numImages, cv::Size(100, 100), pairIndexes, valsI, valsJ, meanVals,
+            anchors, optimizeWhat, exposures[k], redRatios[k], blueRatios[k]);
+        timer.end();
+        times[k] = timer.elapse();
+    }
+    setExposureColorOptimizeUseNormalEquations(true);
+
+    double maxDiff = 0, maxErr = 0;
+    for (int i = 0; i < numImages; i++)
+    {
+        if (optimizeWhat & EXPOSURE)
+            maxErr = std::max(maxErr, fabs(exposures[0][i] / es[i] - 1));
+        if (optimizeWhat & WHITE_BALANCE)
+            maxErr = std::max(maxErr, std::max(fabs(redRatios[0][i] / rs[i] - 1), fabs(blueRatios[0][i] / bs[i] - 1)));
+        if (numRuns > 1)
+        {
+            maxDiff = std::max(maxDiff, fabs(exposures[0][i] - exposures[1][i]));
+            maxDiff = std::max(maxDiff, fabs(redRatios[0][i] - redRatios[1][i]));
+            maxDiff = std::max(maxDiff, fabs(blueRatios[0][i] - blueRatios[1][i]));
+        }
+    }
+    bool ok = maxDiff <= maxSolverDiff && maxErr <= maxRelErr;
+    if (numRuns > 1)
+        printf("%d images %d pairs optimize %d: normal equations %f, dlevmar_dif %f, max diff %f, max rel err %f, %s\n",
+            numImages, numPairs, optimizeWhat, times[0], times[1], maxDiff, maxErr, ok ? "ok" : "wrong");
+    else
+        printf("%d images %d pairs optimize %d: normal equations %f, dlevmar_dif skipped, max rel err %f, %s\n",
+            numImages, numPairs, optimizeWhat, times[0], maxErr, ok ? "ok" : "wrong");
+    return ok;
+}
+
+int main()
+{
+    int numPairs[] = { 10000, 100000, 1000000 };
+    bool ok = true;
+    for (int i = 0; i < 3; i++)
+    {
+        ok &= compare(6, numPairs[i], EXPOSURE | WHITE_BALANCE);
+        ok &= compare(6, numPairs[i], WHITE_BALANCE);
+        ok &= compare(16, numPairs[i], EXPOSURE | WHITE_BALANCE);
+    }
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
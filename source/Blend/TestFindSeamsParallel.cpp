@@ -0,0 +1,104 @@
+#include "ZBlendAlgo.h"
+#include "opencv2/core.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+static const int rows = 120;
+// Image i covers [i * step, i * step + width), so each image overlaps only its neighbours,
+// and the overlaps are more than two pads apart.
+static const int step = 100, width = 160;
+
+// Images of one scene, each with its own smooth distortion, so the seams depend on the content.
+static void makeImagesAndMasks(int numImages, std::vector<cv::Mat>& images, std::vector<cv::Mat>& masks)
+{
+    int cols = (numImages - 1) * step + width;
+    images.resize(numImages);
+    masks.resize(numImages);
+    for (int i = 0; i < numImages; i++)
+    {
+        images[i].create(rows, cols, CV_8UC3);
+        masks[i].create(rows, cols, CV_8UC1);
+        for (int y = 0; y < rows; y++)
+        {
+            unsigned char* ptrImage = images[i].ptr<unsigned char>(y);
+            unsigned char* ptrMask = masks[i].ptr<unsigned char>(y);
+            for (int x = 0; x < cols; x++)
+            {
+                bool in = x >= i * step && x < i * step + width;
+                ptrMask[x] = in ? 255 : 0;
+                int base = 120 + int(50 * sin(x * 0.05) * cos(y * 0.04));
+                int offset = int(40 * sin(x * 0.11 * (i + 1) + y * 0.07 * (2 - i)));
+                for (int c = 0; c < 3; c++)
+                    ptrImage[x * 3 + c] = in ? cv::saturate_cast<unsigned char>(base + offset + c * 10) : 0;
+            }
+        }
+    }
+}
+
+static bool sameMask(const cv::Mat& a, const cv::Mat& b)
+{
+    for (int y = 0; y < a.rows; y++)
+    {
+        if (memcmp(a.ptr(y), b.ptr(y), a.cols))
+            return false;
+    }
+    return true;
+}
+
+// Every pixel of the input masks belongs to exactly one result mask.
+static bool isPartition(const std::vector<cv::Mat>& masks, const std::vector<cv::Mat>& resultMasks)
+{
+    int numImages = masks.size();
+    for (int y = 0; y < masks[0].rows; y++)
+    {
+        for (int x = 0; x < masks[0].cols; x++)
+        {
+            int numIn = 0, numResult = 0;
+            for (int i = 0; i < numImages; i++)
+            {
+                numIn += masks[i].at<unsigned char>(y, x) != 0;
+                numResult += resultMasks[i].at<unsigned char>(y, x) != 0;
+            }
+            if (numResult != (numIn ? 1 : 0))
+                return false;
+        }
+    }
+    return true;
+}
+
+// When each image overlaps only its neighbours, the seam of every pair is the seam between
+// the image and the mosaic of the images before it, so findSeamsParallel and findSeams agree.
+// With 3 images the two pairs run in two rounds, with more images the pairs (0, 1), (2, 3) ...
+// share a round.
+static bool testSameAsSerial(int numImages, int scale, double ratio)
+{
+    std::vector<cv::Mat> images, masks, serialMasks, parallelMasks;
+    makeImagesAndMasks(numImages, images, masks);
+    findSeams(images, masks, serialMasks, 8, scale, ratio, true);
+    findSeamsParallel(images, masks, parallelMasks, 8, scale, ratio, true);
+
+    bool same = (int)serialMasks.size() == numImages && (int)parallelMasks.size() == numImages;
+    for (int i = 0; same && i < numImages; i++)
+        same = sameMask(serialMasks[i], parallelMasks[i]);
+    // Masks the seams left untouched would also be the same, make sure the seams cut the overlaps.
+    bool cut = true;
+    for (int i = 1; same && i < numImages; i++)
+        cut &= cv::countNonZero(parallelMasks[i - 1] & masks[i]) > 0 && cv::countNonZero(parallelMasks[i] & masks[i - 1]) > 0;
+    bool partition = isPartition(masks, parallelMasks);
+    bool ok = same && cut && partition;
+    printf("same as serial: %d images, scale %d, ratio %f, same %d, cut %d, partition %d, %s\n",
+        numImages, scale, ratio, same, cut, partition, ok ? "ok" : "wrong");
+    return ok;
+}
+
+int main()
+{
+    bool ok = true;
+    ok &= testSameAsSerial(3, 1, 1);
+    ok &= testSameAsSerial(5, 1, 1);
+    ok &= testSameAsSerial(5, 1, 2);
+    ok &= testSameAsSerial(4, 2, 1);
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+#include "opencv2/core.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+int getLineRANSAC(const std::vector<cv::Point>& points, cv::Point2d& p, cv::Point2d& dir);
+
+// Value pairs of two overlapping images as calcLUT collects them, y = k * x + h with
+// one level of noise, the first numOutliers pairs are random.
+static void makePoints(int size, int numOutliers, double k, double h, std::vector<cv::Point>& points)
+{
+    srand(1234);
+    points.resize(size);
+    for (int i = 0; i < size; i++)
+    {
+        int x = rand() % 256;
+        if (i < numOutliers)
+            points[i] = cv::Point(x, rand() % 256);
+        else
+            points[i] = cv::Point(x, cvRound(k * x + h) + rand() % 3 - 1);
+    }
+}
+
+static bool testLineWithOutliers(int size, double outlierRatio, double k, double h)
+{
+    std::vector<cv::Point> points;
+    int numOutliers = size * outlierRatio;
+    makePoints(size, numOutliers, k, h, points);
+
+    cv::Point2d p, dir;
+    int numInliers = getLineRANSAC(points, p, dir);
+    double fitK = dir.y / dir.x;
+    double fitH = p.y - fitK * p.x;
+    // Every true inlier is within the threshold, a few random points fall near the line as well
+    int numTrueInliers = size - numOutliers;
+    bool ok = numInliers >= numTrueInliers && numInliers < numTrueInliers + numOutliers * 0.1 &&
+        fabs(fitK - k) < 0.01 && fabs(fitH - h) < 1;
+    printf("line: size %d, outlier ratio %f, %d inliers of %d, k %f of %f, h %f of %f, %s\n",
+        size, outlierRatio, numInliers, numTrueInliers, fitK, k, fitH, h, ok ? "ok" : "wrong");
+    return ok;
+}
+
+// Equal points, like saturated pixels in both images, define no line,
+// the identity line through the origin is returned with no inliers, k = 1 and h = 0.
+static bool testDegenerate()
+{
+    std::vector<cv::Point> points(100, cv::Point(255, 255));
+    cv::Point2d p(-1, -1), dir(-1, -1);
+    int numInliers = getLineRANSAC(points, p, dir);
+    double k = dir.y / dir.x;
+    double h = p.y - k * p.x;
+    bool ok = numInliers == 0 && fabs(k - 1) < 1e-9 && fabs(h) < 1e-9 && fabs(dir.dot(dir) - 1) < 1e-9;
+    printf("degenerate: %d inliers, p (%f, %f), dir (%f, %f), k %f, h %f, %s\n",
+        numInliers, p.x, p.y, dir.x, dir.y, k, h, ok ? "ok" : "wrong");
+    return ok;
+}
+
+int main()
+{
+    bool ok = true;
+    ok &= testLineWithOutliers(200, 0.3, 0.8, 20);
+    ok &= testLineWithOutliers(3000, 0.3, 0.8, 20);
+    ok &= testLineWithOutliers(3000, 0.6, 0.9, 12);
+    ok &= testDegenerate();
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+#include "LookUpTable.h"
+#include "Timer.h"
+#include "opencv2/core.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Per pixel reference of applyLUTs, dst = lut[c][src] for every channel c, the alpha channel
+// copied if there are 3 tables for 4 channels, and zero where mask is zero.
+static void applyLUTsReference(const cv::Mat& src, cv::Mat& dst,
+    const std::vector<std::vector<unsigned char> >& luts, const cv::Mat& mask)
+{
+    int numChannels = src.channels(), numLUTs = luts.size();
+    dst.create(src.size(), src.type());
+    for (int i = 0; i < src.rows; i++)
+    {
+        const unsigned char* ptrSrc = src.ptr<unsigned char>(i);
+        const unsigned char* ptrMask = mask.empty() ? 0 : mask.ptr<unsigned char>(i);
+        unsigned char* ptrDst = dst.ptr<unsigned char>(i);
+        for (int j = 0; j < src.cols; j++)
+        {
+            for (int c = 0; c < numChannels; c++)
+            {
+                int index = j * numChannels + c;
+                unsigned char val;
+                if (numLUTs == 1)
+                    val = luts[0][ptrSrc[index]];
+                else if (c < numLUTs)
+                    val = luts[c][ptrSrc[index]];
+                else
+                    val = ptrSrc[index];
+                ptrDst[index] = (ptrMask && !ptrMask[j]) ? 0 : val;
+            }
+        }
+    }
+}
+
+// cv::LUT with the tables of applyLUTs packed into one table of the channel count of src.
+static void applyLUTsOpenCV(const cv::Mat& src, cv::Mat& dst, const std::vector<std::vector<unsigned char> >& luts)
+{
+    int numChannels = src.channels(), numLUTs = luts.size();
+    cv::Mat table(1, 256, CV_8UC(numChannels));
+    for (int v = 0; v < 256; v++)
+    {
+        for (int c = 0; c < numChannels; c++)
+            table.ptr<unsigned char>()[v * numChannels + c] = numLUTs == 1 ? luts[0][v] : (c < numLUTs ? luts[c][v] : v);
+    }
+    cv::LUT(src, table, dst);
+}
+
+static bool same(const cv::Mat& a, const cv::Mat& b)
+{
+    return a.size() == b.size() && a.type() == b.type() && cv::countNonZero((a != b).reshape(1)) == 0;
+}
+
+// Applies random look up tables with the AVX2 kernels on and off, the results should be the same
+// as the per pixel reference, and as cv::LUT without mask.
+static bool compare(const cv::Size& size, int type, int numLUTs, bool useMask, bool useROI)
+{
+    std::vector<std::vector<unsigned char> > luts(numLUTs, std::vector<unsigned char>(256));
+    for (int i = 0; i < numLUTs; i++)
+    {
+        for (int j = 0; j < 256; j++)
+            luts[i][j] = rand() & 255;
+    }
+
+    cv::Mat large(size.height + 2, size.width + 5, type), src, mask;
+    cv::randu(large, cv::Scalar::all(0), cv::Scalar::all(256));
+    src = useROI ? large(cv::Rect(3, 1, size.width, size.height)) : large(cv::Rect(0, 0, size.width, size.height)).clone();
+    if (useMask)
+    {
+        mask.create(size, CV_8UC1);
+        cv::randu(mask, 0, 2);
+        mask *= 255;
+    }
+
+    cv::Mat results[2];
+    double times[2];
+    for (int i = 0; i < 2; i++)
+    {
+        setLUTUseSIMD(i == 0);
+        ztool::Timer timer;
+        applyLUTs(src, results[i], luts, mask);
+        timer.end();
+        times[i] = timer.elapse();
+    }
+    setLUTUseSIMD(true);
+
+    cv::Mat inPlace = src.clone();
+    applyLUTs(inPlace, inPlace, luts, mask);
+
+    cv::Mat ref;
+    applyLUTsReference(src, ref, luts, mask);
+    bool ok = same(results[0], ref) && same(results[1], ref) && same(inPlace, ref);
+    if (!useMask)
+    {
+        cv::Mat refOpenCV;
+        applyLUTsOpenCV(src, refOpenCV, luts);
+        ok &= same(refOpenCV, ref);
+    }
+    printf("%dx%d channels %d luts %d mask %d roi %d: time SIMD %f scalar %f, %s\n",
+        size.width, size.height, CV_MAT_CN(type), numLUTs, useMask, useROI, times[0], times[1], ok ? "same" : "DIFFERENT");
+    return ok;
+}
+
+int main()
+{
+    cv::Size sizes[] = { cv::Size(1, 1), cv::Size(37, 19), cv::Size(1920, 1080) };
+    bool ok = true;
+    for (int i = 0; i < 3; i++)
+    {
+        for (int k = 0; k < 2; k++)
+        {
+            ok &= compare(sizes[i], CV_8UC1, 1, k == 1, k == 0);
+            ok &= compare(sizes[i], CV_8UC3, 1, k == 0, k == 1);
+            ok &= compare(sizes[i], CV_8UC3, 3, k == 1, k == 1);
+            ok &= compare(sizes[i], CV_8UC4, 3, k == 0, k == 0);
+            ok &= compare(sizes[i], CV_8UC4, 4, k == 1, k == 0);
+        }
+    }
+    printf(ok ? "All passed\n" : "Failed\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+#include "ZBlend.h"
+#include "Timer.h"
+#include "opencv2/core.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Bounds of the difference between the 16 bit and the 32 bit pyramids. The 16 bit weights
+// sum to 128 instead of 256, so rounding differs a little, mostly by 1, by 3 at a few pixels
+// where overlapping custom masks share the weights. A saturated or misaligned accumulation
+// differs far more.
+static const int MAX_ABS_DIFF = 3;
+static const double MIN_PSNR = 50;
+
+// Reports the difference between the 16 bit and the 32 bit pyramids of TilingMultibandBlendFastParallel
+// and checks it against MAX_ABS_DIFF and MIN_PSNR.
+static bool compare(const char* name, const cv::Mat& result32, const cv::Mat& result16)
+{
+    if (!result32.data || !result16.data || result32.size() != result16.size() || result32.type() != result16.type())
+    {
+        printf("%s: results do not match in size or type, wrong\n", name);
+        return false;
+    }
+    cv::Mat diff;
+    cv::absdiff(result32, result16, diff);
+    diff = diff.reshape(1);
+    double maxDiff;
+    cv::minMaxLoc(diff, 0, &maxDiff);
+    double meanDiff = cv::mean(diff)[0];
+    cv::Mat diff32F;
+    diff.convertTo(diff32F, CV_32F);
+    double mse = cv::mean(diff32F.mul(diff32F))[0];
+    double psnr = mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : INFINITY;
+    bool ok = maxDiff <= MAX_ABS_DIFF && psnr >= MIN_PSNR;
+    printf("%s: max abs diff %d, mean abs diff %f, psnr %f dB, %s\n", name, int(maxDiff), meanDiff, psnr, ok ? "ok" : "wrong");
+    return ok;
+}
+
+// Blends images with both pyramids, first with the unique masks computed by prepare,
+// then with customMasks, and compares the results.
+static bool blendAndCompare(const char* name, const std::vector<cv::Mat>& images, const std::vector<cv::Mat>& masks,
+    const std::vector<cv::Mat>& customMasks, int maxLevels, bool saveResult)
+{
+    TilingMultibandBlendFastParallel blender32, blender16(true);
+    if (!blender32.prepare(masks, maxLevels, 2) || !blender16.prepare(masks, maxLevels, 2))
+    {
+        printf("%s: prepare failed, wrong\n", name);
+        return false;
+    }
+
+    cv::Mat result32, result16;
+    ztool::Timer timer;
+    blender32.blend(images, result32);
+    timer.end();
+    double elapse32 = timer.elapse();
+    timer.start();
+    blender16.blend(images, result16);
+    timer.end();
+    printf("%s: 32 bit blend %f, 16 bit blend %f\n", name, elapse32, timer.elapse());
+    char buf[256];
+    sprintf(buf, "%s, unique masks", name);
+    bool ok = compare(buf, result32, result16);
+    if (saveResult)
+    {
+        cv::imwrite("blend32.bmp", result32);
+        cv::imwrite("blend16.bmp", result16);
+    }
+
+    blender32.blend(images, customMasks, result32);
+    blender16.blend(images, customMasks, result16);
+    sprintf(buf, "%s, custom masks", name);
+    ok &= compare(buf, result32, result16);
+    return ok;
+}
+
+// Four cameras side by side around a rows x cols panorama, each covering a quarter plus an eighth
+// of the width, so neighbours overlap. Unless fullMask, every other camera misses the top rows,
+// leaving a hole in the panorama. The custom masks overlap by a sixteenth of the width.
+static bool testSynthetic(int rows, int cols, bool fullMask, int maxLevels)
+{
+    const int numImages = 4;
+    std::vector<cv::Mat> images(numImages), masks(numImages), customMasks(numImages);
+    for (int i = 0; i < numImages; i++)
+    {
+        images[i].create(rows, cols, CV_8UC3);
+        masks[i].create(rows, cols, CV_8UC1);
+        customMasks[i].create(rows, cols, CV_8UC1);
+        for (int y = 0; y < rows; y++)
+        {
+            unsigned char* ptrImage = images[i].ptr<unsigned char>(y);
+            unsigned char* ptrMask = masks[i].ptr<unsigned char>(y);
+            unsigned char* ptrCustomMask = customMasks[i].ptr<unsigned char>(y);
+            for (int x = 0; x < cols; x++)
+            {
+                int pos = (x + cols - i * cols / numImages) % cols;
+                bool in = pos < cols / numImages + cols / 8 && (fullMask || y > rows / 10 || (i & 1));
+                ptrMask[x] = in ? 255 : 0;
+                ptrCustomMask[x] = (in && pos < cols / numImages + cols / 16) ? 255 : 0;
+                for (int k = 0; k < 3; k++)
+                    ptrImage[x * 3 + k] = in ? (x * (k + 1) * 7 + y * (i + 3) * 5 + ((x * y) >> 3)) % 251 : 0;
+            }
+        }
+    }
+
+    char name[256];
+    sprintf(name, "synthetic %dx%d, %s, %d levels", cols, rows, fullMask ? "full" : "with hole", maxLevels);
+    return blendAndCompare(name, images, masks, customMasks, maxLevels, false);
+}
+
+// Usage: TestMultibandBlend16S [maxLevels image0 mask0 image1 mask1 ...]
+// Without arguments compares the two pyramids on synthetic panoramas.
+int main(int argc, char** argv)
+{
+    if (argc == 1)
+    {
+        bool ok = true;
+        ok &= testSynthetic(200, 400, true, 8);
+        ok &= testSynthetic(201, 402, false, 8);
+        ok &= testSynthetic(64, 130, false, 2);
+        ok &= testSynthetic(480, 960, false, 16);
+        printf(ok ? "all passed\n" : "failed\n");
+        return ok ? 0 : 1;
+    }
+
+    if (argc < 4 || (argc & 1))
+    {
+        printf("Usage: %s [maxLevels image0 mask0 image1 mask1 ...]\n", argv[0]);
+        return 1;
+    }
+
+    int maxLevels = atoi(argv[1]);
+    int numImages = (argc - 2) / 2;
+    std::vector<cv::Mat> images(numImages), masks(numImages);
+    for (int i = 0; i < numImages; i++)
+    {
+        images[i] = cv::imread(argv[2 + i * 2]);
+        masks[i] = cv::imread(argv[3 + i * 2], -1);
+        if (!images[i].data || !masks[i].data || masks[i].type() != CV_8UC1)
+        {
+            printf("Could not load image %s or mask %s\n", argv[2 + i * 2], argv[3 + i * 2]);
+            return 1;
+        }
+    }
+
+    bool ok = blendAndCompare("input images", images, masks, masks, maxLevels, true);
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,64 @@
+#include "Pyramid.h"
+#include "opencv2/core.hpp"
+#include <cstdio>
+
+enum PyramidFunc { DownTo32S, Down, Up };
+
+// Compare AVX2 and scalar pyramid kernels, the results should be bit-exact.
+static bool compare(const cv::Mat& src, PyramidFunc func, int horiBorderType)
+{
+    static const char* names[] = { "down to 32S", "down", "up" };
+    cv::Mat simdResult, scalarResult;
+    for (int i = 0; i < 2; i++)
+    {
+        setPyramidUseSIMD(i == 0);
+        cv::Mat& dst = i == 0 ? simdResult : scalarResult;
+        if (func == DownTo32S)
+            pyramidDownTo32S(src, dst, cv::Size(), horiBorderType);
+        else if (func == Down)
+            pyramidDown(src, dst, cv::Size(), horiBorderType);
+        else
+            pyramidUp(src, dst, cv::Size(src.cols * 2 - (src.cols & 1), src.rows * 2 - (src.rows & 1)), horiBorderType);
+    }
+    setPyramidUseSIMD(true);
+
+    cv::Mat diff = simdResult.reshape(1) != scalarResult.reshape(1);
+    int numDiffs = cv::countNonZero(diff);
+    printf("%s, src %d x %d, depth %d, channels %d, border %d, %d different elements\n", names[func],
+        src.cols, src.rows, src.depth(), src.channels(), horiBorderType, numDiffs);
+    return numDiffs == 0;
+}
+
+int main()
+{
+    bool ok = true;
+    // Small sizes make the rows consist of border elements only.
+    const int numSizes = 5;
+    int sizes[numSizes][2] = { { 4096, 2048 }, { 1001, 333 }, { 37, 21 }, { 17, 9 }, { 6, 5 } };
+    const int numChannels[] = { 1, 3, 4 };
+    for (int i = 0; i < numSizes; i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            int cn = numChannels[c];
+            for (int border = 0; border < 2; border++)
+            {
+                int horiBorderType = border ? cv::BORDER_WRAP : cv::BORDER_DEFAULT;
+                cv::Mat src8U(sizes[i][1], sizes[i][0], CV_MAKETYPE(CV_8U, cn)),
+                    src16S(src8U.size(), CV_MAKETYPE(CV_16S, cn)), src32S(src8U.size(), CV_MAKETYPE(CV_32S, cn));
+                cv::randu(src8U, cv::Scalar::all(0), cv::Scalar::all(256));
+                cv::randu(src16S, cv::Scalar::all(-32768), cv::Scalar::all(32768));
+                cv::randu(src32S, cv::Scalar::all(-65536), cv::Scalar::all(65536));
+                ok &= compare(src8U, DownTo32S, horiBorderType);
+                ok &= compare(src16S, DownTo32S, horiBorderType);
+                ok &= compare(src16S, Down, horiBorderType);
+                ok &= compare(src32S, Down, horiBorderType);
+                ok &= compare(src8U, Up, horiBorderType);
+                ok &= compare(src16S, Up, horiBorderType);
+                ok &= compare(src32S, Up, horiBorderType);
+            }
+        }
+    }
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+#include "ZBlendAlgo.h"
+#include "Timer.h"
+#include "opencv2/core.hpp"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+int calcRGBColorDiffRowSSSE3(const unsigned char* ptr1, const unsigned char* ptr2, float* ptr, int width);
+int calcRGBColorDiffRowAVX2(const unsigned char* ptr1, const unsigned char* ptr2, float* ptr, int width);
+void calcRGBColorDiff(const cv::Mat& img1, const cv::Mat& img2, cv::Mat& diff);
+void downDiff(const cv::Mat& src, cv::Mat& dst, int scale);
+
+static void calcRGBColorDiffScalar(const cv::Mat& img1, const cv::Mat& img2, cv::Mat& diff)
+{
+    diff.create(img1.size(), CV_32FC1);
+    for (int i = 0; i < img1.rows; i++)
+    {
+        const unsigned char* ptr1 = img1.ptr<unsigned char>(i);
+        const unsigned char* ptr2 = img2.ptr<unsigned char>(i);
+        float* ptr = diff.ptr<float>(i);
+        for (int j = 0; j < img1.cols; j++)
+        {
+            int diff0 = int(ptr1[j * 3]) - int(ptr2[j * 3]);
+            int diff1 = int(ptr1[j * 3 + 1]) - int(ptr2[j * 3 + 1]);
+            int diff2 = int(ptr1[j * 3 + 2]) - int(ptr2[j * 3 + 2]);
+            ptr[j] = sqrtf(diff0 * diff0 + diff1 * diff1 + diff2 * diff2);
+        }
+    }
+}
+
+static bool sameBytes(const cv::Mat& a, const cv::Mat& b)
+{
+    if (a.size() != b.size() || a.type() != b.type())
+        return false;
+    for (int i = 0; i < a.rows; i++)
+    {
+        if (memcmp(a.ptr(i), b.ptr(i), a.cols * a.elemSize()))
+            return false;
+    }
+    return true;
+}
+
+// Each row kernel and calcRGBColorDiff with SIMD on and off should give the same bytes as the scalar code.
+// The images are views into larger ones, so the rows are not continuous, and the extreme values
+// 0 and 255 are mixed in to hit the largest differences.
+static bool testColorDiff(int width, int height)
+{
+    cv::Mat whole1(height + 2, width + 3, CV_8UC3), whole2(height + 2, width + 3, CV_8UC3);
+    cv::randu(whole1, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::randu(whole2, cv::Scalar::all(0), cv::Scalar::all(256));
+    whole1.row(0).setTo(cv::Scalar::all(255));
+    whole2.row(0).setTo(cv::Scalar::all(0));
+    cv::Mat image1 = whole1(cv::Rect(1, 0, width, height)), image2 = whole2(cv::Rect(2, 0, width, height));
+
+    cv::Mat ref;
+    calcRGBColorDiffScalar(image1, image2, ref);
+
+    bool ok = true;
+    int (*kernels[2])(const unsigned char*, const unsigned char*, float*, int) =
+        { calcRGBColorDiffRowSSSE3, calcRGBColorDiffRowAVX2 };
+    bool supported[2] = { cv::checkHardwareSupport(CV_CPU_SSSE3), cv::checkHardwareSupport(CV_CPU_AVX2) };
+    for (int k = 0; k < 2; k++)
+    {
+        if (!supported[k])
+            continue;
+        for (int i = 0; i < height; i++)
+        {
+            std::vector<float> row(width, -1.0F);
+            int num = kernels[k](image1.ptr<unsigned char>(i), image2.ptr<unsigned char>(i), &row[0], width);
+            // At most 15 pixels are left to the scalar code
+            ok &= num >= 0 && num <= width && width - num < 16 &&
+                memcmp(&row[0], ref.ptr<float>(i), num * sizeof(float)) == 0;
+            // Pixels left to the scalar code should not be written
+            for (int j = num; j < width; j++)
+                ok &= row[j] == -1.0F;
+        }
+    }
+
+    cv::Mat diffs[2];
+    for (int i = 0; i < 2; i++)
+    {
+        setSeamCostUseSIMD(i == 0);
+        calcRGBColorDiff(image1, image2, diffs[i]);
+    }
+    setSeamCostUseSIMD(true);
+    ok &= sameBytes(diffs[0], ref) && sameBytes(diffs[1], ref);
+    printf("color diff, %d x %d, SSSE3 %d, AVX2 %d, %s\n", width, height, supported[0], supported[1], ok ? "ok" : "DIFFERENT");
+    return ok;
+}
+
+// downDiff should equal cv::blur with the default border sampled at every scale-th row and column,
+// up to float rounding, since the sums are taken in a different order.
+static bool testDownDiff(int width, int height, int scale)
+{
+    cv::Mat src(height, width, CV_32FC1);
+    cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(442));
+
+    int length = (scale & 1) ? scale : scale + 1;
+    cv::Mat blurred;
+    cv::blur(src, blurred, cv::Size(length, length));
+    cv::Mat ref((height + scale - 1) / scale, (width + scale - 1) / scale, CV_32FC1);
+    for (int i = 0; i < ref.rows; i++)
+    {
+        for (int j = 0; j < ref.cols; j++)
+            ref.at<float>(i, j) = blurred.at<float>(i * scale, j * scale);
+    }
+
+    cv::Mat dst;
+    downDiff(src, dst, scale);
+    double maxDiff = dst.size() == ref.size() ? cv::norm(dst, ref, cv::NORM_INF) : -1;
+    bool ok = maxDiff >= 0 && maxDiff < 1e-3;
+    printf("down diff, %d x %d, scale %d, dst %d x %d, max diff %g, %s\n",
+        width, height, scale, dst.cols, dst.rows, maxDiff, ok ? "ok" : "DIFFERENT");
+    return ok;
+}
+
+// Finds the seams of two images with the SIMD color difference kernels on and off,
+// the resulting masks should be the same.
+static bool compare(const char* name, const cv::Mat& image1, const cv::Mat& image2,
+    const cv::Mat& mask1, const cv::Mat& mask2, int scale)
+{
+    cv::Mat results1[2], results2[2];
+    double times[2];
+    for (int i = 0; i < 2; i++)
+    {
+        setSeamCostUseSIMD(i == 0);
+        results1[i] = mask1.clone();
+        results2[i] = mask2.clone();
+        ztool::Timer timer;
+        if (scale > 1)
+            findSeamScaleDown(image1, image2, results1[i], results2[i], true, scale, true);
+        else
+            findSeamInROI(image1, image2, mask1 & mask2, results1[i], results2[i], true);
+        timer.end();
+        times[i] = timer.elapse();
+    }
+    setSeamCostUseSIMD(true);
+    bool ok = cv::countNonZero(results1[0] != results1[1]) == 0 &&
+        cv::countNonZero(results2[0] != results2[1]) == 0;
+    printf("%s: time SIMD %f scalar %f, %s\n", name, times[0], times[1], ok ? "same" : "DIFFERENT");
+    return ok;
+}
+
+// Usage: TestSeamCostSIMD [image1 mask1 image2 mask2]
+// Without arguments only the synthetic tests run, with them the seams of the given images are compared as well.
+int main(int argc, char** argv)
+{
+    bool ok = true;
+    // Widths around multiples of 16 leave 0 to 15 pixels to the scalar code
+    const int numWidths = 11;
+    int widths[numWidths] = { 1, 7, 15, 16, 17, 31, 32, 33, 47, 100, 1023 };
+    for (int i = 0; i < numWidths; i++)
+        ok &= testColorDiff(widths[i], 5);
+
+    // Odd sizes make the last sampled rows and columns reach into the border
+    const int numSizes = 5, numScales = 3;
+    int sizes[numSizes][2] = { { 4000, 2000 }, { 1001, 333 }, { 37, 21 }, { 17, 9 }, { 5, 3 } };
+    int scales[numScales] = { 2, 3, 8 };
+    for (int i = 0; i < numSizes; i++)
+    {
+        for (int j = 0; j < numScales; j++)
+            ok &= testDownDiff(sizes[i][0], sizes[i][1], scales[j]);
+    }
+
+    if (argc >= 5)
+    {
+        cv::Mat image1 = cv::imread(argv[1]), mask1 = cv::imread(argv[2], -1);
+        cv::Mat image2 = cv::imread(argv[3]), mask2 = cv::imread(argv[4], -1);
+        if (!image1.data || !mask1.data || !image2.data || !mask2.data ||
+            mask1.type() != CV_8UC1 || mask2.type() != CV_8UC1)
+        {
+            printf("Could not load images and masks\n");
+            return 1;
+        }
+        ok &= compare("findSeamInROI", image1, image2, mask1, mask2, 1);
+        ok &= compare("findSeamScaleDown", image1, image2, mask1, mask2, 8);
+    }
+
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
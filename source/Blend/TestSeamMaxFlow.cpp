@@ -0,0 +1,131 @@
+#include "GridMaxFlow.h"
+#include "Timer.h"
+#include "opencv2/core.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Builds a seam like graph, mask1 covers the left part and mask2 the right part of the grid,
+// overlapping in the middle half, with the edge weights of findSeam, and solves it by
+// GCGraphMaxFlow and GridBKMaxFlow. The flows and the cut costs should be the same.
+// inactive: 0 all pixels active, 1 a band of columns inactive, 2 random pixels inactive,
+// 3 only a band of rows active, 4 only a band of columns active.
+static bool compare(int rows, int cols, bool horiWrap, int inactive)
+{
+    cv::Mat diff(rows, cols, CV_32FC1), mask1(rows, cols, CV_8UC1), mask2(rows, cols, CV_8UC1);
+    for (int y = 0; y < rows; y++)
+    {
+        float* ptrDiff = diff.ptr<float>(y);
+        unsigned char* ptrMask1 = mask1.ptr<unsigned char>(y);
+        unsigned char* ptrMask2 = mask2.ptr<unsigned char>(y);
+        for (int x = 0; x < cols; x++)
+        {
+            ptrDiff[x] = 60 + 50 * sin(x * 0.05 + y * 0.03) * cos(y * 0.07) + rand() % 20;
+            ptrMask1[x] = x < cols * 3 / 4 ? 255 : 0;
+            ptrMask2[x] = x >= cols / 4 ? 255 : 0;
+        }
+    }
+    cv::Mat active;
+    if (inactive)
+    {
+        active.create(rows, cols, CV_8UC1);
+        for (int y = 0; y < rows; y++)
+        {
+            unsigned char* ptrActive = active.ptr<unsigned char>(y);
+            for (int x = 0; x < cols; x++)
+            {
+                if (inactive == 1)
+                    ptrActive[x] = x < cols / 8 || x >= cols / 4 ? 255 : 0;
+                else if (inactive == 2)
+                    ptrActive[x] = rand() % 10 ? 255 : 0;
+                else if (inactive == 3)
+                    ptrActive[x] = y >= rows / 2 - 8 && y < rows / 2 + 8 ? 255 : 0;
+                else
+                    ptrActive[x] = x >= cols / 3 && x < cols * 2 / 3 ? 255 : 0;
+            }
+        }
+    }
+
+    GCGraphMaxFlow gcGraph;
+    GridBKMaxFlow gridBK;
+    GridMaxFlow* graphs[2] = { &gcGraph, &gridBK };
+    float flows[2];
+    double times[2], cuts[2];
+    for (int k = 0; k < 2; k++)
+    {
+        GridMaxFlow* graph = graphs[k];
+        ztool::Timer timer;
+        graph->create(rows, cols, horiWrap, active);
+        for (int y = 0; y < rows; y++)
+        {
+            for (int x = 0; x < cols; x++)
+            {
+                int x1 = x < cols - 1 ? x + 1 : 0;
+                graph->addTermWeights(y, x, mask2.at<unsigned char>(y, x) ? 0.f : 10000.f,
+                                            mask1.at<unsigned char>(y, x) ? 0.f : 10000.f);
+                graph->addRightEdge(y, x, diff.at<float>(y, x) + diff.at<float>(y, x1) + 1);
+                if (y < rows - 1)
+                    graph->addDownEdge(y, x, diff.at<float>(y, x) + diff.at<float>(y + 1, x) + 1);
+            }
+        }
+        flows[k] = graph->maxFlow();
+        timer.end();
+        times[k] = timer.elapse();
+
+        // Cost of the cut given by inSourceSegment
+        double cut = 0;
+        for (int y = 0; y < rows; y++)
+        {
+            for (int x = 0; x < cols; x++)
+            {
+                if (active.data && !active.at<unsigned char>(y, x))
+                    continue;
+                bool source = graph->inSourceSegment(y, x);
+                if (source && !mask1.at<unsigned char>(y, x))
+                    cut += 10000;
+                if (!source && !mask2.at<unsigned char>(y, x))
+                    cut += 10000;
+                int x1 = x < cols - 1 ? x + 1 : (horiWrap ? 0 : -1);
+                if (x1 >= 0 && x1 != x && (!active.data || active.at<unsigned char>(y, x1)) &&
+                    graph->inSourceSegment(y, x1) != source)
+                    cut += diff.at<float>(y, x) + diff.at<float>(y, x1) + 1;
+                if (y < rows - 1 && (!active.data || active.at<unsigned char>(y + 1, x)) &&
+                    graph->inSourceSegment(y + 1, x) != source)
+                    cut += diff.at<float>(y, x) + diff.at<float>(y + 1, x) + 1;
+            }
+        }
+        cuts[k] = cut;
+    }
+
+    // GridBKMaxFlow only stores the bounding rect of the active pixels
+    size_t memorySize = gridBK.getMemorySize();
+    size_t boundSize = 64 * (size_t)rows * cols;
+    if (inactive == 3)
+        boundSize = 64 * (size_t)16 * cols;
+    else if (inactive == 4)
+        boundSize = 64 * (size_t)rows * (cols / 3 + 1);
+    bool ok = fabs(flows[0] - flows[1]) <= 1e-4 * (fabs(flows[0]) + 1) &&
+        fabs(cuts[0] - cuts[1]) <= 1e-4 * (cuts[0] + 1) && memorySize <= boundSize;
+    printf("%dx%d horiWrap %d inactive %d: flow %f %f, cut %f %f, time GCGraph %f GridBK %f, GridBK memory %d, %s\n",
+        rows, cols, horiWrap, inactive, flows[0], flows[1], cuts[0], cuts[1], times[0], times[1], 
+        (int)memorySize, ok ? "OK" : "FAIL");
+    return ok;
+}
+
+int main()
+{
+    bool ok = true;
+    // Scale down graphs
+    ok &= compare(128, 256, true, 0);
+    ok &= compare(256, 512, false, 0);
+    // Refine bands along the seam
+    ok &= compare(300, 1024, false, 2);
+    // Left right wrap
+    ok &= compare(512, 1024, true, 1);
+    // Thin bands, the wrap around edge leaves the bounding rect in the second case
+    ok &= compare(512, 1024, true, 3);
+    ok &= compare(512, 1024, true, 4);
+    printf(ok ? "All passed\n" : "Failed\n");
+    return ok ? 0 : 1;
+}
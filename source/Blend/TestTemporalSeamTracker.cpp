@@ -0,0 +1,153 @@
+#include "ZBlendAlgo.h"
+#include "opencv2/core.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static const int rows = 160, cols = 320;
+// mask1 covers [0, overlapEnd), mask2 covers [overlapBeg, cols)
+static const int overlapBeg = 120, overlapEnd = 200;
+
+static void makeMasks(cv::Mat& mask1, cv::Mat& mask2)
+{
+    mask1.create(rows, cols, CV_8UC1);
+    mask2.create(rows, cols, CV_8UC1);
+    for (int y = 0; y < rows; y++)
+    {
+        for (int x = 0; x < cols; x++)
+        {
+            mask1.at<unsigned char>(y, x) = x < overlapEnd ? 255 : 0;
+            mask2.at<unsigned char>(y, x) = x >= overlapBeg ? 255 : 0;
+        }
+    }
+}
+
+// image2 differs from image1 everywhere except along a valley, at valleyX in the rows
+// of [bandBeg, bandEnd) and at x = 160 in the other rows, the seam should follow the valley.
+static void makeImages(int bandBeg, int bandEnd, int valleyX, cv::Mat& image1, cv::Mat& image2)
+{
+    image1.create(rows, cols, CV_8UC3);
+    image2.create(rows, cols, CV_8UC3);
+    for (int y = 0; y < rows; y++)
+    {
+        int valley = y >= bandBeg && y < bandEnd ? valleyX : 160;
+        for (int x = 0; x < cols; x++)
+        {
+            int base = 100 + int(40 * sin(x * 0.05) * cos(y * 0.04));
+            int offset = std::min(60, std::abs(x - valley) * 6);
+            for (int c = 0; c < 3; c++)
+            {
+                image1.at<unsigned char>(y, x * 3 + c) = base;
+                image2.at<unsigned char>(y, x * 3 + c) = base + offset;
+            }
+        }
+    }
+}
+
+// First column of row y in the overlap that belongs to result mask2, -1 if the labels of the row
+// are not one run of mask1 followed by one run of mask2.
+static int seamColumn(const cv::Mat& result1, const cv::Mat& result2, int y)
+{
+    const unsigned char* ptr1 = result1.ptr<unsigned char>(y);
+    const unsigned char* ptr2 = result2.ptr<unsigned char>(y);
+    int seam = -1;
+    for (int x = 0; x < cols; x++)
+    {
+        if ((ptr1[x] != 0) == (ptr2[x] != 0))
+            return -1;
+        if (ptr2[x] && seam < 0)
+            seam = x;
+        if (ptr1[x] && seam >= 0)
+            return -1;
+    }
+    return seam;
+}
+
+static bool sameRows(const cv::Mat& a, const cv::Mat& b, int beg, int end)
+{
+    for (int y = beg; y < end; y++)
+    {
+        if (memcmp(a.ptr(y), b.ptr(y), cols))
+            return false;
+    }
+    return true;
+}
+
+// Masks that do not intersect are returned unchanged.
+static bool testNoIntersection()
+{
+    cv::Mat mask1(rows, cols, CV_8UC1, cv::Scalar(0)), mask2(rows, cols, CV_8UC1, cv::Scalar(0));
+    mask1(cv::Rect(0, 0, 100, rows)).setTo(255);
+    mask2(cv::Rect(200, 0, 120, rows)).setTo(255);
+    cv::Mat image1, image2, result1, result2;
+    makeImages(0, 0, 160, image1, image2);
+    TemporalSeamTracker tracker;
+    bool prepared = tracker.prepare(mask1, mask2);
+    bool updated = tracker.track(image1, image2, result1, result2);
+    bool ok = prepared && !updated && sameRows(result1, mask1, 0, rows) && sameRows(result2, mask2, 0, rows);
+    printf("no intersection: prepared %d, updated %d, %s\n", prepared, updated, ok ? "ok" : "wrong");
+    return ok;
+}
+
+// A change in a band of rows re-solves the seam only near that band,
+// the labels of the rows far from it are kept.
+static bool testChangedBand()
+{
+    const int bandRadius = 16, bandBeg = 60, bandEnd = 100, valleyX = 150;
+    cv::Mat mask1, mask2, image1, image2;
+    makeMasks(mask1, mask2);
+    TemporalSeamTracker tracker;
+    if (!tracker.prepare(mask1, mask2, bandRadius, 20))
+        return false;
+
+    bool ok = true;
+    cv::Mat first1, first2;
+    makeImages(0, 0, 160, image1, image2);
+    ok &= tracker.track(image1, image2, first1, first2);
+    int firstNumVertices = tracker.getNumVertices();
+    int maxFirstDist = 0;
+    for (int y = 0; y < rows; y++)
+    {
+        int seam = seamColumn(first1, first2, y);
+        maxFirstDist = seam < 0 ? cols : std::max(maxFirstDist, std::abs(seam - 160));
+    }
+    ok &= maxFirstDist <= 2;
+
+    cv::Mat second1, second2;
+    makeImages(bandBeg, bandEnd, valleyX, image1, image2);
+    bool updated = tracker.track(image1, image2, second1, second2);
+    int secondNumVertices = tracker.getNumVertices();
+    ok &= updated && secondNumVertices < firstNumVertices;
+    // The changed pixels are within bandRadius of the band, the graph within bandRadius of them
+    int aboveEnd = bandBeg - 2 * bandRadius - 2, belowBeg = bandEnd + 2 * bandRadius + 2;
+    bool kept = sameRows(first1, second1, 0, aboveEnd) && sameRows(first2, second2, 0, aboveEnd) &&
+        sameRows(first1, second1, belowBeg, rows) && sameRows(first2, second2, belowBeg, rows);
+    int maxBandDist = 0;
+    for (int y = bandBeg + 4; y < bandEnd - 4; y++)
+    {
+        int seam = seamColumn(second1, second2, y);
+        maxBandDist = seam < 0 ? cols : std::max(maxBandDist, std::abs(seam - valleyX));
+    }
+    ok &= kept && maxBandDist <= 2;
+
+    // Nothing changed, the previous seam is returned without a graphcut
+    cv::Mat third1, third2;
+    bool updatedAgain = tracker.track(image1, image2, third1, third2);
+    bool same = sameRows(second1, third1, 0, rows) && sameRows(second2, third2, 0, rows);
+    ok &= !updatedAgain && same;
+
+    printf("changed band: vertices first %d second %d, first seam dist %d, rows far from the band kept %d, "
+        "band seam dist %d, updated without change %d, %s\n", firstNumVertices, secondNumVertices, maxFirstDist,
+        kept, maxBandDist, updatedAgain, ok ? "ok" : "wrong");
+    return ok;
+}
+
+int main()
+{
+    bool ok = true;
+    ok &= testNoIntersection();
+    ok &= testChangedBand();
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
@@ -1,5 +1,6 @@
 #include "ZBlend.h"
 #include "ZBlendAlgo.h"
+#include "LookUpTable.h"
 #include "opencv2/imgproc.hpp"
 #include <iostream>
 
@@ -88,36 +89,11 @@ void scale(const cv::Mat& src, const cv::Mat& mask, double rRatio, double bRatio
 {
     CV_Assert(src.data && src.type() == CV_8UC3 &&
         mask.data && mask.type() == CV_8UC1 && mask.size() == src.size());
-    int rows = src.rows, cols = src.cols;
-    dst.create(rows, cols, CV_8UC3);
-    std::vector<unsigned char> rLUT(256), bLUT(256);
-    const unsigned char* rlut = rLUT.data(), * blut = bLUT.data();
-    getLUT(rLUT, rRatio);
-    getLUT(bLUT, bRatio);
-    for (int i = 0; i < rows; i++)
-    {
-        const unsigned char* ptrSrc = src.ptr<unsigned char>(i);
-        const unsigned char* ptrMask = mask.ptr<unsigned char>(i);
-        unsigned char* ptrDst = dst.ptr<unsigned char>(i);
-        for (int j = 0; j < cols; j++)
-        {
-            if (*ptrMask)
-            {
-                ptrDst[0] = blut[ptrSrc[0]];
-                ptrDst[1] = ptrSrc[1];
-                ptrDst[2] = rlut[ptrSrc[2]];
-            }
-            else
-            {
-                ptrDst[0] = 0;
-                ptrDst[1] = 0;
-                ptrDst[2] = 0;
-            }
-            ptrSrc += 3;
-            ptrMask++;
-            ptrDst += 3;
-        }
-    }
+    std::vector<std::vector<unsigned char> > luts(3);
+    getLUT(luts[0], bRatio);
+    getLUT(luts[1], 1);
+    getLUT(luts[2], rRatio);
+    applyLUTs(src, dst, luts, mask);
 }
 
 void getTintTransformsMeanApproxMimicSiftPanoPaper(const std::vector<cv::Mat>& images, const std::vector<cv::Mat>& masks,
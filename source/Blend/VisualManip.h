@@ -4,6 +4,8 @@
 #include "Warp/ZReproject.h"
 #include "opencv2/core.hpp"
 #include <vector>
+#include <memory>
+#include <mutex>
 
 void compensate(const std::vector<cv::Mat>& images, const std::vector<cv::Mat>& masks, std::vector<cv::Mat>& results);
 
@@ -69,6 +71,67 @@ void exposureColorOptimize(const std::vector<cv::Mat>& images, const std::vector
     const std::vector<int> anchorIndexes, int getPointPairsMethod, int optimizeWhat,
     std::vector<double>& exposures, std::vector<double>& redRatios, std::vector<double>& blueRatios);
 
+// By default exposureColorOptimize solves with a Levenberg-Marquardt working on normal equations
+// accumulated with the analytic Jacobian, if useNormalEquations is false, dlevmar_dif is used.
+void setExposureColorOptimizeUseNormalEquations(bool useNormalEquations);
+
+// Estimates exposures and white balance ratios of video frames in a background thread,
+// with the model of exposureColorOptimize and the HISTOGRAM point pairs method.
+// addFrames is meant to be called by the processing thread for every frame. Only one frame set
+// in frameInterval is taken, it is copied and handed to the background thread, which shrinks it
+// to the size exposureColorOptimize works on. It is dropped without copying if the background thread
+// has not taken the previous set yet.
+// The background thread blends the cumulative histograms of the overlapping regions into running
+// statistics, in which earlier frames decay by historyWeight per estimate, and solves starting from
+// the previous result. Every solved result is published as a new set of LUTs in the layout of
+// getExposureColorOptimizeLUTs, a published set is never modified, so getLUTs is cheap and
+// the returned set stays valid while it is used.
+// addFrames should not be called concurrently with prepare or clear.
+class ExposureColorEstimator
+{
+public:
+    ExposureColorEstimator();
+    ~ExposureColorEstimator();
+    // srcSize is the size of the frames passed to addFrames,
+    // optimizeWhat is EXPOSURE, WHITE_BALANCE or EXPOSURE | WHITE_BALANCE.
+    bool prepare(const std::vector<PhotoParam>& params, const cv::Size& srcSize, int optimizeWhat,
+        int frameInterval = 30, double historyWeight = 0.75);
+    // images should be of type CV_8UC3 or CV_8UC4, they are sampled down to the size
+    // the estimate works on if taken, so the caller may reuse them right after the call.
+    void addFrames(const std::vector<cv::Mat>& images);
+    // Returns an empty pointer before the first estimate is done.
+    std::shared_ptr<const std::vector<std::vector<std::vector<unsigned char> > > > getLUTs() const;
+    bool getResult(std::vector<double>& exposures, std::vector<double>& redRatios, std::vector<double>& blueRatios) const;
+    int getNumSolves() const;
+    void clear();
+private:
+    struct Impl;
+    std::unique_ptr<Impl> ptrImpl;
+};
+
+// The ExposureColorEstimator of a stitching task, started by begin and stopped by stop while the
+// processing thread calls addFrames for every frame set. The lock only guards the pointer swap,
+// addFrames calls the estimator outside it. The new estimator is prepared before the swap
+// by begin, and the old one is joined after it by begin and stop, once addFrames has dropped it.
+class SwitchableExposureColorEstimator
+{
+public:
+    // Replaces the running estimator, if any, by a new one prepared with the given arguments.
+    // On failure the running estimator is kept.
+    bool begin(const std::vector<PhotoParam>& params, const cv::Size& srcSize, int optimizeWhat,
+        int frameInterval = 30, double historyWeight = 0.75);
+    void stop();
+    // Passes images to the running estimator and returns its latest LUTs, an empty pointer
+    // if no estimator is running or the running one has not finished an estimate yet.
+    std::shared_ptr<const std::vector<std::vector<std::vector<unsigned char> > > > addFrames(const std::vector<cv::Mat>& images);
+    std::shared_ptr<const std::vector<std::vector<std::vector<unsigned char> > > > getLUTs() const;
+    int getNumSolves() const;
+private:
+    static void release(std::shared_ptr<ExposureColorEstimator>& oldEstimator);
+    mutable std::mutex mtxEstimator;
+    std::shared_ptr<ExposureColorEstimator> estimator;
+};
+
 void getExposureColorOptimizeLUTs(const std::vector<double>& exposures, const std::vector<double>& redRatios,
     const std::vector<double>& blueRatios, std::vector<std::vector<std::vector<unsigned char> > >& luts);
 
@@ -757,6 +757,12 @@ static BlendConfig validate(const BlendConfig& config)
     {
 #if WRITE_CONSOLE
         printf("graph cut\n");
+#endif
+    }
+    else if (cfg.seamMode == BlendConfig::SEAM_GRAPH_CUT_PARALLEL)
+    {
+#if WRITE_CONSOLE
+        printf("graph cut, pairwise in parallel\n");
 #endif
     }
     else
@@ -848,7 +854,7 @@ static BlendConfig validate(const BlendConfig& config)
 #endif
         }
     }
-    if (cfg.seamMode == BlendConfig::SEAM_GRAPH_CUT)
+    if (cfg.seamMode == BlendConfig::SEAM_GRAPH_CUT || cfg.seamMode == BlendConfig::SEAM_GRAPH_CUT_PARALLEL)
     {
 #if WRITE_CONSOLE
         printf("pad for graphcut: ");
@@ -1146,6 +1152,11 @@ void parallelBlend(const BlendConfig& config, const std::vector<cv::Mat>& images
         newMasks = masks;
     else if (cfg.seamMode == BlendConfig::SEAM_DISTANCE_TRANSFORM)
         getNonIntersectingMasks(masks, newMasks);
+    else if (cfg.seamMode == BlendConfig::SEAM_GRAPH_CUT_PARALLEL)
+    {
+        findSeamsParallel(images, masks, newMasks, cfg.padForGraphCut, 
+            cfg.scaleForGraphCut, cfg.ratioForGraphCut, cfg.refineForGraphCut);
+    }
     else
     {
         findSeams(images, masks, newMasks, cfg.padForGraphCut, 
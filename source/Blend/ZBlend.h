@@ -14,7 +14,8 @@ struct BlendConfig
     {
         SEAM_SKIP,
         SEAM_DISTANCE_TRANSFORM,
-        SEAM_GRAPH_CUT
+        SEAM_GRAPH_CUT,
+        SEAM_GRAPH_CUT_PARALLEL
     };
     enum BlendMode
     {
@@ -47,6 +48,11 @@ struct BlendConfig
         refineForGraphCut = refine;
         ratioForGraphCut = ratio;
     }
+    void setSeamGraphCutParallel(int pad = 8, int scale = 8, int refine = 1, double ratio = 0.75)
+    {
+        seamMode = SEAM_GRAPH_CUT_PARALLEL;
+        setSeamGraphCut(pad, scale, refine, ratio);
+    }
     void setBlendPaste()
     {
         blendMode = BLEND_PASTE;
@@ -126,6 +132,8 @@ private:
     std::vector<cv::Mat> uniqueMasks;
     std::vector<cv::Mat> resultPyr, resultUpPyr, resultWeightPyr;
     std::vector<cv::Mat> imagePyr, image32SPyr, imageUpPyr;
+    // Level 1 of the Gauss pyramid of every image, kept for the strips of level 0
+    std::vector<cv::Mat> imageLevel1s;
     std::vector<std::vector<cv::Mat> > alphaPyrs, weightPyrs;    
     cv::Mat maskNot;
     int numImages;
@@ -142,25 +150,39 @@ private:
     std::vector<cv::Mat> adjustMasks, tempAlphaPyr, adjustAlphaPyr;
 };
 
-// DEPRECATED
-// Just only a little faster than TilingMultibandBlendFast at the expense of more memory consumption
+// Multithreaded TilingMultibandBlendFast with the same results.
+// Each pyramid level is split into row bands which are processed by the threads of cv::parallel_for_.
+// The levels above 0 of the Gauss pyramids of all the images are computed concurrently and kept,
+// which takes about 0.5 bytes per pixel per image more memory than TilingMultibandBlendFast,
+// which keeps only level 1 of every image.
+// Every band of the result accumulates all the images and is normalized and restored by one thread, 
+// so no lock is needed.
+// If use16S is true, the result pyramid, the weight sums and the alpha pyramids are 16 bit 
+// instead of 32 bit, and the weights of the images sum to 128 instead of 256, weights of overlapping
+// custom masks are scaled down to keep the sum. Memory of these pyramids is halved at the cost of 
+// one bit of weight precision, the accumulation saturates if 16 bit images exceed [0, 255].
 class TilingMultibandBlendFastParallel : public MultibandBlendBase
 {
 public:
-    TilingMultibandBlendFastParallel() : numImages(0), rows(0), cols(0), numLevels(0), success(false), threadEnd(true) {}
-    ~TilingMultibandBlendFastParallel();
+    explicit TilingMultibandBlendFastParallel(bool use16S_ = false) 
+        : use16S(use16S_), numImages(0), rows(0), cols(0), numLevels(0), success(false) {}
+    ~TilingMultibandBlendFastParallel() {}
     bool prepare(const std::vector<cv::Mat>& masks, int maxLevels, int minLength);
     void blend(const std::vector<cv::Mat>& images, cv::Mat& blendImage);
     void blend(const std::vector<cv::Mat>& images, const std::vector<cv::Mat>& masks, cv::Mat& blendImage);
     void getUniqueMasks(std::vector<cv::Mat>& masks) const;
 
 private:
+    void blendPyramids(const std::vector<cv::Mat>& images, const std::vector<std::vector<cv::Mat> >& currWeightPyrs, 
+        const std::vector<cv::Mat>& currResultWeightPyr, const cv::Mat& currMaskNot, bool currFullMask, cv::Mat& blendImage);
+    int getWeightValue() const;
+    int getWeightSumType() const;
+
+    bool use16S;
     std::vector<cv::Mat> uniqueMasks;
-    std::vector<cv::Mat> resultPyr, resultUpPyr, resultWeightPyr;
-    std::vector<std::vector<cv::Mat> > imagePyrs, image32SPyrs, imageUpPyrs;
+    std::vector<cv::Mat> resultPyr, resultWeightPyr;
+    std::vector<std::vector<cv::Mat> > imagePyrs;
     std::vector<std::vector<cv::Mat> > alphaPyrs, weightPyrs;
-    std::vector<std::vector<unsigned char> > rowBuffers, tabBuffers;
-    std::vector<unsigned char> restoreRowBuffer, restoreTabBuffer;
     cv::Mat maskNot;
     int numImages;
     int rows, cols;
@@ -168,17 +190,6 @@ private:
     bool fullMask;
     bool success;
 
-    void init();
-    void endThreads();
-    std::vector<cv::Mat> imageHeaders;
-    std::vector<std::unique_ptr<std::thread> > threads;
-    std::mutex mtxBuildPyr, mtxAccum;
-    std::condition_variable cvBuildPyr, cvAccum;
-    std::atomic<int> buildCount;
-    bool threadEnd;
-    void buildPyramid(int index);
-
-    std::vector<cv::Mat> customMasks, customAuxes;
     std::vector<cv::Mat> customResultWeightPyr;
     std::vector<std::vector<cv::Mat> > customWeightPyrs;
     cv::Mat customMaskNot;
@@ -221,6 +221,19 @@ void findSeamScaleDown(const cv::Mat& image1, const cv::Mat& image2,
 void findSeamLeftRightWrap(const cv::Mat& image1, const cv::Mat& image2,
     cv::Mat& mask1, cv::Mat& mask2, int zeroBegInc, int zeroEndExc);
 
+// Chooses the max-flow solver of all the findSeam variants above and the functions built on them.
+// If useGridMaxFlow is true, the graph is solved by GridBKMaxFlow, which reuses its storage
+// across calls, otherwise by GCGraph. Both give cuts of the same cost. The default is true.
+void setSeamUseGridMaxFlow(bool useGridMaxFlow);
+
+// Frees the GridBKMaxFlow solvers kept for reuse by later seams, for example after a task
+// finds its seams once on start up. Solvers in use by seams being searched are not affected.
+void releaseSeamMaxFlowPool();
+
+// Switches the SSSE3 and AVX2 kernels of the color difference of the graphcut seam functions on or off,
+// they are on by default and only used if the cpu supports them. The results are the same either way.
+void setSeamCostUseSIMD(bool useSIMD);
+
 // Use graphcut to split images whose effective regions are defined by masks,
 // results are stored in resultMasks.
 // images.size() should equal to masks.size(),
@@ -239,6 +252,53 @@ void findSeamLeftRightWrap(const cv::Mat& image1, const cv::Mat& image2,
 void findSeams(const std::vector<cv::Mat>& images, const std::vector<cv::Mat>& masks, 
     std::vector<cv::Mat>& resultMasks, int pad, int scale, double ratio, bool refine);
 
+// Multithreaded alternative of findSeams with the same requirements and parameters.
+// findSeams finds the seam between each image and the mosaic of the images before it,
+// so the graphcuts run one after another. This function finds the seam of every 
+// pair of overlapping images instead. The pairs are grouped into rounds in which no 
+// two pairs share an image, and the pairs of a round run concurrently in cv::parallel_for_.
+// The seams differ from those of findSeams, since each seam only considers two images.
+void findSeamsParallel(const std::vector<cv::Mat>& images, const std::vector<cv::Mat>& masks, 
+    std::vector<cv::Mat>& resultMasks, int pad, int scale, double ratio, bool refine);
+
+// Tracks the seam between two video streams frame by frame.
+// The first call of track finds the seam in the padded bounding rect of mask1 & mask2 
+// as findSeamInROI does. Each later call compares the color difference of the current frame 
+// with that of the frame in which each pixel was last cut. Only pixels within bandRadius
+// of the previous seam and within bandRadius of a pixel whose color difference changed 
+// more than diffThresh form the graph. Pixels next to this region keep the labels of the 
+// previous cut and act as fixed terminals, so the seam moves at most bandRadius pixels per call.
+// The max flow solver only stores the bounding rect of the graph pixels, and its search only
+// visits the graph pixels, but the weights are still set over the whole bounding rect of mask1 & mask2.
+// If nothing changed, the previous seam is returned without any graphcut.
+// If mask1 and mask2 do not intersect, track returns them unchanged.
+class TemporalSeamTracker
+{
+public:
+    TemporalSeamTracker() : numVertices(0), bandRadius(0), diffThresh(0), horiWrap(false), hasSeam(false), success(false) {}
+    // mask1 and mask2 should be of type CV_8UC1 and share the same size.
+    bool prepare(const cv::Mat& mask1, const cv::Mat& mask2, int bandRadius = 16, double diffThresh = 20);
+    // image1 and image2 should be of type CV_8UC3 and share the size of the masks passed to prepare.
+    // resultMask1 & resultMask2 is empty set, resultMask1 | resultMask2 equals mask1 | mask2.
+    // Returns true if the seam was updated by a graphcut in this call.
+    bool track(const cv::Mat& image1, const cv::Mat& image2, cv::Mat& resultMask1, cv::Mat& resultMask2);
+    // The next call of track finds the seam from scratch.
+    void reset() { hasSeam = false; }
+    // Number of graph vertices of the last graphcut.
+    int getNumVertices() const { return numVertices; }
+private:
+    cv::Mat mask1, mask2;
+    cv::Rect roi;
+    cv::Mat mask1ROI, mask2ROI, intersectROI, activeROI;
+    cv::Mat refDiff, seamMask1, seamMask2;
+    int numVertices;
+    int bandRadius;
+    double diffThresh;
+    bool horiWrap;
+    bool hasSeam;
+    bool success;
+};
+
 // Generate non-intersecting masks.
 // masks should be non empty, masks.size() should not be more than 255,
 // and all masks[i] should be type CV_8UC1, and share the same size.
@@ -55,7 +55,7 @@ void doclReprojectTo16S(const docl::GpuMat& src, docl::GpuMat& dst, const docl::
     CV_Assert(src.data && src.type == CV_8UC4 && xmap.size() == ymap.size() &&
         xmap.data && xmap.type == CV_32FC1 && ymap.data && ymap.type == CV_32FC1 &&
         docl::ocl && docl::ocl->context && docl::ocl->queue &&
-        docl::reproject && docl::reproject->kernel);
+        docl::reprojectTo16S && docl::reprojectTo16S->kernel);
 
     dst.create(xmap.rows, ymap.cols, CV_16SC4);
 
@@ -2,51 +2,252 @@
 #include "OpenCLAccel/oclobject.hpp"
 #include "OpenCLAccel/CompileControl.h"
 #include "OpenCLAccel/ProgramSourceStrings.h"
+#include <memory>
+#include <thread>
 
 namespace docl
 {
 
 OpenCLBasic* ocl = 0;
 
-OpenCLProgramOneKernel* convert32SC4To8UC4 = 0;
-OpenCLProgramOneKernel* convert32FC4To8UC4 = 0;
+// Program shared by the kernels with the same source and build options
+struct SharedProgram
+{
+    std::wstring programFileName;
+    std::string programText, buildOptions;
+    std::mutex mtx;
+    std::unique_ptr<OpenCLProgram> program;
+    std::string error;
+};
+
+static std::mutex sharedProgramsMutex;
+static std::vector<std::unique_ptr<SharedProgram> > sharedPrograms;
+
+// Returns the program, building it if it has not been built, throws on failure.
+static OpenCLProgram* getSharedProgram(const std::wstring& programFileName, const std::string& programText,
+    const std::string& buildOptions)
+{
+    SharedProgram* sharedProgram = 0;
+    {
+        std::lock_guard<std::mutex> lock(sharedProgramsMutex);
+        for (int i = 0; i < (int)sharedPrograms.size(); i++)
+        {
+            if (sharedPrograms[i]->programFileName == programFileName &&
+                sharedPrograms[i]->programText == programText &&
+                sharedPrograms[i]->buildOptions == buildOptions)
+            {
+                sharedProgram = sharedPrograms[i].get();
+                break;
+            }
+        }
+        if (!sharedProgram)
+        {
+            sharedProgram = new SharedProgram;
+            sharedProgram->programFileName = programFileName;
+            sharedProgram->programText = programText;
+            sharedProgram->buildOptions = buildOptions;
+            sharedPrograms.push_back(std::unique_ptr<SharedProgram>(sharedProgram));
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(sharedProgram->mtx);
+    if (!sharedProgram->program)
+    {
+        if (!sharedProgram->error.empty())
+            throw Error(sharedProgram->error);
+        try
+        {
+            sharedProgram->program.reset(new OpenCLProgram(*ocl, programFileName, programText, buildOptions));
+        }
+        catch (const std::exception& e)
+        {
+            sharedProgram->error = e.what();
+            throw;
+        }
+    }
+    return sharedProgram->program.get();
+}
+
+LazyKernel::LazyKernel(const char* name_, int kernelSets_, const wchar_t* programFileName_, const char* programText_,
+    const char* kernelName_, const char* buildOptions_) :
+    name(name_), kernelSets(kernelSets_), programFileName(programFileName_), programText(programText_),
+    kernelName(kernelName_), buildOptions(buildOptions_), kernel(0), buildTime(-1)
+{
+}
+
+LazyKernel::~LazyKernel()
+{
+    delete kernel.load();
+}
+
+bool LazyKernel::build()
+{
+    if (kernel.load())
+        return true;
+
+    std::lock_guard<std::mutex> lock(mtx);
+    if (kernel.load())
+        return true;
+    if (!error.empty())
+        return false;
+    if (!ocl)
+    {
+        printf("Error in %s, kernel %s, init has not been called\n", __FUNCTION__, name.c_str());
+        return false;
+    }
+
+    double startTime = time_stamp();
+    OpenCLProgramOneKernel* builtKernel = 0;
+    try
+    {
+        OpenCLProgram* program = getSharedProgram(programFileName, programText, buildOptions);
+        builtKernel = new OpenCLProgramOneKernel(program->program, kernelName);
+    }
+    catch (const std::exception& e)
+    {
+        error = e.what();
+        if (error.empty())
+            error = "unknown error";
+        printf("Error in %s, kernel %s, exception caught, %s\n", __FUNCTION__, name.c_str(), e.what());
+        return false;
+    }
+    // buildTime is read without the lock once isBuilt returns true, so it is set before kernel is published
+    buildTime = time_stamp() - startTime;
+    kernel = builtKernel;
+    return true;
+}
+
+OpenCLProgramOneKernel* LazyKernel::get()
+{
+    if (!build())
+        throw Error("Kernel " + name + " is not available");
+    return kernel.load();
+}
 
-OpenCLProgramOneKernel* setZero = 0;
-OpenCLProgramOneKernel* setZero8UC4Mask8UC1 = 0;
-OpenCLProgramOneKernel* setVal16SC1 = 0;
-OpenCLProgramOneKernel* setVal16SC1Mask8UC1 = 0;
-OpenCLProgramOneKernel* scaledSet16SC1Mask32SC1 = 0;
-OpenCLProgramOneKernel* subtract16SC4 = 0;
-OpenCLProgramOneKernel* add32SC4 = 0;
-OpenCLProgramOneKernel* accumulate16SC1To32SC1 = 0;
-OpenCLProgramOneKernel* accumulate16SC4To32SC4 = 0;
-OpenCLProgramOneKernel* normalizeByShift32SC4 = 0;
-OpenCLProgramOneKernel* normalizeByDivide32SC4 = 0;
+OpenCLProgramOneKernel* LazyKernel::createInstance()
+{
+    return new OpenCLProgramOneKernel(get()->program, kernelName);
+}
+
+bool LazyKernel::hasSameProgram(const LazyKernel& other) const
+{
+    return programFileName == other.programFileName && programText == other.programText &&
+        buildOptions == other.buildOptions;
+}
+
+static const int MB = KERNEL_SET_MULTIBAND_BLEND;
+static const int LB = KERNEL_SET_LINEAR_BLEND;
+static const int RP = KERNEL_SET_REPROJECT;
+static const int PY = KERNEL_SET_PYRAMID;
+static const int IP = KERNEL_SET_IMAGE_PROC;
 
-OpenCLProgramOneKernel* reproject = 0;
-OpenCLProgramOneKernel* reprojectTo16S = 0;
-OpenCLProgramOneKernel* reprojectWeightedAccumulateTo32F = 0;
+LazyKernel convert32SC4To8UC4("convert32SC4To8UC4", MB,
+    PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), "convert32SC4To8UC4");
+LazyKernel convert32FC4To8UC4("convert32FC4To8UC4", LB,
+    PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), "convert32FC4To8UC4");
 
-OpenCLProgramOneKernel* pyrDown8UC1To8UC1 = 0;
-OpenCLProgramOneKernel* pyrDown8UC4To8UC4 = 0;
-OpenCLProgramOneKernel* pyrDown8UC4To32SC4 = 0;
+LazyKernel setZero("setZero", LB | MB,
+    PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), "setZeroKernel");
+LazyKernel setZero8UC4Mask8UC1("setZero8UC4Mask8UC1", MB,
+    PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), "setZero8UC4Mask8UC1");
+LazyKernel setVal16SC1("setVal16SC1", MB,
+    PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), "setVal16SC1");
+LazyKernel setVal16SC1Mask8UC1("setVal16SC1Mask8UC1", MB,
+    PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), "setVal16SC1Mask8UC1");
+LazyKernel scaledSet16SC1Mask32SC1("scaledSet16SC1Mask32SC1", MB,
+    PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), "scaledSet16SC1Mask32SC1");
+LazyKernel subtract16SC4("subtract16SC4", MB,
+    PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), "subtract16SC4");
+LazyKernel add32SC4("add32SC4", MB,
+    PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), "add32SC4");
+LazyKernel accumulate16SC1To32SC1("accumulate16SC1To32SC1", MB,
+    PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), "accumulate16SC1To32SC1");
+LazyKernel accumulate16SC4To32SC4("accumulate16SC4To32SC4", MB,
+    PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), "accumulate16SC4To32SC4");
+LazyKernel normalizeByShift32SC4("normalizeByShift32SC4", MB,
+    PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), "normalizeByShift32SC4");
+LazyKernel normalizeByDivide32SC4("normalizeByDivide32SC4", MB,
+    PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), "normalizeByDivide32SC4");
 
-OpenCLProgramOneKernel* pyrDown32FC1 = 0;
-OpenCLProgramOneKernel* pyrDown32FC4 = 0;
+LazyKernel reproject("reproject", RP,
+    PROG_FILE_NAME(L"ReprojectLinearTemplate.txt"), PROG_STRING(sourceReprojectLinearTemplate),
+    "reprojectLinearKernel", "-D DST_TYPE=uchar");
+LazyKernel reprojectTo16S("reprojectTo16S", RP | MB,
+    PROG_FILE_NAME(L"ReprojectLinearTemplate.txt"), PROG_STRING(sourceReprojectLinearTemplate),
+    "reprojectLinearKernel", "-D DST_TYPE=short");
+LazyKernel reprojectWeightedAccumulateTo32F("reprojectWeightedAccumulateTo32F", RP | LB,
+    PROG_FILE_NAME(L"ReprojectWeightedAccumulate.txt"), PROG_STRING(sourceReprojectWeightedAccumulate),
+    "reprojectWeightedAccumulateTo32FKernel");
 
-OpenCLProgramOneKernel* pyrDown16SC1To16SC1 = 0;
-OpenCLProgramOneKernel* pyrDown16SC1To32SC1 = 0;
+LazyKernel pyrDown8UC1To8UC1("pyrDown8UC1To8UC1", PY,
+    PROG_FILE_NAME(L"PyramidDownTemplate.txt"), PROG_STRING(sourcePyramidDownTemplate), "pyrDownKernel",
+    "-D SRC_TYPE=uchar -D DST_TYPE=uchar -D WORK_TYPE=int -D VERT_REFLECT -D HORI_WRAP -D NORMALIZE "
+    "-D CONVERT_WORK_TYPE=convert_int -D CONVERT_DST_TYPE=convert_uchar");
+LazyKernel pyrDown8UC4To8UC4("pyrDown8UC4To8UC4", PY,
+    PROG_FILE_NAME(L"PyramidDownTemplateFP.txt"), PROG_STRING(sourcePyramidDownTemplateFP), "pyrDownKernel",
+    "-D SRC_TYPE=uchar4 -D DST_TYPE=uchar4 -D WORK_TYPE=float4 -D VERT_REFLECT -D HORI_WRAP -D NORMALIZE "
+    "-D CONVERT_WORK_TYPE=convert_float4 -D CONVERT_DST_TYPE=convert_uchar4_sat_rtz");
+LazyKernel pyrDown8UC4To32SC4("pyrDown8UC4To32SC4", PY,
+    PROG_FILE_NAME(L"PyramidDownTemplateFP.txt"), PROG_STRING(sourcePyramidDownTemplateFP), "pyrDownKernel",
+    "-D SRC_TYPE=uchar4 -D DST_TYPE=int4 -D WORK_TYPE=float4 -D VERT_REFLECT -D HORI_WRAP "
+    "-D CONVERT_WORK_TYPE=convert_float4 -D CONVERT_DST_TYPE=convert_int4_sat_rtz");
 
-OpenCLProgramOneKernel* pyrDown16SC4ScaleTo16SC4 = 0;
+LazyKernel pyrDown32FC1("pyrDown32FC1", PY,
+    PROG_FILE_NAME(L"PyramidDownPureFP.txt"), PROG_STRING(sourcePyramidDownPureFP), "pyrDownKernel",
+    "-D TYPE=float -D VERT_REFLECT -D HORI_WRAP");
+LazyKernel pyrDown32FC4("pyrDown32FC4", PY,
+    L"PyramidDownPureFP.txt", "", "pyrDownKernel",
+    "-D TYPE=float4 -D VERT_REFLECT -D HORI_WRAP");
 
-OpenCLProgramOneKernel* pyrUp8UC4To8UC4 = 0;
-OpenCLProgramOneKernel* pyrUp16SC4To16SC4 = 0;
-OpenCLProgramOneKernel* pyrUp32SC4To32SC4 = 0;
+LazyKernel pyrDown16SC1To16SC1("pyrDown16SC1To16SC1", PY | MB,
+    PROG_FILE_NAME(L"PyramidDownTemplateFP.txt"), PROG_STRING(sourcePyramidDownTemplateFP), "pyrDownKernel",
+    "-D SRC_TYPE=short -D DST_TYPE=short -D WORK_TYPE=float -D VERT_REFLECT -D HORI_WRAP -D NORMALIZE "
+    "-D CONVERT_WORK_TYPE=convert_float -D CONVERT_DST_TYPE=convert_short_sat_rtz");
+LazyKernel pyrDown16SC1To32SC1("pyrDown16SC1To32SC1", PY | MB,
+    PROG_FILE_NAME(L"PyramidDownTemplateFP.txt"), PROG_STRING(sourcePyramidDownTemplateFP), "pyrDownKernel",
+    "-D SRC_TYPE=short -D DST_TYPE=int -D WORK_TYPE=float -D VERT_REFLECT -D HORI_WRAP "
+    "-D CONVERT_WORK_TYPE=convert_float -D CONVERT_DST_TYPE=convert_int_sat_rtz");
 
-OpenCLProgramOneKernel* alphaBlend8UC4 = 0;
+LazyKernel pyrDown16SC4ScaleTo16SC4("pyrDown16SC4ScaleTo16SC4", PY | MB,
+    PROG_FILE_NAME(L"PyramidDownTemplateFP.txt"), PROG_STRING(sourcePyramidDownTemplateFP), "pyrDownKernel",
+    "-D SRC_TYPE=short4 -D DST_TYPE=short4 -D WORK_TYPE=float4 -D SCALE_TYPE=int -D SCALE -D VERT_REFLECT -D HORI_WRAP "
+    "-D CONVERT_WORK_TYPE=convert_float4 -D CONVERT_DST_TYPE=convert_short4_sat_rtz");
 
-OpenCLProgramOneKernel* cvtBGR32ToYUV420P = 0;
-OpenCLProgramOneKernel* cvtBGR32ToNV12 = 0;
+LazyKernel pyrUp8UC4To8UC4("pyrUp8UC4To8UC4", PY,
+    PROG_FILE_NAME(L"PyramidUpTemplateFP.txt"), PROG_STRING(sourcePyramidUpTemplateFP), "pyrUpKernel",
+    "-D SRC_TYPE=uchar4 -D DST_TYPE=uchar4 -D WORK_TYPE=float4 -D VERT_REFLECT -D HORI_WRAP "
+    "-D CONVERT_WORK_TYPE=convert_float4 -D CONVERT_DST_TYPE=convert_uchar4_sat_rtz");
+LazyKernel pyrUp16SC4To16SC4("pyrUp16SC4To16SC4", PY | MB,
+    PROG_FILE_NAME(L"PyramidUpTemplateFP.txt"), PROG_STRING(sourcePyramidUpTemplateFP), "pyrUpKernel",
+    "-D SRC_TYPE=short4 -D DST_TYPE=short4 -D WORK_TYPE=float4 -D VERT_REFLECT -D HORI_WRAP "
+    "-D CONVERT_WORK_TYPE=convert_float4 -D CONVERT_DST_TYPE=convert_short4_sat_rtz");
+LazyKernel pyrUp32SC4To32SC4("pyrUp32SC4To32SC4", PY | MB,
+    PROG_FILE_NAME(L"PyramidUpTemplateFP.txt"), PROG_STRING(sourcePyramidUpTemplateFP), "pyrUpKernel",
+    "-D SRC_TYPE=int4 -D DST_TYPE=int4 -D WORK_TYPE=float4 -D VERT_REFLECT -D HORI_WRAP "
+    "-D CONVERT_WORK_TYPE=convert_float4 -D CONVERT_DST_TYPE=convert_int4_sat_rtz");
+
+LazyKernel alphaBlend8UC4("alphaBlend8UC4", IP,
+    PROG_FILE_NAME(L"ImageProc.txt"), PROG_STRING(sourceImageProc), "alphaBlend8UC4");
+
+LazyKernel cvtBGR32ToYUV420P("cvtBGR32ToYUV420P", IP,
+    PROG_FILE_NAME(L"ImageProc.txt"), PROG_STRING(sourceImageProc), "cvtBGR32ToYUV420P");
+LazyKernel cvtBGR32ToNV12("cvtBGR32ToNV12", IP,
+    PROG_FILE_NAME(L"ImageProc.txt"), PROG_STRING(sourceImageProc), "cvtBGR32ToNV12");
+
+static LazyKernel* const allKernels[] =
+{
+    &convert32SC4To8UC4, &convert32FC4To8UC4,
+    &setZero, &setZero8UC4Mask8UC1, &setVal16SC1, &setVal16SC1Mask8UC1, &scaledSet16SC1Mask32SC1,
+    &subtract16SC4, &add32SC4, &accumulate16SC1To32SC1, &accumulate16SC4To32SC4,
+    &normalizeByShift32SC4, &normalizeByDivide32SC4,
+    &reproject, &reprojectTo16S, &reprojectWeightedAccumulateTo32F,
+    &pyrDown8UC1To8UC1, &pyrDown8UC4To8UC4, &pyrDown8UC4To32SC4,
+    &pyrDown32FC1, &pyrDown32FC4,
+    &pyrDown16SC1To16SC1, &pyrDown16SC1To32SC1, &pyrDown16SC4ScaleTo16SC4,
+    &pyrUp8UC4To8UC4, &pyrUp16SC4To16SC4, &pyrUp32SC4To32SC4,
+    &alphaBlend8UC4, &cvtBGR32ToYUV420P, &cvtBGR32ToNV12
+};
+static const int numAllKernels = sizeof(allKernels) / sizeof(allKernels[0]);
 
 static int hasInit = 0;
 bool init()
@@ -87,128 +288,120 @@ bool init()
         return false;
     }
 
-    try
+    hasInit = 1;
+    return true;
+}
+
+static std::mutex prewarmMutex, prewarmJoinMutex;
+static std::vector<std::thread> prewarmThreads;
+static int prewarmFailed = 0;
+
+bool prewarm(int kernelSets)
+{
+    if (!ocl)
     {
-        convert32SC4To8UC4 = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), 
-            "convert32SC4To8UC4");
-        convert32FC4To8UC4 = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), 
-            "convert32FC4To8UC4");
-
-        setZero = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), 
-            "setZeroKernel");
-        setZero8UC4Mask8UC1 = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), 
-            "setZero8UC4Mask8UC1");
-        setVal16SC1 = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), 
-            "setVal16SC1");
-        setVal16SC1Mask8UC1 = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), 
-            "setVal16SC1Mask8UC1");
-        scaledSet16SC1Mask32SC1 = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), 
-            "scaledSet16SC1Mask32SC1");
-        subtract16SC4 = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), 
-            "subtract16SC4");
-        add32SC4 = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), 
-            "add32SC4");
-        accumulate16SC1To32SC1 = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), 
-            "accumulate16SC1To32SC1");
-        accumulate16SC4To32SC4 = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), 
-            "accumulate16SC4To32SC4");
-        normalizeByShift32SC4 = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), 
-            "normalizeByShift32SC4");
-        normalizeByDivide32SC4 = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"MatOp.txt"), PROG_STRING(sourceMatOp), 
-            "normalizeByDivide32SC4");
-
-        reproject = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"ReprojectLinearTemplate.txt"), 
-            PROG_STRING(sourceReprojectLinearTemplate), "reprojectLinearKernel", 
-            "-D DST_TYPE=uchar");
-        reprojectTo16S = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"ReprojectLinearTemplate.txt"), 
-            PROG_STRING(sourceReprojectLinearTemplate), "reprojectLinearKernel", 
-            "-D DST_TYPE=short");
-        reprojectWeightedAccumulateTo32F = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"ReprojectWeightedAccumulate.txt"), 
-            PROG_STRING(sourceReprojectWeightedAccumulate), "reprojectWeightedAccumulateTo32FKernel");
-
-        pyrDown8UC1To8UC1 = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"PyramidDownTemplate.txt"), 
-            PROG_STRING(sourcePyramidDownTemplate), "pyrDownKernel",
-            "-D SRC_TYPE=uchar -D DST_TYPE=uchar -D WORK_TYPE=int -D VERT_REFLECT -D HORI_WRAP -D NORMALIZE "
-            "-D CONVERT_WORK_TYPE=convert_int -D CONVERT_DST_TYPE=convert_uchar");
-        pyrDown8UC4To8UC4 = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"PyramidDownTemplateFP.txt"), 
-            PROG_STRING(sourcePyramidDownTemplateFP), "pyrDownKernel",
-            "-D SRC_TYPE=uchar4 -D DST_TYPE=uchar4 -D WORK_TYPE=float4 -D VERT_REFLECT -D HORI_WRAP -D NORMALIZE "
-            "-D CONVERT_WORK_TYPE=convert_float4 -D CONVERT_DST_TYPE=convert_uchar4_sat_rtz");
-        pyrDown8UC4To32SC4 = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"PyramidDownTemplateFP.txt"), 
-            PROG_STRING(sourcePyramidDownTemplateFP), "pyrDownKernel",
-            "-D SRC_TYPE=uchar4 -D DST_TYPE=int4 -D WORK_TYPE=float4 -D VERT_REFLECT -D HORI_WRAP "
-            "-D CONVERT_WORK_TYPE=convert_float4 -D CONVERT_DST_TYPE=convert_int4_sat_rtz");
-
-        pyrDown32FC1 = 
-            new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"PyramidDownPureFP.txt"), 
-            PROG_STRING(sourcePyramidDownPureFP), "pyrDownKernel",
-            "-D TYPE=float -D VERT_REFLECT -D HORI_WRAP");
-        pyrDown32FC4 = new OpenCLProgramOneKernel(*ocl, L"PyramidDownPureFP.txt", "", "pyrDownKernel",
-            "-D TYPE=float4 -D VERT_REFLECT -D HORI_WRAP");
-
-        pyrDown16SC1To16SC1 = new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"PyramidDownTemplateFP.txt"), 
-            PROG_STRING(sourcePyramidDownTemplateFP), "pyrDownKernel",
-            "-D SRC_TYPE=short -D DST_TYPE=short -D WORK_TYPE=float -D VERT_REFLECT -D HORI_WRAP -D NORMALIZE "
-            "-D CONVERT_WORK_TYPE=convert_float -D CONVERT_DST_TYPE=convert_short_sat_rtz");
-        pyrDown16SC1To32SC1 = new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"PyramidDownTemplateFP.txt"), 
-            PROG_STRING(sourcePyramidDownTemplateFP), "pyrDownKernel",
-            "-D SRC_TYPE=short -D DST_TYPE=int -D WORK_TYPE=float -D VERT_REFLECT -D HORI_WRAP "
-            "-D CONVERT_WORK_TYPE=convert_float -D CONVERT_DST_TYPE=convert_int_sat_rtz");
-
-        pyrDown16SC4ScaleTo16SC4 = new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"PyramidDownTemplateFP.txt"), 
-            PROG_STRING(sourcePyramidDownTemplateFP), "pyrDownKernel",
-            "-D SRC_TYPE=short4 -D DST_TYPE=short4 -D WORK_TYPE=float4 -D SCALE_TYPE=int -D SCALE -D VERT_REFLECT -D HORI_WRAP "
-            "-D CONVERT_WORK_TYPE=convert_float4 -D CONVERT_DST_TYPE=convert_short4_sat_rtz");
-
-        pyrUp8UC4To8UC4 = new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"PyramidUpTemplateFP.txt"), 
-            PROG_STRING(sourcePyramidUpTemplateFP), "pyrUpKernel",
-            "-D SRC_TYPE=uchar4 -D DST_TYPE=uchar4 -D WORK_TYPE=float4 -D VERT_REFLECT -D HORI_WRAP "
-            "-D CONVERT_WORK_TYPE=convert_float4 -D CONVERT_DST_TYPE=convert_uchar4_sat_rtz");
-        pyrUp16SC4To16SC4 = new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"PyramidUpTemplateFP.txt"), 
-            PROG_STRING(sourcePyramidUpTemplateFP), "pyrUpKernel",
-            "-D SRC_TYPE=short4 -D DST_TYPE=short4 -D WORK_TYPE=float4 -D VERT_REFLECT -D HORI_WRAP "
-            "-D CONVERT_WORK_TYPE=convert_float4 -D CONVERT_DST_TYPE=convert_short4_sat_rtz");
-        pyrUp32SC4To32SC4 = new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"PyramidUpTemplateFP.txt"), 
-            PROG_STRING(sourcePyramidUpTemplateFP), "pyrUpKernel",
-            "-D SRC_TYPE=int4 -D DST_TYPE=int4 -D WORK_TYPE=float4 -D VERT_REFLECT -D HORI_WRAP "
-            "-D CONVERT_WORK_TYPE=convert_float4 -D CONVERT_DST_TYPE=convert_int4_sat_rtz");
-
-        alphaBlend8UC4 = new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"ImageProc.txt"), 
-            PROG_STRING(sourceImageProc), "alphaBlend8UC4");
-        cvtBGR32ToYUV420P = new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"ImageProc.txt"), 
-            PROG_STRING(sourceImageProc), "cvtBGR32ToYUV420P");
-        cvtBGR32ToNV12 = new OpenCLProgramOneKernel(*ocl, PROG_FILE_NAME(L"ImageProc.txt"), 
-            PROG_STRING(sourceImageProc), "cvtBGR32ToNV12");
+        printf("Error in %s, init has not been called\n", __FUNCTION__);
+        return false;
     }
-    catch (const std::exception& e)
+
+    // Kernels with a program not built by an earlier kernel in the list go first,
+    // so that the threads build different programs instead of waiting for the same one
+    std::vector<LazyKernel*> firsts, others;
+    for (int i = 0; i < numAllKernels; i++)
     {
-        printf("Error in %s, exception caught, %s\n", __FUNCTION__, e.what());
-        return false;
+        if (!(allKernels[i]->getKernelSets() & kernelSets) || allKernels[i]->isBuilt())
+            continue;
+        bool first = true;
+        for (int j = 0; j < (int)firsts.size(); j++)
+        {
+            if (firsts[j]->hasSameProgram(*allKernels[i]))
+            {
+                first = false;
+                break;
+            }
+        }
+        if (first)
+            firsts.push_back(allKernels[i]);
+        else
+            others.push_back(allKernels[i]);
     }
+    if (firsts.empty())
+        return true;
 
-    hasInit = 1;
+    std::shared_ptr<std::vector<LazyKernel*> > kernels(new std::vector<LazyKernel*>(firsts));
+    kernels->insert(kernels->end(), others.begin(), others.end());
+    std::shared_ptr<std::atomic<int> > next(new std::atomic<int>(0));
+
+    int numThreads = std::thread::hardware_concurrency();
+    numThreads = std::max(1, std::min(numThreads, (int)firsts.size()));
+    std::lock_guard<std::mutex> lock(prewarmMutex);
+    for (int i = 0; i < numThreads; i++)
+    {
+        prewarmThreads.push_back(std::thread([kernels, next]()
+        {
+            int failed = 0;
+            for (int k = (*next)++; k < (int)kernels->size(); k = (*next)++)
+            {
+                if (!(*kernels)[k]->build())
+                    failed = 1;
+            }
+            std::lock_guard<std::mutex> lock(prewarmMutex);
+            prewarmFailed |= failed;
+        }));
+    }
     return true;
 }
 
+bool waitPrewarm()
+{
+    // Threads are joined under prewarmJoinMutex, so that a concurrent call
+    // does not return before the threads taken by this call finish.
+    std::lock_guard<std::mutex> joinLock(prewarmJoinMutex);
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> lock(prewarmMutex);
+        threads.swap(prewarmThreads);
+    }
+    for (int i = 0; i < (int)threads.size(); i++)
+        threads[i].join();
+
+    std::lock_guard<std::mutex> lock(prewarmMutex);
+    bool ok = !prewarmFailed;
+    prewarmFailed = 0;
+    return ok;
+}
+
+// Destroyed before the kernels and the shared programs defined above, in case
+// the program exits without calling waitPrewarm.
+static struct PrewarmExitJoin
+{
+    ~PrewarmExitJoin() { waitPrewarm(); }
+} prewarmExitJoin;
+
+void getKernelBuildInfos(std::vector<KernelBuildInfo>& infos)
+{
+    infos.resize(numAllKernels);
+    for (int i = 0; i < numAllKernels; i++)
+    {
+        infos[i].name = allKernels[i]->getName();
+        infos[i].built = allKernels[i]->isBuilt();
+        infos[i].buildTime = infos[i].built ? allKernels[i]->getBuildTime() : -1;
+    }
+}
+
+void printKernelBuildInfos()
+{
+    std::vector<KernelBuildInfo> infos;
+    getKernelBuildInfos(infos);
+    for (int i = 0; i < (int)infos.size(); i++)
+    {
+        if (infos[i].built)
+            printf("Kernel %s built in %f seconds\n", infos[i].name.c_str(), infos[i].buildTime);
+        else
+            printf("Kernel %s not built\n", infos[i].name.c_str());
+    }
+}
+
 }
 
 bool doclInit()
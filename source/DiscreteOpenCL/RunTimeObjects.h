@@ -1,52 +1,140 @@
 #pragma once
 
 #include "OpenCLAccel/oclobject.hpp"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
 
 namespace docl
 {
 
+// Creates the OpenCL context and queue on a discrete GPU. Kernels are not compiled here,
+// see LazyKernel.
 bool init();
 
 extern OpenCLBasic* ocl;
 
-extern OpenCLProgramOneKernel* convert32SC4To8UC4;
-extern OpenCLProgramOneKernel* convert32FC4To8UC4;
+// Kernel sets of the stitching configurations, used by prewarm.
+enum KernelSet
+{
+    KERNEL_SET_REPROJECT = 1,
+    KERNEL_SET_LINEAR_BLEND = 2,
+    KERNEL_SET_MULTIBAND_BLEND = 4,
+    KERNEL_SET_PYRAMID = 8,
+    KERNEL_SET_IMAGE_PROC = 16,
+    KERNEL_SET_ALL = 31
+};
+
+// Kernel in the registry of this module, compiled the first time it is used.
+// Kernels sharing the same program source and build options share one program,
+// which is built only once. A kernel that fails to build is not built again.
+// Building is thread safe, but a kernel object should be set and run on one thread
+// at a time, use createInstance for concurrent use.
+class LazyKernel
+{
+public:
+    // kernelSets is the combination of KernelSet values the kernel belongs to.
+    LazyKernel(const char* name, int kernelSets, const wchar_t* programFileName, const char* programText,
+        const char* kernelName, const char* buildOptions = "");
+    ~LazyKernel();
+
+    // Builds the kernel if it has not been built, returns false on failure.
+    bool build();
+    // Builds the kernel if it has not been built, throws on failure.
+    OpenCLProgramOneKernel* get();
+    OpenCLProgramOneKernel* operator->() { return get(); }
+    explicit operator bool() { return build(); }
+    // Creates a kernel object of the same program owned by the caller.
+    OpenCLProgramOneKernel* createInstance();
+
+    bool isBuilt() const { return kernel.load() != 0; }
+    const std::string& getName() const { return name; }
+    int getKernelSets() const { return kernelSets; }
+    // Seconds spent in build, including the program build if this kernel triggered it.
+    double getBuildTime() const { return buildTime; }
+    bool hasSameProgram(const LazyKernel& other) const;
+
+private:
+    std::string name;
+    int kernelSets;
+    std::wstring programFileName;
+    std::string programText, kernelName, buildOptions;
+    std::mutex mtx;
+    std::atomic<OpenCLProgramOneKernel*> kernel;
+    double buildTime;
+    std::string error;
+
+    LazyKernel(const LazyKernel&);
+    LazyKernel& operator=(const LazyKernel&);
+};
+
+extern LazyKernel convert32SC4To8UC4;
+extern LazyKernel convert32FC4To8UC4;
 
-extern OpenCLProgramOneKernel* setZero;
-extern OpenCLProgramOneKernel* setZero8UC4Mask8UC1;
-extern OpenCLProgramOneKernel* setVal16SC1;
-extern OpenCLProgramOneKernel* setVal16SC1Mask8UC1;
-extern OpenCLProgramOneKernel* scaledSet16SC1Mask32SC1;
-extern OpenCLProgramOneKernel* subtract16SC4;
-extern OpenCLProgramOneKernel* add32SC4;
-extern OpenCLProgramOneKernel* accumulate16SC1To32SC1;
-extern OpenCLProgramOneKernel* accumulate16SC4To32SC4;
-extern OpenCLProgramOneKernel* normalizeByShift32SC4;
-extern OpenCLProgramOneKernel* normalizeByDivide32SC4;
+extern LazyKernel setZero;
+extern LazyKernel setZero8UC4Mask8UC1;
+extern LazyKernel setVal16SC1;
+extern LazyKernel setVal16SC1Mask8UC1;
+extern LazyKernel scaledSet16SC1Mask32SC1;
+extern LazyKernel subtract16SC4;
+extern LazyKernel add32SC4;
+extern LazyKernel accumulate16SC1To32SC1;
+extern LazyKernel accumulate16SC4To32SC4;
+extern LazyKernel normalizeByShift32SC4;
+extern LazyKernel normalizeByDivide32SC4;
 
-extern OpenCLProgramOneKernel* reproject;
-extern OpenCLProgramOneKernel* reprojectTo16S;
-extern OpenCLProgramOneKernel* reprojectWeightedAccumulateTo32F;
+extern LazyKernel reproject;
+extern LazyKernel reprojectTo16S;
+extern LazyKernel reprojectWeightedAccumulateTo32F;
 
-extern OpenCLProgramOneKernel* pyrDown8UC1To8UC1;
-extern OpenCLProgramOneKernel* pyrDown8UC4To8UC4;
-extern OpenCLProgramOneKernel* pyrDown8UC4To32SC4;
+extern LazyKernel pyrDown8UC1To8UC1;
+extern LazyKernel pyrDown8UC4To8UC4;
+extern LazyKernel pyrDown8UC4To32SC4;
 
-extern OpenCLProgramOneKernel* pyrDown16SC1To16SC1;
-extern OpenCLProgramOneKernel* pyrDown16SC1To32SC1;
+extern LazyKernel pyrDown16SC1To16SC1;
+extern LazyKernel pyrDown16SC1To32SC1;
 
-extern OpenCLProgramOneKernel* pyrDown16SC4ScaleTo16SC4;
+extern LazyKernel pyrDown16SC4ScaleTo16SC4;
 
-extern OpenCLProgramOneKernel* pyrDown32FC1;
-extern OpenCLProgramOneKernel* pyrDown32FC4;
+extern LazyKernel pyrDown32FC1;
+extern LazyKernel pyrDown32FC4;
 
-extern OpenCLProgramOneKernel* pyrUp8UC4To8UC4;
-extern OpenCLProgramOneKernel* pyrUp16SC4To16SC4;
-extern OpenCLProgramOneKernel* pyrUp32SC4To32SC4;
+extern LazyKernel pyrUp8UC4To8UC4;
+extern LazyKernel pyrUp16SC4To16SC4;
+extern LazyKernel pyrUp32SC4To32SC4;
+
+extern LazyKernel alphaBlend8UC4;
+
+extern LazyKernel cvtBGR32ToYUV420P;
+extern LazyKernel cvtBGR32ToNV12;
+
+// Starts building the kernels of kernelSets, a combination of KernelSet values,
+// on background threads and returns at once. init should have been called.
+// A kernel used while it is being built waits for the build to finish.
+// Call waitPrewarm before the kernels are released at exit.
+bool prewarm(int kernelSets);
+
+// Waits for all the builds started by prewarm and joins the build threads,
+// returns false if any of the builds failed.
+bool waitPrewarm();
+
+// Calls waitPrewarm when it goes out of scope, declare one right after prewarm
+// so that every return path of the caller waits for the build threads.
+struct PrewarmGuard
+{
+    ~PrewarmGuard() { waitPrewarm(); }
+};
+
+struct KernelBuildInfo
+{
+    std::string name;
+    int built;
+    double buildTime;
+};
 
-extern OpenCLProgramOneKernel* alphaBlend8UC4;
+void getKernelBuildInfos(std::vector<KernelBuildInfo>& infos);
 
-extern OpenCLProgramOneKernel* cvtBGR32ToYUV420P;
-extern OpenCLProgramOneKernel* cvtBGR32ToNV12;
+void printKernelBuildInfos();
 
 }
@@ -0,0 +1,306 @@
+#include "ProgramBinaryCache.h"
+#include "basic.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#if defined(_WIN32) || defined(WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// File layout: magic, format version, key length, key, binary length, binary.
+// Increase the format version whenever the layout or the key changes.
+static const char cacheMagic[8] = "OCLPBIN";
+static const unsigned int cacheFormatVersion = 1;
+
+static std::mutex cacheDirMutex;
+static std::string cacheDir;
+static int cacheDirSet = 0;
+
+static std::atomic<int> numCacheLoads(0), numCacheMisses(0), numCacheRejects(0), numCacheSaves(0);
+
+void setOpenCLProgramCacheDir(const std::string& dir)
+{
+    std::lock_guard<std::mutex> lock(cacheDirMutex);
+    cacheDir = dir;
+    cacheDirSet = 1;
+}
+
+static std::string getCacheDir()
+{
+    std::lock_guard<std::mutex> lock(cacheDirMutex);
+    if (!cacheDirSet)
+    {
+        try
+        {
+            cacheDir = exe_dir() + "OpenCLProgramCache";
+        }
+        catch (...)
+        {
+            cacheDir.clear();
+        }
+        cacheDirSet = 1;
+    }
+    return cacheDir;
+}
+
+static void makeDir(const std::string& dir)
+{
+    // Failure because the directory exists is expected, other failures show up when writing
+#if defined(_WIN32) || defined(WIN32)
+    _mkdir(dir.c_str());
+#else
+    mkdir(dir.c_str(), 0755);
+#endif
+}
+
+// 64 bit FNV-1a hash
+static unsigned long long hashBytes(const char* data, size_t length)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static std::string hashToString(unsigned long long hash)
+{
+    char buf[32];
+    sprintf(buf, "%016llx", hash);
+    return buf;
+}
+
+static bool getDeviceString(cl_device_id device, cl_device_info info, std::string& str)
+{
+    size_t length = 0;
+    if (clGetDeviceInfo(device, info, 0, 0, &length) != CL_SUCCESS)
+        return false;
+    std::vector<char> buf(length + 1, 0);
+    if (clGetDeviceInfo(device, info, length, &buf[0], 0) != CL_SUCCESS)
+        return false;
+    str = &buf[0];
+    return true;
+}
+
+static bool getPlatformString(cl_platform_id platform, cl_platform_info info, std::string& str)
+{
+    size_t length = 0;
+    if (clGetPlatformInfo(platform, info, 0, 0, &length) != CL_SUCCESS)
+        return false;
+    std::vector<char> buf(length + 1, 0);
+    if (clGetPlatformInfo(platform, info, length, &buf[0], 0) != CL_SUCCESS)
+        return false;
+    str = &buf[0];
+    return true;
+}
+
+static bool getProgramKey(cl_device_id device, const std::vector<char>& source,
+    const std::string& buildOptions, std::string& key)
+{
+    cl_platform_id platform = 0;
+    if (clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, 0) != CL_SUCCESS)
+        return false;
+
+    std::string platformName, platformVersion, deviceName, deviceVersion, driverVersion;
+    if (!getPlatformString(platform, CL_PLATFORM_NAME, platformName) ||
+        !getPlatformString(platform, CL_PLATFORM_VERSION, platformVersion) ||
+        !getDeviceString(device, CL_DEVICE_NAME, deviceName) ||
+        !getDeviceString(device, CL_DEVICE_VERSION, deviceVersion) ||
+        !getDeviceString(device, CL_DRIVER_VERSION, driverVersion))
+        return false;
+
+    key = "platform: " + platformName + "\n" +
+        "platform version: " + platformVersion + "\n" +
+        "device: " + deviceName + "\n" +
+        "device version: " + deviceVersion + "\n" +
+        "driver version: " + driverVersion + "\n" +
+        "build options: " + buildOptions + "\n" +
+        "source length: " + to_str(source.size()) + "\n" +
+        "source hash: " + hashToString(source.empty() ? 0 : hashBytes(&source[0], source.size())) + "\n";
+    return true;
+}
+
+static std::string getCacheFilePath(const std::string& dir, const std::string& key)
+{
+    std::string path = dir;
+    char last = path[path.size() - 1];
+    if (last != '/' && last != '\\')
+        path += "/";
+    return path + hashToString(hashBytes(key.data(), key.size())) + ".bin";
+}
+
+// Returns the binary stored in data if data is a valid cache file of key.
+static bool parseCacheFile(const std::vector<char>& data, const std::string& key,
+    const unsigned char*& binary, size_t& binarySize)
+{
+    size_t pos = 0;
+    unsigned int version = 0, keyLength = 0;
+    unsigned long long length = 0;
+
+    if (data.size() < sizeof(cacheMagic) + sizeof(version) + sizeof(keyLength) ||
+        memcmp(&data[0], cacheMagic, sizeof(cacheMagic)))
+        return false;
+    pos += sizeof(cacheMagic);
+    memcpy(&version, &data[pos], sizeof(version));
+    pos += sizeof(version);
+    memcpy(&keyLength, &data[pos], sizeof(keyLength));
+    pos += sizeof(keyLength);
+    if (version != cacheFormatVersion || keyLength != key.size() ||
+        data.size() - pos < keyLength + sizeof(length) ||
+        memcmp(&data[pos], key.data(), keyLength))
+        return false;
+    pos += keyLength;
+    memcpy(&length, &data[pos], sizeof(length));
+    pos += sizeof(length);
+    if (length == 0 || length != data.size() - pos)
+        return false;
+
+    binary = (const unsigned char*)&data[pos];
+    binarySize = (size_t)length;
+    return true;
+}
+
+std::string getOpenCLProgramCacheFilePath(cl_device_id device,
+    const std::vector<char>& source, const std::string& buildOptions)
+{
+    std::string dir = getCacheDir();
+    std::string key;
+    if (dir.empty() || !getProgramKey(device, source, buildOptions, key))
+        return std::string();
+    return getCacheFilePath(dir, key);
+}
+
+OpenCLProgramCacheStatistics getOpenCLProgramCacheStatistics()
+{
+    OpenCLProgramCacheStatistics stats;
+    stats.numLoads = numCacheLoads;
+    stats.numMisses = numCacheMisses;
+    stats.numRejects = numCacheRejects;
+    stats.numSaves = numCacheSaves;
+    return stats;
+}
+
+cl_program loadCachedProgram(cl_context context, cl_device_id device,
+    const std::vector<char>& source, const std::string& buildOptions)
+{
+    std::string dir = getCacheDir();
+    if (dir.empty())
+        return 0;
+
+    std::string key;
+    if (!getProgramKey(device, source, buildOptions, key))
+        return 0;
+
+    std::ifstream file(getCacheFilePath(dir, key).c_str(), std::ios::in | std::ios::binary);
+    if (!file)
+    {
+        numCacheMisses++;
+        return 0;
+    }
+    file.seekg(0, std::ios::end);
+    std::streamoff fileLength = file.tellg();
+    std::vector<char> data(fileLength > 0 ? (size_t)fileLength : 0);
+    file.seekg(0, std::ios::beg);
+    const unsigned char* binary = 0;
+    size_t binarySize = 0;
+    if (data.empty() || !file.read(&data[0], fileLength) || !parseCacheFile(data, key, binary, binarySize))
+    {
+        numCacheRejects++;
+        return 0;
+    }
+
+    cl_int status = CL_SUCCESS, err = CL_SUCCESS;
+    cl_program program = clCreateProgramWithBinary(context, 1, &device, &binarySize, &binary, &status, &err);
+    if (err != CL_SUCCESS || status != CL_SUCCESS)
+    {
+        if (program)
+            clReleaseProgram(program);
+        numCacheRejects++;
+        return 0;
+    }
+
+    // Binaries still need to be built, which only links them for the device
+    err = clBuildProgram(program, 1, &device, buildOptions.c_str(), 0, 0);
+    if (err != CL_SUCCESS)
+    {
+        clReleaseProgram(program);
+        numCacheRejects++;
+        return 0;
+    }
+    numCacheLoads++;
+    return program;
+}
+
+bool saveCachedProgram(cl_program program, cl_device_id device,
+    const std::vector<char>& source, const std::string& buildOptions)
+{
+    std::string dir = getCacheDir();
+    if (dir.empty())
+        return false;
+
+    std::string key;
+    if (!getProgramKey(device, source, buildOptions, key))
+        return false;
+
+    cl_uint numDevices = 0;
+    if (clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(numDevices), &numDevices, 0) != CL_SUCCESS ||
+        numDevices != 1)
+        return false;
+    size_t binarySize = 0;
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(binarySize), &binarySize, 0) != CL_SUCCESS ||
+        binarySize == 0)
+        return false;
+    std::vector<unsigned char> binary(binarySize);
+    unsigned char* ptrBinary = &binary[0];
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(ptrBinary), &ptrBinary, 0) != CL_SUCCESS)
+        return false;
+
+    makeDir(dir);
+    std::string path = getCacheFilePath(dir, key);
+    static std::atomic<unsigned int> tempCount(0);
+    std::string tempPath = path + "." +
+        to_str((unsigned long long)std::chrono::high_resolution_clock::now().time_since_epoch().count()) +
+        "." + to_str(tempCount++) + ".tmp";
+
+    {
+        std::ofstream file(tempPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+        unsigned int keyLength = key.size();
+        unsigned long long length = binarySize;
+        file.write(cacheMagic, sizeof(cacheMagic));
+        file.write((const char*)&cacheFormatVersion, sizeof(cacheFormatVersion));
+        file.write((const char*)&keyLength, sizeof(keyLength));
+        file.write(key.data(), keyLength);
+        file.write((const char*)&length, sizeof(length));
+        file.write((const char*)&binary[0], binarySize);
+        file.close();
+        if (!file)
+        {
+            std::remove(tempPath.c_str());
+            return false;
+        }
+    }
+
+    // rename does not replace an existing file on Windows, the existing one is stale here
+    if (std::rename(tempPath.c_str(), path.c_str()))
+    {
+        std::remove(path.c_str());
+        if (std::rename(tempPath.c_str(), path.c_str()))
+        {
+            std::remove(tempPath.c_str());
+            return false;
+        }
+    }
+    numCacheSaves++;
+    return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <string>
+#include <vector>
+
+// On disk cache of compiled OpenCL program binaries, used by createAndBuildProgram.
+// A binary is keyed by the platform, the device, the driver version, the build options
+// and the hash of the program source. The file name is the hash of the key, and the key
+// itself is stored in the file and compared on load, so a binary built by another driver
+// or from another source is never loaded, the program is then built from source
+// and the binary is written again.
+// Files are written to a temporary name and renamed, so that processes sharing
+// the directory never read a partial file.
+
+// Sets the cache directory, an empty string disables the cache.
+// The default is the OpenCLProgramCache directory beside the executable.
+// Call it before any program is built.
+void setOpenCLProgramCacheDir(const std::string& dir);
+
+// Loads the cached binary of the source and build options for device and builds it.
+// Returns 0 if the cache is disabled, no matching binary is found or the binary fails to build.
+cl_program loadCachedProgram(cl_context context, cl_device_id device,
+    const std::vector<char>& source, const std::string& buildOptions);
+
+// Writes the binary of program, which should have been built for device only,
+// returns false on failure, which only means the next start builds from source again.
+bool saveCachedProgram(cl_program program, cl_device_id device,
+    const std::vector<char>& source, const std::string& buildOptions);
+
+// Returns the path of the cache file of the source and build options for device,
+// an empty string if the cache is disabled or the device cannot be queried.
+std::string getOpenCLProgramCacheFilePath(cl_device_id device,
+    const std::vector<char>& source, const std::string& buildOptions);
+
+struct OpenCLProgramCacheStatistics
+{
+    // Number of binaries loaded and built
+    int numLoads;
+    // Number of lookups without a cache file
+    int numMisses;
+    // Number of cache files that could not be read, did not match the key or failed to build
+    int numRejects;
+    // Number of binaries written
+    int numSaves;
+};
+
+// Counts since the start of the process.
+OpenCLProgramCacheStatistics getOpenCLProgramCacheStatistics();
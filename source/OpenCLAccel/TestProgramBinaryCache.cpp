@@ -0,0 +1,236 @@
+#include "oclobject.hpp"
+#include "ProgramBinaryCache.h"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <chrono>
+
+// Every run uses sources no earlier run has cached, the files written are removed at the end
+static std::string runTag;
+static std::vector<std::string> cachePaths;
+
+static std::vector<char> prepare(const std::string& text)
+{
+    std::vector<char> prepared(text.begin(), text.end());
+    prepared.push_back(0);
+    return prepared;
+}
+
+// Kernel k writes i * SCALE + offset, SCALE can be set in the build options
+static std::string makeSource(const char* name, int offset)
+{
+    return "// " + std::string(name) + " " + runTag + "\n"
+        "#ifndef SCALE\n"
+        "#define SCALE 1\n"
+        "#endif\n"
+        "__kernel void k(__global int* dst)\n"
+        "{\n"
+        "    int i = get_global_id(0);\n"
+        "    dst[i] = i * SCALE + " + to_str(offset) + ";\n"
+        "}\n";
+}
+
+static OpenCLProgramCacheStatistics diff(const OpenCLProgramCacheStatistics& a, const OpenCLProgramCacheStatistics& b)
+{
+    OpenCLProgramCacheStatistics d;
+    d.numLoads = a.numLoads - b.numLoads;
+    d.numMisses = a.numMisses - b.numMisses;
+    d.numRejects = a.numRejects - b.numRejects;
+    d.numSaves = a.numSaves - b.numSaves;
+    return d;
+}
+
+static bool runKernel(OpenCLBasic& ocl, cl_program program, int scale, int offset)
+{
+    const int size = 64;
+    std::vector<int> result(size, -1);
+    cl_int err;
+    cl_kernel kernel = clCreateKernel(program, "k", &err);
+    if (err != CL_SUCCESS)
+        return false;
+    cl_mem buffer = clCreateBuffer(ocl.context, CL_MEM_WRITE_ONLY, size * sizeof(int), 0, &err);
+    if (err == CL_SUCCESS)
+    {
+        size_t globalSize = size;
+        err = clSetKernelArg(kernel, 0, sizeof(buffer), &buffer);
+        if (err == CL_SUCCESS)
+            err = clEnqueueNDRangeKernel(ocl.queue, kernel, 1, 0, &globalSize, 0, 0, 0, 0);
+        if (err == CL_SUCCESS)
+            err = clEnqueueReadBuffer(ocl.queue, buffer, CL_TRUE, 0, size * sizeof(int), &result[0], 0, 0, 0);
+        clReleaseMemObject(buffer);
+    }
+    clReleaseKernel(kernel);
+    if (err != CL_SUCCESS)
+        return false;
+    for (int i = 0; i < size; i++)
+    {
+        if (result[i] != i * scale + offset)
+            return false;
+    }
+    return true;
+}
+
+// Builds with createAndBuildProgram, runs the kernel and returns the change of the statistics
+static bool buildAndRun(OpenCLBasic& ocl, const std::string& text, const std::string& options,
+    int scale, int offset, OpenCLProgramCacheStatistics& stats)
+{
+    std::vector<char> prepared = prepare(text);
+    cachePaths.push_back(getOpenCLProgramCacheFilePath(ocl.device, prepared, options));
+    OpenCLProgramCacheStatistics before = getOpenCLProgramCacheStatistics();
+    cl_program program = createAndBuildProgram(prepared, ocl.context, 1, &ocl.device, options);
+    stats = diff(getOpenCLProgramCacheStatistics(), before);
+    bool ok = runKernel(ocl, program, scale, offset);
+    clReleaseProgram(program);
+    return ok;
+}
+
+static bool isStats(const OpenCLProgramCacheStatistics& stats, int numLoads, int numMisses, int numRejects, int numSaves)
+{
+    return stats.numLoads == numLoads && stats.numMisses == numMisses &&
+        stats.numRejects == numRejects && stats.numSaves == numSaves;
+}
+
+// The first build is from source and writes the binary, the second loads it.
+static bool testLoad(OpenCLBasic& ocl)
+{
+    std::string text = makeSource("load", 1);
+    OpenCLProgramCacheStatistics first, second;
+    bool ok = buildAndRun(ocl, text, "", 1, 1, first) && isStats(first, 0, 1, 0, 1);
+    ok &= buildAndRun(ocl, text, "", 1, 1, second) && isStats(second, 1, 0, 0, 0);
+    printf("load: second build loads %d, %s\n", second.numLoads, ok ? "ok" : "wrong");
+    return ok;
+}
+
+// A truncated file or a file of something else is rejected, the program is built from source
+// and the binary is written again, so the next build loads it.
+static bool testCorruptFile(OpenCLBasic& ocl)
+{
+    std::string text = makeSource("corrupt", 2);
+    OpenCLProgramCacheStatistics stats;
+    bool ok = buildAndRun(ocl, text, "", 1, 2, stats) && isStats(stats, 0, 1, 0, 1);
+    std::string path = getOpenCLProgramCacheFilePath(ocl.device, prepare(text), "");
+
+    std::vector<char> data;
+    {
+        std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    ok &= data.size() > 2;
+    {
+        std::ofstream file(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        file.write(&data[0], data.size() / 2);
+    }
+    ok &= buildAndRun(ocl, text, "", 1, 2, stats) && isStats(stats, 0, 0, 1, 1);
+    bool truncatedRebuilt = ok;
+    ok &= buildAndRun(ocl, text, "", 1, 2, stats) && isStats(stats, 1, 0, 0, 0);
+
+    {
+        std::ofstream file(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        file << "not a program binary";
+    }
+    ok &= buildAndRun(ocl, text, "", 1, 2, stats) && isStats(stats, 0, 0, 1, 1);
+    bool garbageRebuilt = ok;
+    ok &= buildAndRun(ocl, text, "", 1, 2, stats) && isStats(stats, 1, 0, 0, 0);
+    printf("corrupt file: truncated rebuilt %d, garbage rebuilt %d, %s\n",
+        truncatedRebuilt, garbageRebuilt, ok ? "ok" : "wrong");
+    return ok;
+}
+
+// Other build options are another key, the binary of the first options is never loaded for them.
+static bool testChangedOptions(OpenCLBasic& ocl)
+{
+    std::string text = makeSource("options", 3);
+    OpenCLProgramCacheStatistics stats;
+    bool ok = buildAndRun(ocl, text, "", 1, 3, stats) && isStats(stats, 0, 1, 0, 1);
+    ok &= buildAndRun(ocl, text, "-D SCALE=3", 3, 3, stats) && isStats(stats, 0, 1, 0, 1);
+    bool rebuilt = ok;
+    ok &= buildAndRun(ocl, text, "", 1, 3, stats) && isStats(stats, 1, 0, 0, 0);
+    ok &= buildAndRun(ocl, text, "-D SCALE=3", 3, 3, stats) && isStats(stats, 1, 0, 0, 0);
+    printf("changed options: rebuilt %d, %s\n", rebuilt, ok ? "ok" : "wrong");
+    return ok;
+}
+
+// Duplicate descs share one program, which is built or loaded once, and a failed build
+// of one desc returns no program for any of them.
+static bool testDuplicateDescs(OpenCLBasic& ocl)
+{
+    const char* options[] = { "", "", "", "-D SCALE=2", "" };
+    const int offsets[] = { 4, 4, 5, 4, 5 };
+    const int scales[] = { 1, 1, 1, 2, 1 };
+    const int numDescs = 5;
+    std::vector<OpenCLProgramDesc> descs(numDescs);
+    for (int i = 0; i < numDescs; i++)
+    {
+        descs[i].program_text = makeSource("duplicate", offsets[i]);
+        descs[i].build_options = options[i];
+        cachePaths.push_back(getOpenCLProgramCacheFilePath(ocl.device, prepare(descs[i].program_text), options[i]));
+    }
+
+    bool ok = true;
+    for (int round = 0; round < 2; round++)
+    {
+        std::vector<cl_program> programs;
+        OpenCLProgramCacheStatistics before = getOpenCLProgramCacheStatistics();
+        createAndBuildPrograms(ocl, descs, programs);
+        OpenCLProgramCacheStatistics stats = diff(getOpenCLProgramCacheStatistics(), before);
+        ok &= round == 0 ? isStats(stats, 0, 3, 0, 3) : isStats(stats, 3, 0, 0, 0);
+        ok &= programs.size() == numDescs && programs[0] == programs[1] && programs[2] == programs[4] &&
+            programs[0] != programs[2] && programs[0] != programs[3] && programs[2] != programs[3];
+        for (int i = 0; i < (int)programs.size(); i++)
+            ok &= runKernel(ocl, programs[i], scales[i], offsets[i]);
+        for (int i = 0; i < (int)programs.size(); i++)
+            clReleaseProgram(programs[i]);
+    }
+
+    std::vector<OpenCLProgramDesc> badDescs(descs.begin(), descs.begin() + 2);
+    badDescs[1].program_text = "__kernel void k(__global int* dst) { SYNTAXERROR }";
+    std::vector<cl_program> badPrograms;
+    bool thrown = false;
+    try
+    {
+        createAndBuildPrograms(ocl, badDescs, badPrograms);
+    }
+    catch (const std::exception&)
+    {
+        thrown = true;
+    }
+    int numReturned = 0;
+    for (int i = 0; i < (int)badPrograms.size(); i++)
+    {
+        if (badPrograms[i])
+        {
+            clReleaseProgram(badPrograms[i]);
+            numReturned++;
+        }
+    }
+    ok &= thrown && numReturned == 0;
+    printf("duplicate descs: failed build thrown %d, %s\n", thrown, ok ? "ok" : "wrong");
+    return ok;
+}
+
+// Arguments: cache directory, platform name or index, device type.
+int main(int argc, char** argv)
+{
+    setOpenCLProgramCacheDir(argc > 1 ? argv[1] : "TestProgramBinaryCacheDir");
+    runTag = to_str((unsigned long long)std::chrono::high_resolution_clock::now().time_since_epoch().count());
+
+    bool ok = true;
+    try
+    {
+        OpenCLBasic ocl(argc > 2 ? argv[2] : "0", argc > 3 ? argv[3] : "all");
+        ok &= testLoad(ocl);
+        ok &= testCorruptFile(ocl);
+        ok &= testChangedOptions(ocl);
+        ok &= testDuplicateDescs(ocl);
+    }
+    catch (const std::exception& e)
+    {
+        printf("error: %s\n", e.what());
+        ok = false;
+    }
+
+    for (int i = 0; i < (int)cachePaths.size(); i++)
+        std::remove(cachePaths[i].c_str());
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
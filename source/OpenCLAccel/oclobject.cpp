@@ -26,10 +26,13 @@
 #include <fstream>
 #include <algorithm>
 #include <cstring>
+#include <thread>
+#include <atomic>
 #include <CL/cl.h>
 
 #include "oclobject.hpp"
 #include "basic.hpp"
+#include "ProgramBinaryCache.h"
 
 using std::cerr;
 using std::vector;
@@ -574,6 +577,16 @@ cl_program createAndBuildProgram (
     const string& build_options
 )
 {
+    // Binaries are cached per device, so the cache is only used for single device programs
+    if(num_of_devices == 1)
+    {
+        cl_program cached_program = loadCachedProgram(context, devices[0], program_text_prepared, build_options);
+        if(cached_program)
+        {
+            return cached_program;
+        }
+    }
+
     // Create OpenCL program and build it
     const char* raw_text = &program_text_prepared[0];
     cl_int err;
@@ -610,6 +623,7 @@ cl_program createAndBuildProgram (
             );
             SAMPLE_CHECK_ERRORS(err);
 
+            clReleaseProgram(program);
             throw Error(
                 "Error happened during the build of OpenCL program.\n"
                 "Build log:\n" +
@@ -620,16 +634,20 @@ cl_program createAndBuildProgram (
 
     SAMPLE_CHECK_ERRORS(err);
 
+    if(num_of_devices == 1)
+    {
+        saveCachedProgram(program, devices[0], program_text_prepared, build_options);
+    }
+
     return program;
 }
 
-OpenCLProgram::OpenCLProgram (
-    OpenCLBasic& oclobjects,
+// Reads program text from file or copies it from string, with terminating zero.
+static void prepareProgramText (
     const std::wstring& program_file_name,
     const string& program_text,
-    const string& build_options
-) :
-    program(0)
+    vector<char>& program_text_prepared
+)
 {
     using namespace std;
 
@@ -651,9 +669,6 @@ OpenCLProgram::OpenCLProgram (
 
     assert(program_file_name.empty() + program_text.empty() == 1);
 
-    // use vector for automatic memory management
-    vector<char> program_text_prepared;
-
     if(!program_file_name.empty())
     {
         readProgramFile(program_file_name, program_text_prepared);
@@ -663,10 +678,131 @@ OpenCLProgram::OpenCLProgram (
         program_text_prepared.resize(program_text.length() + 1);  // +1 for terminating zero
         copy(program_text.begin(), program_text.end(), program_text_prepared.begin());
     }
+}
+
+void createAndBuildPrograms (
+    OpenCLBasic& oclobjects,
+    const std::vector<OpenCLProgramDesc>& descs,
+    std::vector<cl_program>& programs
+)
+{
+    using namespace std;
+
+    programs.assign(descs.size(), 0);
+
+    // Find the distinct programs, unique[i] is the index of the first desc equal to descs[i]
+    vector<size_t> unique(descs.size());
+    vector<size_t> distinct;
+    for(size_t i = 0; i < descs.size(); ++i)
+    {
+        unique[i] = i;
+        for(size_t j = 0; j < distinct.size(); ++j)
+        {
+            const OpenCLProgramDesc& other = descs[distinct[j]];
+            if(descs[i].program_file_name == other.program_file_name &&
+                descs[i].program_text == other.program_text &&
+                descs[i].build_options == other.build_options)
+            {
+                unique[i] = distinct[j];
+                break;
+            }
+        }
+        if(unique[i] == i)
+        {
+            distinct.push_back(i);
+        }
+    }
+
+    // Build the distinct programs, each thread takes the next program not taken yet
+    vector<string> errors(distinct.size());
+    atomic<int> next(0);
+    auto build = [&]()
+    {
+        for(int k = next++; k < (int)distinct.size(); k = next++)
+        {
+            const OpenCLProgramDesc& desc = descs[distinct[k]];
+            try
+            {
+                vector<char> program_text_prepared;
+                prepareProgramText(desc.program_file_name, desc.program_text, program_text_prepared);
+                programs[distinct[k]] = createAndBuildProgram(program_text_prepared,
+                    oclobjects.context, 1, &oclobjects.device, desc.build_options);
+            }
+            catch(const std::exception& e)
+            {
+                errors[k] = e.what();
+                if(errors[k].empty())
+                {
+                    errors[k] = "Unknown error happened during the build of OpenCL program.";
+                }
+            }
+        }
+    };
+
+    int num_threads = (int)thread::hardware_concurrency();
+    num_threads = max(1, min(num_threads, (int)distinct.size()));
+    vector<thread> threads;
+    for(int i = 1; i < num_threads; ++i)
+    {
+        threads.push_back(thread(build));
+    }
+    build();
+    for(size_t i = 0; i < threads.size(); ++i)
+    {
+        threads[i].join();
+    }
+
+    for(size_t k = 0; k < distinct.size(); ++k)
+    {
+        if(!errors[k].empty())
+        {
+            for(size_t j = 0; j < distinct.size(); ++j)
+            {
+                if(programs[distinct[j]])
+                {
+                    clReleaseProgram(programs[distinct[j]]);
+                }
+            }
+            programs.assign(descs.size(), 0);
+            throw Error(errors[k]);
+        }
+    }
+
+    // Each desc holds one reference
+    for(size_t i = 0; i < descs.size(); ++i)
+    {
+        if(unique[i] != i)
+        {
+            programs[i] = programs[unique[i]];
+            cl_int err = clRetainProgram(programs[i]);
+            SAMPLE_CHECK_ERRORS(err);
+        }
+    }
+}
+
+OpenCLProgram::OpenCLProgram (
+    OpenCLBasic& oclobjects,
+    const std::wstring& program_file_name,
+    const string& program_text,
+    const string& build_options
+) :
+    program(0)
+{
+    // use vector for automatic memory management
+    vector<char> program_text_prepared;
+    prepareProgramText(program_file_name, program_text, program_text_prepared);
 
     program = createAndBuildProgram(program_text_prepared, oclobjects.context, 1, &oclobjects.device, build_options);
 }
 
+OpenCLProgram::OpenCLProgram (cl_program built_program) :
+    program(0)
+{
+    cl_int err = clRetainProgram(built_program);
+    SAMPLE_CHECK_ERRORS(err);
+    program = built_program;
+}
+
 
 OpenCLProgram::~OpenCLProgram ()
 {
@@ -700,6 +836,18 @@ OpenCLProgramOneKernel::OpenCLProgramOneKernel (
     SAMPLE_CHECK_ERRORS(err);
 }
 
+OpenCLProgramOneKernel::OpenCLProgramOneKernel (
+    cl_program built_program,
+    const string& kernel_name
+) :
+    OpenCLProgram(built_program),
+    kernel(0)
+{
+    cl_int err = 0;
+    kernel = clCreateKernel(program, kernel_name.c_str(), &err);
+    SAMPLE_CHECK_ERRORS(err);
+}
+
 
 OpenCLProgramOneKernel::~OpenCLProgramOneKernel ()
 {
@@ -143,6 +143,10 @@ struct OpenCLProgram
         const string& build_options = ""
     );
 
+    // Hold a program already built, for example by createAndBuildPrograms.
+    // The program is retained, so the caller still owns its reference.
+    explicit OpenCLProgram (cl_program built_program);
+
     ~OpenCLProgram ();
 
 private:
@@ -167,6 +171,12 @@ struct OpenCLProgramOneKernel : public OpenCLProgram
         const string& build_options = ""
     );
 
+    // Extract kernel from a program already built, the program is retained.
+    OpenCLProgramOneKernel (
+        cl_program built_program,
+        const string& kernel_name
+    );
+
     ~OpenCLProgramOneKernel ();
 
 private:
@@ -206,6 +216,27 @@ private:
     OpenCLProgramMultipleKernels& operator= (const OpenCLProgramMultipleKernels&);
 };
 
+// Description of one program for createAndBuildPrograms.
+// Only one of program_file_name or program_text should be non-empty.
+struct OpenCLProgramDesc
+{
+    std::wstring program_file_name;
+    string program_text;
+    string build_options;
+};
+
+// Create and build the programs of descs in one step, programs[i] is the program of descs[i].
+// Descs with the same file name, text and build options share one program,
+// which is built only once, and the distinct programs are built on parallel threads.
+// Every element of programs holds one reference, which the caller should release,
+// for example after passing it to OpenCLProgramOneKernel.
+// If any build fails, no program is returned and the first error is thrown.
+void createAndBuildPrograms (
+    OpenCLBasic& oclobjects,
+    const std::vector<OpenCLProgramDesc>& descs,
+    std::vector<cl_program>& programs
+);
+
 // Helper structure to hold OpenCL buffer together with the host pointer.
 // It does not allocate/initialize neither host pointer nor OpenCL buffer.
 // It is just a container for those two. The only activity it does is
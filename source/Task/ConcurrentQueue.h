@@ -4,6 +4,8 @@
 #include <deque>
 #include <mutex>
 #include <condition_variable>
+#include <memory>
+#include <thread>
 
 // This queue limits its size.
 // If it reaches its maximum size, the oldest item
@@ -36,6 +38,15 @@ public:
         queue.push_front(item);
         return ret;
     }
+    bool push(ItemType&& item)
+    {
+        bool ret = true;
+        std::lock_guard<std::mutex> lock(mtxQueue);
+        while ((int)queue.size() > maxSize - 1)
+            queue.pop_back();
+        queue.push_front(std::move(item));
+        return ret;
+    }
     bool pull(ItemType& item)
     {
         std::lock_guard<std::mutex> lock(mtxQueue);
@@ -44,7 +55,7 @@ public:
             item = ItemType();
             return false;
         }
-        item = queue.back();
+        item = std::move(queue.back());
         queue.pop_back();
         return true;
     }
@@ -105,6 +116,18 @@ public:
         condNonEmpty.notify_one();
         return ret;
     }
+    bool push(ItemType&& item)
+    {
+        bool ret = true;
+        {
+            std::lock_guard<std::mutex> lock(mtxQueue);
+            while ((int)queue.size() > maxSize - 1)
+                queue.pop_back();
+            queue.push_front(std::move(item));
+        }
+        condNonEmpty.notify_one();
+        return ret;
+    }
     bool pull(ItemType& item)
     {
         std::unique_lock<std::mutex> lock(mtxQueue);
@@ -117,7 +140,7 @@ public:
             item = ItemType();
             return false;
         }
-        item = queue.back();
+        item = std::move(queue.back());
         queue.pop_back();
         return true;
     }
@@ -167,6 +190,16 @@ public:
         condNonEmpty.notify_one();
         return ret;
     }
+    bool push(ItemType&& item)
+    {
+        bool ret = true;
+        {
+            std::lock_guard<std::mutex> lock(mtxQueue);
+            queue.push_front(std::move(item));
+        }
+        condNonEmpty.notify_one();
+        return ret;
+    }
     bool pull(ItemType& item)
     {
         std::unique_lock<std::mutex> lock(mtxQueue);
@@ -179,7 +212,7 @@ public:
             item = ItemType();
             return false;
         }
-        item = queue.back();
+        item = std::move(queue.back());
         queue.pop_back();
         return true;
     }
@@ -236,6 +269,19 @@ public:
         condNonEmpty.notify_one();
         return true;
     }
+    bool push(ItemType&& item)
+    {
+        std::unique_lock<std::mutex> lock(mtxQueue);
+        if ((int)queue.size() == maxSize && !pass)
+        {
+            condNotFull.wait(lock, [this]{return ((int)this->queue.size() < maxSize) || this->pass; });
+        }
+        if (pass)
+            return false;
+        queue.push_front(std::move(item));
+        condNonEmpty.notify_one();
+        return true;
+    }
     bool pull(ItemType& item)
     {
         std::unique_lock<std::mutex> lock(mtxQueue);
@@ -248,7 +294,7 @@ public:
             item = ItemType();
             return false;
         }
-        item = queue.back();
+        item = std::move(queue.back());
         queue.pop_back();
         condNotFull.notify_one();
         return true;
@@ -280,4 +326,390 @@ private:
     std::mutex mtxQueue;
     std::condition_variable condNonEmpty, condNotFull;
     int pass;
+};
+
+// The following queues are built on bounded ring buffers whose push and pull
+// do not take any lock. Items are moved into and out of the slots, pulled slots are reset
+// to default constructed items, so that memory pools counting references of the items
+// see them released as soon as they are pulled.
+// Capacity is set by the constructor or setMaxSize and has no upper limit.
+// setMaxSize reallocates the slots and drops the items, call it before the queue is shared by threads.
+
+// Ring buffer for exactly one pushing thread and one pulling thread.
+// tryPush moves from item only if it returns true.
+template<typename ItemType>
+class SPSCRingBuffer
+{
+public:
+    SPSCRingBuffer(int capacity_ = 16) : capacity(0), head(0), tail(0)
+    {
+        reset(capacity_);
+    }
+    void reset(int capacity_)
+    {
+        capacity = capacity_ <= 0 ? 16 : capacity_;
+        slots.reset(new ItemType[capacity]);
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+    bool tryPush(ItemType&& item)
+    {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        if (pos - head.load(std::memory_order_acquire) >= capacity)
+            return false;
+        slots[pos % capacity] = std::move(item);
+        tail.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    bool tryPull(ItemType& item)
+    {
+        size_t pos = head.load(std::memory_order_relaxed);
+        if (pos == tail.load(std::memory_order_acquire))
+            return false;
+        ItemType& slot = slots[pos % capacity];
+        item = std::move(slot);
+        slot = ItemType();
+        head.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    int size() const
+    {
+        return int(tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire));
+    }
+    int getCapacity() const
+    {
+        return int(capacity);
+    }
+private:
+    std::unique_ptr<ItemType[]> slots;
+    size_t capacity;
+    // head is written by the pulling thread and tail by the pushing thread,
+    // keep them in different cache lines
+    char pad0[64];
+    std::atomic<size_t> head;
+    char pad1[64];
+    std::atomic<size_t> tail;
+    char pad2[64];
+};
+
+// Ring buffer for any number of pushing and pulling threads.
+// Every slot has a sequence number telling whether it is ready to be written for the
+// position pos (sequence == pos) or ready to be read (sequence == pos + 1),
+// threads claim positions by compare and swap.
+// tryPush moves from item only if it returns true.
+template<typename ItemType>
+class MPMCRingBuffer
+{
+public:
+    MPMCRingBuffer(int capacity_ = 16) : capacity(0), enqueuePos(0), dequeuePos(0)
+    {
+        reset(capacity_);
+    }
+    void reset(int capacity_)
+    {
+        capacity = capacity_ <= 0 ? 16 : capacity_;
+        slots.reset(new Slot[capacity]);
+        for (size_t i = 0; i < capacity; i++)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos.store(0, std::memory_order_relaxed);
+    }
+    bool tryPush(ItemType&& item)
+    {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true)
+        {
+            slot = &slots[pos % capacity];
+            size_t seq = slot->sequence.load(std::memory_order_acquire);
+            ptrdiff_t diff = ptrdiff_t(seq) - ptrdiff_t(pos);
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+        slot->item = std::move(item);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    bool tryPull(ItemType& item)
+    {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true)
+        {
+            slot = &slots[pos % capacity];
+            size_t seq = slot->sequence.load(std::memory_order_acquire);
+            ptrdiff_t diff = ptrdiff_t(seq) - ptrdiff_t(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = dequeuePos.load(std::memory_order_relaxed);
+        }
+        item = std::move(slot->item);
+        slot->item = ItemType();
+        slot->sequence.store(pos + capacity, std::memory_order_release);
+        return true;
+    }
+    int size() const
+    {
+        ptrdiff_t diff = ptrdiff_t(enqueuePos.load(std::memory_order_acquire)) -
+            ptrdiff_t(dequeuePos.load(std::memory_order_acquire));
+        return diff < 0 ? 0 : (diff > ptrdiff_t(capacity) ? int(capacity) : int(diff));
+    }
+    int getCapacity() const
+    {
+        return int(capacity);
+    }
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        ItemType item;
+    };
+    std::unique_ptr<Slot[]> slots;
+    size_t capacity;
+    char pad0[64];
+    std::atomic<size_t> enqueuePos;
+    char pad1[64];
+    std::atomic<size_t> dequeuePos;
+    char pad2[64];
+};
+
+// Lets threads sleep until a condition on a ring buffer holds.
+// Notifying threads only take the mutex if some thread is waiting,
+// so the fast paths of push and pull stay free of locks.
+class RingBufferSignal
+{
+public:
+    RingBufferSignal() : numWaiters(0) {};
+    template<typename Predicate>
+    void wait(Predicate pred)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        numWaiters.fetch_add(1);
+        // Pairs with the fence in notify, either the waiter sees the change
+        // or the notifier sees the waiter
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cond.wait(lock, pred);
+        numWaiters.fetch_sub(1);
+    }
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (numWaiters.load(std::memory_order_relaxed))
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            cond.notify_all();
+        }
+    }
+    void notifyForce()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        cond.notify_all();
+    }
+private:
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::atomic<int> numWaiters;
+};
+
+// Lock free counterpart of RealTimeQueue, drops the oldest item if full,
+// and pull returns an empty item and false at once if empty.
+// Nothing ever waits on this queue, so it has no stop and resume.
+// The pushing thread removes the oldest item itself, so the ring buffer
+// should be MPMCRingBuffer even for one pushing and one pulling thread.
+template<typename ItemType>
+class LockFreeRealTimeQueue
+{
+    enum { DEFAULT_QUEUE_SIZE = 16 };
+public:
+    LockFreeRealTimeQueue(int maxSize_ = DEFAULT_QUEUE_SIZE) :
+        ring(maxSize_ <= 0 ? DEFAULT_QUEUE_SIZE : maxSize_) {};
+    void setMaxSize(int maxSize_)
+    {
+        ring.reset(maxSize_ <= 0 ? DEFAULT_QUEUE_SIZE : maxSize_);
+    }
+    bool push(const ItemType& item)
+    {
+        ItemType copy(item);
+        return push(std::move(copy));
+    }
+    bool push(ItemType&& item)
+    {
+        while (!ring.tryPush(std::move(item)))
+        {
+            ItemType dropped;
+            // A pulling thread may hold the oldest slot, let it finish
+            if (!ring.tryPull(dropped))
+                std::this_thread::yield();
+        }
+        return true;
+    }
+    bool pull(ItemType& item)
+    {
+        if (!ring.tryPull(item))
+        {
+            item = ItemType();
+            return false;
+        }
+        return true;
+    }
+    void clear()
+    {
+        ItemType item;
+        while (ring.tryPull(item));
+    }
+    int size()
+    {
+        return ring.size();
+    }
+private:
+    MPMCRingBuffer<ItemType> ring;
+};
+
+// Lock free counterpart of ForceWaitRealTimeQueue, drops the oldest item if full,
+// pull sleeps until an item comes or stop is called.
+template<typename ItemType>
+class LockFreeForceWaitRealTimeQueue
+{
+    enum { DEFAULT_QUEUE_SIZE = 16 };
+public:
+    LockFreeForceWaitRealTimeQueue(int maxSize_ = DEFAULT_QUEUE_SIZE) :
+        ring(maxSize_ <= 0 ? DEFAULT_QUEUE_SIZE : maxSize_), pass(0) {};
+    void setMaxSize(int maxSize_)
+    {
+        ring.reset(maxSize_ <= 0 ? DEFAULT_QUEUE_SIZE : maxSize_);
+    }
+    bool push(const ItemType& item)
+    {
+        ItemType copy(item);
+        return push(std::move(copy));
+    }
+    bool push(ItemType&& item)
+    {
+        while (!ring.tryPush(std::move(item)))
+        {
+            ItemType dropped;
+            if (!ring.tryPull(dropped))
+                std::this_thread::yield();
+        }
+        signalNonEmpty.notify();
+        return true;
+    }
+    bool pull(ItemType& item)
+    {
+        bool ok = !pass && ring.tryPull(item);
+        if (!ok && !pass)
+            signalNonEmpty.wait([this, &item, &ok]{ return this->pass || (ok = this->ring.tryPull(item)); });
+        if (!ok)
+        {
+            item = ItemType();
+            return false;
+        }
+        return true;
+    }
+    void clear()
+    {
+        ItemType item;
+        while (ring.tryPull(item));
+        pass = 0;
+    }
+    int size()
+    {
+        return ring.size();
+    }
+    void stop()
+    {
+        pass = 1;
+        signalNonEmpty.notifyForce();
+    }
+    void resume()
+    {
+        pass = 0;
+    }
+private:
+    MPMCRingBuffer<ItemType> ring;
+    RingBufferSignal signalNonEmpty;
+    std::atomic<int> pass;
+};
+
+// Lock free counterpart of BoundedCompleteQueue, push sleeps while the queue is full
+// and pull sleeps while the queue is empty, until space or an item comes or stop is called.
+// Use SPSCRingBuffer as RingBufferType if only one thread pushes and only one thread pulls,
+// such as between the decode and proc threads, otherwise use MPMCRingBuffer.
+template<typename ItemType, typename RingBufferType = MPMCRingBuffer<ItemType> >
+class LockFreeBoundedCompleteQueue
+{
+    enum { DEFAULT_QUEUE_SIZE = 16 };
+public:
+    LockFreeBoundedCompleteQueue(int maxSize_ = DEFAULT_QUEUE_SIZE) :
+        ring(maxSize_ <= 0 ? DEFAULT_QUEUE_SIZE : maxSize_), pass(0) {};
+    void setMaxSize(int maxSize_)
+    {
+        ring.reset(maxSize_ <= 0 ? DEFAULT_QUEUE_SIZE : maxSize_);
+    }
+    bool push(const ItemType& item)
+    {
+        ItemType copy(item);
+        return push(std::move(copy));
+    }
+    bool push(ItemType&& item)
+    {
+        bool ok = !pass && ring.tryPush(std::move(item));
+        if (!ok && !pass)
+            signalNotFull.wait([this, &item, &ok]{ return this->pass || (ok = this->ring.tryPush(std::move(item))); });
+        if (!ok)
+            return false;
+        signalNonEmpty.notify();
+        return true;
+    }
+    bool pull(ItemType& item)
+    {
+        bool ok = !pass && ring.tryPull(item);
+        if (!ok && !pass)
+            signalNonEmpty.wait([this, &item, &ok]{ return this->pass || (ok = this->ring.tryPull(item)); });
+        if (!ok)
+        {
+            item = ItemType();
+            return false;
+        }
+        signalNotFull.notify();
+        return true;
+    }
+    void clear()
+    {
+        ItemType item;
+        while (ring.tryPull(item));
+        pass = 0;
+        signalNotFull.notify();
+    }
+    int size()
+    {
+        return ring.size();
+    }
+    void stop()
+    {
+        pass = 1;
+        signalNonEmpty.notifyForce();
+        signalNotFull.notifyForce();
+    }
+    void resume()
+    {
+        pass = 0;
+    }
+private:
+    RingBufferType ring;
+    RingBufferSignal signalNonEmpty, signalNotFull;
+    std::atomic<int> pass;
 };
\ No newline at end of file
@@ -215,6 +215,11 @@ bool DOclPanoramaLocalDiskTask::Impl::init(const std::vector<std::string>& srcVi
         return false;
     }
 
+    // Color conversion kernels build in the background, render.prepare waits for them,
+    // the guard joins the build threads if init returns before that
+    docl::prewarm(docl::KERNEL_SET_IMAGE_PROC);
+    docl::PrewarmGuard prewarmGuard;
+
     ok = prepareSrcVideos(srcVideoFiles, avp::PixelTypeBGR32, offsets, tryAudioIndex, readers, audioIndex, srcSize, validFrameCount);
     if (!ok)
     {
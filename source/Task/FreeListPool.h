@@ -0,0 +1,240 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+struct FreeListPoolStatistics
+{
+    // Number of items allocated by the pool
+    int numItems;
+    // Number of items referenced outside the pool
+    int numInUse;
+    // Largest numItems since init or resetStatistics, the number of items the work load needs
+    int maxNumItems;
+    // Number of get calls that had to wait because the pool reached its capacity
+    int numWaits;
+    // Number of get calls that failed because no item was released in the wait time
+    int numTimeouts;
+};
+
+// Pool of reference counted items, such as cv::Mat and avp::AudioVideoFrame2.
+// The pool keeps its items in slots and the indexes of the free slots in a free list.
+// get does not hand out the pooled item itself, but an item made by the share function
+// that refers to the same buffer and calls the given release function when its last
+// reference is dropped, through a shared_ptr deleter or a cv::MatAllocator for example.
+// The release function pushes the slot back to the free list and wakes a waiting get,
+// so get and release are O(1) and the pool never checks the reference counts of its items.
+// If capacity is positive and the pool has that many items all in use, get waits on a
+// condition variable until an item is released and fails once the wait time has passed.
+// Zero capacity means no limit, which is the default.
+// Items released after init, reset or clear are not returned to the pool, their buffers
+// stay valid as long as the shared items hold them.
+template<typename ItemType>
+class FreeListPool
+{
+public:
+    typedef std::function<bool (ItemType&)> CreateFunction;
+    typedef std::function<void ()> ReleaseFunction;
+    typedef std::function<void (const ItemType& pooled, const ReleaseFunction& release, ItemType& shared)> ShareFunction;
+    enum { DEFAULT_WAIT_MILLISECONDS = 1000 };
+
+    FreeListPool() :
+        state(new State), capacity(0), waitMilliseconds(DEFAULT_WAIT_MILLISECONDS)
+    {
+    }
+
+    // Drops all items, get creates new items by create_ from now on.
+    void init(const CreateFunction& create_, const ShareFunction& share_)
+    {
+        std::vector<ItemType> dropped;
+        std::lock_guard<std::mutex> lock(state->mtx);
+        drop(dropped);
+        create = create_;
+        share = share_;
+        state->maxNumItems = 0;
+        state->numWaits = 0;
+        state->numTimeouts = 0;
+    }
+
+    // Drops all items and the create function, get fails until init is called again.
+    void reset()
+    {
+        init(CreateFunction(), ShareFunction());
+    }
+
+    // Drops all items, items still in use outside the pool stay valid until they are released.
+    void clear()
+    {
+        std::vector<ItemType> dropped;
+        std::lock_guard<std::mutex> lock(state->mtx);
+        drop(dropped);
+    }
+
+    void setCapacity(int capacity_, int waitMilliseconds_ = DEFAULT_WAIT_MILLISECONDS)
+    {
+        std::lock_guard<std::mutex> lock(state->mtx);
+        capacity = capacity_ < 0 ? 0 : capacity_;
+        waitMilliseconds = waitMilliseconds_ < 0 ? 0 : waitMilliseconds_;
+    }
+
+    bool get(ItemType& item)
+    {
+        // item is assigned after the lock is released, since the assignment may drop
+        // the last reference of an item got before and call its release function.
+        ItemType shared;
+        bool ok = getShared(shared);
+        item = shared;
+        return ok;
+    }
+
+    // Deletes items not in use until the pool holds no more than minSize items.
+    void shrink(int minSize)
+    {
+        std::vector<ItemType> dropped;
+        std::lock_guard<std::mutex> lock(state->mtx);
+        while (!state->freeIndexes.empty() && numItems() > minSize)
+        {
+            int index = state->freeIndexes.back();
+            state->freeIndexes.pop_back();
+            dropped.push_back(items[index]);
+            items[index] = ItemType();
+            emptyIndexes.push_back(index);
+        }
+    }
+
+    int size()
+    {
+        std::lock_guard<std::mutex> lock(state->mtx);
+        return numItems();
+    }
+
+    FreeListPoolStatistics getStatistics()
+    {
+        std::lock_guard<std::mutex> lock(state->mtx);
+        FreeListPoolStatistics stats;
+        stats.numItems = numItems();
+        stats.numInUse = stats.numItems - (int)state->freeIndexes.size();
+        stats.maxNumItems = state->maxNumItems;
+        stats.numWaits = state->numWaits;
+        stats.numTimeouts = state->numTimeouts;
+        return stats;
+    }
+
+    void resetStatistics()
+    {
+        std::lock_guard<std::mutex> lock(state->mtx);
+        state->maxNumItems = numItems();
+        state->numWaits = 0;
+        state->numTimeouts = 0;
+    }
+
+private:
+    // Shared with the release functions of the items handed out, which may outlive the pool.
+    struct State
+    {
+        State() : generation(0), maxNumItems(0), numWaits(0), numTimeouts(0) {}
+        std::mutex mtx;
+        std::condition_variable cvRelease;
+        std::vector<int> freeIndexes;
+        // Incremented whenever the items are dropped, releases of older items are ignored
+        int generation;
+        int maxNumItems;
+        int numWaits;
+        int numTimeouts;
+    };
+
+    static void release(const std::shared_ptr<State>& state, int index, int generation)
+    {
+        std::lock_guard<std::mutex> lock(state->mtx);
+        if (state->generation != generation)
+            return;
+        state->freeIndexes.push_back(index);
+        state->cvRelease.notify_one();
+    }
+
+    int numItems() const
+    {
+        return int(items.size() - emptyIndexes.size());
+    }
+
+    // Called with the lock held, the items are moved to dropped and destroyed after the lock is released.
+    void drop(std::vector<ItemType>& dropped)
+    {
+        dropped.swap(items);
+        items.clear();
+        emptyIndexes.clear();
+        state->freeIndexes.clear();
+        state->generation++;
+        state->cvRelease.notify_all();
+    }
+
+    bool getShared(ItemType& item)
+    {
+        std::unique_lock<std::mutex> lock(state->mtx);
+        if (!create)
+            return false;
+
+        if (state->freeIndexes.empty())
+        {
+            int num = numItems();
+            if (capacity <= 0 || num < capacity)
+            {
+                ItemType newItem;
+                if (!create(newItem))
+                    return false;
+                int index;
+                if (emptyIndexes.empty())
+                {
+                    index = items.size();
+                    items.push_back(newItem);
+                }
+                else
+                {
+                    index = emptyIndexes.back();
+                    emptyIndexes.pop_back();
+                    items[index] = newItem;
+                }
+                if (num + 1 > state->maxNumItems)
+                    state->maxNumItems = num + 1;
+                handOut(index, item);
+                return true;
+            }
+
+            state->numWaits++;
+            int generation = state->generation;
+            bool released = state->cvRelease.wait_for(lock, std::chrono::milliseconds(waitMilliseconds),
+                [this, generation] { return !state->freeIndexes.empty() || state->generation != generation; });
+            if (state->generation != generation)
+                return false;
+            if (!released)
+            {
+                state->numTimeouts++;
+                return false;
+            }
+        }
+
+        int index = state->freeIndexes.back();
+        state->freeIndexes.pop_back();
+        handOut(index, item);
+        return true;
+    }
+
+    void handOut(int index, ItemType& item)
+    {
+        std::shared_ptr<State> sharedState = state;
+        int generation = state->generation;
+        share(items[index], [sharedState, index, generation] { release(sharedState, index, generation); }, item);
+    }
+
+    std::shared_ptr<State> state;
+    CreateFunction create;
+    ShareFunction share;
+    std::vector<ItemType> items;
+    std::vector<int> emptyIndexes;
+    int capacity;
+    int waitMilliseconds;
+};
@@ -98,6 +98,55 @@ bool areAllNotURLs(const std::vector<std::string>& texts)
     return true;
 }
 
+// Number of frames the frame buffer of each camera holds
+static const int videoFrameBufferSize = 36;
+
+static int videoFramePoolCapacity = 0;
+static int videoFramePoolWaitMilliseconds = 1000;
+
+void setLiveStreamVideoFramePoolCapacity(int capacity, int waitMilliseconds)
+{
+    videoFramePoolCapacity = capacity < 0 ? 0 : capacity;
+    videoFramePoolWaitMilliseconds = waitMilliseconds < 1 ? 1 : waitMilliseconds;
+}
+
+static void initVideoFramePools(std::vector<AudioVideoFramePool>& pools, int pixelType, int width, int height)
+{
+    int size = pools.size();
+    for (int i = 0; i < size; i++)
+    {
+        pools[i].initAsVideoFramePool(pixelType, width, height);
+        pools[i].setCapacity(videoFramePoolCapacity, videoFramePoolWaitMilliseconds);
+    }
+}
+
+// At the capacity get blocks until encode or preview releases a frame, and fails after
+// the pool wait time. A stalled consumer should not end the source, so a failed get is
+// retried, each retry blocking in the pool, until it succeeds or the task ends.
+// Without a capacity get only fails if a frame cannot be allocated, which is not retried.
+static bool getVideoFrameFromPool(AudioVideoFramePool& pool, avp::AudioVideoFrame2& frame,
+    const int& finish, const int& endFlag, const char* funcName, size_t id)
+{
+    int numFails = 0;
+    while (!pool.get(frame))
+    {
+        if (videoFramePoolCapacity <= 0 || finish || endFlag)
+            return false;
+        if (numFails++ == 0)
+            ztool::lprintf("Warning in %s [%8x], video frame pool exhausted, waiting for frames to be released\n", funcName, id);
+    }
+    if (numFails)
+        ztool::lprintf("Info in %s [%8x], got video frame from pool after %d retries\n", funcName, id, numFails);
+    return true;
+}
+
+static void printVideoFramePoolStatistics(const char* funcName, int index, AudioVideoFramePool& pool)
+{
+    FreeListPoolStatistics stats = pool.getStatistics();
+    ztool::lprintf("In %s, video frame pool %d, %d frames, max %d, %d waits, %d timeouts\n",
+        funcName, index, stats.numItems, stats.maxNumItems, stats.numWaits, stats.numTimeouts);
+}
+
 AudioVideoSource::AudioVideoSource()
 {
 
@@ -397,11 +446,10 @@ bool FFmpegAudioVideoSource::open(const std::vector<avp::Device>& devices, int w
 
     ptrFrameBuffers.reset(new std::vector<ForceWaitFrameQueue>(numVideos));
     for (int i = 0; i < numVideos; i++)
-        (*ptrFrameBuffers)[i].setMaxSize(36);
+        (*ptrFrameBuffers)[i].setMaxSize(videoFrameBufferSize);
 
     ptrVideoFramePools.reset(new std::vector<AudioVideoFramePool>(numVideos));
-    for (int i = 0; i < numVideos; i++)
-        (*ptrVideoFramePools)[i].initAsVideoFramePool(pixelType, width, height);
+    initVideoFramePools(*ptrVideoFramePools, pixelType, width, height);
 
     ptrSyncedFramesBufferForShow->clear();
     if (forCuda)
@@ -520,11 +568,10 @@ bool FFmpegAudioVideoSource::open(const std::vector<std::string>& urls, bool ope
 
     ptrFrameBuffers.reset(new std::vector<ForceWaitFrameQueue>(numVideos));
     for (int i = 0; i < numVideos; i++)
-        (*ptrFrameBuffers)[i].setMaxSize(36);
+        (*ptrFrameBuffers)[i].setMaxSize(videoFrameBufferSize);
 
     ptrVideoFramePools.reset(new std::vector<AudioVideoFramePool>(numVideos));
-    for (int i = 0; i < numVideos; i++)
-        (*ptrVideoFramePools)[i].initAsVideoFramePool(pixelType, videoFrameSize.width, videoFrameSize.height);
+    initVideoFramePools(*ptrVideoFramePools, pixelType, videoFrameSize.width, videoFrameSize.height);
 
     ptrSyncedFramesBufferForShow->clear();
     if (forCuda)
@@ -673,7 +720,13 @@ void FFmpegAudioVideoSource::videoSource(int index)
     bool ok;
     while (true)
     {
-        pool.get(frame);
+        if (!getVideoFrameFromPool(pool, frame, finish, videoEndFlag, __FUNCTION__, id))
+        {
+            stopCompleteFrameBuffers(ptrFrameBuffers.get());
+            finish = 1;
+            *ptrFinish = 1;
+            break;
+        }
         ok = reader.readTo(dummyAudioFrame, frame, mediaType);
         if (areSourceFiles)
             std::this_thread::sleep_for(std::chrono::milliseconds(waitTime));
@@ -707,7 +760,7 @@ void FFmpegAudioVideoSource::videoSource(int index)
         // NOTICE, for simplicity, I do not check whether the frame has the right property.
         // For the sake of program robustness, we should at least check whether the frame
         // is of type VIDEO, and is not empty, and has the correct pixel type and width and height.
-        buffer.push(frame);
+        buffer.push(std::move(frame));
 
         if (finish || videoEndFlag)
         {
@@ -720,6 +773,7 @@ void FFmpegAudioVideoSource::videoSource(int index)
     }
     reader.close();
 
+    printVideoFramePoolStatistics(__FUNCTION__, index, pool);
     ztool::lprintf("Thread %s [%8x] end\n", __FUNCTION__, id);
 }
 
@@ -907,11 +961,10 @@ bool JuJingAudioVideoSource::open(const std::vector<std::string>& urls)
     ptrDataPacketQueues.reset(new std::vector<RealTimeDataPacketQueue>(numVideos));
     ptrFrameBuffers.reset(new std::vector<ForceWaitFrameQueue>(numVideos));
     for (int i = 0; i < numVideos; i++)
-        (*ptrFrameBuffers)[i].setMaxSize(36);
+        (*ptrFrameBuffers)[i].setMaxSize(videoFrameBufferSize);
 
     ptrVideoFramePools.reset(new std::vector<AudioVideoFramePool>(numVideos));
-    for (int i = 0; i < numVideos; i++)
-        (*ptrVideoFramePools)[i].initAsVideoFramePool(pixelType, videoFrameSize.width, videoFrameSize.height);
+    initVideoFramePools(*ptrVideoFramePools, pixelType, videoFrameSize.width, videoFrameSize.height);
 
     ptrSyncedFramesBufferForShow->clear();
     if (forCuda)
@@ -1160,9 +1213,10 @@ void JuJingAudioVideoSource::videoDecode(int index)
             if (ok && frame.data[0])
             {
                 frame.timeStamp = pkt.pts;
-                pool.get(copyFrame);
+                if (!getVideoFrameFromPool(pool, copyFrame, finish, videoEndFlag, __FUNCTION__, id))
+                    break;
                 frame.copyTo(copyFrame);
-                frameQueue.push(copyFrame);
+                frameQueue.push(std::move(copyFrame));
             }
         }
         count++;
@@ -1172,6 +1226,7 @@ void JuJingAudioVideoSource::videoDecode(int index)
     *ptrFinish = 1;
     stopCompleteFrameBuffers(ptrFrameBuffers.get());
 
+    printVideoFramePoolStatistics(__FUNCTION__, index, pool);
     ztool::lprintf("Thread %s [%8x] end\n", __FUNCTION__, id);
 }
 
@@ -1259,11 +1314,10 @@ bool HuaTuAudioVideoSource::open(const std::string& url)
         (*ptrDataPacketQueues)[i].setMaxSize(36);
     ptrFrameBuffers.reset(new std::vector<ForceWaitFrameQueue>(numVideos));
     for (int i = 0; i < numVideos; i++)
-        (*ptrFrameBuffers)[i].setMaxSize(36);
+        (*ptrFrameBuffers)[i].setMaxSize(videoFrameBufferSize);
 
     ptrVideoFramePools.reset(new std::vector<AudioVideoFramePool>(numVideos));
-    for (int i = 0; i < numVideos; i++)
-        (*ptrVideoFramePools)[i].initAsVideoFramePool(pixelType, videoFrameSize.width, videoFrameSize.height);
+    initVideoFramePools(*ptrVideoFramePools, pixelType, videoFrameSize.width, videoFrameSize.height);
 
     ptrSyncedFramesBufferForShow->clear();
     if (forCuda)
@@ -1542,7 +1596,8 @@ void HuaTuAudioVideoSource::videoDecode(int index)
         dataPacketQueue.pull(pkt);
         if (pkt.data.get())
         {
-            pool.get(frame);
+            if (!getVideoFrameFromPool(pool, frame, finish, videoEndFlag, __FUNCTION__, id))
+                break;
             bool gotFrame;
             //timer.start();
             ok = decoder->decodeTo(pkt.data.get(), pkt.dataSize, pkt.pts, frame, gotFrame);
@@ -1573,5 +1628,6 @@ void HuaTuAudioVideoSource::videoDecode(int index)
     *ptrFinish = 1;
     stopCompleteFrameBuffers(ptrFrameBuffers.get());
 
+    printVideoFramePoolStatistics(__FUNCTION__, index, pool);
     ztool::lprintf("Thread %s [%8x] end\n", __FUNCTION__, id);
 }
\ No newline at end of file
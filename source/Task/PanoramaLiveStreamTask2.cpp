@@ -45,6 +45,8 @@ struct PanoramaLiveStreamTask2::Impl
     bool calcExposures(std::vector<double>& exposures);
     bool setExposures(const std::vector<double>& exposures);
     void resetExposures();
+    bool beginAutoExposures(bool whiteBalance, int frameInterval);
+    void stopAutoExposures();
 
     bool getVideoSourceFrames(std::vector<avp::AudioVideoFrame2>& frames);
     bool getStitchedVideoFrame(avp::AudioVideoFrame2& frame);
@@ -116,11 +118,13 @@ struct PanoramaLiveStreamTask2::Impl
 
     std::unique_ptr<ImageVisualCorrect2> correct;
     std::vector<double> exposures;
+    typedef std::vector<std::vector<std::vector<unsigned char> > > LUTs;
     std::mutex mtxLuts;
-    std::vector<std::vector<std::vector<unsigned char> > > luts;
+    std::shared_ptr<const LUTs> luts;
     void setLUTs(const std::vector<double>& exposures);
     void clearLUTs();
-    void getLuts(std::vector<std::vector<std::vector<unsigned char> > >& luts);
+    std::shared_ptr<const LUTs> getLuts();
+    SwitchableExposureColorEstimator estimator;
 
     double videoSourceFrameRate;
     double stitchVideoFrameRate;
@@ -439,6 +443,7 @@ void PanoramaLiveStreamTask2::Impl::stopVideoStitch()
         renderThread.reset(0);
         render.reset();
         correct.reset();
+        stopAutoExposures();
         renderPrepareSuccess = 0;
         renderThreadJoined = 1;
         procFramePool.clear();
@@ -800,6 +805,43 @@ void PanoramaLiveStreamTask2::Impl::resetExposures()
     clearLUTs();
 }
 
+bool PanoramaLiveStreamTask2::Impl::beginAutoExposures(bool whiteBalance, int frameInterval)
+{
+    if (!renderPrepareSuccess || renderThreadJoined)
+    {
+        ztool::lprintf("Error in %s, render not running, cannot apply exposure correct\n", __FUNCTION__);
+        syncErrorMessage = getText(TI_STITCH_NOT_RUNNING_CANNOT_CORRECT);
+        return false;
+    }
+
+    if (stitchType != PanoStitchTypeMISO)
+    {
+        ztool::lprintf("Error in %s, auto exposure only supports stitch type %d, current %d\n",
+            __FUNCTION__, PanoStitchTypeMISO, stitchType);
+        syncErrorMessage = getText(TI_CORRECT_FAIL);
+        return false;
+    }
+
+    std::vector<PhotoParam> params;
+    bool ok = loadPhotoParams(renderConfigName, params) && params.size() == numVideos &&
+        estimator.begin(params, videoFrameSize, whiteBalance ? (EXPOSURE | WHITE_BALANCE) : EXPOSURE, frameInterval);
+    if (!ok)
+    {
+        ztool::lprintf("Error in %s, could not prepare exposure estimator\n", __FUNCTION__);
+        syncErrorMessage = getText(TI_CORRECT_FAIL);
+        return false;
+    }
+
+    ztool::lprintf("Info in %s, auto exposure started, white balance %d, frame interval %d\n",
+        __FUNCTION__, whiteBalance, frameInterval);
+    return true;
+}
+
+void PanoramaLiveStreamTask2::Impl::stopAutoExposures()
+{
+    estimator.stop();
+}
+
 double PanoramaLiveStreamTask2::Impl::getVideoSourceFrameRate() const
 {
     return videoSourceFrameRate;
@@ -925,7 +967,7 @@ void PanoramaLiveStreamTask2::Impl::procVideo()
     std::vector<long long int> timeStamps;
     std::vector<cv::Mat> src(numVideos);
     cv::cuda::GpuMat bgr32, bgr32Resize;
-    std::vector<std::vector<std::vector<unsigned char> > > localLookUpTables;
+    std::shared_ptr<const LUTs> localLookUpTables;
     CudaMixedAudioVideoFrame renderFrame, showFrame, sendFrame, saveFrame;
     cv::cuda::GpuMat bgr1, y1, u1, v1, uv1;
     cv::cuda::GpuMat bgr2, y2, u2, v2, uv2;
@@ -972,11 +1014,14 @@ void PanoramaLiveStreamTask2::Impl::procVideo()
 
             for (int i = 0; i < numVideos; i++)
                 src[i] = mems[i].createMatHeader();
-            if (luts.size())
+            // The frames are sampled down if the estimator takes them, src may be reused as soon as it returns
+            localLookUpTables = estimator.addFrames(src);
+            if (!localLookUpTables)
+                localLookUpTables = getLuts();
+            if (localLookUpTables)
             {
-                getLuts(localLookUpTables);
                 //procTimer.start();
-                ok = render->render(src, bgr32, localLookUpTables);
+                ok = render->render(src, bgr32, *localLookUpTables);
                 //procTimer.end();
             }
             else
@@ -1297,21 +1342,25 @@ void PanoramaLiveStreamTask2::Impl::setLUTs(const std::vector<double>& exposures
         bs[i] = 1;
     }
     if (needCorrectExposureWhiteBalance(exposures, rs, bs))
-        ImageVisualCorrect2::getLUTs(exposures, rs, bs, luts);
+    {
+        std::shared_ptr<LUTs> newLuts(new LUTs);
+        ImageVisualCorrect2::getLUTs(exposures, rs, bs, *newLuts);
+        luts = newLuts;
+    }
     else
-        luts.clear();
+        luts.reset();
 }
 
 void PanoramaLiveStreamTask2::Impl::clearLUTs()
 {
     std::lock_guard<std::mutex> lg(mtxLuts);
-    luts.clear();
+    luts.reset();
 }
 
-void PanoramaLiveStreamTask2::Impl::getLuts(std::vector<std::vector<std::vector<unsigned char> > >& LUTs)
+std::shared_ptr<const PanoramaLiveStreamTask2::Impl::LUTs> PanoramaLiveStreamTask2::Impl::getLuts()
 {
     std::lock_guard<std::mutex> lg(mtxLuts);
-    LUTs = luts;
+    return luts;
 }
 
 void PanoramaLiveStreamTask2::Impl::addAsyncErrorMessage(const std::string& message, int fromWhere)
@@ -1420,6 +1469,16 @@ void PanoramaLiveStreamTask2::resetExposures()
     ptrImpl->resetExposures();
 }
 
+bool PanoramaLiveStreamTask2::beginAutoExposures(bool whiteBalance, int frameInterval)
+{
+    return ptrImpl->beginAutoExposures(whiteBalance, frameInterval);
+}
+
+void PanoramaLiveStreamTask2::stopAutoExposures()
+{
+    ptrImpl->stopAutoExposures();
+}
+
 double PanoramaLiveStreamTask2::getVideoSourceFrameRate() const
 {
     return ptrImpl->getVideoSourceFrameRate();
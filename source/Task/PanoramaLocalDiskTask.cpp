@@ -4,21 +4,52 @@
 #include "RicohUtil.h"
 #include "PinnedMemoryPool.h"
 #include "SharedAudioVideoFramePool.h"
+#include "TimeStampReorderBuffer.h"
 #include "CudaPanoramaTaskUtil.h"
 #include "Image.h"
 #include "Text.h"
 #include "CompileControl.h"
 #include "Blend/ZBlend.h"
 #include "Warp/ZReproject.h"
+#include "Warp/StreamStabilize.h"
 #include "Tool/Timer.h"
 #include "Tool/Print.h"
 #include "opencv2/highgui.hpp"
 #include <deque>
+#include <map>
 
 typedef BoundedCompleteQueue<avp::AudioVideoFrame2> FrameBufferForCpu;
 typedef std::vector<avp::AudioVideoFrame2> FrameVectorForCpu;
 typedef BoundedCompleteQueue<FrameVectorForCpu> FrameVectorBufferForCpu;
 typedef std::deque<avp::AudioVideoFrame2> TempAudioFrameBufferForCpu;
+typedef TimeStampReorderBuffer<avp::AudioVideoFrame2> ReorderFrameBufferForCpu;
+
+static int cpuLocalDiskTaskNumProcThreads = 1;
+
+void setCPUPanoramaLocalDiskTaskNumProcThreads(int numThreads)
+{
+    cpuLocalDiskTaskNumProcThreads = numThreads < 1 ? 1 : numThreads;
+}
+
+static int cpuLocalDiskTaskStabilize = 0;
+static int cpuLocalDiskTaskStabilizeLookahead = 15;
+
+void setCPUPanoramaLocalDiskTaskStabilize(bool stabilize, int lookahead)
+{
+    cpuLocalDiskTaskStabilize = stabilize;
+    cpuLocalDiskTaskStabilizeLookahead = lookahead < 0 ? 0 : lookahead;
+}
+
+// A get that waits longer than this for a frame to be released fails the task,
+// proc threads wait here while encode holds frames to restore the decode order.
+static const int cpuLocalDiskTaskPoolWaitMilliseconds = 10000;
+
+static void printFramePoolStatistics(const char* funcName, const char* poolName, AudioVideoFramePool& pool)
+{
+    FreeListPoolStatistics stats = pool.getStatistics();
+    ztool::lprintf("Info in %s, %s pool, %d frames, max %d, %d waits, %d timeouts\n",
+        funcName, poolName, stats.numItems, stats.maxNumItems, stats.numWaits, stats.numTimeouts);
+}
 
 enum EncodeState
 {
@@ -55,30 +86,43 @@ struct CPUPanoramaLocalDiskTask::Impl
     cv::Size srcSize, dstSize;
     std::vector<avp::AudioVideoReader3> readers;
     std::vector<std::vector<std::vector<unsigned char> > > luts;
-    std::unique_ptr<CPUPanoramaRender> render;
+    // One render for each proc thread
+    std::vector<std::unique_ptr<CPUPanoramaRender> > renders;
     WatermarkFilter watermarkFilter;
     std::unique_ptr<LogoFilter> logoFilter;
+    // Used by encode if stabilize is set
+    int stabilize;
+    StreamStabilizer stabilizer;
     avp::AudioVideoWriter3 writer;
 
     int decodeCount;
-    int procCount;
+    std::atomic<int> procCount;
     int encodeCount;
     std::atomic<int> finishPercent;
     int validFrameCount;
 
     void decode();
-    void proc();
+    void proc(int index);
     void encode();
+    int numProcThreads;
+    std::atomic<int> numProcThreadsRunning;
     std::unique_ptr<std::thread> decodeThread;
-    std::unique_ptr<std::thread> procThread;
+    std::vector<std::unique_ptr<std::thread> > procThreads;
     std::unique_ptr<std::thread> encodeThread;
+    void joinThreads();
 
     AudioVideoFramePool audioFramesMemoryPool;
     AudioVideoFramePool srcVideoFramesMemoryPool;
     AudioVideoFramePool dstVideoFramesMemoryPool;
+    // Frames the stabilizer writes to, kept apart from dstVideoFramesMemoryPool
+    // so that encode never waits for frames only encode can release
+    AudioVideoFramePool stabilizedVideoFramesMemoryPool;
 
     FrameVectorBufferForCpu decodeFramesBuffer;
     FrameBufferForCpu procFrameBuffer;
+    // Time stamps of the decoded video frames in decode order,
+    // proc threads may finish frames out of this order, encode restores it.
+    CompleteQueue<long long int> decodeTimeStamps;
 
     std::string syncErrorMessage;
     std::mutex mtxAsyncErrorMessage;
@@ -202,17 +246,22 @@ bool CPUPanoramaLocalDiskTask::Impl::init(const std::vector<std::string>& srcVid
         }
     }
 
-    if (panoType == PanoStitchTypeMISO)
-        render.reset(new CPUPanoramaRender);
-    else if (panoType == PanoStitchTypeRicoh)
-        render.reset(new CPURicohPanoramaRender);
-    else
+    numProcThreads = cpuLocalDiskTaskNumProcThreads;
+    renders.resize(numProcThreads);
+    for (int i = 0; i < numProcThreads; i++)
     {
-        ztool::lprintf("Error in %s, unsupported pano stitch type %d, should be %d or %d\n",
-            __FUNCTION__, panoType, PanoStitchTypeMISO, PanoStitchTypeRicoh);
+        if (panoType == PanoStitchTypeMISO)
+            renders[i].reset(new CPUPanoramaRender);
+        else if (panoType == PanoStitchTypeRicoh)
+            renders[i].reset(new CPURicohPanoramaRender);
+        else
+        {
+            ztool::lprintf("Error in %s, unsupported pano stitch type %d, should be %d or %d\n",
+                __FUNCTION__, panoType, PanoStitchTypeMISO, PanoStitchTypeRicoh);
+        }
     }
 
-    ok = render->prepare(cameraParamFile, highQualityBlend, blendParam, srcSize, dstSize);
+    ok = renders[0]->prepare(cameraParamFile, highQualityBlend, blendParam, srcSize, dstSize);
     if (!ok)
     {
         ztool::lprintf("Error in %s, render prepare failed\n", __FUNCTION__);
@@ -220,13 +269,24 @@ bool CPUPanoramaLocalDiskTask::Impl::init(const std::vector<std::string>& srcVid
         return false;
     }
 
-    if (render->getNumImages() != readers.size())
+    if (renders[0]->getNumImages() != readers.size())
     {
         ztool::lprintf("Error in %s, num images in render not equal to num videos\n", __FUNCTION__);
         syncErrorMessage = getText(TI_STITCH_INIT_FAIL);
         return false;
     }
 
+    for (int i = 1; i < numProcThreads; i++)
+    {
+        ok = renders[i]->prepareShared(*renders[0]);
+        if (!ok)
+        {
+            ztool::lprintf("Error in %s, render prepare for proc thread %d failed\n", __FUNCTION__, i);
+            syncErrorMessage = getText(TI_STITCH_INIT_FAIL);
+            return false;
+        }
+    }
+
     //useCustomMasks = 0;
     //if (customMaskFile.size())
     //{
@@ -259,6 +319,22 @@ bool CPUPanoramaLocalDiskTask::Impl::init(const std::vector<std::string>& srcVid
     //    useCustomMasks = 1;
     //}
 
+    stabilize = 0;
+    if (cpuLocalDiskTaskStabilize)
+    {
+        StreamStabilizeParam stabilizeParam;
+        stabilizeParam.lookahead = cpuLocalDiskTaskStabilizeLookahead;
+        if (stabilizer.init(dstSize, stabilizeParam) &&
+            stabilizedVideoFramesMemoryPool.initAsVideoFramePool(avp::PixelTypeBGR24, dstSize.width, dstSize.height))
+        {
+            stabilizedVideoFramesMemoryPool.setCapacity(4, cpuLocalDiskTaskPoolWaitMilliseconds);
+            stabilize = 1;
+        }
+        else
+            ztool::lprintf("Info in %s, could not init stabilizer for dst size %d x %d, skip this\n",
+                __FUNCTION__, dstSize.width, dstSize.height);
+    }
+
     ok = watermarkFilter.init(dstSize.width, dstSize.height, CV_8UC3);
     if (!ok)
     {
@@ -303,11 +379,25 @@ bool CPUPanoramaLocalDiskTask::Impl::init(const std::vector<std::string>& srcVid
         return false;
     }
 
-    decodeFramesBuffer.setMaxSize(4);
-    procFrameBuffer.setMaxSize(16);
+    // Let every proc thread have frames to work on
+    int decodeFramesBufferSize = numProcThreads > 2 ? numProcThreads * 2 : 4;
+    int procFrameBufferSize = numProcThreads > 8 ? numProcThreads * 2 : 16;
+    decodeFramesBuffer.setMaxSize(decodeFramesBufferSize);
+    procFrameBuffer.setMaxSize(procFrameBufferSize);
+
+    // Src frames are held by decode, by decodeFramesBuffer and by the proc threads until their next pull.
+    // Dst frames are held by the proc threads, by procFrameBuffer, by the stabilizer and by the
+    // reorder buffer of encode, which grows while a proc thread falls behind. At the capacity
+    // the other proc threads wait for dst frames, so the capacity also bounds the reorder buffer.
+    // Audio frames are not limited, encode keeps all those before the first video frame.
+    srcVideoFramesMemoryPool.setCapacity(numVideos * (decodeFramesBufferSize + numProcThreads + 2),
+        cpuLocalDiskTaskPoolWaitMilliseconds);
+    dstVideoFramesMemoryPool.setCapacity(procFrameBufferSize + numProcThreads * 3 + 4 +
+        (stabilize ? stabilizer.getLatency() + 2 : 0), cpuLocalDiskTaskPoolWaitMilliseconds);
 
     decodeFramesBuffer.resume();
     procFrameBuffer.resume();
+    decodeTimeStamps.clear();
 
     finishPercent.store(0);
 
@@ -378,8 +468,14 @@ void CPUPanoramaLocalDiskTask::Impl::decode()
 
         if (audioIndex >= 0 && audioIndex < numVideos)
         {
-            audioFramesMemoryPool.get(audioFrame);
-            srcVideoFramesMemoryPool.get(videoFrames[audioIndex]);
+            if (!audioFramesMemoryPool.get(audioFrame) ||
+                !srcVideoFramesMemoryPool.get(videoFrames[audioIndex]))
+            {
+                ztool::lprintf("Error in %s, could not get frame from pool\n", __FUNCTION__);
+                setAsyncErrorMessage(getText(TI_STITCH_FAIL_TASK_TERMINATE));
+                isCanceled = true;
+                break;
+            }
             if (!readers[audioIndex].readTo(audioFrame, videoFrames[audioIndex], mediaType))
                 break;
             if (mediaType == avp::AUDIO)
@@ -401,7 +497,14 @@ void CPUPanoramaLocalDiskTask::Impl::decode()
             if (i == audioIndex)
                 continue;
 
-            srcVideoFramesMemoryPool.get(videoFrames[i]);
+            if (!srcVideoFramesMemoryPool.get(videoFrames[i]))
+            {
+                ztool::lprintf("Error in %s, could not get frame from pool\n", __FUNCTION__);
+                setAsyncErrorMessage(getText(TI_STITCH_FAIL_TASK_TERMINATE));
+                isCanceled = true;
+                successRead = false;
+                break;
+            }
             if (!readers[i].readTo(audioFrame, videoFrames[i], mediaType))
             {
                 successRead = false;
@@ -420,6 +523,7 @@ void CPUPanoramaLocalDiskTask::Impl::decode()
         if (!successRead || isCanceled)
             break;
 
+        decodeTimeStamps.push(videoFrames[audioIndex >= 0 ? audioIndex : 0].timeStamp);
         decodeFramesBuffer.push(videoFrames);
         decodeCount++;
         //ztool::lprintf("decode count = %d\n", decodeCount);
@@ -442,18 +546,30 @@ void CPUPanoramaLocalDiskTask::Impl::decode()
     ztool::lprintf("Thread %s [%8x] end\n", __FUNCTION__, id);
 }
 
-void CPUPanoramaLocalDiskTask::Impl::proc()
+void CPUPanoramaLocalDiskTask::Impl::proc(int procIndex)
 {
     size_t id = std::this_thread::get_id().hash();
-    ztool::lprintf("Thread %s [%8x] started\n", __FUNCTION__, id);
+    ztool::lprintf("Thread %s [%8x] started, index = %d\n", __FUNCTION__, id, procIndex);
 
-    procCount = 0;
+    CPUPanoramaRender& render = *renders[procIndex];
+    int count = 0;
     FrameVectorForCpu frames;
     std::vector<cv::Mat> images(numVideos);
     int index = audioIndex >= 0 ? audioIndex : 0;
     bool ok = false;
     while (true)
     {
+        // Get the dst frame before pulling the src frames, the proc thread with the frame
+        // encode waits for then never waits for the pool
+        avp::AudioVideoFrame2 videoFrame;
+        if (!dstVideoFramesMemoryPool.get(videoFrame))
+        {
+            ztool::lprintf("Error in %s, could not get frame from pool\n", __FUNCTION__);
+            setAsyncErrorMessage(getText(TI_STITCH_FAIL_TASK_TERMINATE));
+            isCanceled = true;
+            break;
+        }
+
         if (!decodeFramesBuffer.pull(frames))
             break;
 
@@ -464,14 +580,12 @@ void CPUPanoramaLocalDiskTask::Impl::proc()
             images[i] = cv::Mat(frames[i].height, frames[i].width, CV_8UC3, frames[i].data[0], frames[i].steps[0]);
         //reprojectParallelTo16S(images, reprojImages, dstSrcMaps);
 
-        avp::AudioVideoFrame2 videoFrame;
-        dstVideoFramesMemoryPool.get(videoFrame);
         cv::Mat blendImage(videoFrame.height, videoFrame.width, CV_8UC3, videoFrame.data[0], videoFrame.steps[0]);
 
         if (luts.empty())
-            render->render(images, blendImage);
+            render.render(images, blendImage);
         else
-            render->render(images, blendImage, luts);
+            render.render(images, blendImage, luts);
 
         //if (useCustomMasks)
         //{
@@ -503,6 +617,8 @@ void CPUPanoramaLocalDiskTask::Impl::proc()
             {
                 ztool::lprintf("Error in %s, add logo fail\n", __FUNCTION__);
                 setAsyncErrorMessage(getText(TI_WRITE_TO_VIDEO_FAIL_TASK_TERMINATE));
+                // Encode would wait for this frame, stop the other threads
+                isCanceled = true;
                 break;
             }
         }
@@ -514,24 +630,34 @@ void CPUPanoramaLocalDiskTask::Impl::proc()
             {
                 ztool::lprintf("Error in %s, add watermark fail\n", __FUNCTION__);
                 setAsyncErrorMessage(getText(TI_WRITE_TO_VIDEO_FAIL_TASK_TERMINATE));
+                isCanceled = true;
                 break;
             }
         }
 
         videoFrame.timeStamp = frames[index].timeStamp;
         procFrameBuffer.push(videoFrame);
+        count++;
         procCount++;
         //ztool::lprintf("proc count = %d\n", procCount);
     }
 
-    if (!isCanceled)
+    ztool::lprintf("In %s, index %d proc %d\n", __FUNCTION__, procIndex, count);
+
+    // The last proc thread to end stops the buffers
+    if (--numProcThreadsRunning == 0)
     {
-        while (procFrameBuffer.size())
-            std::this_thread::sleep_for(std::chrono::milliseconds(25));
-    }
-    procFrameBuffer.stop();
+        if (!isCanceled)
+        {
+            while (procFrameBuffer.size())
+                std::this_thread::sleep_for(std::chrono::milliseconds(25));
+        }
+        procFrameBuffer.stop();
+        // Let decode return if it is waiting for space
+        decodeFramesBuffer.stop();
 
-    ztool::lprintf("In %s, total proc %d\n", __FUNCTION__, procCount);
+        ztool::lprintf("In %s, total proc %d\n", __FUNCTION__, procCount.load());
+    }
     ztool::lprintf("Thread %s [%8x] end\n", __FUNCTION__, id);
 }
 
@@ -553,22 +679,18 @@ void CPUPanoramaLocalDiskTask::Impl::encode()
     int encodeState = VideoFrameNotCome;
     int hasAudio = audioIndex >= 0 && audioIndex < numVideos;
     TempAudioFrameBufferForCpu tempAudioFrames;
-    while (true)
-    {
-        if (!procFrameBuffer.pull(frame))
-            break;
-
-        if (isCanceled)
-            break;
+    ReorderFrameBufferForCpu reorderFrames;
 
+    auto writeFrame = [&](avp::AudioVideoFrame2& frameToWrite) -> bool
+    {
         if (hasAudio)
         {
-            if (frame.mediaType == avp::AUDIO)
+            if (frameToWrite.mediaType == avp::AUDIO)
             {
                 if (encodeState == VideoFrameNotCome)
                 {
-                    tempAudioFrames.push_back(frame);
-                    continue;
+                    tempAudioFrames.push_back(frameToWrite);
+                    return true;
                 }
                 else if (encodeState == FirstVideoFrameCome)
                 {
@@ -582,30 +704,109 @@ void CPUPanoramaLocalDiskTask::Impl::encode()
                 }
             }
 
-            if (frame.mediaType == avp::VIDEO && encodeState == VideoFrameNotCome)
+            if (frameToWrite.mediaType == avp::VIDEO && encodeState == VideoFrameNotCome)
                 encodeState = FirstVideoFrameCome;
         }
 
         //timerEncode.start();
-        bool ok = writer.write(frame);
+        bool ok = writer.write(frameToWrite);
         //timerEncode.end();
         if (!ok)
-        {
-            ztool::lprintf("Error in %s, render failed\n", __FUNCTION__);
-            setAsyncErrorMessage(getText(TI_STITCH_FAIL_TASK_TERMINATE));
-            isCanceled = true;
-            break;
-        }
+            return false;
 
         // Only when the frame is of type video can we increase encodeCount
-        if (frame.mediaType == avp::VIDEO)
+        if (frameToWrite.mediaType == avp::VIDEO)
             encodeCount++;
         //ztool::lprintf("frame %d finish, encode time = %f\n", encodeCount, timerEncode.elapse());
 
         if (encodeCount % step == 0)
             finishPercent.store(double(encodeCount) / (validFrameCount > 0 ? validFrameCount : 100) * 100);
+        return true;
+    };
+
+    // Pushed frames are kept in stabilizeFrames so that the pool does not reuse them
+    // before the stabilizer pops them, stabilized frames are written to new pool frames.
+    std::deque<avp::AudioVideoFrame2> stabilizeFrames;
+    auto writeStabilizedFrames = [&]() -> bool
+    {
+        while (!stabilizeFrames.empty())
+        {
+            avp::AudioVideoFrame2 stabilizedFrame;
+            if (!stabilizedVideoFramesMemoryPool.get(stabilizedFrame))
+                return false;
+            cv::Mat image(stabilizedFrame.height, stabilizedFrame.width, CV_8UC3,
+                stabilizedFrame.data[0], stabilizedFrame.steps[0]);
+            if (!stabilizer.pop(image, stabilizedFrame.timeStamp))
+                break;
+            stabilizeFrames.pop_front();
+            if (!writeFrame(stabilizedFrame))
+                return false;
+        }
+        return true;
+    };
+    auto writeVideoFrame = [&](avp::AudioVideoFrame2& frameToWrite) -> bool
+    {
+        if (!stabilize)
+            return writeFrame(frameToWrite);
+
+        cv::Mat image(frameToWrite.height, frameToWrite.width, CV_8UC3, frameToWrite.data[0], frameToWrite.steps[0]);
+        if (!stabilizer.push(image, frameToWrite.timeStamp))
+            return false;
+        stabilizeFrames.push_back(frameToWrite);
+        return writeStabilizedFrames();
+    };
+
+    auto pullTimeStamp = [this](long long int& timeStamp) -> bool
+    {
+        return decodeTimeStamps.pull(timeStamp);
+    };
+
+    bool ok = true;
+    while (true)
+    {
+        if (!procFrameBuffer.pull(frame))
+            break;
+
+        if (isCanceled)
+            break;
+
+        if (frame.mediaType == avp::VIDEO)
+        {
+            // Keep the video frame until all the video frames decoded before it are written
+            ok = reorderFrames.push(frame.timeStamp, frame, pullTimeStamp, writeVideoFrame);
+        }
+        else
+            ok = writeFrame(frame);
+
+        if (!ok)
+        {
+            ztool::lprintf("Error in %s, render failed\n", __FUNCTION__);
+            setAsyncErrorMessage(getText(TI_STITCH_FAIL_TASK_TERMINATE));
+            isCanceled = true;
+            break;
+        }
     }
 
+    // Frames whose predecessors never came, write them in time stamp order
+    if (!isCanceled)
+    {
+        ok = reorderFrames.flush(writeVideoFrame);
+        if (ok && stabilize)
+        {
+            stabilizer.flush();
+            ok = writeStabilizedFrames();
+        }
+        if (!ok)
+        {
+            ztool::lprintf("Error in %s, write remaining frames failed\n", __FUNCTION__);
+            setAsyncErrorMessage(getText(TI_STITCH_FAIL_TASK_TERMINATE));
+            isCanceled = true;
+        }
+    }
+    ztool::lprintf("In %s, max reorder frames %d\n", __FUNCTION__, reorderFrames.getMaxSize());
+    reorderFrames.clear();
+    stabilizeFrames.clear();
+
     writer.close();
 
     finishPercent.store(100);
@@ -625,30 +826,49 @@ bool CPUPanoramaLocalDiskTask::Impl::start()
     if (finish)
         return false;
 
+    procCount = 0;
+    numProcThreadsRunning = numProcThreads;
     decodeThread.reset(new std::thread(&CPUPanoramaLocalDiskTask::Impl::decode, this));
-    procThread.reset(new std::thread(&CPUPanoramaLocalDiskTask::Impl::proc, this));
+    procThreads.resize(numProcThreads);
+    for (int i = 0; i < numProcThreads; i++)
+        procThreads[i].reset(new std::thread(&CPUPanoramaLocalDiskTask::Impl::proc, this, i));
     encodeThread.reset(new std::thread(&CPUPanoramaLocalDiskTask::Impl::encode, this));
     return true;
 }
 
-void CPUPanoramaLocalDiskTask::Impl::waitForCompletion()
+void CPUPanoramaLocalDiskTask::Impl::joinThreads()
 {
     if (decodeThread && decodeThread->joinable())
         decodeThread->join();
     decodeThread.reset();
-    if (procThread && procThread->joinable())
-        procThread->join();
-    procThread.reset(0);
+    for (int i = 0; i < (int)procThreads.size(); i++)
+    {
+        if (procThreads[i] && procThreads[i]->joinable())
+            procThreads[i]->join();
+    }
+    procThreads.clear();
     if (encodeThread && encodeThread->joinable())
         encodeThread->join();
     encodeThread.reset(0);
+}
+
+void CPUPanoramaLocalDiskTask::Impl::waitForCompletion()
+{
+    joinThreads();
+
+    printFramePoolStatistics(__FUNCTION__, "src video frame", srcVideoFramesMemoryPool);
+    printFramePoolStatistics(__FUNCTION__, "dst video frame", dstVideoFramesMemoryPool);
+    if (stabilize)
+        printFramePoolStatistics(__FUNCTION__, "stabilized video frame", stabilizedVideoFramesMemoryPool);
 
     audioFramesMemoryPool.clear();
     srcVideoFramesMemoryPool.clear();
     dstVideoFramesMemoryPool.clear();
+    stabilizedVideoFramesMemoryPool.clear();
 
     decodeFramesBuffer.clear();
     procFrameBuffer.clear();
+    decodeTimeStamps.clear();
 
     watermarkFilter.clear();
     logoFilter.reset();
@@ -693,32 +913,29 @@ void CPUPanoramaLocalDiskTask::Impl::getLastAsyncErrorMessage(std::string& messa
 
 void CPUPanoramaLocalDiskTask::Impl::clear()
 {
-    if (decodeThread && decodeThread->joinable())
-        decodeThread->join();
-    decodeThread.reset();
-    if (procThread && procThread->joinable())
-        procThread->join();
-    procThread.reset(0);
-    if (encodeThread && encodeThread->joinable())
-        encodeThread->join();
-    encodeThread.reset(0);
+    joinThreads();
 
     audioFramesMemoryPool.clear();
     srcVideoFramesMemoryPool.clear();
     dstVideoFramesMemoryPool.clear();
+    stabilizedVideoFramesMemoryPool.clear();
 
     decodeFramesBuffer.clear();
     procFrameBuffer.clear();
+    decodeTimeStamps.clear();
 
     watermarkFilter.clear();
     logoFilter.reset();
+    stabilize = 0;
+    stabilizer.clear();
 
     numVideos = 0;
     srcSize = cv::Size();
     dstSize = cv::Size();
     readers.clear();
     luts.clear();
-    render.reset();
+    renders.clear();
+    numProcThreads = 1;
     writer.close();
     isCanceled = false;
 
@@ -2373,6 +2590,11 @@ bool DOclPanoramaLocalDiskTask::Impl::init(const std::vector<std::string>& srcVi
         return false;
     }
 
+    // Color conversion kernels build in the background, render.prepare waits for them,
+    // the guard joins the build threads if init returns before that
+    docl::prewarm(docl::KERNEL_SET_IMAGE_PROC);
+    docl::PrewarmGuard prewarmGuard;
+
     ok = prepareSrcVideos(srcVideoFiles, avp::PixelTypeBGR32, offsets, tryAudioIndex, readers, audioIndex, srcSize, validFrameCount);
     if (!ok)
     {
@@ -131,7 +131,7 @@ bool CPUPanoramaPreviewTask::Impl::init(const std::vector<std::string>& srcVideo
     {
         ztool::lprintf("Warning in %s, params.size() > numVideos\n", __FUNCTION__);
     }
-    getReprojectMapsAndMasks(params, srcSize, dstSize, dstSrcMaps, dstMasks);
+    getReprojectMapsCompactAndMasks(params, srcSize, dstSize, dstSrcMaps, dstMasks);
 
     if (!visualCorrect.prepare(cameraParamFile))
     {
@@ -201,7 +201,7 @@ bool CPUPanoramaPreviewTask::Impl::reset(const std::string& cameraParamFile)
     {
         ztool::lprintf("Warning in %s, params.size() > numVideos\n", __FUNCTION__);
     }
-    getReprojectMapsAndMasks(params, srcSize, dstSize, dstSrcMaps, dstMasks);
+    getReprojectMapsCompactAndMasks(params, srcSize, dstSize, dstSrcMaps, dstMasks);
 
     bool ok = false;
     ok = mbBlender.prepare(dstMasks, blendNumLevels, 2);
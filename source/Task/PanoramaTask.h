@@ -11,6 +11,31 @@ void setLanguage(bool isChinese);
 
 void setCPUMultibandBlendMultiThread(bool multiThread);
 
+// If enabled, the cpu render with multiband blending keeps its pyramids in 16 bit instead of 32 bit,
+// which halves their memory at a small loss of precision. Disabled by default.
+void setCPUMultibandBlend16Bit(bool use16Bit);
+
+// If enabled, the cpu render with linear blending resamples, weights and accumulates 
+// all the cameras in a single pass over the panorama. Enabled by default.
+void setCPULinearBlendFused(bool fused);
+
+// Number of threads stitching frames at the same time in CPUPanoramaLocalDiskTask,
+// each thread has its own render sharing the maps and weights with the others.
+// Read when the task is initialized. Default value is 1.
+void setCPUPanoramaLocalDiskTaskNumProcThreads(int numThreads);
+
+// If enabled, CPUPanoramaLocalDiskTask stabilizes the stitched video with StreamStabilizer
+// before encoding, each frame is written lookahead frames after it is stitched.
+// Read when the task is initialized. Disabled by default.
+void setCPUPanoramaLocalDiskTaskStabilize(bool stabilize, int lookahead = 15);
+
+// Largest number of frames the video frame pool of each source of the live stream tasks allocates.
+// At the capacity getting a frame waits waitMilliseconds for encode or preview to release one,
+// and is retried until it succeeds or the task ends. About 76 frames, the camera frame buffer
+// and two synced frame queues, are enough while the consumers keep up.
+// Read when the source is opened. Default capacity is 0, the pools grow on demand.
+void setLiveStreamVideoFramePoolCapacity(int capacity, int waitMilliseconds = 1000);
+
 typedef void(*PanoTaskLogCallbackFunc)(const char*, va_list);
 
 PanoTaskLogCallbackFunc setPanoTaskLogCallback(PanoTaskLogCallbackFunc func);
@@ -346,6 +371,12 @@ public:
     bool calcExposures(std::vector<double>& exposures);
     bool setExposures(const std::vector<double>& exposures);
     void resetExposures();
+    // Keeps estimating exposures, and white balance if whiteBalance is true, in a background thread
+    // from one frame set in frameInterval while stitching, every new estimate is applied to the
+    // following frames. While running, it takes precedence over the exposures given by
+    // calcExposures and setExposures. It is stopped by stopAutoExposures or stopVideoStitch.
+    bool beginAutoExposures(bool whiteBalance = false, int frameInterval = 30);
+    void stopAutoExposures();
 
     double getVideoSourceFrameRate() const;
     double getStitchFrameRate() const;
@@ -1,9 +1,13 @@
 #pragma once
 
 #include "opencv2/core/cuda.hpp"
+#include "FreeListPool.h"
 #include <vector>
 #include <mutex>
 
+// cv::cuda::HostMem frees its page locked buffer itself when the last reference is released
+// and offers no hook to hand the buffer back, so this pool cannot be built on FreeListPool
+// and looks for a buffer whose reference count shows that only the pool holds it.
 class PinnedMemoryPool
 {
 public:
@@ -264,11 +268,69 @@ private:
 };
 #endif
 
+// Allocator of the cv::Mat handed out by CPUMemoryPool. A handed out Mat refers to the buffer
+// of a pooled Mat, which it holds in the user data of its UMatData together with the release
+// function of the pool. When the last copy of the handed out Mat is released, deallocate
+// calls the release function instead of freeing the buffer.
+class PooledMatAllocator : public cv::MatAllocator
+{
+public:
+    static const PooledMatAllocator* instance()
+    {
+        static PooledMatAllocator allocator;
+        return &allocator;
+    }
+
+    void share(const cv::Mat& pooled, const std::function<void ()>& release, cv::Mat& shared) const
+    {
+        cv::UMatData* u = new cv::UMatData(this);
+        u->data = u->origdata = pooled.data;
+        u->size = pooled.step[0] * pooled.rows;
+        u->refcount = 1;
+        u->userdata = new Holder(pooled, release);
+        shared = cv::Mat(pooled.rows, pooled.cols, pooled.type(), pooled.data, pooled.step[0]);
+        shared.u = u;
+    }
+
+    // Handed out Mats keep the standard allocator for new buffers, a create call
+    // with another size or type releases the pooled buffer and allocates as usual.
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+        int flags, cv::UMatUsageFlags usageFlags) const
+    {
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    bool allocate(cv::UMatData* u, int accessFlags, cv::UMatUsageFlags usageFlags) const
+    {
+        return u != 0;
+    }
+
+    void deallocate(cv::UMatData* u) const
+    {
+        if (!u)
+            return;
+        Holder* holder = (Holder*)u->userdata;
+        delete u;
+        holder->release();
+        delete holder;
+    }
+
+private:
+    struct Holder
+    {
+        Holder(const cv::Mat& pooled_, const std::function<void ()>& release_)
+            : pooled(pooled_), release(release_)
+        {
+        }
+        cv::Mat pooled;
+        std::function<void ()> release;
+    };
+};
+
 class CPUMemoryPool
 {
 public:
-    CPUMemoryPool() :
-        rows(0), cols(0), type(0), hasInit(0)
+    CPUMemoryPool()
     {
     }
 
@@ -276,8 +338,6 @@ public:
     {
         clear();
 
-        std::lock_guard<std::mutex> lock(mtx);
-
         cv::Mat test;
         try
         {
@@ -290,61 +350,41 @@ public:
         if (!test.data)
             return false;
 
-        rows = rows_;
-        cols = cols_;
-        type = type_;
-
-        hasInit = 1;
+        pool.init([rows_, cols_, type_](cv::Mat& mem)
+        {
+            mem.create(rows_, cols_, type_);
+            return mem.data != 0;
+        }, share);
         return true;
     }
 
     void clear()
     {
-        std::lock_guard<std::mutex> lock(mtx);
         pool.clear();
     }
 
-    bool get(cv::Mat& mem)
+    // Limits the number of buffers, see FreeListPool.
+    void setCapacity(int capacity, int waitMilliseconds = FreeListPool<cv::Mat>::DEFAULT_WAIT_MILLISECONDS)
     {
-        std::lock_guard<std::mutex> lock(mtx);
-        if (!hasInit)
-        {
-            mem = cv::Mat();
-            return false;
-        }
-
-        int size = pool.size();
-        int index = -1;
-        for (int i = 0; i < size; i++)
-        {
-            if (pool[i].u && pool[i].u->refcount == 1)
-            {
-                index = i;
-                break;
-            }
-        }
-        if (index >= 0)
-        {
-            mem = pool[index];
-            return true;
-        }
+        pool.setCapacity(capacity, waitMilliseconds);
+    }
 
-        cv::Mat newMem(rows, cols, type);
-        if (!newMem.data)
-        {
-            mem = cv::Mat();
-            return false;
-        }
+    bool get(cv::Mat& mem)
+    {
+        return pool.get(mem);
+    }
 
-        mem = newMem;
-        pool.push_back(newMem);
-        return true;
+    FreeListPoolStatistics getStatistics()
+    {
+        return pool.getStatistics();
     }
 private:
-    int rows, cols, type;
-    std::vector<cv::Mat> pool;
-    std::mutex mtx;
-    int hasInit;
+    static void share(const cv::Mat& pooled, const std::function<void ()>& release, cv::Mat& shared)
+    {
+        PooledMatAllocator::instance()->share(pooled, release, shared);
+    }
+
+    FreeListPool<cv::Mat> pool;
 };
 
 #include "CompileControl.h"
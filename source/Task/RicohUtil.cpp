@@ -1412,6 +1412,31 @@ void setCPUMultibandBlendMultiThread(bool multiThread)
     cpuMultibandBlendMT = multiThread;
 }
 
+static int cpuMultibandBlend16Bit = 0;
+
+void setCPUMultibandBlend16Bit(bool use16Bit)
+{
+    cpuMultibandBlend16Bit = use16Bit;
+}
+
+static int cpuLinearBlendFused = 1;
+
+void setCPULinearBlendFused(bool fused)
+{
+    cpuLinearBlendFused = fused;
+}
+
+static MultibandBlendBase* createCPUMultibandBlender()
+{
+    // The 16 bit pyramids are only implemented by TilingMultibandBlendFastParallel.
+    if (cpuMultibandBlend16Bit)
+        return new TilingMultibandBlendFastParallel(true);
+    else if (cpuMultibandBlendMT)
+        return new TilingMultibandBlendFastParallel;
+    else
+        return new TilingMultibandBlendFast;
+}
+
 bool CPUPanoramaRender::prepare(const std::string& path_, int highQualityBlend_, int blendParam_, 
     const cv::Size& srcSize_, const cv::Size& dstSize_)
 {
@@ -1448,13 +1473,13 @@ bool CPUPanoramaRender::prepare(const std::string& path_, int highQualityBlend_,
     {
         numImages = params.size();
         std::vector<cv::Mat> masks;
-        getReprojectMapsAndMasks(params, srcSize, dstSize, maps, masks);
+        getReprojectMapsCompactAndMasks(params, srcSize, dstSize, maps, masks);
+        getReprojectRowSpans(masks, spans);
         if (highQualityBlend)
         {
-            if (cpuMultibandBlendMT)
-                mbBlender.reset(new TilingMultibandBlendFastParallel);
-            else
-                mbBlender.reset(new TilingMultibandBlendFast);
+            blendParam = blendParam_;
+            blendMasks = masks;
+            mbBlender.reset(createCPUMultibandBlender());
             if (!mbBlender->prepare(masks, blendParam_, MIN_SIDE_LENGTH))
             {
                 ztool::lprintf("Error in %s, multiband blend prepare failed\n", __FUNCTION__);
@@ -1478,6 +1503,52 @@ bool CPUPanoramaRender::prepare(const std::string& path_, int highQualityBlend_,
     return true;
 }
 
+bool CPUPanoramaRender::prepareShared(const CPUPanoramaRender& other)
+{
+    clear();
+
+    success = 0;
+
+    if (!other.success)
+    {
+        ztool::lprintf("Error in %s, other render has not prepared or prepare failed before\n", __FUNCTION__);
+        return false;
+    }
+
+    srcSize = other.srcSize;
+    dstSize = other.dstSize;
+    maps = other.maps;
+    spans = other.spans;
+    weights = other.weights;
+    numImages = other.numImages;
+    highQualityBlend = other.highQualityBlend;
+
+    try
+    {
+        if (highQualityBlend)
+        {
+            blendParam = other.blendParam;
+            blendMasks = other.blendMasks;
+            mbBlender.reset(createCPUMultibandBlender());
+            if (!mbBlender->prepare(blendMasks, blendParam, MIN_SIDE_LENGTH))
+            {
+                ztool::lprintf("Error in %s, multiband blend prepare failed\n", __FUNCTION__);
+                return false;
+            }
+        }
+        else
+            accum.create(dstSize, CV_32FC3);
+    }
+    catch (std::exception& e)
+    {
+        ztool::lprintf("Error in %s, exception caught: %s\n", __FUNCTION__, e.what());
+        return false;
+    }
+
+    success = 1;
+    return true;
+}
+
 bool CPUPanoramaRender::render(const std::vector<cv::Mat>& src, cv::Mat& dst,
     const std::vector<std::vector<std::vector<unsigned char> > >& luts)
 {
@@ -1540,7 +1611,19 @@ bool CPUPanoramaRender::render(const std::vector<cv::Mat>& src, cv::Mat& dst,
 
     try
     {
-        if (!highQualityBlend)
+        if (!highQualityBlend && cpuLinearBlendFused)
+        {
+            if (correct)
+            {
+                correctImages.resize(numImages);
+                for (int i = 0; i < numImages; i++)
+                    transform(src[i], correctImages[i], luts[i]);
+                reprojectWeightedBlendParallel(correctImages, dst, maps, weights, spans);
+            }
+            else
+                reprojectWeightedBlendParallel(src, dst, maps, weights, spans);
+        }
+        else if (!highQualityBlend)
         {
             accum.setTo(0);
             if (correct)
@@ -1548,13 +1631,13 @@ bool CPUPanoramaRender::render(const std::vector<cv::Mat>& src, cv::Mat& dst,
                 for (int i = 0; i < numImages; i++)
                 {
                     transform(src[i], correctImage, luts[i]);
-                    reprojectWeightedAccumulateParallelTo32F(correctImage, accum, maps[i], weights[i]);
+                    reprojectWeightedAccumulateParallelTo32F(correctImage, accum, maps[i], weights[i], spans[i]);
                 }
             }
             else
             {
                 for (int i = 0; i < numImages; i++)
-                    reprojectWeightedAccumulateParallelTo32F(src[i], accum, maps[i], weights[i]);
+                    reprojectWeightedAccumulateParallelTo32F(src[i], accum, maps[i], weights[i], spans[i]);
             }
             accum.convertTo(dst, CV_8U);
         }
@@ -1566,13 +1649,13 @@ bool CPUPanoramaRender::render(const std::vector<cv::Mat>& src, cv::Mat& dst,
                 for (int i = 0; i < numImages; i++)
                 {
                     transform(src[i], correctImage, luts[i]);
-                    reprojectParallelTo16S(correctImage, reprojImages[i], maps[i]);
+                    reprojectParallelTo16S(correctImage, reprojImages[i], maps[i], spans[i]);
                 }
             }
             else
             {
                 for (int i = 0; i < numImages; i++)
-                    reprojectParallelTo16S(src[i], reprojImages[i], maps[i]);
+                    reprojectParallelTo16S(src[i], reprojImages[i], maps[i], spans[i]);
             }
             mbBlender->blend(reprojImages, dst);
         }
@@ -1589,14 +1672,18 @@ bool CPUPanoramaRender::render(const std::vector<cv::Mat>& src, cv::Mat& dst,
 void CPUPanoramaRender::clear()
 {
     maps.clear();
+    spans.clear();
     reprojImages.clear();
     mbBlender.reset();
+    blendMasks.clear();
     weights.clear();
     correctImage.release();
+    correctImages.clear();
     accum.release();
     success = 0;
     numImages = 0;
     highQualityBlend = 0;
+    blendParam = 0;
 }
 
 int CPUPanoramaRender::getNumImages() const
@@ -2029,8 +2116,7 @@ int IOclPanoramaRender::getNumImages() const
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
 #if COMPILE_DISCRETE_OPENCL
-#include "OpenCLAccel/CompileControl.h"
-#include "OpenCLAccel/ProgramSourceStrings.h"
+#include "DiscreteOpenCL/RunTimeObjects.h"
 
 bool DOclPanoramaRender::prepare(const std::string& path_, int highQualityBlend_, int blendParam_,
     const cv::Size& srcSize_, const cv::Size& dstSize_)
@@ -2043,6 +2129,11 @@ bool DOclPanoramaRender::prepare(const std::string& path_, int highQualityBlend_
         return false;
     }
 
+    // Kernels build in the background while the maps are computed,
+    // the guard joins the build threads on the early returns
+    docl::prewarm(highQualityBlend_ ? docl::KERNEL_SET_MULTIBAND_BLEND : docl::KERNEL_SET_LINEAR_BLEND);
+    docl::PrewarmGuard prewarmGuard;
+
     success = 0;
 
     if (!((dstSize_.width & 1) == 0 && (dstSize_.height & 1) == 0 &&
@@ -2077,6 +2168,20 @@ bool DOclPanoramaRender::prepare(const std::string& path_, int highQualityBlend_
             xmaps[i].upload(xmapsCpu[i]);
             ymaps[i].upload(ymapsCpu[i]);
         }
+        if (!docl::waitPrewarm())
+        {
+            ztool::lprintf("Error in %s, build opencl kernels failed\n", __FUNCTION__);
+            return false;
+        }
+        // Logs every kernel built so far, the ones prewarmed here and by the caller included
+        std::vector<docl::KernelBuildInfo> buildInfos;
+        docl::getKernelBuildInfos(buildInfos);
+        for (int i = 0; i < (int)buildInfos.size(); i++)
+        {
+            if (buildInfos[i].built)
+                ztool::lprintf("Info in %s, kernel %s built in %f seconds\n", __FUNCTION__, 
+                    buildInfos[i].name.c_str(), buildInfos[i].buildTime);
+        }
         if (highQualityBlend)
         {
             if (!mbBlender.prepare(masks, blendParam_, MIN_SIDE_LENGTH))
@@ -2089,9 +2194,7 @@ bool DOclPanoramaRender::prepare(const std::string& path_, int highQualityBlend_
             queues.resize(numImages);
             for (int i = 0; i < numImages; i++)
             {
-                reprojKernels[i].reset(new OpenCLProgramOneKernel(*docl::ocl, 
-                    PROG_FILE_NAME(L"ReprojectLinearTemplate.txt"), PROG_STRING(sourceReprojectLinearTemplate), 
-                    "reprojectLinearKernel", "-D DST_TYPE=short"));
+                reprojKernels[i].reset(docl::reprojectTo16S.createInstance());
                 queues[i].reset(new OpenCLQueue(*docl::ocl));
             }
         }
@@ -2109,9 +2212,7 @@ bool DOclPanoramaRender::prepare(const std::string& path_, int highQualityBlend_
             queues.resize(numImages);
             for (int i = 0; i < numImages; i++)
             {
-                reprojKernels[i].reset(new OpenCLProgramOneKernel(*docl::ocl, 
-                    PROG_FILE_NAME(L"ReprojectWeightedAccumulate.txt"), PROG_STRING(sourceReprojectWeightedAccumulate), 
-                    "reprojectWeightedAccumulateTo32FKernel"));
+                reprojKernels[i].reset(docl::reprojectWeightedAccumulateTo32F.createInstance());
                 queues[i].reset(new OpenCLQueue(*docl::ocl));
             }
         }
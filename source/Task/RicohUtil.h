@@ -237,10 +237,14 @@ public:
 class CPUPanoramaRender
 {
 public:
-    CPUPanoramaRender() : success(0), highQualityBlend(0), numImages(0) {};
+    CPUPanoramaRender() : success(0), highQualityBlend(0), blendParam(0), numImages(0) {};
     virtual ~CPUPanoramaRender() { };
     virtual bool prepare(const std::string& path, int highQualityBlend, int blendParam, 
         const cv::Size& srcSize, const cv::Size& dstSize);
+    // Prepares from another prepared render of the same type, the maps, row spans and weights
+    // are shared read only, the blender and the buffers are this render's own,
+    // so that the two renders can render in different threads at the same time.
+    virtual bool prepareShared(const CPUPanoramaRender& other);
     virtual bool render(const std::vector<cv::Mat>& src, cv::Mat& dst,
         const std::vector<std::vector<std::vector<unsigned char> > >& luts =
         std::vector<std::vector<std::vector<unsigned char> > >());
@@ -249,11 +253,15 @@ public:
 protected:
     cv::Size srcSize, dstSize;
     std::vector<cv::Mat> maps;
+    std::vector<ReprojectRowSpans> spans;
     std::vector<cv::Mat> reprojImages;
     int highQualityBlend;
+    int blendParam;
+    std::vector<cv::Mat> blendMasks;
     std::unique_ptr<MultibandBlendBase> mbBlender;
     std::vector<cv::Mat> weights;
     cv::Mat correctImage;
+    std::vector<cv::Mat> correctImages;
     cv::Mat accum;
     int numImages;
     int success;
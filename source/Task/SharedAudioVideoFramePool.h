@@ -1,160 +1,91 @@
 #pragma once
 
 #include "AudioVideoProcessor.h"
-#include <vector>
-#include <memory>
-#include <mutex>
+#include "FreeListPool.h"
 
 class AudioVideoFramePool
 {
 public:
 
-    AudioVideoFramePool() :
-        hasInit(0)
+    AudioVideoFramePool()
     {}
 
     void clear()
     {
-        std::lock_guard<std::mutex> lock(mtx);
-        pool.clear();
-        deep = avp::AudioVideoFrame2();
-        hasInit = 0;
+        pool.reset();
     }
 
     bool initAsAudioFramePool(int sampleType, int numChannels, int channelLayout, int numSamples)
     {
         clear();
 
-        std::lock_guard<std::mutex> lock(mtx);
-
+        avp::AudioVideoFrame2 deep;
         deep.create(sampleType, numChannels, channelLayout, numSamples, -1LL, -1);
+        if (!deep.data[0])
+            return false;
 
-        if (deep.data[0])
-        {
-            hasInit = 1;
-            return true;
-        }
-        else
+        pool.init([sampleType, numChannels, channelLayout, numSamples](avp::AudioVideoFrame2& frame)
         {
-            clear();
-            return false;
-        }
+            frame.create(sampleType, numChannels, channelLayout, numSamples, -1LL, -1);
+            return frame.data[0] != 0;
+        }, share);
+        return true;
     }
 
     bool initAsVideoFramePool(int pixelType, int width, int height)
     {
         clear();
 
-        std::lock_guard<std::mutex> lock(mtx);
-
+        avp::AudioVideoFrame2 deep;
         deep.create(pixelType, width, height, -1LL, -1);
+        if (!deep.data[0])
+            return false;
 
-        if (deep.data[0])
+        pool.init([pixelType, width, height](avp::AudioVideoFrame2& frame)
         {
-            hasInit = 1;
-            return true;
-        }
-        else
-        {
-            clear();
-            return false;
-        }
+            frame.create(pixelType, width, height, -1LL, -1);
+            return frame.data[0] != 0;
+        }, share);
+        return true;
     }
 
-    bool get(avp::AudioVideoFrame2& frame)
+    // Limits the number of frames, see FreeListPool.
+    void setCapacity(int capacity, int waitMilliseconds = FreeListPool<avp::AudioVideoFrame2>::DEFAULT_WAIT_MILLISECONDS)
     {
-        std::lock_guard<std::mutex> lock(mtx);
-        if (!hasInit)
-        {
-            frame = avp::AudioVideoFrame2();
-            return false;
-        }
-
-        int size = pool.size();
-        int index = -1;
-        for (int i = 0; i < size; i++)
-        {
-            if (pool[i].sdata.use_count() == 1)
-            {
-                index = i;
-                break;
-            }
-        }
-        if (index >= 0)
-        {
-            frame = pool[index];
-            return true;
-        }
-
-        avp::AudioVideoFrame2 newFrame;
-        if (deep.mediaType == avp::AUDIO)
-            newFrame.create(deep.sampleType, deep.numChannels, deep.channelLayout, deep.numSamples, -1LL, -1);
-        else
-            newFrame.create(deep.pixelType, deep.width, deep.height, -1LL, -1);
-
-        if (!newFrame.data[0])
-        {
-            frame = avp::AudioVideoFrame2();
-            return false;
-        }
+        pool.setCapacity(capacity, waitMilliseconds);
+    }
 
-        frame = newFrame;
-        pool.push_back(newFrame);
-        return true;
+    bool get(avp::AudioVideoFrame2& frame)
+    {
+        return pool.get(frame);
     }
 
     void shrink(int minSize)
     {
-        std::lock_guard<std::mutex> lock(mtx);
-        if (!hasInit)
-            return;
-
-        int size = pool.size();
-        if (size < minSize)
-            return;
-
-        int numNotInUse = 0;        
-        for (int i = 0; i < size; i++)
-        {
-            if (pool[i].sdata.use_count() == 1)
-                numNotInUse++;
-        }
-        if (numNotInUse == 0)
-            return;
-
-        int numInUse = size - numNotInUse;
-        int numDelete = 0;
-        if (numInUse >= minSize)
-            numDelete = numNotInUse;
-        else
-            numDelete = size - minSize;
-        if (numDelete == 0)
-            return;
-
-        std::vector<avp::AudioVideoFrame2>::iterator itr = pool.begin();
-        for (; itr != pool.end();)
-        {
-            if (itr->sdata.use_count() == 1)
-            {
-                itr = pool.erase(itr);
-                numDelete--;
-                if (numDelete == 0)
-                    return;
-            }
-            else
-                ++itr;
-        }
+        pool.shrink(minSize);
     }
 
     int size()
     {
-        std::lock_guard<std::mutex> lock(mtx);
         return pool.size();
     }
 
+    FreeListPoolStatistics getStatistics()
+    {
+        return pool.getStatistics();
+    }
+
 private:
-    avp::AudioVideoFrame2 deep;
-    std::vector<avp::AudioVideoFrame2> pool;
-    std::mutex mtx;
-    int hasInit;
+    // The shared frame is a shallow copy of the pooled frame whose sdata refers to the same
+    // buffer through a deleter that calls release, and keeps the buffer alive until then.
+    static void share(const avp::AudioVideoFrame2& pooled, const std::function<void ()>& release,
+        avp::AudioVideoFrame2& shared)
+    {
+        typedef decltype(pooled.sdata) SharedData;
+        SharedData buffer = pooled.sdata;
+        shared = pooled;
+        shared.sdata = SharedData(buffer.get(), [buffer, release](SharedData::element_type*) { release(); });
+    }
+
+    FreeListPool<avp::AudioVideoFrame2> pool;
 };
\ No newline at end of file
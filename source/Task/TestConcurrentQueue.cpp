@@ -0,0 +1,130 @@
+#include "ConcurrentQueue.h"
+#include "Timer.h"
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+typedef std::shared_ptr<long long int> Item;
+
+// Pushes numItems increasing values from every producer and checks that every consumer
+// receives the values of each producer in increasing order and that nothing is lost.
+template<typename QueueType>
+static bool testComplete(const char* name, int numProducers, int numConsumers, int numItems)
+{
+    QueueType queue;
+    queue.setMaxSize(8);
+    std::vector<long long int> sums(numConsumers, 0);
+    std::vector<int> orderOK(numConsumers, 1);
+    ztool::Timer timer;
+    std::vector<std::unique_ptr<std::thread> > consumers(numConsumers), producers(numProducers);
+    for (int i = 0; i < numConsumers; i++)
+    {
+        consumers[i].reset(new std::thread([&, i]
+        {
+            std::vector<long long int> last(numProducers, -1);
+            Item item;
+            while (queue.pull(item))
+            {
+                int producer = int(*item % numProducers);
+                long long int value = *item / numProducers;
+                if (value <= last[producer])
+                    orderOK[i] = 0;
+                last[producer] = value;
+                sums[i] += value;
+            }
+        }));
+    }
+    for (int i = 0; i < numProducers; i++)
+    {
+        producers[i].reset(new std::thread([&, i]
+        {
+            for (int j = 0; j < numItems; j++)
+                queue.push(Item(new long long int(j * (long long int)numProducers + i)));
+        }));
+    }
+    for (int i = 0; i < numProducers; i++)
+        producers[i]->join();
+    while (queue.size())
+        std::this_thread::sleep_for(std::chrono::microseconds(25));
+    queue.stop();
+    for (int i = 0; i < numConsumers; i++)
+        consumers[i]->join();
+    timer.end();
+
+    long long int sum = 0;
+    bool ok = true;
+    for (int i = 0; i < numConsumers; i++)
+    {
+        sum += sums[i];
+        ok = ok && orderOK[i];
+    }
+    ok = ok && sum == (long long int)numProducers * numItems * (numItems - 1) / 2;
+    printf("%s, %d producers %d consumers: time %f, %s\n", name, numProducers, numConsumers, timer.elapse(), ok ? "passed" : "FAILED");
+    return ok;
+}
+
+// Drop oldest queues should keep the latest maxSize items, and pulled items
+// should not be referenced by the queue any more.
+template<typename QueueType>
+static bool testDropOldest(const char* name)
+{
+    QueueType queue;
+    queue.setMaxSize(5);
+    Item kept(new long long int(-1));
+    queue.push(kept);
+    for (int i = 0; i < 20; i++)
+        queue.push(Item(new long long int(i)));
+    bool ok = queue.size() == 5 && kept.use_count() == 1;
+    Item item;
+    for (int i = 15; i < 20; i++)
+        ok = ok && queue.pull(item) && *item == i && item.use_count() == 1;
+    ok = ok && queue.size() == 0;
+    printf("%s drop oldest: %s\n", name, ok ? "passed" : "FAILED");
+    return ok;
+}
+
+// stop should wake up a thread waiting in pull.
+template<typename QueueType>
+static bool testStop(const char* name)
+{
+    QueueType queue;
+    bool pulled = true;
+    std::thread consumer([&]
+    {
+        Item item;
+        pulled = queue.pull(item);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    queue.stop();
+    consumer.join();
+    queue.resume();
+    queue.push(Item(new long long int(1)));
+    Item item;
+    bool ok = !pulled && queue.pull(item) && *item == 1;
+    printf("%s stop: %s\n", name, ok ? "passed" : "FAILED");
+    return ok;
+}
+
+int main()
+{
+    const int numItems = 200000;
+    bool ok = true;
+    ok &= testComplete<BoundedCompleteQueue<Item> >("BoundedCompleteQueue", 1, 1, numItems);
+    ok &= testComplete<LockFreeBoundedCompleteQueue<Item, SPSCRingBuffer<Item> > >("LockFreeBoundedCompleteQueue SPSC", 1, 1, numItems);
+    ok &= testComplete<LockFreeBoundedCompleteQueue<Item> >("LockFreeBoundedCompleteQueue MPMC", 1, 1, numItems);
+    ok &= testComplete<BoundedCompleteQueue<Item> >("BoundedCompleteQueue", 4, 1, numItems);
+    ok &= testComplete<LockFreeBoundedCompleteQueue<Item> >("LockFreeBoundedCompleteQueue MPMC", 4, 1, numItems);
+    ok &= testComplete<LockFreeBoundedCompleteQueue<Item> >("LockFreeBoundedCompleteQueue MPMC", 4, 4, numItems);
+
+    ok &= testDropOldest<ForceWaitRealTimeQueue<Item> >("ForceWaitRealTimeQueue");
+    ok &= testDropOldest<LockFreeForceWaitRealTimeQueue<Item> >("LockFreeForceWaitRealTimeQueue");
+    ok &= testDropOldest<LockFreeRealTimeQueue<Item> >("LockFreeRealTimeQueue");
+
+    ok &= testStop<ForceWaitRealTimeQueue<Item> >("ForceWaitRealTimeQueue");
+    ok &= testStop<LockFreeForceWaitRealTimeQueue<Item> >("LockFreeForceWaitRealTimeQueue");
+    ok &= testStop<LockFreeBoundedCompleteQueue<Item, SPSCRingBuffer<Item> > >("LockFreeBoundedCompleteQueue SPSC");
+
+    printf(ok ? "All passed\n" : "Failed\n");
+    return ok ? 0 : 1;
+}
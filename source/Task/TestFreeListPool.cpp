@@ -0,0 +1,120 @@
+#include "FreeListPool.h"
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <deque>
+#include <chrono>
+
+typedef std::shared_ptr<int> Item;
+
+// The shared item aliases the pooled int and calls release when its last copy is dropped.
+static void initPool(FreeListPool<Item>& pool)
+{
+    pool.init([](Item& item) { item.reset(new int(0)); return true; },
+        [](const Item& pooled, const std::function<void ()>& release, Item& shared)
+        {
+            shared = Item(pooled.get(), [pooled, release](int*) { release(); });
+        });
+}
+
+// Items released in the order they are got are recycled, the pool stays as large
+// as the number of items held at the same time.
+static bool testRecycle()
+{
+    FreeListPool<Item> pool;
+    initPool(pool);
+    std::deque<Item> held;
+    bool ok = true;
+    for (int i = 0; i < 1000; i++)
+    {
+        Item item;
+        ok &= pool.get(item);
+        held.push_back(item);
+        if (held.size() > 4)
+            held.pop_front();
+    }
+    held.clear();
+    FreeListPoolStatistics stats = pool.getStatistics();
+    printf("recycle: %d items, %d in use, max %d, %d waits, %d timeouts\n",
+        stats.numItems, stats.numInUse, stats.maxNumItems, stats.numWaits, stats.numTimeouts);
+    return ok && stats.numItems == 5 && stats.maxNumItems == 5 && stats.numInUse == 0 &&
+        stats.numWaits == 0 && stats.numTimeouts == 0;
+}
+
+// At the capacity get waits until another thread releases an item.
+static bool testWait()
+{
+    FreeListPool<Item> pool;
+    initPool(pool);
+    pool.setCapacity(2, 2000);
+    Item a, b, c;
+    bool ok = pool.get(a) && pool.get(b);
+    std::thread releaser([&a]
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        a.reset();
+    });
+    ok &= pool.get(c);
+    releaser.join();
+    FreeListPoolStatistics stats = pool.getStatistics();
+    printf("wait: got %d, %d items, max %d, %d waits, %d timeouts\n",
+        ok, stats.numItems, stats.maxNumItems, stats.numWaits, stats.numTimeouts);
+    return ok && c && stats.numItems == 2 && stats.maxNumItems == 2 &&
+        stats.numWaits == 1 && stats.numTimeouts == 0;
+}
+
+// If nothing is released in the wait time get fails, and succeeds again once an item is released.
+// The wait is measured by the clock, it should not last much longer than the wait time.
+static bool testTimeout()
+{
+    FreeListPool<Item> pool;
+    initPool(pool);
+    pool.setCapacity(2, 20);
+    Item a, b, c;
+    bool ok = pool.get(a) && pool.get(b);
+    std::chrono::steady_clock::time_point beg = std::chrono::steady_clock::now();
+    bool gotFull = pool.get(c);
+    int elapse = (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - beg).count();
+    ok &= !gotFull && !c && elapse >= 20 && elapse < 200;
+    b.reset();
+    ok &= pool.get(c);
+    FreeListPoolStatistics stats = pool.getStatistics();
+    printf("timeout: got at capacity %d after %d ms, %d items, max %d, %d waits, %d timeouts\n",
+        gotFull, elapse, stats.numItems, stats.maxNumItems, stats.numWaits, stats.numTimeouts);
+    return ok && stats.numItems == 2 && stats.numWaits == 1 && stats.numTimeouts == 1;
+}
+
+// Items handed out before clear stay valid and are not returned to the pool when released,
+// copies of an item return it only when the last copy is dropped.
+static bool testClear()
+{
+    FreeListPool<Item> pool;
+    initPool(pool);
+    Item a, b;
+    bool ok = pool.get(a) && pool.get(b);
+    *a = 7;
+    Item copy = b;
+    b.reset();
+    FreeListPoolStatistics stats = pool.getStatistics();
+    ok &= stats.numInUse == 2;
+    copy.reset();
+    stats = pool.getStatistics();
+    ok &= stats.numInUse == 1;
+    pool.clear();
+    ok &= *a == 7;
+    a.reset();
+    stats = pool.getStatistics();
+    printf("clear: %d items, %d in use\n", stats.numItems, stats.numInUse);
+    return ok && stats.numItems == 0 && stats.numInUse == 0;
+}
+
+int main()
+{
+    bool ok = true;
+    ok &= testRecycle();
+    ok &= testWait();
+    ok &= testTimeout();
+    ok &= testClear();
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
@@ -44,7 +44,8 @@ int main(int argc, char* argv[])
         "{pano_width             | 2048        | pano picture width}"
         "{pano_height            | 1024        | pano picture height}"
         "{pano_video_name        | panogpu.mp4 | xml param file path}"
-        "{use_cuda               | false       | use gpu to accelerate computation}";
+        "{use_cuda               | false       | use gpu to accelerate computation}"
+        "{num_proc_threads       | 1           | number of cpu stitching threads}";
 
     cv::CommandLineParser parser(argc, argv, keys);
 
@@ -54,6 +55,7 @@ int main(int argc, char* argv[])
     //setPanoTaskLogCallback(bstLogVlPrintf);
     setLanguage(false);
     setCPUMultibandBlendMultiThread(true);
+    setCPUPanoramaLocalDiskTaskNumProcThreads(parser.get<int>("num_proc_threads"));
 
     cv::Size srcSize, dstSize;
     std::vector<std::string> srcVideoNames;
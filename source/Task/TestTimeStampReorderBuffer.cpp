@@ -0,0 +1,173 @@
+#include "TimeStampReorderBuffer.h"
+#include "ConcurrentQueue.h"
+#include "Timer.h"
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+struct Frame
+{
+    long long int timeStamp;
+    int index;
+};
+
+// Runs the decode, proc and encode threads of CPUPanoramaLocalDiskTask on dummy frames.
+// Decode pushes the time stamps before the frames, numProcThreads proc threads take frames
+// with a work time that varies from frame to frame, so they finish out of order,
+// and encode writes through the reorder buffer. Frames whose index is dropIndex never reach encode.
+static bool runPipeline(int numProcThreads, int numFrames, int dropIndex,
+    std::vector<int>& written, int& maxReorderSize, double& elapse)
+{
+    CompleteQueue<long long int> decodeTimeStamps;
+    BoundedCompleteQueue<Frame> decodeFrames(numProcThreads > 2 ? numProcThreads * 2 : 4);
+    BoundedCompleteQueue<Frame> procFrames(numProcThreads > 8 ? numProcThreads * 2 : 16);
+    std::atomic<int> numProcThreadsRunning(numProcThreads);
+    written.clear();
+
+    ztool::Timer timer;
+    std::thread decodeThread([&]
+    {
+        for (int i = 0; i < numFrames; i++)
+        {
+            Frame frame;
+            frame.index = i;
+            frame.timeStamp = i * 40000LL;
+            decodeTimeStamps.push(frame.timeStamp);
+            decodeFrames.push(frame);
+        }
+        while (decodeFrames.size())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        decodeFrames.stop();
+    });
+
+    std::vector<std::unique_ptr<std::thread> > procThreads(numProcThreads);
+    for (int i = 0; i < numProcThreads; i++)
+    {
+        procThreads[i].reset(new std::thread([&]
+        {
+            Frame frame;
+            while (decodeFrames.pull(frame))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1 + frame.index * 7 % 5));
+                if (frame.index != dropIndex)
+                    procFrames.push(frame);
+            }
+            if (--numProcThreadsRunning == 0)
+            {
+                while (procFrames.size())
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                procFrames.stop();
+            }
+        }));
+    }
+
+    bool ok = true;
+    TimeStampReorderBuffer<Frame> reorderFrames;
+    auto pullTimeStamp = [&](long long int& timeStamp) { return decodeTimeStamps.pull(timeStamp); };
+    auto write = [&](Frame& frame) { written.push_back(frame.index); return true; };
+    Frame frame;
+    while (procFrames.pull(frame))
+        ok &= reorderFrames.push(frame.timeStamp, frame, pullTimeStamp, write);
+    ok &= reorderFrames.flush(write);
+    maxReorderSize = reorderFrames.getMaxSize();
+
+    decodeThread.join();
+    for (int i = 0; i < numProcThreads; i++)
+        procThreads[i]->join();
+    timer.end();
+    elapse = timer.elapse();
+    return ok;
+}
+
+static bool isDecodeOrder(const std::vector<int>& written, int numFrames, int dropIndex)
+{
+    std::vector<int> expected;
+    for (int i = 0; i < numFrames; i++)
+    {
+        if (i != dropIndex)
+            expected.push_back(i);
+    }
+    return written == expected;
+}
+
+// Frames come out in decode order whatever the number of proc threads, more threads finish faster.
+static bool testOrder()
+{
+    const int numFrames = 300;
+    const int numThreads[] = { 1, 2, 4, 8 };
+    double singleElapse = 0;
+    bool ok = true;
+    for (int i = 0; i < 4; i++)
+    {
+        std::vector<int> written;
+        int maxReorderSize;
+        double elapse;
+        bool run = runPipeline(numThreads[i], numFrames, -1, written, maxReorderSize, elapse);
+        bool ordered = isDecodeOrder(written, numFrames, -1);
+        if (i == 0)
+            singleElapse = elapse;
+        ok &= run && ordered && (numThreads[i] > 1 || maxReorderSize == 1);
+        printf("order: %d proc threads, %d written, in decode order %d, max reorder frames %d, "
+            "%f s, speedup %.2f\n", numThreads[i], (int)written.size(), ordered, maxReorderSize,
+            elapse, singleElapse / elapse);
+    }
+    return ok;
+}
+
+// A frame that never comes holds the later frames back until flush, which writes them in order.
+static bool testDroppedFrame()
+{
+    const int numFrames = 100, dropIndex = 60;
+    std::vector<int> written;
+    int maxReorderSize;
+    double elapse;
+    bool run = runPipeline(4, numFrames, dropIndex, written, maxReorderSize, elapse);
+    bool ordered = isDecodeOrder(written, numFrames, dropIndex);
+    bool ok = run && ordered && maxReorderSize >= numFrames - dropIndex - 1;
+    printf("dropped frame: %d written, in decode order %d, max reorder frames %d, %s\n",
+        (int)written.size(), ordered, maxReorderSize, ok ? "ok" : "wrong");
+    return ok;
+}
+
+// A failed write is reported and the failed frame is not written again.
+static bool testWriteFail()
+{
+    TimeStampReorderBuffer<Frame> reorderFrames;
+    CompleteQueue<long long int> timeStamps;
+    for (int i = 0; i < 4; i++)
+        timeStamps.push(i);
+    std::vector<int> written;
+    auto pullTimeStamp = [&](long long int& timeStamp) { return timeStamps.pull(timeStamp); };
+    auto write = [&](Frame& frame) { written.push_back(frame.index); return frame.index != 1; };
+    Frame frames[4];
+    for (int i = 0; i < 4; i++)
+    {
+        frames[i].index = i;
+        frames[i].timeStamp = i;
+    }
+    bool ok = reorderFrames.push(2, frames[2], pullTimeStamp, write);
+    ok &= reorderFrames.push(1, frames[1], pullTimeStamp, write);
+    ok &= reorderFrames.push(0, frames[0], pullTimeStamp, write);
+    bool failed = !ok;
+    ok = reorderFrames.push(3, frames[3], pullTimeStamp, write);
+    std::vector<int> expected;
+    expected.push_back(0);
+    expected.push_back(1);
+    expected.push_back(2);
+    expected.push_back(3);
+    ok &= failed && written == expected && reorderFrames.size() == 0;
+    printf("write fail: reported %d, %d written, %s\n", failed, (int)written.size(), ok ? "ok" : "wrong");
+    return ok;
+}
+
+int main()
+{
+    bool ok = true;
+    ok &= testOrder();
+    ok &= testDroppedFrame();
+    ok &= testWriteFail();
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
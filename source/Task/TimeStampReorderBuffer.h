@@ -0,0 +1,82 @@
+#pragma once
+
+#include <functional>
+#include <map>
+
+// Puts frames finished by several proc threads back into decode order before they are written.
+// Decode pushes the time stamp of every frame to a queue before the frame is processed,
+// push keeps a frame until the frames of all the time stamps pulled before its own are written.
+// The time stamp of a kept frame has been pushed already, so pulling the next one does not block.
+// Not thread safe, only the encode thread should use it.
+template<typename FrameType>
+class TimeStampReorderBuffer
+{
+public:
+    typedef std::function<bool (long long int&)> PullTimeStampFunction;
+    typedef std::function<bool (FrameType&)> WriteFunction;
+
+    TimeStampReorderBuffer() : nextTimeStamp(0), hasNextTimeStamp(false), maxSize(0)
+    {
+    }
+
+    // Keeps frame, then writes the kept frames as long as the next time stamp is among them.
+    // If pullTimeStamp fails the frames stay for flush. Returns false if write fails,
+    // the failed frame is dropped.
+    bool push(long long int timeStamp, const FrameType& frame,
+        const PullTimeStampFunction& pullTimeStamp, const WriteFunction& write)
+    {
+        frames.insert(std::make_pair(timeStamp, frame));
+        if (int(frames.size()) > maxSize)
+            maxSize = frames.size();
+        while (!frames.empty())
+        {
+            if (!hasNextTimeStamp)
+                hasNextTimeStamp = pullTimeStamp(nextTimeStamp);
+            typename FrameMap::iterator itr = frames.find(nextTimeStamp);
+            if (!hasNextTimeStamp || itr == frames.end())
+                break;
+            bool ok = write(itr->second);
+            frames.erase(itr);
+            hasNextTimeStamp = false;
+            if (!ok)
+                return false;
+        }
+        return true;
+    }
+
+    // Writes the frames whose predecessors never came in time stamp order.
+    bool flush(const WriteFunction& write)
+    {
+        bool ok = true;
+        for (typename FrameMap::iterator itr = frames.begin(); ok && itr != frames.end(); ++itr)
+            ok = write(itr->second);
+        frames.clear();
+        return ok;
+    }
+
+    void clear()
+    {
+        frames.clear();
+        nextTimeStamp = 0;
+        hasNextTimeStamp = false;
+        maxSize = 0;
+    }
+
+    int size() const
+    {
+        return frames.size();
+    }
+
+    // Largest number of frames kept at the same time since construction or clear
+    int getMaxSize() const
+    {
+        return maxSize;
+    }
+
+private:
+    typedef std::multimap<long long int, FrameType> FrameMap;
+    FrameMap frames;
+    long long int nextTimeStamp;
+    bool hasNextTimeStamp;
+    int maxSize;
+};
@@ -0,0 +1,205 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+namespace ztool
+{
+
+// RANSAC shared by the estimators, the model specific part is a Problem class providing
+//     typedef ... Model;
+//     enum { NUM_MODEL_POINTS = ... };
+//     int size() const;
+//     // Fits a model to the points of indexes, which holds NUM_MODEL_POINTS distinct indexes.
+//     // Returns false if the sample is degenerate.
+//     bool fit(const int* indexes, Model& model) const;
+//     // Number of the points in [beg, end) whose error is less than thresh.
+//     int countInliers(const Model& model, int beg, int end, double thresh) const;
+//     // Sets mask[i] to 255 for inliers and 0 for outliers, returns the number of inliers.
+//     int getInliers(const Model& model, double thresh, unsigned char* mask) const;
+// The problem should keep its points in separate arrays for each coordinate,
+// so that countInliers runs over contiguous memory.
+//
+// Hypotheses are evaluated in batches of BATCH_SIZE, in parallel if there are enough points.
+// A hypothesis is scored block by block and dropped as soon as it can no longer beat
+// the best hypothesis of the previous batches, which gives the same result as scoring all the points.
+// Samples are drawn from seed and the iteration index only, so the result does not depend
+// on the number of threads and is the same for the same seed.
+
+struct RansacParam
+{
+    RansacParam(double thresh_ = 1, double confidence_ = 0.99, int numMaxIters_ = 1000)
+        : thresh(thresh_), confidence(confidence_), numMaxIters(numMaxIters_),
+        seed(0x5DEECE66DULL), parallel(true)
+    {}
+
+    double thresh;
+    double confidence;
+    int numMaxIters;
+    unsigned long long seed;
+    bool parallel;
+};
+
+inline int updateRansacNumIters(double p, double ep, int modelPoints, int maxIters)
+{
+    CV_Assert(modelPoints > 0);
+
+    p = std::max(p, 0.);
+    p = std::min(p, 1.);
+    ep = std::max(ep, 0.);
+    ep = std::min(ep, 1.);
+
+    // avoid inf's & nan's
+    double num = std::max(1. - p, DBL_MIN);
+    double denom = 1. - pow(1. - ep, modelPoints);
+    if (denom < DBL_MIN)
+        return 0;
+
+    num = log(num);
+    denom = log(denom);
+
+    return denom >= 0 || -num >= maxIters*(-denom) ?
+        maxIters : cvRound(num / denom);
+}
+
+namespace detail
+{
+
+// splitmix64, cheap to seed for every iteration
+inline unsigned long long ransacNextRandom(unsigned long long& state)
+{
+    unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+inline void ransacSample(unsigned long long seed, int iter, int size, int count, int* indexes)
+{
+    unsigned long long state = seed ^ ((unsigned long long)iter * 0xD1B54A32D192ED03ULL);
+    for (int i = 0; i < count; i++)
+    {
+        bool repeated;
+        do
+        {
+            indexes[i] = (int)(ransacNextRandom(state) % (unsigned long long)size);
+            repeated = false;
+            for (int j = 0; j < i; j++)
+            {
+                if (indexes[j] == indexes[i])
+                {
+                    repeated = true;
+                    break;
+                }
+            }
+        } while (repeated);
+    }
+}
+
+template<typename Problem>
+class RansacBatchLoop : public cv::ParallelLoopBody
+{
+public:
+    enum { BLOCK_SIZE = 64 };
+
+    RansacBatchLoop(const Problem& problem_, const RansacParam& param_, int firstIter_, int numToBeat_,
+        typename Problem::Model* models_, int* numInliers_)
+        : problem(problem_), param(param_), firstIter(firstIter_), numToBeat(numToBeat_),
+        models(models_), numInliers(numInliers_)
+    {}
+
+    virtual ~RansacBatchLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        int size = problem.size();
+        int indexes[Problem::NUM_MODEL_POINTS];
+        for (int i = r.start; i < r.end; i++)
+        {
+            numInliers[i] = 0;
+            detail::ransacSample(param.seed, firstIter + i, size, Problem::NUM_MODEL_POINTS, indexes);
+            if (!problem.fit(indexes, models[i]))
+                continue;
+
+            int count = 0;
+            for (int beg = 0; beg < size; beg += BLOCK_SIZE)
+            {
+                int end = std::min(beg + (int)BLOCK_SIZE, size);
+                count += problem.countInliers(models[i], beg, end, param.thresh);
+                // Even if all the remaining points are inliers the best is not beaten
+                if (count + size - end <= numToBeat)
+                {
+                    count = 0;
+                    break;
+                }
+            }
+            numInliers[i] = count;
+        }
+    }
+
+private:
+    const Problem& problem;
+    const RansacParam& param;
+    int firstIter;
+    int numToBeat;
+    typename Problem::Model* models;
+    int* numInliers;
+};
+
+}
+
+// Returns the number of inliers of the best model, model and mask are set only if it is positive.
+template<typename Problem>
+int runRansac(const Problem& problem, const RansacParam& param, typename Problem::Model& model,
+    std::vector<unsigned char>& mask)
+{
+    enum { BATCH_SIZE = 16 };
+    // Below this number of points a batch is cheaper than waking the threads
+    const int minNumPointsParallel = 512;
+
+    int size = problem.size();
+    CV_Assert(size >= Problem::NUM_MODEL_POINTS);
+
+    typename Problem::Model models[BATCH_SIZE];
+    int numInliers[BATCH_SIZE];
+    int numMaxInliers = 0;
+    int numIters = param.numMaxIters;
+    for (int iter = 0; iter < numIters; iter += BATCH_SIZE)
+    {
+        int numToBeat = std::max(numMaxInliers, (int)Problem::NUM_MODEL_POINTS - 1);
+        int batchSize = std::min((int)BATCH_SIZE, numIters - iter);
+        detail::RansacBatchLoop<Problem> loop(problem, param, iter, numToBeat, models, numInliers);
+        if (param.parallel && size >= minNumPointsParallel)
+            cv::parallel_for_(cv::Range(0, batchSize), loop);
+        else
+            loop(cv::Range(0, batchSize));
+
+        // The first of the best in the batch, independent of the order the threads finished
+        int batchBest = -1;
+        for (int i = 0; i < batchSize; i++)
+        {
+            if (numInliers[i] > numToBeat && (batchBest < 0 || numInliers[i] > numInliers[batchBest]))
+                batchBest = i;
+        }
+        if (batchBest >= 0)
+        {
+            numMaxInliers = numInliers[batchBest];
+            model = models[batchBest];
+            numIters = std::min(param.numMaxIters, updateRansacNumIters(param.confidence,
+                double(size - numMaxInliers) / size, Problem::NUM_MODEL_POINTS, param.numMaxIters));
+        }
+    }
+
+    mask.resize(size);
+    if (numMaxInliers == 0)
+    {
+        std::fill(mask.begin(), mask.end(), 0);
+        return 0;
+    }
+    return problem.getInliers(model, param.thresh, &mask[0]);
+}
+
+}
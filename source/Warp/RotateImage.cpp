@@ -1,5 +1,27 @@
+#include "RotateImage.h"
 #include "ConvertCoordinate.h"
 #include "Rotation.h"
+#include "ZReprojectCompact.h"
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <smmintrin.h>
+#include <immintrin.h>
+
+#if defined(__GNUC__)
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+static int rotateImageUseFastMap = 1;
+
+void setRotateImageUseFastMap(bool useFastMap)
+{
+    rotateImageUseFastMap = useFastMap;
+}
 
 inline int clamp(int val, int low, int high)
 {
@@ -8,6 +30,13 @@ inline int clamp(int val, int low, int high)
 
 void mapNearestNeighbor(const cv::Mat& src, cv::Mat& dst, const cv::Matx33d& rot)
 {
+    if (rotateImageUseFastMap && src.type() == CV_8UC3)
+    {
+        EquiRectRotateMap rotateMap;
+        rotateMap.mapNearestNeighbor(src, dst, rot, false);
+        return;
+    }
+
     cv::Matx33d invRot = rot.t();
     int rows = src.rows, cols = src.cols;
     int rowsMinus1 = rows - 1, colsMinus1 = cols - 1;
@@ -70,6 +99,13 @@ public:
 
 void mapNearestNeighborParallel(const cv::Mat& src, cv::Mat& dst, const cv::Matx33d& rot)
 {
+    if (rotateImageUseFastMap && src.type() == CV_8UC3)
+    {
+        EquiRectRotateMap rotateMap;
+        rotateMap.mapNearestNeighbor(src, dst, rot, true);
+        return;
+    }
+
     dst.create(src.size(), src.type());
     MapNNLoop loop(src, dst, rot);
     cv::parallel_for_(cv::Range(0, src.rows), loop, src.total() / (double)(1 << 16));
@@ -80,6 +116,13 @@ static const int BILINEAR_INTER_BACK_SHIFT = BILINEAR_INTER_SHIFT * 2;
 static const int BILINEAR_UNIT = 1 << BILINEAR_INTER_SHIFT;
 void mapBilinear(const cv::Mat& src, cv::Mat& dst, const cv::Matx33d& rot)
 {
+    if (rotateImageUseFastMap && src.type() == CV_8UC3)
+    {
+        EquiRectRotateMap rotateMap;
+        rotateMap.mapBilinear(src, dst, rot, false);
+        return;
+    }
+
     cv::Matx33d invRot = rot.t();
     int rows = src.rows, cols = src.cols;
     int rowsMinus1 = rows - 1, colsMinus1 = cols - 1;
@@ -258,6 +301,13 @@ public:
 
 void mapBilinearParallel(const cv::Mat& src, cv::Mat& dst, const cv::Matx33d& rot)
 {
+    if (rotateImageUseFastMap && src.type() == CV_8UC3)
+    {
+        EquiRectRotateMap rotateMap;
+        rotateMap.mapBilinear(src, dst, rot, true);
+        return;
+    }
+
     dst.create(src.size(), src.type());
     MapBilinearLoop loop(src, dst, rot);
     cv::parallel_for_(cv::Range(0, src.rows), loop, src.total() / (double)(1 << 16));
@@ -361,4 +411,489 @@ void mapNearestNeighborParallel(const cv::Mat& src, cv::Mat& dst, const cv::Size
         ViewTransformLoop<FishEyeBackToEquiRect> loop(src, dst, transform);
         cv::parallel_for_(cv::Range(0, dst.rows), loop, dst.total() / (double)(1 << 16));
     }
-}
\ No newline at end of file
+}
+
+// Fast rotation of equirectangular images.
+// For dst pixel (x, y), theta only depends on y and phi only depends on x, so the unit vector
+// (sin(theta) * sin(phi), cos(theta), sin(theta) * cos(phi)) rotated by invRot is
+// k0 * sin(phi) + k1 * cos(phi) + k2 for each of its components, where k0, k1 and k2
+// are computed once per row. Longitude and latitude of the rotated vector are both
+// computed by atan2, latitude as atan2(y, sqrt(x * x + z * z)) instead of acos(y),
+// which keeps full precision near the poles. Src positions are quantized to the compact map
+// resolution directly by the kernels.
+
+#if STYLE != HUGIN_REMAP
+#error "EquiRectRotateMap follows the hugin remap style of findRotateEquiRectangularSrc"
+#endif
+
+static const float ATAN_TAN_PI_8 = 0.414213562373095F;
+static const float ATAN_P0 = 8.05374449538e-2F;
+static const float ATAN_P1 = -1.38776856032e-1F;
+static const float ATAN_P2 = 1.99777106478e-1F;
+static const float ATAN_P3 = -3.33329491539e-1F;
+static const float QUARTER_PI_F = 0.785398163397448F;
+static const float HALF_PI_F = 1.57079632679490F;
+static const float PI_F = 3.14159265358979F;
+
+// Max error is about 1e-7 radians. The SIMD versions perform the same operations
+// in the same order, so that all the kernels produce the same map.
+inline float fastAtan2(float y, float x)
+{
+    float ax = fabsf(x), ay = fabsf(y);
+    float t = std::min(ax, ay) / std::max(std::max(ax, ay), FLT_MIN);
+    float base = 0;
+    if (t > ATAN_TAN_PI_8)
+    {
+        t = (t - 1) / (t + 1);
+        base = QUARTER_PI_F;
+    }
+    float z = t * t;
+    float r = base + ((((ATAN_P0 * z + ATAN_P1) * z + ATAN_P2) * z + ATAN_P3) * z * t + t);
+    if (ay > ax)
+        r = HALF_PI_F - r;
+    if (x < 0)
+        r = PI_F - r;
+    return y < 0 ? -r : r;
+}
+
+struct RotateMapRowParam
+{
+    // Rotated direction components are k[i][0] * sin(phi) + k[i][1] * cos(phi) + k[i][2].
+    float k[3][3];
+    // Src positions scaled by COMPACT_MAP_FRAC_UNIT are longitude * scaleX + offsetX
+    // and latitude * scaleY + offsetY.
+    float scaleX, offsetX, scaleY, offsetY;
+    // Scaled src x wraps around at widthUnit, scaled src y is clamped to [0, maxY].
+    int widthUnit, maxY;
+};
+
+inline void rotateMapOne(const RotateMapRowParam& p, float sp, float cp, int* ptrX, int* ptrY)
+{
+    float x = p.k[0][0] * sp + p.k[0][1] * cp + p.k[0][2];
+    float y = p.k[1][0] * sp + p.k[1][1] * cp + p.k[1][2];
+    float z = p.k[2][0] * sp + p.k[2][1] * cp + p.k[2][2];
+    float lon = fastAtan2(x, z);
+    float lat = fastAtan2(y, sqrtf(x * x + z * z));
+    int ix = cvRound(lon * p.scaleX + p.offsetX);
+    int iy = cvRound(lat * p.scaleY + p.offsetY);
+    if (ix < 0)
+        ix += p.widthUnit;
+    if (ix >= p.widthUnit)
+        ix -= p.widthUnit;
+    *ptrX = ix;
+    *ptrY = iy < 0 ? 0 : (iy > p.maxY ? p.maxY : iy);
+}
+
+static void rotateMapRow(const RotateMapRowParam& p, const float* sinPhi, const float* cosPhi,
+    int* ptrX, int* ptrY, int count)
+{
+    for (int w = 0; w < count; w++)
+        rotateMapOne(p, sinPhi[w], cosPhi[w], ptrX + w, ptrY + w);
+}
+
+TARGET_SSE41 inline __m128 fastAtan2SSE41(__m128 y, __m128 x)
+{
+    __m128 signMask = _mm_set1_ps(-0.0F), one = _mm_set1_ps(1.0F), zero = _mm_setzero_ps();
+    __m128 ax = _mm_andnot_ps(signMask, x), ay = _mm_andnot_ps(signMask, y);
+    __m128 t = _mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(FLT_MIN)));
+    __m128 reduce = _mm_cmpgt_ps(t, _mm_set1_ps(ATAN_TAN_PI_8));
+    t = _mm_blendv_ps(t, _mm_div_ps(_mm_sub_ps(t, one), _mm_add_ps(t, one)), reduce);
+    __m128 base = _mm_and_ps(reduce, _mm_set1_ps(QUARTER_PI_F));
+    __m128 z = _mm_mul_ps(t, t);
+    __m128 poly = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ATAN_P0), z), _mm_set1_ps(ATAN_P1));
+    poly = _mm_add_ps(_mm_mul_ps(poly, z), _mm_set1_ps(ATAN_P2));
+    poly = _mm_add_ps(_mm_mul_ps(poly, z), _mm_set1_ps(ATAN_P3));
+    __m128 r = _mm_add_ps(base, _mm_add_ps(_mm_mul_ps(_mm_mul_ps(poly, z), t), t));
+    r = _mm_blendv_ps(r, _mm_sub_ps(_mm_set1_ps(HALF_PI_F), r), _mm_cmpgt_ps(ay, ax));
+    r = _mm_blendv_ps(r, _mm_sub_ps(_mm_set1_ps(PI_F), r), _mm_cmplt_ps(x, zero));
+    return _mm_xor_ps(r, _mm_and_ps(_mm_cmplt_ps(y, zero), signMask));
+}
+
+TARGET_SSE41 static void rotateMapRowSSE41(const RotateMapRowParam& p, const float* sinPhi, const float* cosPhi,
+    int* ptrX, int* ptrY, int count)
+{
+    __m128 k[3][3];
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+            k[i][j] = _mm_set1_ps(p.k[i][j]);
+    }
+    __m128 scaleX = _mm_set1_ps(p.scaleX), offsetX = _mm_set1_ps(p.offsetX);
+    __m128 scaleY = _mm_set1_ps(p.scaleY), offsetY = _mm_set1_ps(p.offsetY);
+    __m128i widthUnit = _mm_set1_epi32(p.widthUnit), widthUnitMinus1 = _mm_set1_epi32(p.widthUnit - 1);
+    __m128i zero = _mm_setzero_si128(), maxY = _mm_set1_epi32(p.maxY);
+    int w = 0;
+    for (; w <= count - 4; w += 4)
+    {
+        __m128 sp = _mm_loadu_ps(sinPhi + w), cp = _mm_loadu_ps(cosPhi + w);
+        __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(k[0][0], sp), _mm_mul_ps(k[0][1], cp)), k[0][2]);
+        __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(k[1][0], sp), _mm_mul_ps(k[1][1], cp)), k[1][2]);
+        __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(k[2][0], sp), _mm_mul_ps(k[2][1], cp)), k[2][2]);
+        __m128 lon = fastAtan2SSE41(x, z);
+        __m128 lat = fastAtan2SSE41(y, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(z, z))));
+        __m128i ix = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(lon, scaleX), offsetX));
+        __m128i iy = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(lat, scaleY), offsetY));
+        ix = _mm_add_epi32(ix, _mm_and_si128(_mm_cmplt_epi32(ix, zero), widthUnit));
+        ix = _mm_sub_epi32(ix, _mm_and_si128(_mm_cmpgt_epi32(ix, widthUnitMinus1), widthUnit));
+        iy = _mm_min_epi32(_mm_max_epi32(iy, zero), maxY);
+        _mm_storeu_si128((__m128i*)(ptrX + w), ix);
+        _mm_storeu_si128((__m128i*)(ptrY + w), iy);
+    }
+    for (; w < count; w++)
+        rotateMapOne(p, sinPhi[w], cosPhi[w], ptrX + w, ptrY + w);
+}
+
+TARGET_AVX2 inline __m256 fastAtan2AVX2(__m256 y, __m256 x)
+{
+    __m256 signMask = _mm256_set1_ps(-0.0F), one = _mm256_set1_ps(1.0F), zero = _mm256_setzero_ps();
+    __m256 ax = _mm256_andnot_ps(signMask, x), ay = _mm256_andnot_ps(signMask, y);
+    __m256 t = _mm256_div_ps(_mm256_min_ps(ax, ay), _mm256_max_ps(_mm256_max_ps(ax, ay), _mm256_set1_ps(FLT_MIN)));
+    __m256 reduce = _mm256_cmp_ps(t, _mm256_set1_ps(ATAN_TAN_PI_8), _CMP_GT_OQ);
+    t = _mm256_blendv_ps(t, _mm256_div_ps(_mm256_sub_ps(t, one), _mm256_add_ps(t, one)), reduce);
+    __m256 base = _mm256_and_ps(reduce, _mm256_set1_ps(QUARTER_PI_F));
+    __m256 z = _mm256_mul_ps(t, t);
+    __m256 poly = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(ATAN_P0), z), _mm256_set1_ps(ATAN_P1));
+    poly = _mm256_add_ps(_mm256_mul_ps(poly, z), _mm256_set1_ps(ATAN_P2));
+    poly = _mm256_add_ps(_mm256_mul_ps(poly, z), _mm256_set1_ps(ATAN_P3));
+    __m256 r = _mm256_add_ps(base, _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(poly, z), t), t));
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(HALF_PI_F), r), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(PI_F), r), _mm256_cmp_ps(x, zero, _CMP_LT_OQ));
+    return _mm256_xor_ps(r, _mm256_and_ps(_mm256_cmp_ps(y, zero, _CMP_LT_OQ), signMask));
+}
+
+TARGET_AVX2 static void rotateMapRowAVX2(const RotateMapRowParam& p, const float* sinPhi, const float* cosPhi,
+    int* ptrX, int* ptrY, int count)
+{
+    __m256 k[3][3];
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+            k[i][j] = _mm256_set1_ps(p.k[i][j]);
+    }
+    __m256 scaleX = _mm256_set1_ps(p.scaleX), offsetX = _mm256_set1_ps(p.offsetX);
+    __m256 scaleY = _mm256_set1_ps(p.scaleY), offsetY = _mm256_set1_ps(p.offsetY);
+    __m256i widthUnit = _mm256_set1_epi32(p.widthUnit), widthUnitMinus1 = _mm256_set1_epi32(p.widthUnit - 1);
+    __m256i zero = _mm256_setzero_si256(), maxY = _mm256_set1_epi32(p.maxY);
+    int w = 0;
+    for (; w <= count - 8; w += 8)
+    {
+        __m256 sp = _mm256_loadu_ps(sinPhi + w), cp = _mm256_loadu_ps(cosPhi + w);
+        __m256 x = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(k[0][0], sp), _mm256_mul_ps(k[0][1], cp)), k[0][2]);
+        __m256 y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(k[1][0], sp), _mm256_mul_ps(k[1][1], cp)), k[1][2]);
+        __m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(k[2][0], sp), _mm256_mul_ps(k[2][1], cp)), k[2][2]);
+        __m256 lon = fastAtan2AVX2(x, z);
+        __m256 lat = fastAtan2AVX2(y, _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(z, z))));
+        __m256i ix = _mm256_cvtps_epi32(_mm256_add_ps(_mm256_mul_ps(lon, scaleX), offsetX));
+        __m256i iy = _mm256_cvtps_epi32(_mm256_add_ps(_mm256_mul_ps(lat, scaleY), offsetY));
+        ix = _mm256_add_epi32(ix, _mm256_and_si256(_mm256_cmpgt_epi32(zero, ix), widthUnit));
+        ix = _mm256_sub_epi32(ix, _mm256_and_si256(_mm256_cmpgt_epi32(ix, widthUnitMinus1), widthUnit));
+        iy = _mm256_min_epi32(_mm256_max_epi32(iy, zero), maxY);
+        _mm256_storeu_si256((__m256i*)(ptrX + w), ix);
+        _mm256_storeu_si256((__m256i*)(ptrY + w), iy);
+    }
+    for (; w < count; w++)
+        rotateMapOne(p, sinPhi[w], cosPhi[w], ptrX + w, ptrY + w);
+}
+
+typedef void(*RotateMapRowFunc)(const RotateMapRowParam& p, const float* sinPhi, const float* cosPhi,
+    int* ptrX, int* ptrY, int count);
+
+static RotateMapRowFunc getRotateMapRowFunc()
+{
+    if (cv::checkHardwareSupport(CV_CPU_AVX2))
+        return rotateMapRowAVX2;
+    if (cv::checkHardwareSupport(CV_CPU_SSE4_1))
+        return rotateMapRowSSE41;
+    return rotateMapRow;
+}
+
+class RotateMapLoop : public cv::ParallelLoopBody
+{
+public:
+    RotateMapLoop(const cv::Matx33d& rot, const std::vector<double>& sinTheta_, const std::vector<double>& cosTheta_,
+        const std::vector<float>& sinPhi_, const std::vector<float>& cosPhi_,
+        cv::Mat& map_, std::vector<std::vector<int> >& seamCols_)
+        : invRot(rot.t()), sinTheta(sinTheta_), cosTheta(cosTheta_), sinPhi(sinPhi_), cosPhi(cosPhi_),
+        map(map_), seamCols(seamCols_)
+    {
+        rows = map.rows, cols = map.cols;
+        double halfWidth = cols * 0.5, halfHeight = rows * 0.5;
+        // x = halfWidth + lon / PI * halfWidth - 0.5, y = halfHeight * (2 - acos(.) / HALF_PI) - 0.5
+        // and acos(.) = HALF_PI - lat, see findRotateEquiRectangularSrc
+        param.scaleX = halfWidth / PI * COMPACT_MAP_FRAC_UNIT;
+        param.offsetX = (halfWidth - 0.5) * COMPACT_MAP_FRAC_UNIT;
+        param.scaleY = halfHeight / HALF_PI * COMPACT_MAP_FRAC_UNIT;
+        param.offsetY = (halfHeight - 0.5) * COMPACT_MAP_FRAC_UNIT;
+        param.widthUnit = cols * COMPACT_MAP_FRAC_UNIT;
+        param.maxY = (rows - 1) * COMPACT_MAP_FRAC_UNIT;
+        rowFunc = getRotateMapRowFunc();
+    }
+
+    virtual ~RotateMapLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        std::vector<int> buf(cols * 2);
+        int* ptrX = &buf[0];
+        int* ptrY = ptrX + cols;
+        RotateMapRowParam p = param;
+        for (int h = r.start; h < r.end; h++)
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                p.k[i][0] = invRot(i, 0) * sinTheta[h];
+                p.k[i][1] = invRot(i, 2) * sinTheta[h];
+                p.k[i][2] = invRot(i, 1) * cosTheta[h];
+            }
+            rowFunc(p, &sinPhi[0], &cosPhi[0], ptrX, ptrY, cols);
+
+            short* ptrMap = map.ptr<short>(h);
+            std::vector<int>& seam = seamCols[h];
+            seam.clear();
+            for (int w = 0; w < cols; w++)
+            {
+                int x0 = ptrX[w] >> COMPACT_MAP_FRAC_BITS, fx = ptrX[w] & COMPACT_MAP_FRAC_MASK;
+                ptrMap[0] = x0;
+                ptrMap[1] = ptrY[w] >> COMPACT_MAP_FRAC_BITS;
+                ptrMap[2] = ((ptrY[w] & COMPACT_MAP_FRAC_MASK) << COMPACT_MAP_FRAC_BITS) | fx;
+                if (x0 == cols - 1 && fx)
+                    seam.push_back(w);
+                ptrMap += 3;
+            }
+        }
+    }
+
+    cv::Matx33d invRot;
+    const std::vector<double>& sinTheta;
+    const std::vector<double>& cosTheta;
+    const std::vector<float>& sinPhi;
+    const std::vector<float>& cosPhi;
+    cv::Mat& map;
+    std::vector<std::vector<int> >& seamCols;
+    int rows, cols;
+    RotateMapRowParam param;
+    RotateMapRowFunc rowFunc;
+};
+
+template<int NumChannels>
+class RotateBilinearLoop : public cv::ParallelLoopBody
+{
+public:
+    RotateBilinearLoop(const cv::Mat& src_, cv::Mat& dst_, const cv::Mat& map_,
+        const std::vector<std::vector<int> >& seamCols_)
+        : src(src_), dst(dst_), map(map_), seamCols(seamCols_)
+    {
+        rows = src.rows, cols = src.cols, step = src.step;
+        rowFunc = getCompactReprojectRowFunc(src.type(), CV_8U);
+    }
+
+    virtual ~RotateBilinearLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        const unsigned char* srcData = src.data;
+        int res[NumChannels];
+        for (int h = r.start; h < r.end; h++)
+        {
+            const short* ptrMap = map.ptr<short>(h);
+            unsigned char* ptrDstRow = dst.ptr<unsigned char>(h);
+            if (rowFunc)
+                rowFunc(srcData, cols, rows, step, ptrMap, ptrDstRow, cols);
+            else
+            {
+                for (int w = 0; w < cols; w++)
+                {
+                    compactBilinearResampling<NumChannels>(cols, rows, step, srcData, ptrMap + w * 3, res);
+                    for (int i = 0; i < NumChannels; i++)
+                        ptrDstRow[w * NumChannels + i] = compactBilinearCast<unsigned char>(res[i]);
+                }
+            }
+
+            // Interpolate between the last and the first column
+            const std::vector<int>& seam = seamCols[h];
+            for (int k = 0, size = seam.size(); k < size; k++)
+            {
+                int w = seam[k];
+                const short* ptr = ptrMap + w * 3;
+                int y0 = ptr[1], y1 = y0 < rows - 1 ? y0 + 1 : y0;
+                int fx = ptr[2] & COMPACT_MAP_FRAC_MASK, fy = ptr[2] >> COMPACT_MAP_FRAC_BITS;
+                int wx0 = COMPACT_MAP_FRAC_UNIT - fx, wy0 = COMPACT_MAP_FRAC_UNIT - fy;
+                const unsigned char* ptr00 = srcData + step * y0 + (cols - 1) * NumChannels;
+                const unsigned char* ptr01 = srcData + step * y0;
+                const unsigned char* ptr10 = srcData + step * y1 + (cols - 1) * NumChannels;
+                const unsigned char* ptr11 = srcData + step * y1;
+                for (int i = 0; i < NumChannels; i++)
+                    ptrDstRow[w * NumChannels + i] = compactBilinearCast<unsigned char>(
+                        (ptr00[i] * wx0 + ptr01[i] * fx) * wy0 + (ptr10[i] * wx0 + ptr11[i] * fx) * fy);
+            }
+        }
+    }
+
+    const cv::Mat& src;
+    cv::Mat& dst;
+    const cv::Mat& map;
+    const std::vector<std::vector<int> >& seamCols;
+    int rows, cols, step;
+    CompactReprojectRowFunc rowFunc;
+};
+
+template<int NumChannels>
+class RotateNearestNeighborLoop : public cv::ParallelLoopBody
+{
+public:
+    RotateNearestNeighborLoop(const cv::Mat& src_, cv::Mat& dst_, const cv::Mat& map_)
+        : src(src_), dst(dst_), map(map_)
+    {
+        rows = src.rows, cols = src.cols;
+    }
+
+    virtual ~RotateNearestNeighborLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        const int half = COMPACT_MAP_FRAC_UNIT / 2;
+        for (int h = r.start; h < r.end; h++)
+        {
+            const short* ptrMap = map.ptr<short>(h);
+            unsigned char* ptrDstRow = dst.ptr<unsigned char>(h);
+            for (int w = 0; w < cols; w++)
+            {
+                int x = ptrMap[0] + ((ptrMap[2] & COMPACT_MAP_FRAC_MASK) >= half);
+                int y = ptrMap[1] + ((ptrMap[2] >> COMPACT_MAP_FRAC_BITS) >= half);
+                if (x >= cols)
+                    x = 0;
+                if (y >= rows)
+                    y = rows - 1;
+                const unsigned char* ptrSrc = src.ptr<unsigned char>(y) + x * NumChannels;
+                for (int i = 0; i < NumChannels; i++)
+                    ptrDstRow[i] = ptrSrc[i];
+                ptrMap += 3;
+                ptrDstRow += NumChannels;
+            }
+        }
+    }
+
+    const cv::Mat& src;
+    cv::Mat& dst;
+    const cv::Mat& map;
+    int rows, cols;
+};
+
+static void runRotateLoop(const cv::ParallelLoopBody& loop, const cv::Size& size, bool parallel)
+{
+    if (parallel)
+        cv::parallel_for_(cv::Range(0, size.height), loop, size.area() / (double)(1 << 16));
+    else
+        loop(cv::Range(0, size.height));
+}
+
+EquiRectRotateMap::EquiRectRotateMap()
+{
+    clear();
+}
+
+void EquiRectRotateMap::setTolerance(double tolerance_)
+{
+    tolerance = tolerance_ < 0 ? 0 : tolerance_;
+}
+
+void EquiRectRotateMap::clear()
+{
+    size = cv::Size();
+    rotation = cv::Matx33d::eye();
+    tolerance = 0;
+    numBuilds = 0;
+    sinTheta.clear();
+    cosTheta.clear();
+    sinPhi.clear();
+    cosPhi.clear();
+    map.release();
+    seamCols.clear();
+}
+
+bool EquiRectRotateMap::prepare(const cv::Size& size_, const cv::Matx33d& rot, bool parallel)
+{
+    CV_Assert(size_.width > 0 && size_.height > 0 && size_.width < SHRT_MAX && size_.height < SHRT_MAX);
+
+    if (size_ != size)
+    {
+        size = size_;
+        int rows = size.height, cols = size.width;
+        double halfWidth = cols * 0.5, halfHeight = rows * 0.5;
+        sinTheta.resize(rows);
+        cosTheta.resize(rows);
+        for (int i = 0; i < rows; i++)
+        {
+            double theta = PI - (i + 0.5) / halfHeight * HALF_PI;
+            sinTheta[i] = sin(theta);
+            cosTheta[i] = cos(theta);
+        }
+        sinPhi.resize(cols);
+        cosPhi.resize(cols);
+        for (int i = 0; i < cols; i++)
+        {
+            double phi = ((i + 0.5) - halfWidth) / halfWidth * PI;
+            sinPhi[i] = sin(phi);
+            cosPhi[i] = cos(phi);
+        }
+        map.release();
+    }
+    else if (map.data)
+    {
+        bool same = true;
+        for (int i = 0; i < 9; i++)
+            same = same && rot.val[i] == rotation.val[i];
+        if (same)
+            return false;
+        if (tolerance > 0)
+        {
+            // Angle of the rotation between rot and the rotation of the map
+            cv::Matx33d diff = rot * rotation.t();
+            double cosAngle = (diff(0, 0) + diff(1, 1) + diff(2, 2) - 1) * 0.5;
+            if (cosAngle >= cos(tolerance))
+                return false;
+        }
+    }
+
+    rotation = rot;
+    map.create(size, CV_16SC3);
+    seamCols.resize(size.height);
+    RotateMapLoop loop(rot, sinTheta, cosTheta, sinPhi, cosPhi, map, seamCols);
+    runRotateLoop(loop, size, parallel);
+    numBuilds++;
+    return true;
+}
+
+void EquiRectRotateMap::mapNearestNeighbor(const cv::Mat& src, cv::Mat& dst, const cv::Matx33d& rot, bool parallel)
+{
+    CV_Assert(src.data && (src.type() == CV_8UC3 || src.type() == CV_8UC4));
+    prepare(src.size(), rot, parallel);
+    dst.create(src.size(), src.type());
+    if (src.type() == CV_8UC3)
+    {
+        RotateNearestNeighborLoop<3> loop(src, dst, map);
+        runRotateLoop(loop, src.size(), parallel);
+    }
+    else
+    {
+        RotateNearestNeighborLoop<4> loop(src, dst, map);
+        runRotateLoop(loop, src.size(), parallel);
+    }
+}
+
+void EquiRectRotateMap::mapBilinear(const cv::Mat& src, cv::Mat& dst, const cv::Matx33d& rot, bool parallel)
+{
+    CV_Assert(src.data && (src.type() == CV_8UC3 || src.type() == CV_8UC4));
+    prepare(src.size(), rot, parallel);
+    dst.create(src.size(), src.type());
+    if (src.type() == CV_8UC3)
+    {
+        RotateBilinearLoop<3> loop(src, dst, map, seamCols);
+        runRotateLoop(loop, src.size(), parallel);
+    }
+    else
+    {
+        RotateBilinearLoop<4> loop(src, dst, map, seamCols);
+        runRotateLoop(loop, src.size(), parallel);
+    }
+}
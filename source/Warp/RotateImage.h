@@ -1,6 +1,7 @@
 #pragma once
 
 #include "opencv2/core.hpp"
+#include <vector>
 
 void mapNearestNeighbor(const cv::Mat& src, cv::Mat& dst, const cv::Matx33d& rot);
 
@@ -14,4 +15,54 @@ void mapNearestNeighbor(const cv::Mat& src, cv::Mat& dst, const cv::Size& dstSiz
     double dstHFov, double srcHoriAngleOffset, double srcVertAngleOffset, bool isRectLinear);
 
 void mapNearestNeighborParallel(const cv::Mat& src, cv::Mat& dst, const cv::Size& dstSize,
-    double dstHFov, double srcHoriAngleOffset, double srcVertAngleOffset, bool isRectLinear);
\ No newline at end of file
+    double dstHFov, double srcHoriAngleOffset, double srcVertAngleOffset, bool isRectLinear);
+
+// Enable or disable the fast path of mapNearestNeighbor, mapNearestNeighborParallel, mapBilinear and
+// mapBilinearParallel taking a rotation, which builds an EquiRectRotateMap on every call.
+// It is enabled by default, the disabled path evaluates the double precision rotation for every pixel.
+// The fast nearest neighbor path rounds src positions, while the old path truncates them.
+void setRotateImageUseFastMap(bool useFastMap);
+
+// Rotates equirectangular images of type CV_8UC3 or CV_8UC4 through a cached compact map,
+// see getReprojectMapCompactAndMask in ZReproject.h for the map layout.
+// The map is computed from per-row and per-column sin and cos tables, the rotated directions
+// and their longitudes and latitudes are evaluated in float by SSE4.1 or AVX2 kernels.
+// The map is rebuilt only if the image size changes or the rotation differs by more than
+// the tolerance from the rotation the map was built for, so a stabilized video whose correction
+// changes slowly rebuilds it only from time to time.
+// An object is not thread safe, use one object per thread.
+class EquiRectRotateMap
+{
+public:
+    EquiRectRotateMap();
+
+    // Angle in radians, zero means the map is reused only for the same rotation, which is the default.
+    void setTolerance(double tolerance);
+
+    // Builds the map for size and rot if needed, returns true if the map is rebuilt.
+    bool prepare(const cv::Size& size, const cv::Matx33d& rot, bool parallel = true);
+
+    void mapNearestNeighbor(const cv::Mat& src, cv::Mat& dst, const cv::Matx33d& rot, bool parallel = true);
+
+    void mapBilinear(const cv::Mat& src, cv::Mat& dst, const cv::Matx33d& rot, bool parallel = true);
+
+    // Compact map of type CV_16SC3 of the last prepare call.
+    const cv::Mat& getMap() const { return map; }
+
+    // Number of times the map has been built.
+    int getNumBuilds() const { return numBuilds; }
+
+    void clear();
+
+private:
+    cv::Size size;
+    cv::Matx33d rotation;
+    double tolerance;
+    int numBuilds;
+    std::vector<double> sinTheta, cosTheta;
+    std::vector<float> sinPhi, cosPhi;
+    cv::Mat map;
+    // For each row, the columns whose src positions lie between the last and the first column,
+    // the compact map kernels clamp them, they are interpolated across the seam afterwards.
+    std::vector<std::vector<int> > seamCols;
+};
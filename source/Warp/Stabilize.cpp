@@ -1,5 +1,6 @@
 #include "Rotation.h"
 #include "Stabilize.h"
+#include "../Tool/Ransac.h"
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -236,33 +237,6 @@ void getRigidTransform(const std::vector<cv::Point3d>& src, const std::vector<cv
     //printf("t = %f, %f, %f\n", tsl.x, tsl.y, tsl.z);
 }
 
-void randomPermute(int size, int count, std::vector<int>& arr)
-{
-    arr.clear();
-    CV_Assert(size > 0 && count > 0 && count <= size);    
-    cv::RNG rng(cv::getTickCount());
-    std::vector<int> total(size);
-    for (int i = 0; i < size; i++)
-        total[i] = i;
-    for (int i = 0; i < count; i++)
-    {
-        int index = rng.uniform(i, size);
-        std::swap(total[i], total[index]);
-    }
-    arr.resize(count);
-    for (int i = 0; i < count; i++)
-        arr[i] = total[i];
-}
-
-void select(const std::vector<cv::Point3d>& total, const std::vector<int>& index, std::vector<cv::Point3d>& subset)
-{
-    subset.clear();
-    int size = index.size();
-    subset.resize(size);
-    for (int i = 0; i < size; i++)
-        subset[i] = total[index[i]];
-}
-
 void select(const std::vector<cv::Point3d>& total, const std::vector<unsigned char>& mask, std::vector<cv::Point3d>& subset)
 {
     subset.clear();
@@ -276,97 +250,121 @@ void select(const std::vector<cv::Point3d>& total, const std::vector<unsigned ch
     }
 }
 
-int getInliers(const std::vector<cv::Point3d> src, const std::vector<cv::Point3d>& dst, 
-    const cv::Matx33d& R, const cv::Point3d& T, double error, std::vector<unsigned char>& mask)
+// Point pairs of getRigidTransformRANSAC for ztool::runRansac, one array for each coordinate
+class RigidTransformRansacProblem
 {
-    mask.clear();
-    if (src.empty())
-        return 0;
+public:
+    struct Model
+    {
+        cv::Matx33d R;
+        cv::Point3d T;
+    };
+    enum { NUM_MODEL_POINTS = 3 };
 
-    int size = src.size();
-    CV_Assert(size == dst.size());
-    mask.resize(size, 0);
-    int count = 0;
-    double minError = DBL_MAX, maxError = 0;
-    for (int i = 0; i < size; i++)
+    RigidTransformRansacProblem(const std::vector<cv::Point3d>& src, const std::vector<cv::Point3d>& dst)
     {
-        double currError = cv::norm(dst[i] - R * src[i] - T);
-        minError = MIN(currError, minError);
-        maxError = MAX(currError, maxError);
-        if (currError < error)
+        numPoints = src.size();
+        srcX.resize(numPoints), srcY.resize(numPoints), srcZ.resize(numPoints);
+        dstX.resize(numPoints), dstY.resize(numPoints), dstZ.resize(numPoints);
+        for (int i = 0; i < numPoints; i++)
         {
-            mask[i] = 255;
-            count++;
+            srcX[i] = src[i].x, srcY[i] = src[i].y, srcZ[i] = src[i].z;
+            dstX[i] = dst[i].x, dstY[i] = dst[i].y, dstZ[i] = dst[i].z;
         }
     }
-    //printf("in getInliers, minError = %f, maxError = %f\n", minError, maxError);
-    return count;
-}
 
-int updateNumIters(double p, double ep, int modelPoints, int maxIters)
-{
-    CV_Assert(modelPoints > 0);
+    int size() const
+    {
+        return numPoints;
+    }
+
+    // Same as getRigidTransform on the three points
+    bool fit(const int* indexes, Model& model) const
+    {
+        cv::Point3d src[NUM_MODEL_POINTS], dst[NUM_MODEL_POINTS];
+        cv::Point3d srcAvg(0, 0, 0), dstAvg(0, 0, 0);
+        for (int i = 0; i < NUM_MODEL_POINTS; i++)
+        {
+            int k = indexes[i];
+            src[i] = cv::Point3d(srcX[k], srcY[k], srcZ[k]);
+            dst[i] = cv::Point3d(dstX[k], dstY[k], dstZ[k]);
+            srcAvg += src[i];
+            dstAvg += dst[i];
+        }
+        srcAvg *= 1.0 / NUM_MODEL_POINTS;
+        dstAvg *= 1.0 / NUM_MODEL_POINTS;
 
-    p = MAX(p, 0.);
-    p = MIN(p, 1.);
-    ep = MAX(ep, 0.);
-    ep = MIN(ep, 1.);
+        cv::Matx33d H = cv::Matx33d::zeros(), prod;
+        for (int i = 0; i < NUM_MODEL_POINTS; i++)
+        {
+            mulUVt(src[i] - srcAvg, dst[i] - dstAvg, prod);
+            H += prod;
+        }
 
-    // avoid inf's & nan's
-    double num = MAX(1. - p, DBL_MIN);
-    double denom = 1. - pow(1. - ep, modelPoints);
-    if (denom < DBL_MIN)
-        return 0;
+        cv::Matx33d U, VT;
+        cv::Matx31d L;
+        cv::SVD::compute(H, L, U, VT);
+        model.R = VT.t() * U.t();
+        model.T = dstAvg - model.R * srcAvg;
+        return true;
+    }
 
-    num = log(num);
-    denom = log(denom);
+    int countInliers(const Model& model, int beg, int end, double thresh) const
+    {
+        const cv::Matx33d& R = model.R;
+        double r00 = R(0, 0), r01 = R(0, 1), r02 = R(0, 2);
+        double r10 = R(1, 0), r11 = R(1, 1), r12 = R(1, 2);
+        double r20 = R(2, 0), r21 = R(2, 1), r22 = R(2, 2);
+        double tx = model.T.x, ty = model.T.y, tz = model.T.z;
+        double sqrThresh = thresh * thresh;
+        const double* ptrSrcX = &srcX[0], *ptrSrcY = &srcY[0], *ptrSrcZ = &srcZ[0];
+        const double* ptrDstX = &dstX[0], *ptrDstY = &dstY[0], *ptrDstZ = &dstZ[0];
+        int count = 0;
+        for (int i = beg; i < end; i++)
+        {
+            double ex = ptrDstX[i] - (r00 * ptrSrcX[i] + r01 * ptrSrcY[i] + r02 * ptrSrcZ[i]) - tx;
+            double ey = ptrDstY[i] - (r10 * ptrSrcX[i] + r11 * ptrSrcY[i] + r12 * ptrSrcZ[i]) - ty;
+            double ez = ptrDstZ[i] - (r20 * ptrSrcX[i] + r21 * ptrSrcY[i] + r22 * ptrSrcZ[i]) - tz;
+            count += (ex * ex + ey * ey + ez * ez < sqrThresh);
+        }
+        return count;
+    }
 
-    return denom >= 0 || -num >= maxIters*(-denom) ?
-        maxIters : cvRound(num / denom);
-}
+    int getInliers(const Model& model, double thresh, unsigned char* mask) const
+    {
+        int count = 0;
+        for (int i = 0; i < numPoints; i++)
+        {
+            mask[i] = countInliers(model, i, i + 1, thresh) ? 255 : 0;
+            count += mask[i] != 0;
+        }
+        return count;
+    }
+
+private:
+    int numPoints;
+    std::vector<double> srcX, srcY, srcZ, dstX, dstY, dstZ;
+};
 
 int getRigidTransformRANSAC(const std::vector<cv::Point3d>& src, const std::vector<cv::Point3d>& dst, 
     cv::Matx33d& R, cv::Point3d& T, std::vector<unsigned char>& mask)
 {
     CV_Assert(src.size() == dst.size() && src.size() > 3);
-    int size = src.size();
-    //printf("RANSAC:\n");
-    //printf("size = %d\n", size);
-
-    int numModelPoints = 3;
-    int numMaxIters = 1000;
-    int numIters = numMaxIters;
-    double confidence = 0.995;
-    double projError = 0.03;
-    std::vector<unsigned char> currMask, bestMask;
-    std::vector<int> currIndex;
-    std::vector<cv::Point3d> currSrc, currDst;
-    int numMaxInliers = 0;
-    for (int i = 0; i < numIters; i++)
-    {
-        //printf("iter = %d\n", i);
-        randomPermute(size, numModelPoints, currIndex);
-        select(src, currIndex, currSrc);
-        select(dst, currIndex, currDst);
-        cv::Matx33d currR;
-        cv::Point3d currT;
-        getRigidTransform(currSrc, currDst, currR, currT);
-        int currNumInliers = getInliers(src, dst, currR, currT, projError, currMask);
-        //printf("currNumInliers = %d\n", currNumInliers);
-        if (currNumInliers > MAX(numMaxInliers, numModelPoints - 1))
-        {
-            numIters = updateNumIters(confidence, double(size - currNumInliers) / size, numModelPoints, numMaxIters);
-            //int currNumIters = updateNumIters(confidence, double(size - currNumInliers) / size, numModelPoints, numMaxIters);
-            //numIters = MIN(numMaxIters, i > 2 * currNumIters ? currNumIters : currNumIters + i); 
-            //printf("numIters changed to %d\n", numIters);
-            numMaxInliers = currNumInliers;
-            bestMask = currMask;
-        }
+
+    RigidTransformRansacProblem problem(src, dst);
+    RigidTransformRansacProblem::Model model;
+    int numMaxInliers = ztool::runRansac(problem, ztool::RansacParam(0.03, 0.995, 1000), model, mask);
+    if (numMaxInliers < 3)
+    {
+        R = cv::Matx33d::eye();
+        T = cv::Point3d(0, 0, 0);
+        return numMaxInliers;
     }
-    mask = bestMask;
-    select(src, bestMask, currSrc);
-    select(dst, bestMask, currDst);
-    getRigidTransform(currSrc, currDst, R, T);
+
+    std::vector<cv::Point3d> inlierSrc, inlierDst;
+    select(src, mask, inlierSrc);
+    select(dst, mask, inlierDst);
+    getRigidTransform(inlierSrc, inlierDst, R, T);
     return numMaxInliers;
 }
 
@@ -0,0 +1,302 @@
+#include "StreamStabilize.h"
+#include "Stabilize.h"
+#include "Rotation.h"
+#include "ConvertCoordinate.h"
+#include "ZReproject.h"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/video.hpp"
+#include <algorithm>
+
+StreamStabilizeParam::StreamStabilizeParam()
+{
+    cubeLength = 256;
+    maxNumFeaturesPerFace = 200;
+    featureQualityLevel = 0.05;
+    featureMinDistance = 12;
+    radius = 15;
+    lookahead = 15;
+    decay = 0.98;
+    mapTolerance = 0.0002;
+}
+
+// Points closer than this to the border of a face are dropped,
+// the optical flow window there reaches into the neighbouring face.
+static const int faceMargin = 8;
+// Pairs of points needed to estimate the rotation
+static const int minNumPairs = 12;
+
+FrameRotationEstimator::FrameRotationEstimator()
+{
+    clear();
+}
+
+bool FrameRotationEstimator::init(const cv::Size& frameSize_, const StreamStabilizeParam& param_)
+{
+    clear();
+    if (frameSize_.width != frameSize_.height * 2 || param_.cubeLength <= faceMargin * 4 ||
+        param_.maxNumFeaturesPerFace <= 0)
+        return false;
+
+    param = param_;
+    frameSize = frameSize_;
+    int length = param.cubeLength;
+    cv::Mat map;
+    getEquiRectToCubeMap(map, frameSize.height, length, CubeType3x2);
+    convertReprojectMapToCompact(map, frameSize, cubeMap);
+    for (int i = 0; i < 6; i++)
+        faces.push_back(cv::Rect((i % 3) * length, (i / 3) * length, length, length));
+    points.resize(6);
+    return true;
+}
+
+void FrameRotationEstimator::clear()
+{
+    frameSize = cv::Size();
+    cubeMap.release();
+    faces.clear();
+    cube.release();
+    gray.release();
+    prevGray.release();
+    points.clear();
+    hasPrev = false;
+}
+
+void FrameRotationEstimator::detect(int face)
+{
+    std::vector<cv::Point2f>& facePoints = points[face];
+    int numNeeded = param.maxNumFeaturesPerFace - facePoints.size();
+    if (numNeeded <= 0)
+        return;
+
+    // Skip the margin and the neighbourhoods of the points still tracked
+    int length = param.cubeLength;
+    cv::Mat detectMask(length, length, CV_8UC1, cv::Scalar(0));
+    detectMask(cv::Rect(faceMargin, faceMargin, length - 2 * faceMargin, length - 2 * faceMargin)).setTo(255);
+    int size = facePoints.size();
+    for (int i = 0; i < size; i++)
+        cv::circle(detectMask, facePoints[i], param.featureMinDistance, cv::Scalar(0), -1);
+
+    cv::goodFeaturesToTrack(gray(faces[face]), candidates, numNeeded,
+        param.featureQualityLevel, param.featureMinDistance, detectMask);
+    facePoints.insert(facePoints.end(), candidates.begin(), candidates.end());
+}
+
+bool FrameRotationEstimator::estimate(const cv::Mat& frame, cv::Matx33d& rot)
+{
+    rot = cv::Matx33d::eye();
+    if (!cubeMap.data || frame.size() != frameSize ||
+        (frame.type() != CV_8UC3 && frame.type() != CV_8UC4))
+        return false;
+
+    reprojectParallel(frame, cube, cubeMap);
+    cv::cvtColor(cube, gray, frame.type() == CV_8UC3 ? CV_BGR2GRAY : CV_BGRA2GRAY);
+
+    src.clear();
+    dst.clear();
+    if (hasPrev)
+    {
+        cv::TermCriteria termCrit(cv::TermCriteria::COUNT | cv::TermCriteria::EPS, 20, 0.03);
+        float low = faceMargin, high = param.cubeLength - faceMargin;
+        for (int i = 0; i < 6; i++)
+        {
+            std::vector<cv::Point2f>& facePoints = points[i];
+            if (facePoints.empty())
+                continue;
+
+            cv::calcOpticalFlowPyrLK(prevGray(faces[i]), gray(faces[i]), facePoints, nextPoints,
+                status, errors, cv::Size(21, 21), 3, termCrit, 0, 0.001);
+
+            // Keep the points tracked inside the face, compacting both lists in place
+            int size = facePoints.size(), count = 0;
+            for (int j = 0; j < size; j++)
+            {
+                const cv::Point2f& p = nextPoints[j];
+                if (status[j] && p.x >= low && p.x < high && p.y >= low && p.y < high)
+                {
+                    facePoints[count] = facePoints[j];
+                    nextPoints[count] = p;
+                    count++;
+                }
+            }
+            facePoints.resize(count);
+            nextPoints.resize(count);
+
+            cubeToSphere(facePoints, param.cubeLength, i, faceSrc);
+            cubeToSphere(nextPoints, param.cubeLength, i, faceDst);
+            src.insert(src.end(), faceSrc.begin(), faceSrc.end());
+            dst.insert(dst.end(), faceDst.begin(), faceDst.end());
+            facePoints.swap(nextPoints);
+        }
+    }
+
+    for (int i = 0; i < 6; i++)
+    {
+        if ((int)points[i].size() * 2 < param.maxNumFeaturesPerFace)
+            detect(i);
+    }
+    cv::swap(gray, prevGray);
+
+    bool ok = false;
+    if (hasPrev && src.size() >= minNumPairs)
+    {
+        cv::Matx33d R;
+        cv::Point3d T;
+        int numInliers = getRigidTransformRANSAC(src, dst, R, T, mask);
+        if (numInliers >= minNumPairs)
+        {
+            // Refit a pure rotation on the inliers
+            int size = src.size(), count = 0;
+            for (int i = 0; i < size; i++)
+            {
+                if (mask[i])
+                {
+                    src[count] = src[i];
+                    dst[count] = dst[i];
+                    count++;
+                }
+            }
+            src.resize(count);
+            dst.resize(count);
+            double yaw, pitch, roll;
+            refineRotation(src, dst, R, yaw, pitch, roll);
+            rot = R;
+            ok = true;
+        }
+    }
+    hasPrev = true;
+    return ok;
+}
+
+MotionSmoother::MotionSmoother()
+{
+    init(0, 0, 1);
+}
+
+void MotionSmoother::init(int radius_, int lookahead_, double decay_)
+{
+    radius = std::max(radius_, 0);
+    lookahead = std::max(lookahead_, 0);
+    decay = std::min(std::max(decay_, 0.0), 1.0);
+    clear();
+}
+
+void MotionSmoother::clear()
+{
+    motions.clear();
+    firstIndex = 0;
+    numFrames = 0;
+    nextIndex = 0;
+    accumCorrection = cv::Vec3d(0, 0, 0);
+}
+
+void MotionSmoother::getCorrection(int windowEnd, cv::Matx33d& correction)
+{
+    // Average the motion in [nextIndex - radius, windowEnd], the window is cut at the first frame
+    int windowBeg = std::max(nextIndex - radius, 0);
+    cv::Vec3d sum(0, 0, 0);
+    for (int i = windowBeg; i <= windowEnd; i++)
+        sum += motions[i - firstIndex];
+    cv::Vec3d smoothed = sum * (1.0 / (windowEnd + 1 - windowBeg));
+
+    // Same as accumulate(smoothed) - accumulate(motion) in the VideoStab drivers when decay is one
+    accumCorrection = accumCorrection * decay + (smoothed - motions[nextIndex - firstIndex]);
+    setRotationRM(correction, accumCorrection[0], accumCorrection[1], accumCorrection[2]);
+
+    nextIndex++;
+    while (firstIndex < nextIndex - radius)
+    {
+        motions.pop_front();
+        firstIndex++;
+    }
+}
+
+bool MotionSmoother::push(const cv::Vec3d& motion, cv::Matx33d& correction)
+{
+    motions.push_back(motion);
+    numFrames++;
+    if (numFrames - 1 - nextIndex < lookahead)
+        return false;
+    getCorrection(nextIndex + lookahead, correction);
+    return true;
+}
+
+bool MotionSmoother::flush(cv::Matx33d& correction)
+{
+    if (nextIndex >= numFrames)
+        return false;
+    getCorrection(std::min(nextIndex + lookahead, numFrames - 1), correction);
+    return true;
+}
+
+StreamStabilizer::StreamStabilizer()
+{
+    clear();
+}
+
+bool StreamStabilizer::init(const cv::Size& frameSize_, const StreamStabilizeParam& param_)
+{
+    clear();
+    if (!estimator.init(frameSize_, param_))
+        return false;
+    param = param_;
+    frameSize = frameSize_;
+    smoother.init(param.radius, param.lookahead, param.decay);
+    rotateMap.setTolerance(param.mapTolerance);
+    return true;
+}
+
+void StreamStabilizer::clear()
+{
+    frameSize = cv::Size();
+    estimator.clear();
+    smoother.clear();
+    rotateMap.clear();
+    items.clear();
+    readyEnd = 0;
+    flushed = false;
+}
+
+int StreamStabilizer::getLatency() const
+{
+    return param.lookahead;
+}
+
+bool StreamStabilizer::push(const cv::Mat& frame, long long int timeStamp)
+{
+    if (flushed || frame.size() != frameSize || (frame.type() != CV_8UC3 && frame.type() != CV_8UC4))
+        return false;
+
+    // A frame whose motion can not be estimated is treated as still
+    cv::Matx33d rot;
+    estimator.estimate(frame, rot);
+    double yaw, pitch, roll;
+    getRotationRM(rot, yaw, pitch, roll);
+
+    Item item;
+    item.frame = frame;
+    item.timeStamp = timeStamp;
+    items.push_back(item);
+    if (smoother.push(cv::Vec3d(yaw, pitch, roll), items[readyEnd].correction))
+        readyEnd++;
+    return true;
+}
+
+void StreamStabilizer::flush()
+{
+    flushed = true;
+    while (readyEnd < (int)items.size() && smoother.flush(items[readyEnd].correction))
+        readyEnd++;
+}
+
+bool StreamStabilizer::pop(cv::Mat& dst, long long int& timeStamp)
+{
+    if (readyEnd == 0)
+        return false;
+
+    Item& item = items.front();
+    rotateMap.mapBilinear(item.frame, dst, item.correction);
+    timeStamp = item.timeStamp;
+    items.pop_front();
+    readyEnd--;
+    return true;
+}
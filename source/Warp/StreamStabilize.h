@@ -0,0 +1,133 @@
+#pragma once
+
+#include "RotateImage.h"
+#include "opencv2/core.hpp"
+#include <deque>
+#include <vector>
+
+// Streaming stabilization of equirectangular video.
+// Unlike the VideoStab drivers, which read the whole video and smooth the motion
+// with a centered window, frames go in one by one and come out lookahead frames later,
+// so the stabilizer can sit between the stitcher and the encoder of a task.
+
+struct StreamStabilizeParam
+{
+    StreamStabilizeParam();
+
+    // Side length of the cube faces features are tracked on.
+    int cubeLength;
+    // Features tracked on each face, new features are detected on a face
+    // when less than half of them are left.
+    int maxNumFeaturesPerFace;
+    double featureQualityLevel;
+    double featureMinDistance;
+    // The smoothed motion of a frame is the average motion of radius frames before it,
+    // the frame itself and lookahead frames after it. lookahead is the latency in frames,
+    // zero makes the smoother causal.
+    int radius;
+    int lookahead;
+    // The correction is multiplied by decay every frame, so that the view follows
+    // the camera back after the camera turns. One never decays, as the VideoStab drivers do.
+    double decay;
+    // Tolerance in radians of the cached rotation map, see EquiRectRotateMap.
+    double mapTolerance;
+};
+
+// Estimates the rotation between consecutive frames. Features are tracked incrementally
+// on the six faces of a 3x2 cube map by pyramidal Lucas Kanade optical flow,
+// and the tracked points on the sphere are fitted by getRigidTransformRANSAC and refineRotation.
+class FrameRotationEstimator
+{
+public:
+    FrameRotationEstimator();
+    // frameSize should be of an equirectangular image, width is twice height.
+    bool init(const cv::Size& frameSize, const StreamStabilizeParam& param);
+    // frame should be of type CV_8UC3 or CV_8UC4. rot maps the points of the previous frame
+    // to the points of frame. Returns false on the first frame or if too few features are tracked,
+    // rot is the identity matrix then.
+    bool estimate(const cv::Mat& frame, cv::Matx33d& rot);
+    void clear();
+
+private:
+    void detect(int face);
+
+    StreamStabilizeParam param;
+    cv::Size frameSize;
+    cv::Mat cubeMap;
+    std::vector<cv::Rect> faces;
+    cv::Mat cube, gray, prevGray;
+    std::vector<std::vector<cv::Point2f> > points;
+    std::vector<cv::Point2f> nextPoints, candidates;
+    std::vector<unsigned char> status;
+    std::vector<float> errors;
+    std::vector<cv::Point3d> faceSrc, faceDst, src, dst;
+    std::vector<unsigned char> mask;
+    bool hasPrev;
+};
+
+// Smooths the frame to frame motion, given as yaw, pitch and roll of getRotationRM,
+// with a window of radius frames before and lookahead frames after each frame.
+class MotionSmoother
+{
+public:
+    MotionSmoother();
+    void init(int radius, int lookahead, double decay);
+    // Adds the motion of the newest frame. Returns true if the correction of the frame
+    // lookahead frames before it is ready, correction is the rotation to apply to that frame.
+    bool push(const cv::Vec3d& motion, cv::Matx33d& correction);
+    // Returns the corrections of the frames left after the last push one by one,
+    // the windows of these frames are cut at the last frame.
+    bool flush(cv::Matx33d& correction);
+    void clear();
+
+private:
+    void getCorrection(int windowEnd, cv::Matx33d& correction);
+
+    int radius, lookahead;
+    double decay;
+    // Motions of the frames from frame firstIndex on
+    std::deque<cv::Vec3d> motions;
+    int firstIndex;
+    int numFrames;
+    int nextIndex;
+    cv::Vec3d accumCorrection;
+};
+
+// Estimates, smooths and applies the correction to each frame. A frame is returned by pop
+// lookahead frames after it is pushed, or after flush at the end of the stream.
+// Pushed frames are referenced, not copied, until they are popped, so the caller should
+// not overwrite them before that, a frame pool that checks reference counts does this.
+class StreamStabilizer
+{
+public:
+    StreamStabilizer();
+    bool init(const cv::Size& frameSize, const StreamStabilizeParam& param = StreamStabilizeParam());
+    // Returns false if frame does not match the size given in init or if its type is not supported.
+    bool push(const cv::Mat& frame, long long int timeStamp);
+    // No more frames will be pushed, pop returns all the frames held.
+    void flush();
+    // Writes the next stabilized frame into dst, which is reused if it already has the right size and type.
+    // Returns false if no frame is ready.
+    bool pop(cv::Mat& dst, long long int& timeStamp);
+    // Number of frames held before the first frame is ready.
+    int getLatency() const;
+    void clear();
+
+private:
+    struct Item
+    {
+        cv::Mat frame;
+        long long int timeStamp;
+        cv::Matx33d correction;
+    };
+
+    StreamStabilizeParam param;
+    cv::Size frameSize;
+    FrameRotationEstimator estimator;
+    MotionSmoother smoother;
+    EquiRectRotateMap rotateMap;
+    std::deque<Item> items;
+    // Items before readyEnd have their corrections
+    int readyEnd;
+    bool flushed;
+};
@@ -0,0 +1,97 @@
+#include "Stabilize.h"
+#include "Rotation.h"
+#include "Timer.h"
+#include "opencv2/core.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+static cv::Point3d randomUnitVector()
+{
+    cv::Point3d p;
+    double len;
+    do
+    {
+        p.x = rand() / double(RAND_MAX) * 2 - 1;
+        p.y = rand() / double(RAND_MAX) * 2 - 1;
+        p.z = rand() / double(RAND_MAX) * 2 - 1;
+        len = sqrt(p.dot(p));
+    } while (len < 0.1 || len > 1);
+    return p * (1.0 / len);
+}
+
+// Points on the unit sphere rotated by rot with a little noise, the first numOutliers dst points are random.
+static void makePairs(int size, int numOutliers, const cv::Matx33d& rot,
+    std::vector<cv::Point3d>& src, std::vector<cv::Point3d>& dst)
+{
+    srand(4321);
+    src.resize(size);
+    dst.resize(size);
+    for (int i = 0; i < size; i++)
+    {
+        src[i] = randomUnitVector();
+        if (i < numOutliers)
+            dst[i] = randomUnitVector();
+        else
+            dst[i] = rot * src[i] + randomUnitVector() * 0.002;
+    }
+}
+
+static double maxDiff(const cv::Matx33d& a, const cv::Matx33d& b)
+{
+    double diff = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+            diff = std::max(diff, fabs(a(i, j) - b(i, j)));
+    }
+    return diff;
+}
+
+static bool testRigidTransformRANSAC(int size, double outlierRatio)
+{
+    cv::Matx33d rot;
+    setRotationRM(rot, 0.05, -0.02, 0.03);
+    std::vector<cv::Point3d> src, dst;
+    int numOutliers = size * outlierRatio;
+    makePairs(size, numOutliers, rot, src, dst);
+
+    cv::Matx33d R, singleThreadR;
+    cv::Point3d T, singleThreadT;
+    std::vector<unsigned char> mask, singleThreadMask;
+    int numThreads = cv::getNumThreads();
+    cv::setNumThreads(1);
+    int singleThreadNumInliers = getRigidTransformRANSAC(src, dst, singleThreadR, singleThreadT, singleThreadMask);
+    cv::setNumThreads(numThreads);
+
+    int numRuns = 100;
+    int numInliers = 0;
+    ztool::Timer timer;
+    for (int i = 0; i < numRuns; i++)
+        numInliers = getRigidTransformRANSAC(src, dst, R, T, mask);
+    timer.end();
+
+    // Inliers missed or outliers taken
+    int numWrong = 0;
+    for (int i = 0; i < size; i++)
+        numWrong += (mask[i] != 0) != (i >= numOutliers);
+
+    // The result does not depend on the number of threads
+    bool sameAsSingleThread = numInliers == singleThreadNumInliers && mask == singleThreadMask &&
+        maxDiff(R, singleThreadR) == 0;
+    double diff = maxDiff(R, rot);
+    printf("size %d, outlier ratio %f, %d inliers, %d wrong, rotation diff %g, same as single thread %d, %f ms\n",
+        size, outlierRatio, numInliers, numWrong, diff, sameAsSingleThread, timer.elapse() * 1000 / numRuns);
+    return sameAsSingleThread && diff < 0.002 && numWrong < size * 0.02;
+}
+
+int main()
+{
+    bool ok = true;
+    ok &= testRigidTransformRANSAC(100, 0.3);
+    ok &= testRigidTransformRANSAC(1000, 0.3);
+    ok &= testRigidTransformRANSAC(4000, 0.3);
+    ok &= testRigidTransformRANSAC(4000, 0.6);
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
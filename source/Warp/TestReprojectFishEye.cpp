@@ -0,0 +1,126 @@
+#include "ZReproject.h"
+#include "opencv2/core.hpp"
+#include <cstdio>
+
+// A circular fish eye camera whose crop rect and circle reach beyond the src image on the top left,
+// as happens when the lens is not centered on the sensor.
+static PhotoParam makeFishEyeParam(const cv::Size& srcSize, double yaw)
+{
+    PhotoParam param;
+    param.imageType = PhotoParam::ImageTypeCircularFishEye;
+    param.cropX = -150;
+    param.cropY = -100;
+    param.cropWidth = srcSize.width + 150;
+    param.cropHeight = srcSize.width + 150;
+    param.circleX = param.cropX + param.cropWidth / 2;
+    param.circleY = param.cropY + param.cropHeight / 2;
+    param.circleR = param.cropWidth / 2;
+    param.hfov = 200;
+    param.yaw = yaw;
+    return param;
+}
+
+static double maxAbsDiff(const cv::Mat& a, const cv::Mat& b)
+{
+    cv::Mat diff;
+    cv::absdiff(a.reshape(1), b.reshape(1), diff);
+    double maxDiff;
+    cv::minMaxLoc(diff, 0, &maxDiff);
+    return maxDiff;
+}
+
+// Map entries set by the mask should be inside the src image.
+static bool checkMaskAgreesWithMap(const cv::Mat& map, const cv::Mat& mask, const cv::Size& srcSize)
+{
+    int numValid = 0;
+    for (int h = 0; h < map.rows; h++)
+    {
+        const short* ptrMap = map.ptr<short>(h);
+        const unsigned char* ptrMask = mask.ptr<unsigned char>(h);
+        for (int w = 0; w < map.cols; w++, ptrMap += 3)
+        {
+            bool valid = ptrMap[0] >= 0 && ptrMap[1] >= 0 && ptrMap[0] < srcSize.width && ptrMap[1] < srcSize.height;
+            if ((ptrMask[w] != 0) != valid)
+                return false;
+            numValid += valid;
+        }
+    }
+    return numValid > 0;
+}
+
+int main()
+{
+    cv::Size srcSize(960, 720), dstSize(1024, 512);
+    std::vector<PhotoParam> params;
+    params.push_back(makeFishEyeParam(srcSize, 0));
+    params.push_back(makeFishEyeParam(srcSize, 180));
+
+    std::vector<cv::Mat> src(2), maps, masks, weights(2);
+    getReprojectMapsCompactAndMasks(params, srcSize, dstSize, maps, masks);
+    bool ok = true;
+    for (int i = 0; i < 2; i++)
+    {
+        bool agree = checkMaskAgreesWithMap(maps[i], masks[i], srcSize);
+        printf("camera %d, mask agrees with map %d\n", i, agree);
+        ok &= agree;
+        src[i].create(srcSize, CV_8UC3);
+        cv::randu(src[i], cv::Scalar::all(0), cv::Scalar::all(256));
+        weights[i].create(dstSize, CV_32FC1);
+        cv::randu(weights[i], 0, 0.5);
+    }
+
+    // Full masks put the invalid entries inside spans, the blend should skip them
+    // just as the accumulation over the whole map does.
+    cv::Mat fullMask(dstSize, CV_8UC1, cv::Scalar(255));
+    std::vector<ReprojectRowSpans> spans;
+    getReprojectRowSpans(std::vector<cv::Mat>(2, fullMask), spans);
+
+    for (int useSIMD = 0; useSIMD < 2; useSIMD++)
+    {
+        setReprojectUseSIMD(useSIMD != 0);
+        cv::Mat accum(dstSize, CV_32FC3, cv::Scalar::all(0)), ref, blend;
+        for (int i = 0; i < 2; i++)
+            reprojectWeightedAccumulateParallelTo32F(src[i], accum, maps[i], weights[i]);
+        accum.convertTo(ref, CV_8U);
+        reprojectWeightedBlendParallel(src, blend, maps, weights, spans);
+        double diff = maxAbsDiff(ref, blend);
+        printf("use SIMD %d, max diff between blend and accumulation %f\n", useSIMD, diff);
+        ok &= diff <= 1;
+    }
+
+    // A dst passed back with other content inside the bounding rect of the spans,
+    // as a previous frame could leave it, should give the same result as reprojecting 
+    // over the whole map, with zeros outside the camera footprint. With the full masks 
+    // the invalid entries inside spans should be zeroed as well.
+    std::vector<ReprojectRowSpans> maskSpans;
+    getReprojectRowSpans(masks, maskSpans);
+    for (int useSIMD = 0; useSIMD < 2; useSIMD++)
+    {
+        setReprojectUseSIMD(useSIMD != 0);
+        for (int i = 0; i < 2; i++)
+        {
+            cv::Mat ref, dst, ref16S, dst16S;
+            reprojectParallel(src[1 - i], dst, maps[i], maskSpans[i]);
+            reprojectParallelTo16S(src[1 - i], dst16S, maps[i], maskSpans[i]);
+            dst(maskSpans[i].boundingRect).setTo(cv::Scalar::all(77));
+            dst16S(maskSpans[i].boundingRect).setTo(cv::Scalar::all(-77));
+            const unsigned char* dstData = dst.data;
+            reprojectParallel(src[i], ref, maps[i]);
+            reprojectParallel(src[i], dst, maps[i], maskSpans[i]);
+            reprojectParallelTo16S(src[i], ref16S, maps[i]);
+            reprojectParallelTo16S(src[i], dst16S, maps[i], maskSpans[i]);
+            cv::Mat dstFull;
+            reprojectParallel(src[1 - i], dstFull, maps[i], spans[i]);
+            dstFull.setTo(cv::Scalar::all(77));
+            reprojectParallel(src[i], dstFull, maps[i], spans[i]);
+            double diff = maxAbsDiff(ref, dst), diff16S = maxAbsDiff(ref16S, dst16S);
+            double diffFull = maxAbsDiff(ref, dstFull);
+            printf("use SIMD %d, camera %d, max diff of dirty dst, 8U %f, 16S %f, full mask %f\n", 
+                useSIMD, i, diff, diff16S, diffFull);
+            ok &= dst.data == dstData && diff == 0 && diff16S == 0 && diffFull == 0;
+        }
+    }
+    setReprojectUseSIMD(true);
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+#include "ZReproject.h"
+#include "opencv2/core.hpp"
+#include <cmath>
+#include <cstdio>
+
+// Smooth src image, so that positions off by maxError change the resampled values by less than one
+static void makeSmoothImage(const cv::Size& size, cv::Mat& image)
+{
+    image.create(size, CV_8UC3);
+    for (int i = 0; i < size.height; i++)
+    {
+        unsigned char* ptr = image.ptr<unsigned char>(i);
+        for (int j = 0; j < size.width; j++, ptr += 3)
+        {
+            ptr[0] = cv::saturate_cast<unsigned char>(128 + 100 * sin(j * 0.02));
+            ptr[1] = cv::saturate_cast<unsigned char>(128 + 100 * cos(i * 0.03));
+            ptr[2] = cv::saturate_cast<unsigned char>((i + j) * 0.05);
+        }
+    }
+}
+
+// If needDenseCells is set, maxError should be small enough to leave dense cells off the first cell column.
+static bool compareWithDenseMap(const char* name, const PhotoParam& param, const cv::Size& srcSize,
+    const cv::Size& dstSize, int cellSize, double maxError, bool needDenseCells)
+{
+    cv::Mat src;
+    makeSmoothImage(srcSize, src);
+
+    cv::Mat denseMap, denseMask, denseDst;
+    getReprojectMapAndMask(param, srcSize, dstSize, denseMap, denseMask);
+    reprojectParallel(src, denseDst, denseMap);
+
+    ReprojectMeshMap meshMap;
+    cv::Mat meshMask, meshDst;
+    getReprojectMeshMapAndMask(param, srcSize, dstSize, meshMap, meshMask, cellSize, maxError);
+    reprojectParallel(src, meshDst, meshMap);
+
+    int numMaskDiffs = 0;
+    for (int i = 0; i < dstSize.height; i++)
+    {
+        const unsigned char* ptrDense = denseMask.ptr<unsigned char>(i);
+        const unsigned char* ptrMesh = meshMask.ptr<unsigned char>(i);
+        for (int j = 0; j < dstSize.width; j++)
+            numMaskDiffs += (ptrDense[j] != 0) != (ptrMesh[j] != 0);
+    }
+
+    // Dense cells hold the exact positions, they should match the dense map exactly.
+    // Cells off the first column check that dense points are indexed relative to the cell.
+    // Positions beyond the last src row or column are clamped by the mesh map,
+    // the dense map samples the border differently there, so these pixels are skipped.
+    int numDenseCells = 0, numDenseCellsOffFirstCol = 0, maxDenseCellDiff = 0, maxDiff = 0;
+    for (int cy = 0; cy < meshMap.cells.rows; cy++)
+    {
+        const int* ptrCells = meshMap.cells.ptr<int>(cy);
+        for (int cx = 0; cx < meshMap.cells.cols; cx++)
+        {
+            cv::Rect cell = cv::Rect(cx * cellSize, cy * cellSize, cellSize, cellSize) & cv::Rect(0, 0, dstSize.width, dstSize.height);
+            int cellDiff = 0;
+            for (int i = cell.y; i < cell.y + cell.height; i++)
+            {
+                const cv::Point2d* ptrMap = denseMap.ptr<cv::Point2d>(i);
+                const unsigned char* ptrDense = denseDst.ptr<unsigned char>(i);
+                const unsigned char* ptrMesh = meshDst.ptr<unsigned char>(i);
+                for (int j = cell.x; j < cell.x + cell.width; j++)
+                {
+                    if (ptrMap[j].x > srcSize.width - 1 || ptrMap[j].y > srcSize.height - 1)
+                        continue;
+                    for (int k = j * 3; k < j * 3 + 3; k++)
+                        cellDiff = std::max(cellDiff, std::abs(ptrDense[k] - ptrMesh[k]));
+                }
+            }
+            maxDiff = std::max(maxDiff, cellDiff);
+            if (ptrCells[cx * 2] == ReprojectMeshMap::CellDense)
+            {
+                numDenseCells++;
+                numDenseCellsOffFirstCol += cx > 0;
+                maxDenseCellDiff = std::max(maxDenseCellDiff, cellDiff);
+            }
+        }
+    }
+
+    int denseMapBytes = denseMap.total() * denseMap.elemSize();
+    int meshMapBytes = meshMap.grid.total() * meshMap.grid.elemSize() + meshMap.cells.total() * meshMap.cells.elemSize() +
+        (meshMap.finePoints.size() + meshMap.densePoints.size()) * sizeof(cv::Point2d);
+    printf("%s: %d mask diffs, %d dense cells, %d off the first column, max diff %d, in dense cells %d, "
+        "map bytes dense %d mesh %d, mask bytes %d\n", name, numMaskDiffs, numDenseCells, numDenseCellsOffFirstCol,
+        maxDiff, maxDenseCellDiff, denseMapBytes, meshMapBytes, (int)meshMask.total());
+    return numMaskDiffs == 0 && (!needDenseCells || numDenseCellsOffFirstCol > 0) && maxDenseCellDiff == 0 && maxDiff <= 2;
+}
+
+int main()
+{
+    cv::Size srcSize(960, 720), dstSize(1024, 512);
+    bool ok = true;
+
+    PhotoParam fishEye;
+    fishEye.imageType = PhotoParam::ImageTypeCircularFishEye;
+    fishEye.cropX = -150;
+    fishEye.cropY = -100;
+    fishEye.cropWidth = srcSize.width + 150;
+    fishEye.cropHeight = srcSize.width + 150;
+    fishEye.circleX = fishEye.cropX + fishEye.cropWidth / 2;
+    fishEye.circleY = fishEye.cropY + fishEye.cropHeight / 2;
+    fishEye.circleR = fishEye.cropWidth / 2;
+    fishEye.hfov = 200;
+    fishEye.yaw = 30;
+    ok &= compareWithDenseMap("circular fish eye", fishEye, srcSize, dstSize, 16, 0.1, false);
+
+    PhotoParam rectilinear;
+    rectilinear.imageType = PhotoParam::ImageTypeRectlinear;
+    rectilinear.cropWidth = srcSize.width;
+    rectilinear.cropHeight = srcSize.height;
+    rectilinear.hfov = 90;
+    rectilinear.pitch = 60;
+    ok &= compareWithDenseMap("rectilinear pitch 60", rectilinear, srcSize, dstSize, 16, 0.02, true);
+
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+#include "RotateImage.h"
+#include "Rotation.h"
+#include "Timer.h"
+#include "opencv2/core.hpp"
+#include <cmath>
+#include <cstdio>
+
+// Smooth image, periodic in the horizontal direction like a real equirectangular image,
+// so that the difference between the fast path and the double precision path
+// mainly shows the error of the src positions.
+static void makeImage(const cv::Size& size, int type, cv::Mat& image)
+{
+    image.create(size, type);
+    int numChannels = image.channels();
+    for (int i = 0; i < size.height; i++)
+    {
+        unsigned char* ptr = image.ptr<unsigned char>(i);
+        for (int j = 0; j < size.width; j++)
+        {
+            for (int k = 0; k < numChannels; k++)
+                ptr[j * numChannels + k] = cvRound(127.5 + 127.5 *
+                    sin(j * (2 * CV_PI * (24 + k * 7)) / size.width + i * (0.017 - k * 0.004)));
+        }
+    }
+}
+
+static int maxDiff(const cv::Mat& a, const cv::Mat& b)
+{
+    int diff = 0;
+    int length = a.cols * a.channels();
+    for (int i = 0; i < a.rows; i++)
+    {
+        const unsigned char* ptrA = a.ptr<unsigned char>(i);
+        const unsigned char* ptrB = b.ptr<unsigned char>(i);
+        for (int j = 0; j < length; j++)
+            diff = std::max(diff, abs(ptrA[j] - ptrB[j]));
+    }
+    return diff;
+}
+
+static bool compareWithDoublePath(const cv::Size& size, double yaw, double pitch, double roll)
+{
+    cv::Mat src, fastResult, slowResult;
+    makeImage(size, CV_8UC3, src);
+    cv::Matx33d rot;
+    setRotationRM(rot, yaw, pitch, roll);
+
+    ztool::Timer timer;
+    setRotateImageUseFastMap(false);
+    mapBilinearParallel(src, slowResult, rot);
+    timer.end();
+    double slowTime = timer.elapse();
+
+    timer.start();
+    setRotateImageUseFastMap(true);
+    mapBilinearParallel(src, fastResult, rot);
+    timer.end();
+    double fastTime = timer.elapse();
+
+    int diff = maxDiff(fastResult, slowResult);
+    printf("size %d x %d, rotation (%f, %f, %f), double path %f, fast path %f, max diff %d\n",
+        size.width, size.height, yaw, pitch, roll, slowTime, fastTime, diff);
+    return diff <= 1;
+}
+
+// Image whose pixels hold their own positions, x in channel 0 and the low 4 bits of channel 1, 
+// y in the high 4 bits of channel 1 and channel 2, for widths and heights up to 4096.
+static void makePositionImage(const cv::Size& size, cv::Mat& image)
+{
+    image.create(size, CV_8UC3);
+    for (int i = 0; i < size.height; i++)
+    {
+        cv::Vec3b* ptr = image.ptr<cv::Vec3b>(i);
+        for (int j = 0; j < size.width; j++)
+            ptr[j] = cv::Vec3b(j & 255, (j >> 8) | ((i & 15) << 4), i >> 4);
+    }
+}
+
+static cv::Point getPosition(const cv::Vec3b& val)
+{
+    return cv::Point(val[0] | ((val[1] & 15) << 8), (val[1] >> 4) | (val[2] << 4));
+}
+
+// The fast nearest neighbor path rounds the src positions of the compact map and wraps x at cols,
+// the double precision path truncates them, so the src pixels taken should be at most one pixel apart,
+// measured around the horizontal wrap.
+static bool compareNearestNeighborWithDoublePath(const cv::Size& size, double yaw, double pitch, double roll)
+{
+    cv::Mat src, fastResult, slowResult;
+    makePositionImage(size, src);
+    cv::Matx33d rot;
+    setRotationRM(rot, yaw, pitch, roll);
+
+    ztool::Timer timer;
+    setRotateImageUseFastMap(false);
+    mapNearestNeighborParallel(src, slowResult, rot);
+    timer.end();
+    double slowTime = timer.elapse();
+
+    timer.start();
+    setRotateImageUseFastMap(true);
+    mapNearestNeighborParallel(src, fastResult, rot);
+    timer.end();
+    double fastTime = timer.elapse();
+
+    int maxDiffX = 0, maxDiffY = 0, numDiff = 0;
+    for (int i = 0; i < size.height; i++)
+    {
+        const cv::Vec3b* ptrFast = fastResult.ptr<cv::Vec3b>(i);
+        const cv::Vec3b* ptrSlow = slowResult.ptr<cv::Vec3b>(i);
+        for (int j = 0; j < size.width; j++)
+        {
+            cv::Point fast = getPosition(ptrFast[j]), slow = getPosition(ptrSlow[j]);
+            int diffX = abs(fast.x - slow.x), diffY = abs(fast.y - slow.y);
+            diffX = std::min(diffX, size.width - diffX);
+            maxDiffX = std::max(maxDiffX, diffX);
+            maxDiffY = std::max(maxDiffY, diffY);
+            numDiff += fast != slow;
+        }
+    }
+    printf("nearest neighbor, size %d x %d, rotation (%f, %f, %f), double path %f, fast path %f, "
+        "max position diff (%d, %d), %d pixels differ\n",
+        size.width, size.height, yaw, pitch, roll, slowTime, fastTime, maxDiffX, maxDiffY, numDiff);
+    return maxDiffX <= 1 && maxDiffY <= 1;
+}
+
+// The map should be rebuilt only if the rotation changes by more than the tolerance.
+static bool testCache()
+{
+    cv::Size size(3840, 1920);
+    cv::Mat src, dst;
+    makeImage(size, CV_8UC4, src);
+
+    EquiRectRotateMap rotateMap;
+    rotateMap.setTolerance(0.001);
+    cv::Matx33d rot;
+    ztool::Timer timer;
+    double buildTime = 0, reuseTime = 0;
+    int numFrames = 20;
+    for (int i = 0; i < numFrames; i++)
+    {
+        // Rotation changes by 0.0004 radians per frame, a new map every third frame
+        setRotationRM(rot, 0.1 + i * 0.0004, 0.05, 0.02);
+        timer.start();
+        bool built = rotateMap.prepare(size, rot);
+        rotateMap.mapBilinear(src, dst, rot);
+        timer.end();
+        (built ? buildTime : reuseTime) += timer.elapse();
+    }
+    int numBuilds = rotateMap.getNumBuilds();
+    printf("cache: %d frames, %d builds, %f per built frame, %f per reused frame\n",
+        numFrames, numBuilds, buildTime / numBuilds, reuseTime / (numFrames - numBuilds));
+    return numBuilds == 7;
+}
+
+int main()
+{
+    bool ok = true;
+    ok &= compareWithDoublePath(cv::Size(2048, 1024), 0, 0, 0);
+    ok &= compareWithDoublePath(cv::Size(2048, 1024), 0.3, -0.2, 0.1);
+    ok &= compareWithDoublePath(cv::Size(3840, 1920), -2.5, 1.2, 0.7);
+    ok &= compareWithDoublePath(cv::Size(1001, 499), 1.0, 0.5, -3.0);
+    ok &= compareNearestNeighborWithDoublePath(cv::Size(2048, 1024), 0, 0, 0);
+    ok &= compareNearestNeighborWithDoublePath(cv::Size(2048, 1024), 0.3, -0.2, 0.1);
+    ok &= compareNearestNeighborWithDoublePath(cv::Size(3840, 1920), -2.5, 1.2, 0.7);
+    ok &= compareNearestNeighborWithDoublePath(cv::Size(1001, 499), 1.0, 0.5, -3.0);
+    ok &= testCache();
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,261 @@
+#include "StreamStabilize.h"
+#include "Stabilize.h"
+#include "Rotation.h"
+#include "RotateImage.h"
+#include "opencv2/core.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+static const cv::Size frameSize(512, 256);
+
+static double maxDiff(const cv::Matx33d& a, const cv::Matx33d& b)
+{
+    double diff = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+            diff = std::max(diff, fabs(a(i, j) - b(i, j)));
+    }
+    return diff;
+}
+
+// With decay one and lookahead equal to radius, the streaming corrections
+// should be the same as those of smooth and accumulate over the whole video.
+static bool compareWithOffline(int numFrames, int radius)
+{
+    std::vector<cv::Vec3d> motions(numFrames);
+    srand(12345);
+    for (int i = 0; i < numFrames; i++)
+    {
+        for (int j = 0; j < 3; j++)
+            motions[i][j] = (rand() / double(RAND_MAX) - 0.5) * 0.02;
+    }
+
+    std::vector<cv::Vec3d> smoothed, accumOrig, accumSmoothed;
+    smooth(motions, radius, smoothed);
+    accumulate(motions, accumOrig);
+    accumulate(smoothed, accumSmoothed);
+
+    MotionSmoother smoother;
+    smoother.init(radius, radius, 1);
+    std::vector<cv::Matx33d> corrections;
+    cv::Matx33d correction;
+    bool ok = true;
+    for (int i = 0; i < numFrames; i++)
+    {
+        bool ready = smoother.push(motions[i], correction);
+        // The first correction comes with frame radius
+        if (ready != (i >= radius))
+            ok = false;
+        if (ready)
+            corrections.push_back(correction);
+    }
+    while (smoother.flush(correction))
+        corrections.push_back(correction);
+    if ((int)corrections.size() != numFrames)
+        ok = false;
+
+    double diff = 0;
+    for (int i = 0; ok && i < numFrames; i++)
+    {
+        cv::Vec3d angles = accumSmoothed[i] - accumOrig[i];
+        cv::Matx33d rot;
+        setRotationRM(rot, angles[0], angles[1], angles[2]);
+        diff = std::max(diff, maxDiff(rot, corrections[i]));
+    }
+    printf("frames %d, radius %d, %d corrections, max diff %g\n",
+        numFrames, radius, (int)corrections.size(), diff);
+    return ok && diff < 1e-9;
+}
+
+// After the camera turns and stops, the correction of a causal smoother should
+// stay away from the identity without decay and return to it with decay.
+static bool testDecay(double decay)
+{
+    MotionSmoother smoother;
+    smoother.init(10, 0, decay);
+    cv::Matx33d correction;
+    for (int i = 0; i < 200; i++)
+    {
+        if (!smoother.push(cv::Vec3d(i < 20 ? 0.01 : 0, 0, 0), correction))
+            return false;
+    }
+    double diff = maxDiff(correction, cv::Matx33d::eye());
+    printf("decay %f: diff to identity after a turn %g\n", decay, diff);
+    return decay < 1 ? diff < 1e-6 : diff > 1e-3;
+}
+
+// Angle in radians of the rotation a * b.t()
+static double angleBetween(const cv::Matx33d& a, const cv::Matx33d& b)
+{
+    cv::Matx33d diff = a * b.t();
+    double cosAngle = (diff(0, 0) + diff(1, 1) + diff(2, 2) - 1) * 0.5;
+    return acos(std::min(1.0, std::max(-1.0, cosAngle)));
+}
+
+// Sum of plane waves through the sphere, so that the texture has no seam at the border
+// of the equirectangular image and corners to track on every cube face.
+static void makeSphereTexture(const cv::Size& size, cv::Mat& image)
+{
+    const int numWaves = 12;
+    cv::Point3d dirs[numWaves];
+    double freqs[numWaves], phases[numWaves];
+    srand(54321);
+    for (int k = 0; k < numWaves; k++)
+    {
+        cv::Point3d d(rand() / double(RAND_MAX) - 0.5, rand() / double(RAND_MAX) - 0.5, rand() / double(RAND_MAX) - 0.5);
+        dirs[k] = d * (1.0 / sqrt(d.dot(d) + 1e-12));
+        freqs[k] = 10 + 15 * rand() / double(RAND_MAX);
+        phases[k] = 2 * PI * rand() / double(RAND_MAX);
+    }
+
+    image.create(size, CV_8UC3);
+    for (int i = 0; i < size.height; i++)
+    {
+        double lat = PI * 0.5 - (i + 0.5) / size.height * PI;
+        unsigned char* ptr = image.ptr<unsigned char>(i);
+        for (int j = 0; j < size.width; j++, ptr += 3)
+        {
+            double lon = (j + 0.5) / size.width * 2 * PI - PI;
+            cv::Point3d p(cos(lat) * sin(lon), sin(lat), cos(lat) * cos(lon));
+            double val = 0;
+            for (int k = 0; k < numWaves; k++)
+                val += sin(freqs[k] * p.dot(dirs[k]) + phases[k]);
+            unsigned char v = cv::saturate_cast<unsigned char>(128 + 30 * val);
+            ptr[0] = ptr[1] = ptr[2] = v;
+        }
+    }
+}
+
+static StreamStabilizeParam makeParam(int radius)
+{
+    StreamStabilizeParam param;
+    param.cubeLength = 128;
+    param.maxNumFeaturesPerFace = 100;
+    param.radius = radius;
+    param.lookahead = radius;
+    return param;
+}
+
+// EquiRectRotateMap takes the pixel at direction p from rot.t() * p of the src image, so the texture
+// moves by rot and the estimator should return rot, not its inverse, for each axis and sign.
+static bool testEstimateSign()
+{
+    cv::Mat base;
+    makeSphereTexture(frameSize, base);
+    const double angle = 2 * PI / 180;
+    const double angles[6][3] =
+    {
+        { angle, 0, 0 }, { -angle, 0, 0 }, { 0, angle, 0 }, { 0, -angle, 0 }, { 0, 0, angle }, { 0, 0, -angle }
+    };
+    EquiRectRotateMap rotateMap;
+    bool ok = true;
+    for (int k = 0; k < 6; k++)
+    {
+        cv::Matx33d truth, rot;
+        setRotationRM(truth, angles[k][0], angles[k][1], angles[k][2]);
+        cv::Mat moved;
+        rotateMap.mapBilinear(base, moved, truth);
+
+        FrameRotationEstimator estimator;
+        bool estimated = estimator.init(frameSize, makeParam(0)) &&
+            !estimator.estimate(base, rot) && estimator.estimate(moved, rot);
+        double error = angleBetween(rot, truth), inverseError = angleBetween(rot, truth.t());
+        bool right = estimated && error < angle * 0.15;
+        ok &= right;
+        printf("estimate yaw %g pitch %g roll %g: error %g rad, error to the inverse %g rad, %s\n",
+            angles[k][0], angles[k][1], angles[k][2], error, inverseError, right ? "ok" : "wrong");
+    }
+    return ok;
+}
+
+static double meanAbsDiff(const cv::Mat& a, const cv::Mat& b)
+{
+    double sum = 0;
+    for (int i = 0; i < a.rows; i++)
+    {
+        const unsigned char* ptrA = a.ptr<unsigned char>(i);
+        const unsigned char* ptrB = b.ptr<unsigned char>(i);
+        for (int j = 0; j < a.cols * a.channels(); j++)
+            sum += std::abs(ptrA[j] - ptrB[j]);
+    }
+    return sum / (double(a.rows) * a.cols * a.channels());
+}
+
+// A camera shaking in yaw by +-angle around a fixed direction. Every pushed frame should
+// come out once, in order, lookahead frames after it is pushed or after flush, and
+// the stabilized frames should shake much less than the input, a wrong sign would double it.
+static bool testStabilizeOrder()
+{
+    const int numFrames = 40, radius = 5;
+    const double angle = 1.5 * PI / 180;
+    cv::Mat base;
+    makeSphereTexture(frameSize, base);
+    EquiRectRotateMap rotateMap;
+    std::vector<cv::Mat> frames(numFrames);
+    for (int i = 0; i < numFrames; i++)
+    {
+        cv::Matx33d rot;
+        setRotationRM(rot, i % 2 ? angle : -angle, 0, 0);
+        rotateMap.mapBilinear(base, frames[i], rot);
+    }
+
+    StreamStabilizer stabilizer;
+    if (!stabilizer.init(frameSize, makeParam(radius)) || stabilizer.getLatency() != radius)
+        return false;
+
+    std::vector<cv::Mat> results;
+    std::vector<long long int> timeStamps;
+    bool lagRight = true;
+    cv::Mat dst;
+    long long int timeStamp;
+    for (int i = 0; i < numFrames; i++)
+    {
+        if (!stabilizer.push(frames[i], i * 1000))
+            return false;
+        int numPopped = 0;
+        while (stabilizer.pop(dst, timeStamp))
+        {
+            results.push_back(dst.clone());
+            timeStamps.push_back(timeStamp);
+            numPopped++;
+        }
+        lagRight &= numPopped == (i >= radius ? 1 : 0) &&
+            (numPopped == 0 || timeStamp == (i - radius) * 1000);
+    }
+    stabilizer.flush();
+    while (stabilizer.pop(dst, timeStamp))
+    {
+        results.push_back(dst.clone());
+        timeStamps.push_back(timeStamp);
+    }
+    bool ordered = (int)timeStamps.size() == numFrames;
+    for (int i = 0; ordered && i < numFrames; i++)
+        ordered = timeStamps[i] == i * 1000;
+
+    double inputShake = 0, outputShake = 0;
+    for (int i = radius; ordered && i < numFrames - radius; i++)
+    {
+        inputShake += meanAbsDiff(frames[i], frames[i - 1]);
+        outputShake += meanAbsDiff(results[i], results[i - 1]);
+    }
+    bool ok = lagRight && ordered && outputShake < inputShake * 0.5;
+    printf("stabilize: %d frames out, lag %d right %d, in order %d, shake in %g out %g, %s\n",
+        (int)timeStamps.size(), radius, lagRight, ordered, inputShake, outputShake, ok ? "ok" : "wrong");
+    return ok;
+}
+
+int main()
+{
+    bool ok = true;
+    ok &= compareWithOffline(100, 15);
+    ok &= compareWithOffline(10, 15);
+    ok &= compareWithOffline(50, 0);
+    ok &= testDecay(1);
+    ok &= testDecay(0.9);
+    ok &= testEstimateSign();
+    ok &= testStabilizeOrder();
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
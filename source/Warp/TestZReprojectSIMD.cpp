@@ -0,0 +1,53 @@
+#include "ZReproject.h"
+#include "opencv2/core.hpp"
+#include <cstdio>
+
+// Compare SIMD and scalar reprojection with compact maps, the results should be bit-exact.
+static bool compare(const cv::Mat& src, const cv::Mat& map, int dstDepth)
+{
+    cv::Mat simdResult, scalarResult;
+    for (int i = 0; i < 2; i++)
+    {
+        setReprojectUseSIMD(i == 0);
+        cv::Mat& dst = i == 0 ? simdResult : scalarResult;
+        if (dstDepth == CV_8U)
+            reprojectParallel(src, dst, map);
+        else if (dstDepth == CV_16S)
+            reprojectParallelTo16S(src, dst, map);
+        else
+            reprojectParallelTo32F(src, dst, map);
+    }
+    setReprojectUseSIMD(true);
+
+    cv::Mat diff;
+    cv::absdiff(simdResult.reshape(1), scalarResult.reshape(1), diff);
+    double maxDiff;
+    cv::minMaxLoc(diff, 0, &maxDiff);
+    printf("src channels %d, dst depth %d, max diff %f\n", src.channels(), dstDepth, maxDiff);
+    return maxDiff == 0;
+}
+
+int main()
+{
+    cv::Size srcSize(1920, 1080), dstSize(2048, 1024);
+
+    // Random positions cover the borders of src, 5 percent of them are invalid.
+    cv::Mat map64F(dstSize, CV_64FC2), invalid(dstSize, CV_8UC1);
+    cv::randu(map64F, cv::Scalar(-1, -1), cv::Scalar(srcSize.width, srcSize.height));
+    cv::randu(invalid, 0, 100);
+    map64F.setTo(cv::Scalar(-1, -1), invalid < 5);
+    cv::Mat map;
+    convertReprojectMapToCompact(map64F, srcSize, map);
+
+    bool ok = true;
+    for (int numChannels = 3; numChannels <= 4; numChannels++)
+    {
+        cv::Mat src(srcSize, CV_MAKETYPE(CV_8U, numChannels));
+        cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(256));
+        ok &= compare(src, map, CV_8U);
+        ok &= compare(src, map, CV_16S);
+        ok &= compare(src, map, CV_32F);
+    }
+    printf(ok ? "all passed\n" : "failed\n");
+    return ok ? 0 : 1;
+}
@@ -1,6 +1,7 @@
 #include "Rotation.h"
 #include "ConvertCoordinate.h"
 #include "Stabilize.h"
+#include "RotateImage.h"
 #include "ZReproject.h"
 #include "Blend/ZBlend.h"
 #include "CudaAccel/CudaInterface.h"
@@ -19,9 +20,6 @@
 #include <condition_variable>
 #include <atomic>
 
-void mapBilinear(const cv::Mat& src, cv::Mat& dst, const cv::Matx33d& rot);
-void mapNearestNeighbor(const cv::Mat& src, cv::Mat& dst, const cv::Matx33d& rot);
-
 static void toValidFileName(const std::string& path, std::string& result)
 {
     result = path;
@@ -499,6 +497,10 @@ int main()
     ztool::Timer timer;
     cv::Vec3d accumOrig(0, 0, 0), accumProc(0, 0, 0);
     cv::Mat remapFrame;
+    // Reuse the rotation map while the correction changes by less than about
+    // an eighth of a pixel of a 4K frame
+    EquiRectRotateMap rotateMap;
+    rotateMap.setTolerance(0.0002);
     while (true)
     {
         printf("currCount = %d\n", frameCount);
@@ -536,7 +538,7 @@ int main()
 
         cv::Matx33d rot;
         setRotationRM(rot, diff[0], diff[1], diff[2]);
-        mapBilinear(blendImage, remapFrame, rot);
+        rotateMap.mapBilinear(blendImage, remapFrame, rot);
         writer.write(remapFrame);
 
         frameCount++;
@@ -617,6 +619,10 @@ int main()
     ztool::Timer timer;
     cv::Vec3d accumOrig(0, 0, 0), accumProc(0, 0, 0);
     cv::Mat remapFrame;
+    // Reuse the rotation map while the correction changes by less than about
+    // an eighth of a pixel of a 4K frame
+    EquiRectRotateMap rotateMap;
+    rotateMap.setTolerance(0.0002);
     while (true)
     {
         printf("currCount = %d\n", frameCount);
@@ -654,7 +660,7 @@ int main()
 
         cv::Matx33d rot;
         setRotationRM(rot, diff[0], diff[1], diff[2]);
-        mapBilinear(blendImage, remapFrame, rot);
+        rotateMap.mapBilinear(blendImage, remapFrame, rot);
         writer.write(remapFrame);
 
         frameCount++;
@@ -1,6 +1,7 @@
 #include "Rotation.h"
 #include "ConvertCoordinate.h"
 #include "Stabilize.h"
+#include "RotateImage.h"
 #include "ZReproject.h"
 #include "Blend/ZBlend.h"
 #include "CudaAccel/CudaInterface.h"
@@ -20,9 +21,6 @@
 #include <list>
 #include <algorithm>
 
-void mapBilinear(const cv::Mat& src, cv::Mat& dst, const cv::Matx33d& rot);
-void mapNearestNeighbor(const cv::Mat& src, cv::Mat& dst, const cv::Matx33d& rot);
-
 static void toValidFileName(const std::string& path, std::string& result)
 {
     result = path;
@@ -271,6 +269,10 @@ int main()
     std::vector<cv::Mat> dstImages, compImages;
     ztool::Timer timer;
     cv::Vec3d accumOrig(0, 0, 0), accumProc(0, 0, 0);
+    // Reuse the rotation map while the correction changes by less than about
+    // an eighth of a pixel of a 4K frame
+    EquiRectRotateMap rotateMap;
+    rotateMap.setTolerance(0.0002);
     while (true)
     {
         printf("currCount = %d\n", frameCount);
@@ -286,7 +288,7 @@ int main()
         cv::Vec3d diff = accumProc - accumOrig;
         cv::Matx33d rot;
         setRotationRM(rot, diff[0], diff[1], diff[2]);
-        mapBilinear(frame, rotateImage, rot);
+        rotateMap.mapBilinear(frame, rotateImage, rot);
 
         writer.write(rotateImage);
 
@@ -1030,6 +1032,10 @@ int main2()
     std::vector<cv::Mat> dstImages, compImages;
     ztool::Timer timer;
     cv::Vec3d accumOrig(0, 0, 0), accumProc(0, 0, 0);
+    // Reuse the rotation map while the correction changes by less than about
+    // an eighth of a pixel of a 4K frame
+    EquiRectRotateMap rotateMap;
+    rotateMap.setTolerance(0.0002);
     while (true)
     {
         //printf("currCount = %d\n", frameCount);
@@ -1045,7 +1051,7 @@ int main2()
         cv::Vec3d diff = accumProc - accumOrig;
         cv::Matx33d rot;
         setRotationRM(rot, diff[0], diff[1], diff[2]);
-        mapBilinear(frame, rotateImage, rot);
+        rotateMap.mapBilinear(frame, rotateImage, rot);
 
         //getCorrespondingPoints(allFeaturePointsHistory, frameCount, rotPts, smoothRotPts);
         //warpAffineMap(rotPts, smoothRotPts, rotateImage, warpImage);
@@ -1,4 +1,5 @@
 #include "ZReproject.h"
+#include "ZReprojectCompact.h"
 
 inline int weightedSum(const unsigned char rgb[4], const double w[4])
 {
@@ -129,103 +130,285 @@ inline void bilinearResampling(int width, int height, int step, const unsigned c
         dst[i] = cv::saturate_cast<DstElemType>(res[i]);
 }
 
-void getReprojectMapAndMask(const PhotoParam& param,
-    const cv::Size& srcSize, const cv::Size& dstSize, cv::Mat& map, cv::Mat& mask)
+// Flattened version of Remap::remapImage for dst images of type equirectangular.
+// Trigonometric functions of the equirectangular longitude and latitude 
+// only depend on the column and row indexes, so they are computed once
+// for each column and each row in init, instead of once for each pixel.
+struct ReprojectMapContext
+{
+    void init(const PhotoParam& param, const cv::Size& srcSize, const cv::Size& dstSize);
+    // tableSize may be larger than dstSize if positions beyond the dst image are needed.
+    void init(const PhotoParam& param, const cv::Size& srcSize, const cv::Size& dstSize, const cv::Size& tableSize);
+    inline void remapImage(double& x_dest, double& y_dest, int w, int h) const;
+    inline bool isValid(double sx, double sy) const;
+
+    Remap remap;
+    std::vector<double> sinPhi, cosPhi;
+    std::vector<double> sinTheta, cosTheta;
+    int srcWidth, srcHeight;
+    int fishEye;
+    double cropX, cropY, cropXEnd, cropYEnd;
+    double centx, centy, sqrDist;
+};
+
+void ReprojectMapContext::init(const PhotoParam& param, const cv::Size& srcSize, const cv::Size& dstSize)
+{
+    init(param, srcSize, dstSize, dstSize);
+}
+
+void ReprojectMapContext::init(const PhotoParam& param, const cv::Size& srcSize, const cv::Size& dstSize, 
+    const cv::Size& tableSize)
 {
     int dstWidth = dstSize.width, dstHeight = dstSize.height;
-    int srcWidth = srcSize.width, srcHeight = srcSize.height;
-    if (param.imageType != 3 && param.imageType != 2)
+    srcWidth = srcSize.width, srcHeight = srcSize.height;
+    remap.init(param, dstWidth, dstHeight, srcWidth, srcHeight);
+
+    const Remap::MakeParam& mp = remap.mp;
+    const double PI = 3.14159265358979323846264338327950288;
+
+    int tableWidth = tableSize.width, tableHeight = tableSize.height;
+    sinPhi.resize(tableWidth);
+    cosPhi.resize(tableWidth);
+    for (int w = 0; w < tableWidth; w++)
     {
-        Remap remap;
-        remap.init(param, dstWidth, dstHeight, srcWidth, srcHeight);
-        map.create(dstHeight, dstWidth, CV_64FC2);
-        mask.create(dstHeight, dstWidth, CV_8UC1);
-        mask.setTo(0);
-        for (int h = 0; h < dstHeight; h++)
-        {
-            cv::Point2d* ptrMap = map.ptr<cv::Point2d>(h);
-            unsigned char* ptrMask = mask.ptr<unsigned char>(h);
-            for (int w = 0; w < dstWidth; w++)
-            {
-                double sx, sy;
-                remap.remapImage(sx, sy, w, h);
-                if (sx >= 0 && sy >= 0 && sx < srcWidth && sy < srcHeight)
-                {
-                    ptrMap[w].x = sx;
-                    ptrMap[w].y = sy;
-                    ptrMask[w] = 255;
-                }
-                else
-                {
-                    ptrMap[w].x = -1;
-                    ptrMap[w].y = -1;
-                }
-            }
-        }
+        double x = w - (remap.srcTX - 0.5) + mp.rot[1];
+        while (x < -mp.rot[0])
+            x += 2 * mp.rot[0];
+        while (x > mp.rot[0])
+            x -= 2 * mp.rot[0];
+        double phi = x / mp.distance;
+        sinPhi[w] = sin(phi);
+        cosPhi[w] = cos(phi);
     }
-    else
+
+    // If theta is folded back into [0, PI], phi is increased by PI,
+    // which is equivalent to negating sin(theta) here.
+    sinTheta.resize(tableHeight);
+    cosTheta.resize(tableHeight);
+    for (int h = 0; h < tableHeight; h++)
     {
-        Remap remap;
-        remap.init(param, dstWidth, dstHeight, srcWidth, srcHeight);
-        map.create(dstHeight, dstWidth, CV_64FC2);
-        mask.create(dstHeight, dstWidth, CV_8UC1);
-        mask.setTo(0);
-        double centx, centy, sqrDist;
-        if (param.circleR > 0)
+        double y = h - (remap.srcTY - 0.5);
+        double theta = -y / mp.distance + PI / 2;
+        double sign = 1;
+        if (theta < 0)
         {
-            centx = param.circleX;
-            centy = param.circleY;
-            sqrDist = param.circleR * param.circleR;
+            theta = -theta;
+            sign = -sign;
         }
-        else
+        if (theta > PI)
         {
-            centx = param.cropX + param.cropWidth / 2;
-            centy = param.cropY + param.cropHeight / 2;
-            sqrDist = param.cropWidth > param.cropHeight ?
-                param.cropWidth * param.cropWidth * 0.25 :
-                param.cropHeight * param.cropHeight * 0.25;
+            theta = PI - (theta - PI);
+            sign = -sign;
         }
-        for (int h = 0; h < dstHeight; h++)
+        sinTheta[h] = sin(theta) * sign;
+        cosTheta[h] = cos(theta);
+    }
+
+    fishEye = param.imageType == PhotoParam::ImageTypeDrumFishEye ||
+        param.imageType == PhotoParam::ImageTypeCircularFishEye;
+    cropX = param.cropX;
+    cropY = param.cropY;
+    cropXEnd = param.cropX + param.cropWidth;
+    cropYEnd = param.cropY + param.cropHeight;
+    if (param.circleR > 0)
+    {
+        centx = param.circleX;
+        centy = param.circleY;
+        sqrDist = param.circleR * param.circleR;
+    }
+    else
+    {
+        centx = param.cropX + param.cropWidth / 2;
+        centy = param.cropY + param.cropHeight / 2;
+        sqrDist = param.cropWidth > param.cropHeight ?
+            param.cropWidth * param.cropWidth * 0.25 :
+            param.cropHeight * param.cropHeight * 0.25;
+    }
+}
+
+inline void ReprojectMapContext::remapImage(double& x_dest, double& y_dest, int w, int h) const
+{
+    const Remap::MakeParam& mp = remap.mp;
+    const double PI = 3.14159265358979323846264338327950288;
+
+    double st = sinTheta[h];
+    double v0 = st * sinPhi[w];
+    double v1 = cosTheta[h];
+    double v2 = st * cosPhi[w];
+
+    double x = mp.mt[0][0] * v0 + mp.mt[1][0] * v1 + mp.mt[2][0] * v2;
+    double y = mp.mt[0][1] * v0 + mp.mt[1][1] * v1 + mp.mt[2][1] * v2;
+    double z = mp.mt[0][2] * v0 + mp.mt[1][2] * v1 + mp.mt[2][2] * v2;
+
+    double r = sqrt(x * x + y * y);
+    double theta = r == 0.0 ? 0.0 : mp.distance * atan2(r, z) / r;
+    x *= theta;
+    y *= theta;
+
+    if (remap.srcImageType == PTImageTypeRectlinear)
+    {
+        double rr = sqrt(x * x + y * y);
+        double th = rr / mp.distance;
+        double rho;
+        if (th >= PI / 2.0)
+            rho = 1.6e16;
+        else if (th == 0.0)
+            rho = 1.0;
+        else
+            rho = tan(th) / th;
+        x *= rho;
+        y *= rho;
+    }
+
+    x *= mp.scale[0];
+    y *= mp.scale[1];
+
+    double rt = sqrt(x * x + y * y) / mp.rad[4];
+    double scale = rt < mp.rad[5] ? ((mp.rad[3] * rt + mp.rad[2]) * rt + mp.rad[1]) * rt + mp.rad[0] : 1000.0;
+    x *= scale;
+    y = y * scale + mp.vertical;
+    x += mp.horizontal;
+
+    x_dest = x + mp.shear[0] * y + remap.destTX - 0.5;
+    y_dest = y + mp.shear[1] * x + remap.destTY - 0.5;
+}
+
+inline bool ReprojectMapContext::isValid(double sx, double sy) const
+{
+    // The crop rect and circle of a fish eye camera may reach beyond the src image,
+    // so the src bounds are tested in both cases, which keeps the map, the mask
+    // and the spans built from the mask consistent.
+    if (sx < 0 || sy < 0 || sx >= srcWidth || sy >= srcHeight)
+        return false;
+    if (fishEye)
+        return sx >= cropX && sy >= cropY && sx < cropXEnd && sy < cropYEnd &&
+            (sx - centx) * (sx - centx) + (sy - centy) * (sy - centy) < sqrDist;
+    return true;
+}
+
+// Each index of the parallel range refers to one row of one camera,
+// so that cameras and rows are both distributed among threads.
+class ReprojectMapLoop : public cv::ParallelLoopBody
+{
+public:
+    ReprojectMapLoop(const std::vector<ReprojectMapContext>& contexts_,
+        std::vector<cv::Mat>& maps_, std::vector<cv::Mat>& masks_, bool compact_)
+        : contexts(contexts_), maps(maps_), masks(masks_), compact(compact_)
+    {
+        dstHeight = masks[0].rows;
+        dstWidth = masks[0].cols;
+    }
+
+    virtual ~ReprojectMapLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        for (int k = r.start; k < r.end; k++)
         {
-            cv::Point2d* ptrMap = map.ptr<cv::Point2d>(h);
-            unsigned char* ptrMask = mask.ptr<unsigned char>(h);
-            for (int w = 0; w < dstWidth; w++)
+            int index = k / dstHeight, h = k % dstHeight;
+            const ReprojectMapContext& context = contexts[index];
+            unsigned char* ptrMask = masks[index].ptr<unsigned char>(h);
+            // IMPORTANT NOTE!!!
+            // If the reproject params are later used to get reprojected images for multiband blending,
+            // invalid positions should be set to -1. In the reproject code, if the row and column 
+            // indexes are outside the bound of the src image, no reproject sampling is done.
+            // Multiband blending requires that src image pixle be zero if the corresponding mask image 
+            // position have zero value. Failing to meet the requirement will make the pyramid down operation
+            // produce wrong result.
+            if (compact)
             {
-                double sx, sy;
-                remap.remapImage(sx, sy, w, h);
-                if (sx >= param.cropX && sy >= param.cropY && 
-                    sx < param.cropX + param.cropWidth && sy < param.cropY + param.cropHeight &&
-                    (sx - centx) * (sx - centx) + (sy - centy) * (sy - centy) < sqrDist)
+                short* ptrMap = maps[index].ptr<short>(h);
+                for (int w = 0; w < dstWidth; w++)
                 {
-                    ptrMap[w].x = sx;
-                    ptrMap[w].y = sy;
-                    ptrMask[w] = 255;
+                    double sx, sy;
+                    context.remapImage(sx, sy, w, h);
+                    if (context.isValid(sx, sy))
+                    {
+                        setCompactMapPoint(sx, sy, context.srcWidth, context.srcHeight, ptrMap);
+                        ptrMask[w] = 255;
+                    }
+                    else
+                    {
+                        ptrMap[0] = -1;
+                        ptrMap[1] = -1;
+                        ptrMap[2] = 0;
+                        ptrMask[w] = 0;
+                    }
+                    ptrMap += 3;
                 }
-                else
+            }
+            else
+            {
+                cv::Point2d* ptrMap = maps[index].ptr<cv::Point2d>(h);
+                for (int w = 0; w < dstWidth; w++)
                 {
-                    // IMPORTANT NOTE!!!
-                    // If the reproject params are later used to get reprojected images for multiband blending,
-                    // the following two lines of code are necessary. In the reproject code, if the row and column 
-                    // indexes are outside the bound of the src image, no reproject sampling is done.
-                    // Multiband blending requires that src image pixle be zero if the corresponding mask image 
-                    // position have zero value. Failing to meet the requirement will make the pyramid down operation
-                    // produce wrong result.
-                    ptrMap[w].x = -1;
-                    ptrMap[w].y = -1;
+                    double sx, sy;
+                    context.remapImage(sx, sy, w, h);
+                    if (context.isValid(sx, sy))
+                    {
+                        ptrMap[w].x = sx;
+                        ptrMap[w].y = sy;
+                        ptrMask[w] = 255;
+                    }
+                    else
+                    {
+                        ptrMap[w].x = -1;
+                        ptrMap[w].y = -1;
+                        ptrMask[w] = 0;
+                    }
                 }
             }
         }
     }
-}
 
-void getReprojectMapsAndMasks(const std::vector<PhotoParam>& params,
-    const cv::Size& srcSize, const cv::Size& dstSize, std::vector<cv::Mat>& maps, std::vector<cv::Mat>& masks)
+    const std::vector<ReprojectMapContext>& contexts;
+    std::vector<cv::Mat>& maps;
+    std::vector<cv::Mat>& masks;
+    bool compact;
+    int dstWidth, dstHeight;
+};
+
+static void getReprojectMapsAndMasks(const std::vector<PhotoParam>& params, const cv::Size& srcSize, 
+    const cv::Size& dstSize, bool compact, std::vector<cv::Mat>& maps, std::vector<cv::Mat>& masks)
 {
+    if (compact)
+    {
+        CV_Assert(srcSize.width > 0 && srcSize.width <= SHRT_MAX &&
+            srcSize.height > 0 && srcSize.height <= SHRT_MAX);
+    }
+
     int num = params.size();
     maps.resize(num);
     masks.resize(num);
+    if (num == 0)
+        return;
+
+    std::vector<ReprojectMapContext> contexts(num);
     for (int i = 0; i < num; i++)
-        getReprojectMapAndMask(params[i], srcSize, dstSize, maps[i], masks[i]);
+    {
+        contexts[i].init(params[i], srcSize, dstSize);
+        maps[i].create(dstSize, compact ? CV_16SC3 : CV_64FC2);
+        masks[i].create(dstSize, CV_8UC1);
+    }
+
+    ReprojectMapLoop loop(contexts, maps, masks, compact);
+    cv::parallel_for_(cv::Range(0, num * dstSize.height), loop);
+}
+
+void getReprojectMapAndMask(const PhotoParam& param,
+    const cv::Size& srcSize, const cv::Size& dstSize, cv::Mat& map, cv::Mat& mask)
+{
+    std::vector<PhotoParam> params(1, param);
+    std::vector<cv::Mat> maps(1, map), masks(1, mask);
+    getReprojectMapsAndMasks(params, srcSize, dstSize, false, maps, masks);
+    map = maps[0];
+    mask = masks[0];
+}
+
+void getReprojectMapsAndMasks(const std::vector<PhotoParam>& params,
+    const cv::Size& srcSize, const cv::Size& dstSize, std::vector<cv::Mat>& maps, std::vector<cv::Mat>& masks)
+{
+    getReprojectMapsAndMasks(params, srcSize, dstSize, false, maps, masks);
 }
 
 void getReprojectMap32FAndMask(const PhotoParam& param, const cv::Size& srcSize, const cv::Size& dstSize,
@@ -308,6 +491,52 @@ void getReprojectMaps16SAndWeights32SAndMasks(const std::vector<PhotoParam>& par
         getReprojectMap16SAndWeight32SAndMask(params[i], srcSize, dstSize, maps[i], weights[i], masks[i]);
 }
 
+void convertReprojectMapToCompact(const cv::Mat& map64F, const cv::Size& srcSize, cv::Mat& map)
+{
+    CV_Assert(map64F.data && map64F.type() == CV_64FC2);
+    CV_Assert(srcSize.width > 0 && srcSize.width <= SHRT_MAX && 
+        srcSize.height > 0 && srcSize.height <= SHRT_MAX);
+
+    int srcWidth = srcSize.width, srcHeight = srcSize.height;
+    int rows = map64F.rows, cols = map64F.cols;
+    map.create(rows, cols, CV_16SC3);
+    for (int i = 0; i < rows; i++)
+    {
+        const double* ptrMap64F = map64F.ptr<double>(i);
+        short* ptrMap = map.ptr<short>(i);
+        for (int j = 0; j < cols; j++)
+        {
+            double x = ptrMap64F[0], y = ptrMap64F[1];
+            if (x < 0 || y < 0 || x >= srcWidth || y >= srcHeight)
+            {
+                ptrMap[0] = -1;
+                ptrMap[1] = -1;
+                ptrMap[2] = 0;
+            }
+            else
+                setCompactMapPoint(x, y, srcWidth, srcHeight, ptrMap);
+            ptrMap64F += 2;
+            ptrMap += 3;
+        }
+    }
+}
+
+void getReprojectMapCompactAndMask(const PhotoParam& param, const cv::Size& srcSize, const cv::Size& dstSize,
+    cv::Mat& map, cv::Mat& mask)
+{
+    std::vector<PhotoParam> params(1, param);
+    std::vector<cv::Mat> maps(1, map), masks(1, mask);
+    getReprojectMapsAndMasks(params, srcSize, dstSize, true, maps, masks);
+    map = maps[0];
+    mask = masks[0];
+}
+
+void getReprojectMapsCompactAndMasks(const std::vector<PhotoParam>& params, const cv::Size& srcSize, const cv::Size& dstSize,
+    std::vector<cv::Mat>& maps, std::vector<cv::Mat>& masks)
+{
+    getReprojectMapsAndMasks(params, srcSize, dstSize, true, maps, masks);
+}
+
 void reproject(const cv::Mat& src, cv::Mat& dst, cv::Mat& mask, 
     const PhotoParam& param, const cv::Size& dstSize)
 {    
@@ -490,6 +719,78 @@ public:
     int dstWidth, dstHeight;
 };
 
+template<typename DstElemType, int NumChannels>
+class ZReprojectCompactLoop : public cv::ParallelLoopBody
+{
+public:
+    ZReprojectCompactLoop(const cv::Mat& src_, cv::Mat& dst_, const cv::Mat& map_)
+        : src(src_), dst(dst_), map(map_)
+    {
+        srcWidth = src.cols, srcHeight = src.rows, srcStep = src.step;
+        dstWidth = map.cols, dstHeight = map.rows;
+        rowFunc = getCompactReprojectRowFunc(src.type(), dst.depth());
+    }
+
+    virtual ~ZReprojectCompactLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        const unsigned char* srcData = src.data;
+        int start = r.start, end = std::min(r.end, dstHeight);
+        if (rowFunc)
+        {
+            for (int h = start; h < end; h++)
+                rowFunc(srcData, srcWidth, srcHeight, srcStep, map.ptr<short>(h), dst.ptr<DstElemType>(h), dstWidth);
+            return;
+        }
+
+        int res[NumChannels];
+        for (int h = start; h < end; h++)
+        {
+            const short* ptrMap = map.ptr<short>(h);
+            DstElemType* ptrDstRow = dst.ptr<DstElemType>(h);
+            for (int w = 0; w < dstWidth; w++)
+            {
+                if (ptrMap[0] >= 0 && ptrMap[1] >= 0)
+                {
+                    compactBilinearResampling<NumChannels>(srcWidth, srcHeight, srcStep, srcData, ptrMap, res);
+                    for (int i = 0; i < NumChannels; i++)
+                        ptrDstRow[i] = compactBilinearCast<DstElemType>(res[i]);
+                }
+                else
+                {
+                    for (int i = 0; i < NumChannels; i++)
+                        ptrDstRow[i] = 0;
+                }
+                ptrMap += 3;
+                ptrDstRow += NumChannels;
+            }
+        }
+    }
+
+    const cv::Mat& src;
+    cv::Mat& dst;
+    const cv::Mat& map;
+    int srcWidth, srcHeight, srcStep;
+    int dstWidth, dstHeight;
+    CompactReprojectRowFunc rowFunc;
+};
+
+template<typename DstElemType, int NumChannels>
+static void runReprojectLoop(const cv::Mat& src, cv::Mat& dst, const cv::Mat& map)
+{
+    if (map.type() == CV_16SC3)
+    {
+        ZReprojectCompactLoop<DstElemType, NumChannels> loop(src, dst, map);
+        cv::parallel_for_(cv::Range(0, dst.rows), loop);
+    }
+    else
+    {
+        ZReprojectLoop<DstElemType, NumChannels> loop(src, dst, map);
+        cv::parallel_for_(cv::Range(0, dst.rows), loop);
+    }
+}
+
 void reprojectParallel(const cv::Mat& src, cv::Mat& dst, const cv::Mat& map)
 {
     //dst.create(map.size(), CV_8UC3);
@@ -498,29 +799,26 @@ void reprojectParallel(const cv::Mat& src, cv::Mat& dst, const cv::Mat& map)
     //cv::parallel_for_(cv::Range(0, dst.rows), loop);
 
     CV_Assert(src.data && src.depth() == CV_8U);
+    CV_Assert(map.data && (map.type() == CV_64FC2 || map.type() == CV_16SC3));
     int numChannels = src.channels();
     CV_Assert(numChannels > 0 && numChannels <= 4);
     dst.create(map.size(), CV_MAKETYPE(CV_8U, numChannels));
     dst.setTo(0);
     if (numChannels == 1)
     {
-        ZReprojectLoop<unsigned char, 1> loop(src, dst, map);
-        cv::parallel_for_(cv::Range(0, dst.rows), loop);
+        runReprojectLoop<unsigned char, 1>(src, dst, map);
     }
     else if (numChannels == 2)
     {
-        ZReprojectLoop<unsigned char, 2> loop(src, dst, map);
-        cv::parallel_for_(cv::Range(0, dst.rows), loop);
+        runReprojectLoop<unsigned char, 2>(src, dst, map);
     }
     else if (numChannels == 3)
     {
-        ZReprojectLoop<unsigned char, 3> loop(src, dst, map);
-        cv::parallel_for_(cv::Range(0, dst.rows), loop);
+        runReprojectLoop<unsigned char, 3>(src, dst, map);
     }
     else if (numChannels == 4)
     {
-        ZReprojectLoop<unsigned char, 4> loop(src, dst, map);
-        cv::parallel_for_(cv::Range(0, dst.rows), loop);
+        runReprojectLoop<unsigned char, 4>(src, dst, map);
     }
 }
 
@@ -540,29 +838,26 @@ void reprojectParallelTo16S(const cv::Mat& src, cv::Mat& dst, const cv::Mat& map
     //cv::parallel_for_(cv::Range(0, dst.rows), loop);
 
     CV_Assert(src.data && src.depth() == CV_8U);
+    CV_Assert(map.data && (map.type() == CV_64FC2 || map.type() == CV_16SC3));
     int numChannels = src.channels();
     CV_Assert(numChannels > 0 && numChannels <= 4);
     dst.create(map.size(), CV_MAKETYPE(CV_16S, numChannels));
     dst.setTo(0);
     if (numChannels == 1)
     {
-        ZReprojectLoop<short, 1> loop(src, dst, map);
-        cv::parallel_for_(cv::Range(0, dst.rows), loop);
+        runReprojectLoop<short, 1>(src, dst, map);
     }
     else if (numChannels == 2)
     {
-        ZReprojectLoop<short, 2> loop(src, dst, map);
-        cv::parallel_for_(cv::Range(0, dst.rows), loop);
+        runReprojectLoop<short, 2>(src, dst, map);
     }
     else if (numChannels == 3)
     {
-        ZReprojectLoop<short, 3> loop(src, dst, map);
-        cv::parallel_for_(cv::Range(0, dst.rows), loop);
+        runReprojectLoop<short, 3>(src, dst, map);
     }
     else if (numChannels == 4)
     {
-        ZReprojectLoop<short, 4> loop(src, dst, map);
-        cv::parallel_for_(cv::Range(0, dst.rows), loop);
+        runReprojectLoop<short, 4>(src, dst, map);
     }
 }
 
@@ -577,29 +872,26 @@ void reprojectParallelTo16S(const std::vector<cv::Mat>& src, std::vector<cv::Mat
 void reprojectParallelTo32F(const cv::Mat& src, cv::Mat& dst, const cv::Mat& map)
 {
     CV_Assert(src.data && src.depth() == CV_8U);
+    CV_Assert(map.data && (map.type() == CV_64FC2 || map.type() == CV_16SC3));
     int numChannels = src.channels();
     CV_Assert(numChannels > 0 && numChannels <= 4);
     dst.create(map.size(), CV_MAKETYPE(CV_32F, numChannels));
     dst.setTo(0);
     if (numChannels == 1)
     {
-        ZReprojectLoop<float, 1> loop(src, dst, map);
-        cv::parallel_for_(cv::Range(0, dst.rows), loop);
+        runReprojectLoop<float, 1>(src, dst, map);
     }
     else if (numChannels == 2)
     {
-        ZReprojectLoop<float, 2> loop(src, dst, map);
-        cv::parallel_for_(cv::Range(0, dst.rows), loop);
+        runReprojectLoop<float, 2>(src, dst, map);
     }
     else if (numChannels == 3)
     {
-        ZReprojectLoop<float, 3> loop(src, dst, map);
-        cv::parallel_for_(cv::Range(0, dst.rows), loop);
+        runReprojectLoop<float, 3>(src, dst, map);
     }
     else if (numChannels == 4)
     {
-        ZReprojectLoop<float, 4> loop(src, dst, map);
-        cv::parallel_for_(cv::Range(0, dst.rows), loop);
+        runReprojectLoop<float, 4>(src, dst, map);
     }
 }
 
@@ -679,13 +971,901 @@ public:
     int dstWidth, dstHeight;
 };
 
+class ReprojAccumCompactLoop : public cv::ParallelLoopBody
+{
+public:
+    ReprojAccumCompactLoop(const cv::Mat& src_, cv::Mat& dst_, const cv::Mat& map_, const cv::Mat& weight_)
+        : src(src_), dst(dst_), map(map_), weight(weight_)
+    {
+        srcWidth = src.cols, srcHeight = src.rows, srcStep = src.step;
+        dstWidth = map.cols, dstHeight = map.rows;
+    }
+
+    virtual ~ReprojAccumCompactLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        const unsigned char* srcData = src.data;
+        int start = r.start, end = std::min(r.end, dstHeight);
+        const float scale = 1.0F / (1 << COMPACT_MAP_BACK_SHIFT);
+        int res[3];
+        for (int h = start; h < end; h++)
+        {
+            const short* ptrMap = map.ptr<short>(h);
+            const float* ptrWeight = weight.ptr<float>(h);
+            cv::Vec3f* ptrDstRow = dst.ptr<cv::Vec3f>(h);
+            for (int w = 0; w < dstWidth; w++)
+            {
+                if (ptrMap[0] >= 0 && ptrMap[1] >= 0)
+                {
+                    compactBilinearResampling<3>(srcWidth, srcHeight, srcStep, srcData, ptrMap, res);
+                    float alpha = ptrWeight[w] * scale;
+                    ptrDstRow[w][0] += res[0] * alpha;
+                    ptrDstRow[w][1] += res[1] * alpha;
+                    ptrDstRow[w][2] += res[2] * alpha;
+                }
+                ptrMap += 3;
+            }
+        }
+    }
+
+    const cv::Mat& src;
+    cv::Mat& dst;
+    const cv::Mat& map;
+    const cv::Mat& weight;
+    int srcWidth, srcHeight, srcStep;
+    int dstWidth, dstHeight;
+};
+
 void reprojectWeightedAccumulateParallelTo32F(const cv::Mat& src, cv::Mat& dst,
     const cv::Mat& map, const cv::Mat& weight)
 {
     CV_Assert(src.data && src.type() == CV_8UC3 && dst.data && dst.type() == CV_32FC3 &&
-        map.data && map.type() == CV_64FC2 && weight.data && weight.type() == CV_32FC1 &&
+        map.data && (map.type() == CV_64FC2 || map.type() == CV_16SC3) && 
+        weight.data && weight.type() == CV_32FC1 &&
         dst.size() == map.size() && dst.size() == weight.size());
 
-    ReprojAccumLoop loop(src, dst, map, weight);
-    cv::parallel_for_(cv::Range(0, dst.rows), loop);
-}
\ No newline at end of file
+    if (map.type() == CV_16SC3)
+    {
+        ReprojAccumCompactLoop loop(src, dst, map, weight);
+        cv::parallel_for_(cv::Range(0, dst.rows), loop);
+    }
+    else
+    {
+        ReprojAccumLoop loop(src, dst, map, weight);
+        cv::parallel_for_(cv::Range(0, dst.rows), loop);
+    }
+}
+
+void getReprojectRowSpans(const cv::Mat& mask, ReprojectRowSpans& spans)
+{
+    CV_Assert(mask.data && mask.type() == CV_8UC1);
+
+    int rows = mask.rows, cols = mask.cols;
+    int minX = cols, maxX = -1, minY = rows, maxY = -1;
+    spans.rowIndexes.resize(rows + 1);
+    spans.spans.clear();
+    for (int i = 0; i < rows; i++)
+    {
+        spans.rowIndexes[i] = spans.spans.size();
+        const unsigned char* ptrMask = mask.ptr<unsigned char>(i);
+        int j = 0;
+        while (j < cols)
+        {
+            while (j < cols && !ptrMask[j])
+                j++;
+            if (j == cols)
+                break;
+            int beg = j;
+            while (j < cols && ptrMask[j])
+                j++;
+            spans.spans.push_back(cv::Range(beg, j));
+            minX = std::min(minX, beg);
+            maxX = std::max(maxX, j);
+            minY = std::min(minY, i);
+            maxY = i;
+        }
+    }
+    spans.rowIndexes[rows] = spans.spans.size();
+    if (maxX < 0)
+        spans.boundingRect = cv::Rect();
+    else
+        spans.boundingRect = cv::Rect(minX, minY, maxX - minX, maxY - minY + 1);
+}
+
+void getReprojectRowSpans(const std::vector<cv::Mat>& masks, std::vector<ReprojectRowSpans>& spans)
+{
+    int num = masks.size();
+    spans.resize(num);
+    for (int i = 0; i < num; i++)
+        getReprojectRowSpans(masks[i], spans[i]);
+}
+
+// Spans only skip the resampling of the pixels masked out, the src positions inside them 
+// are still bound checked, as the SIMD row functions do, since a mask given by the caller
+// need not agree with the map. Only rows inside the bounding rect of the spans are processed,
+// the gaps between spans inside the rect are zeroed, and invalid src positions inside spans
+// are written as zero. Pixels outside the rect are left as they are.
+template<typename DstElemType, int NumChannels>
+class ZReprojectSpansLoop : public cv::ParallelLoopBody
+{
+public:
+    ZReprojectSpansLoop(const cv::Mat& src_, cv::Mat& dst_, const cv::Mat& map_, const ReprojectRowSpans& spans_)
+        : src(src_), dst(dst_), map(map_), spans(spans_)
+    {
+        srcWidth = src.cols, srcHeight = src.rows, srcStep = src.step;
+        rectBeg = spans.boundingRect.x;
+        rectEnd = spans.boundingRect.x + spans.boundingRect.width;
+        compact = map.type() == CV_16SC3;
+        rowFunc = compact ? getCompactReprojectRowFunc(src.type(), dst.depth()) : 0;
+    }
+
+    virtual ~ZReprojectSpansLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        const unsigned char* srcData = src.data;
+        int res[NumChannels];
+        for (int h = r.start; h < r.end; h++)
+        {
+            DstElemType* ptrDstRow = dst.ptr<DstElemType>(h);
+            int spanBeg = spans.rowIndexes[h], spanEnd = spans.rowIndexes[h + 1];
+            int gapBeg = rectBeg;
+            for (int k = spanBeg; k < spanEnd; k++)
+            {
+                int beg = spans.spans[k].start, end = spans.spans[k].end;
+                if (beg > gapBeg)
+                    memset(ptrDstRow + gapBeg * NumChannels, 0, (beg - gapBeg) * NumChannels * sizeof(DstElemType));
+                gapBeg = end;
+                DstElemType* ptrDst = ptrDstRow + beg * NumChannels;
+                if (rowFunc)
+                    rowFunc(srcData, srcWidth, srcHeight, srcStep, map.ptr<short>(h) + beg * 3, ptrDst, end - beg);
+                else if (compact)
+                {
+                    const short* ptrMap = map.ptr<short>(h) + beg * 3;
+                    for (int w = beg; w < end; w++)
+                    {
+                        if (ptrMap[0] >= 0 && ptrMap[1] >= 0)
+                        {
+                            compactBilinearResampling<NumChannels>(srcWidth, srcHeight, srcStep, srcData, ptrMap, res);
+                            for (int i = 0; i < NumChannels; i++)
+                                ptrDst[i] = compactBilinearCast<DstElemType>(res[i]);
+                        }
+                        else
+                        {
+                            for (int i = 0; i < NumChannels; i++)
+                                ptrDst[i] = 0;
+                        }
+                        ptrMap += 3;
+                        ptrDst += NumChannels;
+                    }
+                }
+                else
+                {
+                    const cv::Point2d* ptrSrcPos = map.ptr<cv::Point2d>(h);
+                    for (int w = beg; w < end; w++)
+                    {
+                        cv::Point2d pt = ptrSrcPos[w];
+                        if (pt.x >= 0 && pt.y >= 0 && pt.x < srcWidth && pt.y < srcHeight)
+                            bilinearResampling<DstElemType, NumChannels>(srcWidth, srcHeight, srcStep, srcData, 
+                                pt.x, pt.y, ptrDst);
+                        else
+                        {
+                            for (int i = 0; i < NumChannels; i++)
+                                ptrDst[i] = 0;
+                        }
+                        ptrDst += NumChannels;
+                    }
+                }
+            }
+            if (rectEnd > gapBeg)
+                memset(ptrDstRow + gapBeg * NumChannels, 0, (rectEnd - gapBeg) * NumChannels * sizeof(DstElemType));
+        }
+    }
+
+    const cv::Mat& src;
+    cv::Mat& dst;
+    const cv::Mat& map;
+    const ReprojectRowSpans& spans;
+    int srcWidth, srcHeight, srcStep;
+    int rectBeg, rectEnd;
+    bool compact;
+    CompactReprojectRowFunc rowFunc;
+};
+
+template<typename DstElemType>
+static void reprojectParallelSpans(const cv::Mat& src, cv::Mat& dst, int dstDepth,
+    const cv::Mat& map, const ReprojectRowSpans& spans)
+{
+    CV_Assert(src.data && src.depth() == CV_8U);
+    CV_Assert(map.data && (map.type() == CV_64FC2 || map.type() == CV_16SC3));
+    CV_Assert(spans.rowIndexes.size() == map.rows + 1);
+    int numChannels = src.channels();
+    CV_Assert(numChannels > 0 && numChannels <= 4);
+
+    // Pixels outside the bounding rect of the spans are never written by the loop,
+    // they are zeroed only when dst is (re)allocated here, so the caller should pass back
+    // the same dst for the same spans, as the per camera buffers of a video do.
+    int dstType = CV_MAKETYPE(dstDepth, numChannels);
+    if (!dst.data || dst.size() != map.size() || dst.type() != dstType)
+    {
+        dst.create(map.size(), dstType);
+        dst.setTo(0);
+    }
+
+    const cv::Rect& rect = spans.boundingRect;
+    if (rect.area() == 0)
+        return;
+
+    cv::Range range(rect.y, rect.y + rect.height);
+    if (numChannels == 1)
+    {
+        ZReprojectSpansLoop<DstElemType, 1> loop(src, dst, map, spans);
+        cv::parallel_for_(range, loop);
+    }
+    else if (numChannels == 2)
+    {
+        ZReprojectSpansLoop<DstElemType, 2> loop(src, dst, map, spans);
+        cv::parallel_for_(range, loop);
+    }
+    else if (numChannels == 3)
+    {
+        ZReprojectSpansLoop<DstElemType, 3> loop(src, dst, map, spans);
+        cv::parallel_for_(range, loop);
+    }
+    else if (numChannels == 4)
+    {
+        ZReprojectSpansLoop<DstElemType, 4> loop(src, dst, map, spans);
+        cv::parallel_for_(range, loop);
+    }
+}
+
+void reprojectParallel(const cv::Mat& src, cv::Mat& dst, const cv::Mat& map, const ReprojectRowSpans& spans)
+{
+    reprojectParallelSpans<unsigned char>(src, dst, CV_8U, map, spans);
+}
+
+void reprojectParallel(const std::vector<cv::Mat>& src, std::vector<cv::Mat>& dst, 
+    const std::vector<cv::Mat>& maps, const std::vector<ReprojectRowSpans>& spans)
+{
+    CV_Assert(src.size() == maps.size() && src.size() == spans.size());
+    int numImages = src.size();
+    dst.resize(numImages);
+    for (int i = 0; i < numImages; i++)
+        reprojectParallel(src[i], dst[i], maps[i], spans[i]);
+}
+
+void reprojectParallelTo16S(const cv::Mat& src, cv::Mat& dst, const cv::Mat& map, const ReprojectRowSpans& spans)
+{
+    reprojectParallelSpans<short>(src, dst, CV_16S, map, spans);
+}
+
+void reprojectParallelTo16S(const std::vector<cv::Mat>& src, std::vector<cv::Mat>& dst,
+    const std::vector<cv::Mat>& maps, const std::vector<ReprojectRowSpans>& spans)
+{
+    CV_Assert(src.size() == maps.size() && src.size() == spans.size());
+    int numImages = src.size();
+    dst.resize(numImages);
+    for (int i = 0; i < numImages; i++)
+        reprojectParallelTo16S(src[i], dst[i], maps[i], spans[i]);
+}
+
+void reprojectParallelTo32F(const cv::Mat& src, cv::Mat& dst, const cv::Mat& map, const ReprojectRowSpans& spans)
+{
+    reprojectParallelSpans<float>(src, dst, CV_32F, map, spans);
+}
+
+class ReprojAccumSpansLoop : public cv::ParallelLoopBody
+{
+public:
+    ReprojAccumSpansLoop(const cv::Mat& src_, cv::Mat& dst_, const cv::Mat& map_, const cv::Mat& weight_,
+        const ReprojectRowSpans& spans_)
+        : src(src_), dst(dst_), map(map_), weight(weight_), spans(spans_)
+    {
+        srcWidth = src.cols, srcHeight = src.rows, srcStep = src.step;
+        compact = map.type() == CV_16SC3;
+    }
+
+    virtual ~ReprojAccumSpansLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        const unsigned char* srcData = src.data;
+        const float scale = 1.0F / (1 << COMPACT_MAP_BACK_SHIFT);
+        int res[3];
+        unsigned char dest[3];
+        for (int h = r.start; h < r.end; h++)
+        {
+            const float* ptrWeight = weight.ptr<float>(h);
+            cv::Vec3f* ptrDstRow = dst.ptr<cv::Vec3f>(h);
+            int spanBeg = spans.rowIndexes[h], spanEnd = spans.rowIndexes[h + 1];
+            for (int k = spanBeg; k < spanEnd; k++)
+            {
+                int beg = spans.spans[k].start, end = spans.spans[k].end;
+                if (compact)
+                {
+                    const short* ptrMap = map.ptr<short>(h) + beg * 3;
+                    for (int w = beg; w < end; w++)
+                    {
+                        if (ptrMap[0] >= 0 && ptrMap[1] >= 0)
+                        {
+                            compactBilinearResampling<3>(srcWidth, srcHeight, srcStep, srcData, ptrMap, res);
+                            float alpha = ptrWeight[w] * scale;
+                            ptrDstRow[w][0] += res[0] * alpha;
+                            ptrDstRow[w][1] += res[1] * alpha;
+                            ptrDstRow[w][2] += res[2] * alpha;
+                        }
+                        ptrMap += 3;
+                    }
+                }
+                else
+                {
+                    const cv::Point2d* ptrSrcPos = map.ptr<cv::Point2d>(h);
+                    for (int w = beg; w < end; w++)
+                    {
+                        cv::Point2d pt = ptrSrcPos[w];
+                        if (pt.x >= 0 && pt.y >= 0 && pt.x < srcWidth && pt.y < srcHeight)
+                        {
+                            bilinearResampling<unsigned char, 3>(srcWidth, srcHeight, srcStep, srcData, 
+                                pt.x, pt.y, dest);
+                            float alpha = ptrWeight[w];
+                            ptrDstRow[w][0] += dest[0] * alpha;
+                            ptrDstRow[w][1] += dest[1] * alpha;
+                            ptrDstRow[w][2] += dest[2] * alpha;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    const cv::Mat& src;
+    cv::Mat& dst;
+    const cv::Mat& map;
+    const cv::Mat& weight;
+    const ReprojectRowSpans& spans;
+    int srcWidth, srcHeight, srcStep;
+    bool compact;
+};
+
+void reprojectWeightedAccumulateParallelTo32F(const cv::Mat& src, cv::Mat& dst,
+    const cv::Mat& map, const cv::Mat& weight, const ReprojectRowSpans& spans)
+{
+    CV_Assert(src.data && src.type() == CV_8UC3 && dst.data && dst.type() == CV_32FC3 &&
+        map.data && (map.type() == CV_64FC2 || map.type() == CV_16SC3) &&
+        weight.data && weight.type() == CV_32FC1 &&
+        dst.size() == map.size() && dst.size() == weight.size());
+    CV_Assert(spans.rowIndexes.size() == map.rows + 1);
+
+    const cv::Rect& rect = spans.boundingRect;
+    if (rect.area() == 0)
+        return;
+
+    ReprojAccumSpansLoop loop(src, dst, map, weight, spans);
+    cv::parallel_for_(cv::Range(rect.y, rect.y + rect.height), loop);
+}
+
+class ReprojWeightedBlendLoop : public cv::ParallelLoopBody
+{
+public:
+    enum { TILE_WIDTH = 256 };
+
+    ReprojWeightedBlendLoop(const std::vector<cv::Mat>& src_, cv::Mat& dst_, const std::vector<cv::Mat>& maps_,
+        const std::vector<cv::Mat>& weights_, const std::vector<ReprojectRowSpans>& spans_)
+        : src(src_), dst(dst_), maps(maps_), weights(weights_), spans(spans_)
+    {
+        rowFunc = getCompactReprojectRowFunc(CV_8UC3, CV_32F);
+    }
+
+    virtual ~ReprojWeightedBlendLoop() {}
+
+    void accumulate(int index, int h, int beg, int end, float* ptrAccum, float* samples) const
+    {
+        const cv::Mat& image = src[index];
+        const cv::Mat& map = maps[index];
+        const float* ptrWeight = weights[index].ptr<float>(h);
+        int srcWidth = image.cols, srcHeight = image.rows, srcStep = image.step;
+        if (map.type() == CV_16SC3)
+        {
+            const short* ptrMap = map.ptr<short>(h) + beg * 3;
+            if (rowFunc)
+            {
+                // rowFunc writes zeros for invalid entries, they are skipped here
+                // as in the scalar path.
+                rowFunc(image.data, srcWidth, srcHeight, srcStep, ptrMap, samples, end - beg);
+                for (int w = beg; w < end; w++)
+                {
+                    if (ptrMap[0] >= 0 && ptrMap[1] >= 0)
+                    {
+                        float alpha = ptrWeight[w];
+                        ptrAccum[0] += samples[0] * alpha;
+                        ptrAccum[1] += samples[1] * alpha;
+                        ptrAccum[2] += samples[2] * alpha;
+                    }
+                    ptrMap += 3;
+                    samples += 3;
+                    ptrAccum += 3;
+                }
+            }
+            else
+            {
+                const float scale = 1.0F / (1 << COMPACT_MAP_BACK_SHIFT);
+                int res[3];
+                for (int w = beg; w < end; w++)
+                {
+                    if (ptrMap[0] >= 0 && ptrMap[1] >= 0)
+                    {
+                        compactBilinearResampling<3>(srcWidth, srcHeight, srcStep, image.data, ptrMap, res);
+                        float alpha = ptrWeight[w] * scale;
+                        ptrAccum[0] += res[0] * alpha;
+                        ptrAccum[1] += res[1] * alpha;
+                        ptrAccum[2] += res[2] * alpha;
+                    }
+                    ptrMap += 3;
+                    ptrAccum += 3;
+                }
+            }
+        }
+        else
+        {
+            const cv::Point2d* ptrSrcPos = map.ptr<cv::Point2d>(h);
+            unsigned char dest[3];
+            for (int w = beg; w < end; w++)
+            {
+                cv::Point2d pt = ptrSrcPos[w];
+                if (pt.x >= 0 && pt.y >= 0 && pt.x < srcWidth && pt.y < srcHeight)
+                {
+                    bilinearResampling<unsigned char, 3>(srcWidth, srcHeight, srcStep, image.data,
+                        pt.x, pt.y, dest);
+                    float alpha = ptrWeight[w];
+                    ptrAccum[0] += dest[0] * alpha;
+                    ptrAccum[1] += dest[1] * alpha;
+                    ptrAccum[2] += dest[2] * alpha;
+                }
+                ptrAccum += 3;
+            }
+        }
+    }
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        float accum[TILE_WIDTH * 3];
+        float samples[TILE_WIDTH * 3];
+        int numImages = src.size(), dstWidth = dst.cols;
+        for (int h = r.start; h < r.end; h++)
+        {
+            unsigned char* ptrDstRow = dst.ptr<unsigned char>(h);
+            for (int tileBeg = 0; tileBeg < dstWidth; tileBeg += TILE_WIDTH)
+            {
+                int tileEnd = std::min(tileBeg + TILE_WIDTH, dstWidth);
+                memset(accum, 0, (tileEnd - tileBeg) * 3 * sizeof(float));
+                for (int i = 0; i < numImages; i++)
+                {
+                    const ReprojectRowSpans& rowSpans = spans[i];
+                    int spanBeg = rowSpans.rowIndexes[h], spanEnd = rowSpans.rowIndexes[h + 1];
+                    for (int k = spanBeg; k < spanEnd; k++)
+                    {
+                        int beg = std::max(rowSpans.spans[k].start, tileBeg);
+                        int end = std::min(rowSpans.spans[k].end, tileEnd);
+                        if (beg < end)
+                            accumulate(i, h, beg, end, accum + (beg - tileBeg) * 3, samples);
+                    }
+                }
+                unsigned char* ptrDst = ptrDstRow + tileBeg * 3;
+                int count = (tileEnd - tileBeg) * 3;
+                for (int j = 0; j < count; j++)
+                    ptrDst[j] = cv::saturate_cast<unsigned char>(accum[j]);
+            }
+        }
+    }
+
+    const std::vector<cv::Mat>& src;
+    cv::Mat& dst;
+    const std::vector<cv::Mat>& maps;
+    const std::vector<cv::Mat>& weights;
+    const std::vector<ReprojectRowSpans>& spans;
+    CompactReprojectRowFunc rowFunc;
+};
+
+void reprojectWeightedBlendParallel(const std::vector<cv::Mat>& src, cv::Mat& dst,
+    const std::vector<cv::Mat>& maps, const std::vector<cv::Mat>& weights, 
+    const std::vector<ReprojectRowSpans>& spans)
+{
+    int numImages = src.size();
+    CV_Assert(numImages > 0 && maps.size() == numImages && weights.size() == numImages && spans.size() == numImages);
+    cv::Size dstSize = maps[0].size();
+    for (int i = 0; i < numImages; i++)
+    {
+        CV_Assert(src[i].data && src[i].type() == CV_8UC3 &&
+            maps[i].data && (maps[i].type() == CV_64FC2 || maps[i].type() == CV_16SC3) &&
+            weights[i].data && weights[i].type() == CV_32FC1 &&
+            maps[i].size() == dstSize && weights[i].size() == dstSize);
+        CV_Assert(spans[i].rowIndexes.size() == dstSize.height + 1);
+    }
+
+    dst.create(dstSize, CV_8UC3);
+    ReprojWeightedBlendLoop loop(src, dst, maps, weights, spans);
+    cv::parallel_for_(cv::Range(0, dstSize.height), loop);
+}
+
+inline cv::Point2d meshInterp(const cv::Point2d& p00, const cv::Point2d& p01, 
+    const cv::Point2d& p10, const cv::Point2d& p11, double u, double v)
+{
+    cv::Point2d left = p00 + (p10 - p00) * v;
+    cv::Point2d right = p01 + (p11 - p01) * v;
+    return left + (right - left) * u;
+}
+
+// Max interpolation error over the valid pixels of a width x height block whose 
+// top left pixel is (x, y) in exact, p00 to p11 are exact positions at (x, y), 
+// (x + step, y), (x, y + step) and (x + step, y + step).
+static double meshInterpError(const cv::Point2d* exact, int exactStep, const unsigned char* mask, int maskStep,
+    int x, int y, int width, int height, int step, const cv::Point2d& p00, const cv::Point2d& p01,
+    const cv::Point2d& p10, const cv::Point2d& p11)
+{
+    double maxError = 0;
+    for (int i = 0; i < height; i++)
+    {
+        const cv::Point2d* ptrExact = exact + (y + i) * exactStep + x;
+        const unsigned char* ptrMask = mask + (y + i) * maskStep + x;
+        double v = double(i) / step;
+        for (int j = 0; j < width; j++)
+        {
+            if (!ptrMask[j])
+                continue;
+            cv::Point2d pt = meshInterp(p00, p01, p10, p11, double(j) / step, v);
+            double error = std::max(fabs(pt.x - ptrExact[j].x), fabs(pt.y - ptrExact[j].y));
+            if (error > maxError)
+                maxError = error;
+        }
+    }
+    return maxError;
+}
+
+class ReprojectMeshGridLoop : public cv::ParallelLoopBody
+{
+public:
+    ReprojectMeshGridLoop(const ReprojectMapContext& context_, cv::Mat& grid_, int cellSize_)
+        : context(context_), grid(grid_), cellSize(cellSize_)
+    {
+    }
+
+    virtual ~ReprojectMeshGridLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        for (int i = r.start; i < r.end; i++)
+        {
+            cv::Point2d* ptrGrid = grid.ptr<cv::Point2d>(i);
+            for (int j = 0; j < grid.cols; j++)
+                context.remapImage(ptrGrid[j].x, ptrGrid[j].y, j * cellSize, i * cellSize);
+        }
+    }
+
+    const ReprojectMapContext& context;
+    cv::Mat& grid;
+    int cellSize;
+};
+
+// Each index of the parallel range refers to one row of cells. Fine and dense points 
+// of each row of cells are collected separately with offsets local to the row,
+// and are concatenated after the parallel loop.
+class ReprojectMeshCellLoop : public cv::ParallelLoopBody
+{
+public:
+    ReprojectMeshCellLoop(const ReprojectMapContext& context_, ReprojectMeshMap& map_, cv::Mat& mask_, double maxError_,
+        std::vector<std::vector<cv::Point2d> >& rowFinePoints_, std::vector<std::vector<cv::Point2d> >& rowDensePoints_)
+        : context(context_), map(map_), mask(mask_), maxError(maxError_), 
+          rowFinePoints(rowFinePoints_), rowDensePoints(rowDensePoints_)
+    {
+    }
+
+    virtual ~ReprojectMeshCellLoop() {}
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        const int numSubDivs = ReprojectMeshMap::numSubDivs;
+        const int numFinePoints = (numSubDivs + 1) * (numSubDivs + 1);
+        int cellSize = map.cellSize, subSize = cellSize / numSubDivs;
+        int dstWidth = mask.cols, dstHeight = mask.rows;
+        std::vector<cv::Point2d> exact(cellSize * cellSize);
+        cv::Point2d finePoints[numFinePoints];
+        for (int cy = r.start; cy < r.end; cy++)
+        {
+            std::vector<cv::Point2d>& fine = rowFinePoints[cy];
+            std::vector<cv::Point2d>& dense = rowDensePoints[cy];
+            const cv::Point2d* ptrGrid0 = map.grid.ptr<cv::Point2d>(cy);
+            const cv::Point2d* ptrGrid1 = map.grid.ptr<cv::Point2d>(cy + 1);
+            int* ptrCells = map.cells.ptr<int>(cy);
+            int yBeg = cy * cellSize, cellHeight = std::min(cellSize, dstHeight - yBeg);
+            for (int cx = 0; cx < map.cells.cols; cx++)
+            {
+                int xBeg = cx * cellSize, cellWidth = std::min(cellSize, dstWidth - xBeg);
+                bool hasValid = false;
+                for (int i = 0; i < cellHeight; i++)
+                {
+                    unsigned char* ptrMask = mask.ptr<unsigned char>(yBeg + i) + xBeg;
+                    cv::Point2d* ptrExact = &exact[i * cellWidth];
+                    for (int j = 0; j < cellWidth; j++)
+                    {
+                        context.remapImage(ptrExact[j].x, ptrExact[j].y, xBeg + j, yBeg + i);
+                        ptrMask[j] = context.isValid(ptrExact[j].x, ptrExact[j].y) ? 255 : 0;
+                        hasValid |= ptrMask[j] != 0;
+                    }
+                }
+
+                if (!hasValid)
+                {
+                    ptrCells[cx * 2] = ReprojectMeshMap::CellEmpty;
+                    ptrCells[cx * 2 + 1] = 0;
+                    continue;
+                }
+
+                const unsigned char* cellMask = mask.ptr<unsigned char>(yBeg) + xBeg;
+                int maskStep = mask.step;
+                if (meshInterpError(&exact[0], cellWidth, cellMask, maskStep, 0, 0, cellWidth, cellHeight, cellSize,
+                    ptrGrid0[cx], ptrGrid0[cx + 1], ptrGrid1[cx], ptrGrid1[cx + 1]) <= maxError)
+                {
+                    ptrCells[cx * 2] = ReprojectMeshMap::CellCoarse;
+                    ptrCells[cx * 2 + 1] = 0;
+                    continue;
+                }
+
+                for (int i = 0; i <= numSubDivs; i++)
+                {
+                    for (int j = 0; j <= numSubDivs; j++)
+                    {
+                        cv::Point2d& pt = finePoints[i * (numSubDivs + 1) + j];
+                        context.remapImage(pt.x, pt.y, xBeg + j * subSize, yBeg + i * subSize);
+                    }
+                }
+                bool fineOK = true;
+                for (int i = 0; i < numSubDivs && fineOK; i++)
+                {
+                    int y = i * subSize, subHeight = std::min(subSize, cellHeight - y);
+                    if (subHeight <= 0)
+                        break;
+                    const cv::Point2d* ptrFine = finePoints + i * (numSubDivs + 1);
+                    for (int j = 0; j < numSubDivs; j++)
+                    {
+                        int x = j * subSize, subWidth = std::min(subSize, cellWidth - x);
+                        if (subWidth <= 0)
+                            break;
+                        if (meshInterpError(&exact[0], cellWidth, cellMask, maskStep, x, y, subWidth, subHeight, subSize,
+                            ptrFine[j], ptrFine[j + 1], ptrFine[j + numSubDivs + 1], ptrFine[j + numSubDivs + 2]) > maxError)
+                        {
+                            fineOK = false;
+                            break;
+                        }
+                    }
+                }
+
+                if (fineOK)
+                {
+                    ptrCells[cx * 2] = ReprojectMeshMap::CellFine;
+                    ptrCells[cx * 2 + 1] = fine.size();
+                    fine.insert(fine.end(), finePoints, finePoints + numFinePoints);
+                }
+                else
+                {
+                    ptrCells[cx * 2] = ReprojectMeshMap::CellDense;
+                    ptrCells[cx * 2 + 1] = dense.size();
+                    dense.insert(dense.end(), exact.begin(), exact.begin() + cellWidth * cellHeight);
+                }
+            }
+        }
+    }
+
+    const ReprojectMapContext& context;
+    ReprojectMeshMap& map;
+    cv::Mat& mask;
+    double maxError;
+    std::vector<std::vector<cv::Point2d> >& rowFinePoints;
+    std::vector<std::vector<cv::Point2d> >& rowDensePoints;
+};
+
+void getReprojectMeshMapAndMask(const PhotoParam& param, const cv::Size& srcSize, const cv::Size& dstSize,
+    ReprojectMeshMap& map, cv::Mat& mask, int cellSize, double maxError)
+{
+    CV_Assert(cellSize >= ReprojectMeshMap::numSubDivs && cellSize % ReprojectMeshMap::numSubDivs == 0);
+    CV_Assert(maxError > 0);
+
+    int numCellRows = (dstSize.height + cellSize - 1) / cellSize;
+    int numCellCols = (dstSize.width + cellSize - 1) / cellSize;
+
+    // Grid points of the last row and column of cells may lie beyond the dst image.
+    ReprojectMapContext context;
+    context.init(param, srcSize, dstSize, cv::Size(numCellCols * cellSize + 1, numCellRows * cellSize + 1));
+
+    map.srcSize = srcSize;
+    map.cellSize = cellSize;
+    map.grid.create(numCellRows + 1, numCellCols + 1, CV_64FC2);
+    map.cells.create(numCellRows, numCellCols, CV_32SC2);
+    map.finePoints.clear();
+    map.densePoints.clear();
+    mask.create(dstSize, CV_8UC1);
+
+    ReprojectMeshGridLoop gridLoop(context, map.grid, cellSize);
+    cv::parallel_for_(cv::Range(0, map.grid.rows), gridLoop);
+
+    std::vector<std::vector<cv::Point2d> > rowFinePoints(numCellRows), rowDensePoints(numCellRows);
+    ReprojectMeshCellLoop cellLoop(context, map, mask, maxError, rowFinePoints, rowDensePoints);
+    cv::parallel_for_(cv::Range(0, numCellRows), cellLoop);
+
+    for (int i = 0; i < numCellRows; i++)
+    {
+        int fineOffset = map.finePoints.size(), denseOffset = map.densePoints.size();
+        int* ptrCells = map.cells.ptr<int>(i);
+        for (int j = 0; j < numCellCols; j++)
+        {
+            if (ptrCells[j * 2] == ReprojectMeshMap::CellFine)
+                ptrCells[j * 2 + 1] += fineOffset;
+            else if (ptrCells[j * 2] == ReprojectMeshMap::CellDense)
+                ptrCells[j * 2 + 1] += denseOffset;
+        }
+        map.finePoints.insert(map.finePoints.end(), rowFinePoints[i].begin(), rowFinePoints[i].end());
+        map.densePoints.insert(map.densePoints.end(), rowDensePoints[i].begin(), rowDensePoints[i].end());
+    }
+    map.mask = mask;
+}
+
+void getReprojectMeshMapsAndMasks(const std::vector<PhotoParam>& params, const cv::Size& srcSize, const cv::Size& dstSize,
+    std::vector<ReprojectMeshMap>& maps, std::vector<cv::Mat>& masks, int cellSize, double maxError)
+{
+    int num = params.size();
+    maps.resize(num);
+    masks.resize(num);
+    for (int i = 0; i < num; i++)
+        getReprojectMeshMapAndMask(params[i], srcSize, dstSize, maps[i], masks[i], cellSize, maxError);
+}
+
+template<typename DstElemType, int NumChannels>
+class ZReprojectMeshLoop : public cv::ParallelLoopBody
+{
+public:
+    ZReprojectMeshLoop(const cv::Mat& src_, cv::Mat& dst_, const ReprojectMeshMap& map_)
+        : src(src_), dst(dst_), map(map_)
+    {
+        srcWidth = src.cols, srcHeight = src.rows, srcStep = src.step;
+        dstWidth = dst.cols, dstHeight = dst.rows;
+    }
+
+    virtual ~ZReprojectMeshLoop() {}
+
+    // Interpolated positions may slightly exceed the src image near its border.
+    inline void resample(cv::Point2d pt, DstElemType* ptrDst) const
+    {
+        pt.x = pt.x < 0 ? 0 : (pt.x > srcWidth - 1 ? srcWidth - 1 : pt.x);
+        pt.y = pt.y < 0 ? 0 : (pt.y > srcHeight - 1 ? srcHeight - 1 : pt.y);
+        bilinearResampling<DstElemType, NumChannels>(srcWidth, srcHeight, srcStep, src.data, pt.x, pt.y, ptrDst);
+    }
+
+    virtual void operator()(const cv::Range& r) const
+    {
+        const int numSubDivs = ReprojectMeshMap::numSubDivs;
+        int cellSize = map.cellSize, subSize = cellSize / numSubDivs;
+        int start = r.start, end = std::min(r.end, dstHeight);
+        for (int h = start; h < end; h++)
+        {
+            int cy = h / cellSize, yBeg = cy * cellSize, y = h - yBeg;
+            int cellHeight = std::min(cellSize, dstHeight - yBeg);
+            double v = double(y) / cellSize;
+            int sy = y / subSize;
+            double sv = double(y - sy * subSize) / subSize;
+            const cv::Point2d* ptrGrid0 = map.grid.ptr<cv::Point2d>(cy);
+            const cv::Point2d* ptrGrid1 = map.grid.ptr<cv::Point2d>(cy + 1);
+            const int* ptrCells = map.cells.ptr<int>(cy);
+            const unsigned char* ptrMask = map.mask.ptr<unsigned char>(h);
+            DstElemType* ptrDstRow = dst.ptr<DstElemType>(h);
+            for (int cx = 0; cx < map.cells.cols; cx++)
+            {
+                int type = ptrCells[cx * 2], offset = ptrCells[cx * 2 + 1];
+                int xBeg = cx * cellSize, xEnd = std::min(xBeg + cellSize, dstWidth);
+                if (type == ReprojectMeshMap::CellCoarse)
+                {
+                    for (int w = xBeg; w < xEnd; w++)
+                    {
+                        if (ptrMask[w])
+                            resample(meshInterp(ptrGrid0[cx], ptrGrid0[cx + 1], ptrGrid1[cx], ptrGrid1[cx + 1], 
+                                double(w - xBeg) / cellSize, v), ptrDstRow + w * NumChannels);
+                    }
+                }
+                else if (type == ReprojectMeshMap::CellFine)
+                {
+                    const cv::Point2d* ptrFine = &map.finePoints[offset] + sy * (numSubDivs + 1);
+                    for (int w = xBeg; w < xEnd; w++)
+                    {
+                        if (!ptrMask[w])
+                            continue;
+                        int x = w - xBeg, sx = x / subSize;
+                        resample(meshInterp(ptrFine[sx], ptrFine[sx + 1], ptrFine[sx + numSubDivs + 1], ptrFine[sx + numSubDivs + 2],
+                            double(x - sx * subSize) / subSize, sv), ptrDstRow + w * NumChannels);
+                    }
+                }
+                else if (type == ReprojectMeshMap::CellDense)
+                {
+                    const cv::Point2d* ptrDense = &map.densePoints[offset + y * (xEnd - xBeg)];
+                    for (int w = xBeg; w < xEnd; w++)
+                    {
+                        if (ptrMask[w])
+                            resample(ptrDense[w - xBeg], ptrDstRow + w * NumChannels);
+                    }
+                }
+            }
+        }
+    }
+
+    const cv::Mat& src;
+    cv::Mat& dst;
+    const ReprojectMeshMap& map;
+    int srcWidth, srcHeight, srcStep;
+    int dstWidth, dstHeight;
+};
+
+template<typename DstElemType>
+static void reprojectParallelMesh(const cv::Mat& src, cv::Mat& dst, int dstDepth, const ReprojectMeshMap& map)
+{
+    CV_Assert(src.data && src.depth() == CV_8U && src.size() == map.srcSize);
+    CV_Assert(map.grid.data && map.cells.data && map.mask.data);
+    int numChannels = src.channels();
+    CV_Assert(numChannels > 0 && numChannels <= 4);
+    dst.create(map.mask.size(), CV_MAKETYPE(dstDepth, numChannels));
+    dst.setTo(0);
+
+    cv::Range range(0, dst.rows);
+    if (numChannels == 1)
+    {
+        ZReprojectMeshLoop<DstElemType, 1> loop(src, dst, map);
+        cv::parallel_for_(range, loop);
+    }
+    else if (numChannels == 2)
+    {
+        ZReprojectMeshLoop<DstElemType, 2> loop(src, dst, map);
+        cv::parallel_for_(range, loop);
+    }
+    else if (numChannels == 3)
+    {
+        ZReprojectMeshLoop<DstElemType, 3> loop(src, dst, map);
+        cv::parallel_for_(range, loop);
+    }
+    else if (numChannels == 4)
+    {
+        ZReprojectMeshLoop<DstElemType, 4> loop(src, dst, map);
+        cv::parallel_for_(range, loop);
+    }
+}
+
+void reprojectParallel(const cv::Mat& src, cv::Mat& dst, const ReprojectMeshMap& map)
+{
+    reprojectParallelMesh<unsigned char>(src, dst, CV_8U, map);
+}
+
+void reprojectParallel(const std::vector<cv::Mat>& src, std::vector<cv::Mat>& dst, 
+    const std::vector<ReprojectMeshMap>& maps)
+{
+    CV_Assert(src.size() == maps.size());
+    int numImages = src.size();
+    dst.resize(numImages);
+    for (int i = 0; i < numImages; i++)
+        reprojectParallel(src[i], dst[i], maps[i]);
+}
+
+void reprojectParallelTo16S(const cv::Mat& src, cv::Mat& dst, const ReprojectMeshMap& map)
+{
+    reprojectParallelMesh<short>(src, dst, CV_16S, map);
+}
+
+void reprojectParallelTo16S(const std::vector<cv::Mat>& src, std::vector<cv::Mat>& dst,
+    const std::vector<ReprojectMeshMap>& maps)
+{
+    CV_Assert(src.size() == maps.size());
+    int numImages = src.size();
+    dst.resize(numImages);
+    for (int i = 0; i < numImages; i++)
+        reprojectParallelTo16S(src[i], dst[i], maps[i]);
+}
+
+void reprojectParallelTo32F(const cv::Mat& src, cv::Mat& dst, const ReprojectMeshMap& map)
+{
+    reprojectParallelMesh<float>(src, dst, CV_32F, map);
+}
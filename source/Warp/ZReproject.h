@@ -109,6 +109,23 @@ void getReprojectMap32FAndMask(const PhotoParam& param, const cv::Size& srcSize,
 void getReprojectMaps32FAndMasks(const std::vector<PhotoParam>& params, const cv::Size& srcSize, const cv::Size& dstSize,
     std::vector<cv::Mat>& dstSrcXMaps, std::vector<cv::Mat>& dstSrcYMaps, std::vector<cv::Mat>& masks);
 
+// Compact map of type CV_16SC3, 6 bytes per pixel instead of 16 bytes of the CV_64FC2 map.
+// Channel 0 and 1 hold the integer part of src x and y, channel 2 holds the fractional part
+// quantized to 1/32 pixel, packed as (fy << 5) | fx. Invalid positions hold x = y = -1.
+// reprojectParallel, reprojectParallelTo16S, reprojectParallelTo32F and 
+// reprojectWeightedAccumulateParallelTo32F accept both CV_64FC2 and compact maps.
+void getReprojectMapCompactAndMask(const PhotoParam& param, const cv::Size& srcSize, const cv::Size& dstSize,
+    cv::Mat& dstSrcMap, cv::Mat& mask);
+
+void getReprojectMapsCompactAndMasks(const std::vector<PhotoParam>& params, const cv::Size& srcSize, const cv::Size& dstSize,
+    std::vector<cv::Mat>& dstSrcMaps, std::vector<cv::Mat>& masks);
+
+void convertReprojectMapToCompact(const cv::Mat& dstSrcMap, const cv::Size& srcSize, cv::Mat& dstSrcCompactMap);
+
+// Enable or disable the SSE4.1 and AVX2 kernels used for compact maps and 8UC3 or 8UC4 src images.
+// They are enabled by default and selected at run time according to cpu support.
+void setReprojectUseSIMD(bool useSIMD);
+
 void getReprojectMap16SAndWeight32SAndMask(const PhotoParam& param, const cv::Size& srcSize, const cv::Size& dstSize,
     cv::Mat& dstSrcMap, cv::Mat& weight, cv::Mat& mask);
 
@@ -141,6 +158,105 @@ void reprojectWeightedAccumulateTo32F(const cv::Mat& src, cv::Mat& dst,
 void reprojectWeightedAccumulateParallelTo32F(const cv::Mat& src, cv::Mat& dst,
     const cv::Mat& dstSrcMap, const cv::Mat& weight);
 
+// Horizontal runs of non zero pixels of the mask produced together with a reprojection map.
+// Spans of row i are spans[rowIndexes[i]] to spans[rowIndexes[i + 1] - 1],
+// the start of each span is inclusive and the end is exclusive.
+// boundingRect is the bounding rect of all the spans.
+struct ReprojectRowSpans
+{
+    std::vector<int> rowIndexes;
+    std::vector<cv::Range> spans;
+    cv::Rect boundingRect;
+};
+
+void getReprojectRowSpans(const cv::Mat& mask, ReprojectRowSpans& spans);
+
+void getReprojectRowSpans(const std::vector<cv::Mat>& masks, std::vector<ReprojectRowSpans>& spans);
+
+// The following functions only resample pixels inside spans, which should be 
+// got from the mask produced together with dstSrcMap. 
+// Pixels inside the bounding rect of spans but outside spans, and pixels with invalid 
+// src positions, are set to zero. Pixels outside the bounding rect are zeroed only when 
+// dst is (re)allocated, so the caller should pass back the same dst for the same spans.
+void reprojectParallel(const cv::Mat& src, cv::Mat& dst, const cv::Mat& dstSrcMap, 
+    const ReprojectRowSpans& spans);
+
+void reprojectParallel(const std::vector<cv::Mat>& src, std::vector<cv::Mat>& dst, 
+    const std::vector<cv::Mat>& dstSrcMaps, const std::vector<ReprojectRowSpans>& spans);
+
+void reprojectParallelTo16S(const cv::Mat& src, cv::Mat& dst, const cv::Mat& dstSrcMap,
+    const ReprojectRowSpans& spans);
+
+void reprojectParallelTo16S(const std::vector<cv::Mat>& src, std::vector<cv::Mat>& dst, 
+    const std::vector<cv::Mat>& dstSrcMaps, const std::vector<ReprojectRowSpans>& spans);
+
+void reprojectParallelTo32F(const cv::Mat& src, cv::Mat& dst, const cv::Mat& dstSrcMap,
+    const ReprojectRowSpans& spans);
+
+void reprojectWeightedAccumulateParallelTo32F(const cv::Mat& src, cv::Mat& dst,
+    const cv::Mat& dstSrcMap, const cv::Mat& weight, const ReprojectRowSpans& spans);
+
+// Single pass linear blending of all the src images into dst of type CV_8UC3.
+// dst is processed in tiles, for each tile the src images whose spans cover it are resampled
+// and accumulated with their weights in a small buffer that stays in cache, so dst is
+// written once and no full size accumulator is needed. The result is the same as zeroing 
+// a CV_32FC3 accumulator, calling reprojectWeightedAccumulateParallelTo32F for each src image 
+// and converting the accumulator to CV_8U.
+void reprojectWeightedBlendParallel(const std::vector<cv::Mat>& src, cv::Mat& dst,
+    const std::vector<cv::Mat>& dstSrcMaps, const std::vector<cv::Mat>& weights, 
+    const std::vector<ReprojectRowSpans>& spans);
+
+// Mesh warp map. Exact src positions are only stored on the corners of a grid of 
+// cellSize x cellSize cells, positions inside a cell are bilinearly interpolated 
+// from the corners while reprojecting. Cells whose interpolation error exceeds maxError,
+// usually close to the poles of the dst image or the rim of fisheye images, are subdivided
+// into ReprojectMeshMap::numSubDivs x ReprojectMeshMap::numSubDivs sub cells,
+// and cells whose sub cells still exceed maxError store exact src positions of every pixel.
+// The error is checked on every valid pixel when the map is built.
+// mask shares data with the mask got together with the mesh map, pixels with zero mask value
+// are not resampled. The mask takes one byte per dst pixel, so the mesh map with its mask
+// is never smaller than 1/16 of the CV_64FC2 map.
+struct ReprojectMeshMap
+{
+    enum CellType
+    {
+        CellEmpty,
+        CellCoarse,
+        CellFine,
+        CellDense
+    };
+    enum { numSubDivs = 4 };
+
+    cv::Size srcSize;
+    int cellSize;
+    // CV_64FC2, (number of cell rows + 1) x (number of cell cols + 1)
+    cv::Mat grid;
+    // CV_32SC2, cell type and offset into finePoints or densePoints of each cell
+    cv::Mat cells;
+    std::vector<cv::Point2d> finePoints;
+    std::vector<cv::Point2d> densePoints;
+    cv::Mat mask;
+};
+
+// cellSize should be a multiple of ReprojectMeshMap::numSubDivs.
+void getReprojectMeshMapAndMask(const PhotoParam& param, const cv::Size& srcSize, const cv::Size& dstSize,
+    ReprojectMeshMap& dstSrcMap, cv::Mat& mask, int cellSize = 16, double maxError = 0.1);
+
+void getReprojectMeshMapsAndMasks(const std::vector<PhotoParam>& params, const cv::Size& srcSize, const cv::Size& dstSize,
+    std::vector<ReprojectMeshMap>& dstSrcMaps, std::vector<cv::Mat>& masks, int cellSize = 16, double maxError = 0.1);
+
+void reprojectParallel(const cv::Mat& src, cv::Mat& dst, const ReprojectMeshMap& dstSrcMap);
+
+void reprojectParallel(const std::vector<cv::Mat>& src, std::vector<cv::Mat>& dst, 
+    const std::vector<ReprojectMeshMap>& dstSrcMaps);
+
+void reprojectParallelTo16S(const cv::Mat& src, cv::Mat& dst, const ReprojectMeshMap& dstSrcMap);
+
+void reprojectParallelTo16S(const std::vector<cv::Mat>& src, std::vector<cv::Mat>& dst, 
+    const std::vector<ReprojectMeshMap>& dstSrcMaps);
+
+void reprojectParallelTo32F(const cv::Mat& src, cv::Mat& dst, const ReprojectMeshMap& dstSrcMap);
+
 // right left top bottom front back
 enum CubeType
 {
@@ -0,0 +1,89 @@
+#pragma once
+
+// Helpers shared by the scalar and SIMD kernels working on compact maps,
+// see getReprojectMapCompactAndMask for the map layout.
+
+static const int COMPACT_MAP_FRAC_BITS = 5;
+static const int COMPACT_MAP_FRAC_UNIT = 1 << COMPACT_MAP_FRAC_BITS;
+static const int COMPACT_MAP_FRAC_MASK = COMPACT_MAP_FRAC_UNIT - 1;
+static const int COMPACT_MAP_BACK_SHIFT = COMPACT_MAP_FRAC_BITS * 2;
+static const int COMPACT_MAP_HALF = 1 << (COMPACT_MAP_BACK_SHIFT - 1);
+
+// Encode a valid src position (x, y) into one compact map entry.
+// (x, y) should be inside the src image, ReprojectMapContext::isValid tests this
+// for both normal and fish eye cameras, so only the upper bound needs clamping.
+inline void setCompactMapPoint(double x, double y, int srcWidth, int srcHeight, short* ptrMap)
+{
+    CV_DbgAssert(x >= 0 && y >= 0 && x < srcWidth && y < srcHeight);
+    int ix = cvRound(x * COMPACT_MAP_FRAC_UNIT);
+    int iy = cvRound(y * COMPACT_MAP_FRAC_UNIT);
+    int x0 = ix >> COMPACT_MAP_FRAC_BITS, y0 = iy >> COMPACT_MAP_FRAC_BITS;
+    int fx = ix & COMPACT_MAP_FRAC_MASK, fy = iy & COMPACT_MAP_FRAC_MASK;
+    // Rounding may push the position onto the right or bottom border,
+    // clamp it back to the last column or row.
+    if (x0 > srcWidth - 1)
+    {
+        x0 = srcWidth - 1;
+        fx = 0;
+    }
+    if (y0 > srcHeight - 1)
+    {
+        y0 = srcHeight - 1;
+        fy = 0;
+    }
+    ptrMap[0] = x0;
+    ptrMap[1] = y0;
+    ptrMap[2] = (fy << COMPACT_MAP_FRAC_BITS) | fx;
+}
+
+template<typename DstElemType>
+inline DstElemType compactBilinearCast(int val)
+{
+    return (val + COMPACT_MAP_HALF) >> COMPACT_MAP_BACK_SHIFT;
+}
+
+template<>
+inline float compactBilinearCast<float>(int val)
+{
+    return val * (1.0F / (1 << COMPACT_MAP_BACK_SHIFT));
+}
+
+// Output values are scaled by 1 << COMPACT_MAP_BACK_SHIFT.
+// The src position encoded in ptrMap should be valid, callers test ptrMap[0] >= 0 && ptrMap[1] >= 0 first.
+template<int NumChannels>
+inline void compactBilinearResampling(int width, int height, int step, const unsigned char* src,
+    const short* ptrMap, int dst[NumChannels])
+{
+    int x0 = ptrMap[0], y0 = ptrMap[1];
+    int fx = ptrMap[2] & COMPACT_MAP_FRAC_MASK, fy = ptrMap[2] >> COMPACT_MAP_FRAC_BITS;
+    int wx0 = COMPACT_MAP_FRAC_UNIT - fx, wy0 = COMPACT_MAP_FRAC_UNIT - fy;
+    int x1 = x0 < width - 1 ? x0 + 1 : x0;
+    int y1 = y0 < height - 1 ? y0 + 1 : y0;
+    const unsigned char* ptr00 = src + step * y0 + x0 * NumChannels;
+    const unsigned char* ptr01 = src + step * y0 + x1 * NumChannels;
+    const unsigned char* ptr10 = src + step * y1 + x0 * NumChannels;
+    const unsigned char* ptr11 = src + step * y1 + x1 * NumChannels;
+    for (int i = 0; i < NumChannels; i++)
+        dst[i] = (ptr00[i] * wx0 + ptr01[i] * fx) * wy0 + (ptr10[i] * wx0 + ptr11[i] * fx) * fy;
+}
+
+template<typename DstElemType, int NumChannels>
+inline void compactBilinearResampling(int width, int height, int step, const unsigned char* src,
+    const short* ptrMap, DstElemType* ptrDst)
+{
+    int res[NumChannels];
+    compactBilinearResampling<NumChannels>(width, height, step, src, ptrMap, res);
+    for (int i = 0; i < NumChannels; i++)
+        ptrDst[i] = compactBilinearCast<DstElemType>(res[i]);
+}
+
+// Resample count consecutive pixels of one row of a compact map to ptrDst.
+// Pixels with invalid src positions are set to zero.
+// Results are bit-exact with compactBilinearResampling.
+typedef void(*CompactReprojectRowFunc)(const unsigned char* src, int srcWidth, int srcHeight, int srcStep,
+    const short* ptrMap, void* ptrDst, int count);
+
+// Returns the fastest SIMD row kernel for the running cpu.
+// srcType should be CV_8UC3 or CV_8UC4, dstDepth should be CV_8U, CV_16S or CV_32F.
+// Returns 0 if no SIMD kernel is available or SIMD kernels are disabled by setReprojectUseSIMD.
+CompactReprojectRowFunc getCompactReprojectRowFunc(int srcType, int dstDepth);
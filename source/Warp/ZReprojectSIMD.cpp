@@ -0,0 +1,257 @@
+#include "ZReproject.h"
+#include "ZReprojectCompact.h"
+#include <smmintrin.h>
+#include <immintrin.h>
+
+// SSE4.1 and AVX2 bilinear kernels for compact maps.
+// Each pixel is interpolated with its channels in the lanes of one 128-bit register,
+// the AVX2 kernels handle two pixels per 256-bit register.
+// A pixel takes the vector path if the 8 bytes loaded from each of its two src rows
+// stay inside the row, otherwise it falls back to compactBilinearResampling.
+
+#if defined(__GNUC__)
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+static int reprojectUseSIMD = 1;
+
+void setReprojectUseSIMD(bool useSIMD)
+{
+    reprojectUseSIMD = useSIMD;
+}
+
+template<int NumChannels>
+inline bool isInterior(int x0, int y0, int srcWidth, int srcHeight)
+{
+    // 8UC3 pixels need two more bytes on the right to load 8 bytes safely.
+    return x0 >= 0 && y0 >= 0 && y0 < srcHeight - 1 &&
+        x0 < srcWidth - (NumChannels == 3 ? 2 : 1);
+}
+
+template<int NumChannels>
+TARGET_SSE41 inline __m128i getInterleaveMask()
+{
+    // Interleave the channels of the two horizontally adjacent pixels,
+    // so that _mm_madd_epi16 performs the horizontal interpolation.
+    if (NumChannels == 3)
+        return _mm_setr_epi8(0, 3, 1, 4, 2, 5, 6, 7, 8, 11, 9, 12, 10, 13, 14, 15);
+    else
+        return _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15);
+}
+
+template<int NumChannels>
+TARGET_SSE41 inline __m128i compactBilinearSSE41(const unsigned char* src, int srcStep,
+    const short* ptrMap, __m128i interleave)
+{
+    int fx = ptrMap[2] & COMPACT_MAP_FRAC_MASK, fy = ptrMap[2] >> COMPACT_MAP_FRAC_BITS;
+    const unsigned char* ptr = src + ptrMap[1] * srcStep + ptrMap[0] * NumChannels;
+    __m128i top = _mm_cvtepu8_epi16(_mm_shuffle_epi8(_mm_loadl_epi64((const __m128i*)ptr), interleave));
+    __m128i bot = _mm_cvtepu8_epi16(_mm_shuffle_epi8(_mm_loadl_epi64((const __m128i*)(ptr + srcStep)), interleave));
+    __m128i wx = _mm_set1_epi32(((fx << 16) | (COMPACT_MAP_FRAC_UNIT - fx)));
+    __m128i wy = _mm_set1_epi32(((fy << 16) | (COMPACT_MAP_FRAC_UNIT - fy)));
+    top = _mm_madd_epi16(top, wx);
+    bot = _mm_madd_epi16(bot, wx);
+    // Horizontal results are at most 255 * 32, pack them to 16 bits
+    // and interleave top and bottom for the vertical interpolation.
+    __m128i tb = _mm_packs_epi32(top, bot);
+    tb = _mm_unpacklo_epi16(tb, _mm_srli_si128(tb, 8));
+    return _mm_madd_epi16(tb, wy);
+}
+
+template<int NumChannels>
+TARGET_AVX2 inline __m256i compactBilinearAVX2(const unsigned char* src, int srcStep,
+    const short* ptrMap, __m128i interleave)
+{
+    int fx0 = ptrMap[2] & COMPACT_MAP_FRAC_MASK, fy0 = ptrMap[2] >> COMPACT_MAP_FRAC_BITS;
+    int fx1 = ptrMap[5] & COMPACT_MAP_FRAC_MASK, fy1 = ptrMap[5] >> COMPACT_MAP_FRAC_BITS;
+    const unsigned char* ptr0 = src + ptrMap[1] * srcStep + ptrMap[0] * NumChannels;
+    const unsigned char* ptr1 = src + ptrMap[4] * srcStep + ptrMap[3] * NumChannels;
+    __m128i top = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)ptr0), _mm_loadl_epi64((const __m128i*)ptr1));
+    __m128i bot = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(ptr0 + srcStep)),
+        _mm_loadl_epi64((const __m128i*)(ptr1 + srcStep)));
+    __m256i top16 = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(top, interleave));
+    __m256i bot16 = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(bot, interleave));
+    __m256i wx = _mm256_inserti128_si256(_mm256_castsi128_si256(
+        _mm_set1_epi32((fx0 << 16) | (COMPACT_MAP_FRAC_UNIT - fx0))),
+        _mm_set1_epi32((fx1 << 16) | (COMPACT_MAP_FRAC_UNIT - fx1)), 1);
+    __m256i wy = _mm256_inserti128_si256(_mm256_castsi128_si256(
+        _mm_set1_epi32((fy0 << 16) | (COMPACT_MAP_FRAC_UNIT - fy0))),
+        _mm_set1_epi32((fy1 << 16) | (COMPACT_MAP_FRAC_UNIT - fy1)), 1);
+    __m256i t = _mm256_madd_epi16(top16, wx);
+    __m256i b = _mm256_madd_epi16(bot16, wx);
+    __m256i tb = _mm256_packs_epi32(t, b);
+    tb = _mm256_unpacklo_epi16(tb, _mm256_srli_si256(tb, 8));
+    return _mm256_madd_epi16(tb, wy);
+}
+
+// Store the channels of one pixel held in the lanes of val.
+template<typename DstElemType, int NumChannels>
+struct CompactStore;
+
+template<int NumChannels>
+struct CompactStore<unsigned char, NumChannels>
+{
+    TARGET_SSE41 static inline void store(__m128i val, unsigned char* ptrDst)
+    {
+        val = _mm_srai_epi32(_mm_add_epi32(val, _mm_set1_epi32(COMPACT_MAP_HALF)), COMPACT_MAP_BACK_SHIFT);
+        val = _mm_packus_epi16(_mm_packs_epi32(val, val), val);
+        int res = _mm_cvtsi128_si32(val);
+        if (NumChannels == 4)
+            *(int*)ptrDst = res;
+        else
+        {
+            ptrDst[0] = res;
+            ptrDst[1] = res >> 8;
+            ptrDst[2] = res >> 16;
+        }
+    }
+};
+
+template<int NumChannels>
+struct CompactStore<short, NumChannels>
+{
+    TARGET_SSE41 static inline void store(__m128i val, short* ptrDst)
+    {
+        val = _mm_srai_epi32(_mm_add_epi32(val, _mm_set1_epi32(COMPACT_MAP_HALF)), COMPACT_MAP_BACK_SHIFT);
+        val = _mm_packs_epi32(val, val);
+        if (NumChannels == 4)
+            _mm_storel_epi64((__m128i*)ptrDst, val);
+        else
+        {
+            *(int*)ptrDst = _mm_cvtsi128_si32(val);
+            ptrDst[2] = _mm_extract_epi16(val, 2);
+        }
+    }
+};
+
+template<int NumChannels>
+struct CompactStore<float, NumChannels>
+{
+    TARGET_SSE41 static inline void store(__m128i val, float* ptrDst)
+    {
+        __m128 res = _mm_mul_ps(_mm_cvtepi32_ps(val), _mm_set1_ps(1.0F / (1 << COMPACT_MAP_BACK_SHIFT)));
+        if (NumChannels == 4)
+            _mm_storeu_ps(ptrDst, res);
+        else
+        {
+            _mm_storel_pi((__m64*)ptrDst, res);
+            _mm_store_ss(ptrDst + 2, _mm_movehl_ps(res, res));
+        }
+    }
+};
+
+template<typename DstElemType, int NumChannels>
+TARGET_SSE41 inline void compactResampleOneSSE41(const unsigned char* src, int srcWidth, int srcHeight, int srcStep,
+    const short* ptrMap, DstElemType* ptrDst, __m128i interleave)
+{
+    if (isInterior<NumChannels>(ptrMap[0], ptrMap[1], srcWidth, srcHeight))
+        CompactStore<DstElemType, NumChannels>::store(
+            compactBilinearSSE41<NumChannels>(src, srcStep, ptrMap, interleave), ptrDst);
+    else if (ptrMap[0] >= 0 && ptrMap[1] >= 0)
+        compactBilinearResampling<DstElemType, NumChannels>(srcWidth, srcHeight, srcStep, src, ptrMap, ptrDst);
+    else
+    {
+        for (int i = 0; i < NumChannels; i++)
+            ptrDst[i] = 0;
+    }
+}
+
+template<typename DstElemType, int NumChannels>
+TARGET_SSE41 void compactReprojectRowSSE41(const unsigned char* src, int srcWidth, int srcHeight, int srcStep,
+    const short* ptrMap, void* ptrDstVoid, int count)
+{
+    DstElemType* ptrDst = (DstElemType*)ptrDstVoid;
+    __m128i interleave = getInterleaveMask<NumChannels>();
+    int w = 0;
+    for (; w <= count - 4; w += 4)
+    {
+        compactResampleOneSSE41<DstElemType, NumChannels>(src, srcWidth, srcHeight, srcStep, ptrMap, ptrDst, interleave);
+        compactResampleOneSSE41<DstElemType, NumChannels>(src, srcWidth, srcHeight, srcStep, ptrMap + 3, ptrDst + NumChannels, interleave);
+        compactResampleOneSSE41<DstElemType, NumChannels>(src, srcWidth, srcHeight, srcStep, ptrMap + 6, ptrDst + NumChannels * 2, interleave);
+        compactResampleOneSSE41<DstElemType, NumChannels>(src, srcWidth, srcHeight, srcStep, ptrMap + 9, ptrDst + NumChannels * 3, interleave);
+        ptrMap += 12;
+        ptrDst += NumChannels * 4;
+    }
+    for (; w < count; w++)
+    {
+        compactResampleOneSSE41<DstElemType, NumChannels>(src, srcWidth, srcHeight, srcStep, ptrMap, ptrDst, interleave);
+        ptrMap += 3;
+        ptrDst += NumChannels;
+    }
+}
+
+template<typename DstElemType, int NumChannels>
+TARGET_AVX2 inline void compactResampleTwoAVX2(const unsigned char* src, int srcWidth, int srcHeight, int srcStep,
+    const short* ptrMap, DstElemType* ptrDst, __m128i interleave)
+{
+    if (isInterior<NumChannels>(ptrMap[0], ptrMap[1], srcWidth, srcHeight) &&
+        isInterior<NumChannels>(ptrMap[3], ptrMap[4], srcWidth, srcHeight))
+    {
+        __m256i val = compactBilinearAVX2<NumChannels>(src, srcStep, ptrMap, interleave);
+        CompactStore<DstElemType, NumChannels>::store(_mm256_castsi256_si128(val), ptrDst);
+        CompactStore<DstElemType, NumChannels>::store(_mm256_extracti128_si256(val, 1), ptrDst + NumChannels);
+    }
+    else
+    {
+        compactResampleOneSSE41<DstElemType, NumChannels>(src, srcWidth, srcHeight, srcStep, ptrMap, ptrDst, interleave);
+        compactResampleOneSSE41<DstElemType, NumChannels>(src, srcWidth, srcHeight, srcStep, ptrMap + 3, ptrDst + NumChannels, interleave);
+    }
+}
+
+template<typename DstElemType, int NumChannels>
+TARGET_AVX2 void compactReprojectRowAVX2(const unsigned char* src, int srcWidth, int srcHeight, int srcStep,
+    const short* ptrMap, void* ptrDstVoid, int count)
+{
+    DstElemType* ptrDst = (DstElemType*)ptrDstVoid;
+    __m128i interleave = getInterleaveMask<NumChannels>();
+    int w = 0;
+    for (; w <= count - 8; w += 8)
+    {
+        compactResampleTwoAVX2<DstElemType, NumChannels>(src, srcWidth, srcHeight, srcStep, ptrMap, ptrDst, interleave);
+        compactResampleTwoAVX2<DstElemType, NumChannels>(src, srcWidth, srcHeight, srcStep, ptrMap + 6, ptrDst + NumChannels * 2, interleave);
+        compactResampleTwoAVX2<DstElemType, NumChannels>(src, srcWidth, srcHeight, srcStep, ptrMap + 12, ptrDst + NumChannels * 4, interleave);
+        compactResampleTwoAVX2<DstElemType, NumChannels>(src, srcWidth, srcHeight, srcStep, ptrMap + 18, ptrDst + NumChannels * 6, interleave);
+        ptrMap += 24;
+        ptrDst += NumChannels * 8;
+    }
+    for (; w < count; w++)
+    {
+        compactResampleOneSSE41<DstElemType, NumChannels>(src, srcWidth, srcHeight, srcStep, ptrMap, ptrDst, interleave);
+        ptrMap += 3;
+        ptrDst += NumChannels;
+    }
+}
+
+template<typename DstElemType>
+static CompactReprojectRowFunc selectCompactReprojectRowFunc(int numChannels, bool avx2)
+{
+    if (numChannels == 3)
+        return avx2 ? compactReprojectRowAVX2<DstElemType, 3> : compactReprojectRowSSE41<DstElemType, 3>;
+    else
+        return avx2 ? compactReprojectRowAVX2<DstElemType, 4> : compactReprojectRowSSE41<DstElemType, 4>;
+}
+
+CompactReprojectRowFunc getCompactReprojectRowFunc(int srcType, int dstDepth)
+{
+    if (!reprojectUseSIMD)
+        return 0;
+    if (srcType != CV_8UC3 && srcType != CV_8UC4)
+        return 0;
+
+    bool avx2 = cv::checkHardwareSupport(CV_CPU_AVX2);
+    if (!avx2 && !cv::checkHardwareSupport(CV_CPU_SSE4_1))
+        return 0;
+
+    int numChannels = CV_MAT_CN(srcType);
+    if (dstDepth == CV_8U)
+        return selectCompactReprojectRowFunc<unsigned char>(numChannels, avx2);
+    else if (dstDepth == CV_16S)
+        return selectCompactReprojectRowFunc<short>(numChannels, avx2);
+    else if (dstDepth == CV_32F)
+        return selectCompactReprojectRowFunc<float>(numChannels, avx2);
+    return 0;
+}